@@ -135,6 +135,10 @@ namespace DFHack
             in_batch = false;
             supported_terminal = false;
             state = con_unclaimed;
+            wlock = NULL;
+            writer = NULL;
+            writer_exit = false;
+            queue_color = QUEUE_COLOR_UNKNOWN;
         };
         virtual ~Private()
         {
@@ -171,67 +175,166 @@ namespace DFHack
             fputs(data, dfout_C);
         }
 
-        void print_text(color_ostream::color_value clr, const std::string &chunk)
+        /*
+         * Output queue. Producers append colored text under queue_lock,
+         * which is never held for longer than a string append. The writer
+         * thread swaps the queue out and emits it with as few write()
+         * calls as possible, temporarily removing the line edit prompt.
+         * If the terminal can't keep up and the queue reaches its limit,
+         * the producer waits for the writer to make room. Producers never
+         * hold wlock, so the writer is always able to get there.
+         */
+        enum { QUEUE_COLOR_UNKNOWN = -2 };
+        static const size_t MAX_QUEUE_SIZE = 1024*1024;
+
+        void queue_text(color_ostream::color_value clr, const std::string &chunk)
         {
-            if(!in_batch && state == con_lineedit)
+            if (chunk.empty())
+                return;
+            if (!queue.empty() && queue.size() + chunk.size() > MAX_QUEUE_SIZE)
+                wait_for_space(chunk.size());
+            if (clr != queue_color)
             {
-                disable_raw();
-                fprintf(dfout_C,"\x1b[1G");
-                fprintf(dfout_C,"\x1b[0K");
+                queue.append(getANSIColor(clr));
+                queue_color = clr;
+            }
+            queue.append(chunk);
+            queue_cond.notify_one();
+        }
 
-                color(clr);
-                print(chunk.c_str());
+        /// Block until the writer has emptied the queue enough for size bytes.
+        /// Called with queue_lock held once, or twice from within a batch.
+        void wait_for_space(size_t size)
+        {
+            // The condition variable releases only one level of the
+            // recursive lock, so drop the one taken by begin_batch.
+            bool batch = in_batch;
+            if (batch)
+                queue_lock.unlock();
+            in_batch = false;
 
-                reset_color();
-                enable_raw();
-                prompt_refresh();
-            }
-            else
+            while (!queue.empty() && queue.size() + size > MAX_QUEUE_SIZE &&
+                   writer && !writer_exit)
             {
-                color(clr);
-                print(chunk.c_str());
+                queue_cond.notify_one();
+                space_cond.wait(queue_lock);
             }
+
+            if (batch)
+                queue_lock.lock();
+            in_batch = batch;
         }
 
         void begin_batch()
         {
             assert(!in_batch);
-
             in_batch = true;
-
-            if (state == con_lineedit)
-            {
-                disable_raw();
-                fprintf(dfout_C,"\x1b[1G");
-                fprintf(dfout_C,"\x1b[0K");
-            }
         }
 
         void end_batch()
         {
             assert(in_batch);
-
+            in_batch = false;
             flush();
+        }
 
-            in_batch = false;
+        /// Wake up the writer thread
+        void flush()
+        {
+            if (!queue.empty())
+                queue_cond.notify_one();
+        }
+
+        /// Write out everything queued so far. Must hold wlock.
+        void drain()
+        {
+            std::string data;
+            {
+                lock_guard <recursive_mutex> g(queue_lock);
+                data.swap(queue);
+                // the terminal color gets reset below
+                queue_color = QUEUE_COLOR_UNKNOWN;
+                space_cond.notify_all();
+            }
+            if (data.empty())
+                return;
+
+            data.append(RESETCOLOR);
+
+            bool lineedit = (state == con_lineedit);
+            if (lineedit)
+            {
+                disable_raw();
+                data.insert(0, "\x1b[1G\x1b[0K");
+            }
 
-            if (state == con_lineedit)
+            // flush anything printed through stdio first
+            fflush(dfout_C);
+            write_all(fileno(dfout_C), data.data(), data.size());
+
+            if (lineedit)
             {
-                reset_color();
                 enable_raw();
                 prompt_refresh();
             }
         }
 
-        void flush()
+        static void write_all(int fd, const char *data, size_t size)
         {
-            if (!rawmode)
-                fflush(dfout_C);
+            while (size > 0)
+            {
+                ssize_t ret = TEMP_FAILURE_RETRY(::write(fd, data, size));
+                if (ret <= 0)
+                    return;
+                data += ret;
+                size -= ret;
+            }
+        }
+
+        static void writer_thread(void *data)
+        {
+            Private *self = (Private*)data;
+
+            for (;;)
+            {
+                {
+                    lock_guard <recursive_mutex> g(self->queue_lock);
+                    while (self->queue.empty() && !self->writer_exit)
+                        self->queue_cond.wait(self->queue_lock);
+                    if (self->queue.empty())
+                        return;
+                }
+
+                lock_guard <recursive_mutex> g(*self->wlock);
+                self->drain();
+            }
+        }
+
+        void start_writer(recursive_mutex *lock)
+        {
+            wlock = lock;
+            writer = new thread(writer_thread, this);
+        }
+
+        void stop_writer()
+        {
+            if (!writer)
+                return;
+            {
+                lock_guard <recursive_mutex> g(queue_lock);
+                writer_exit = true;
+                queue_cond.notify_one();
+                space_cond.notify_all();
+            }
+            writer->join();
+            delete writer;
+            writer = NULL;
         }
 
         /// Clear the console, along with its scrollback
         void clear()
         {
+            drain();
             if(rawmode)
             {
                 const char * clr = "\033c\033[3J\033[H";
@@ -298,6 +401,7 @@ namespace DFHack
         /// A simple line edit (raw mode)
         int lineedit(const std::string& prompt, std::string& output, recursive_mutex * lock, CommandHistory & ch)
         {
+            drain();
             output.clear();
             reset_color();
             this->prompt = prompt;
@@ -613,6 +717,15 @@ namespace DFHack
             con_lineedit
         } state;
         bool in_batch;
+        // output queue
+        recursive_mutex queue_lock;
+        condition_variable queue_cond;  // wakes the writer
+        condition_variable space_cond;  // wakes producers waiting for room
+        std::string queue;
+        int queue_color;        // last color emitted into the queue
+        recursive_mutex * wlock;
+        thread * writer;
+        bool writer_exit;
         std::string prompt;     // current prompt string
         std::string raw_buffer; // current raw mode buffer
         int raw_cursor;         // cursor position in the buffer
@@ -658,6 +771,7 @@ bool Console::init(bool sharing)
     FD_ZERO(&d->descriptor_set);
     FD_SET(STDIN_FILENO, &d->descriptor_set);
     FD_SET(d->exit_pipe[0], &d->descriptor_set);
+    d->start_writer(wlock);
     inited = true;
     return true;
 }
@@ -666,7 +780,9 @@ bool Console::shutdown(void)
 {
     if(!d)
         return true;
+    d->stop_writer();
     lock_guard <recursive_mutex> g(*wlock);
+    d->drain();
     if(d->rawmode)
         d->disable_raw();
     d->print("\n");
@@ -676,36 +792,45 @@ bool Console::shutdown(void)
     return true;
 }
 
+// Text output only touches the queue; the terminal itself
+// is written by the writer thread while holding wlock.
+
 void Console::begin_batch()
 {
     //color_ostream::begin_batch();
 
-    wlock->lock();
+    if (!inited)
+        return;
 
-    if (inited)
-        d->begin_batch();
+    d->queue_lock.lock();
+    d->begin_batch();
 }
 
 void Console::end_batch()
 {
-    if (inited)
-        d->end_batch();
+    if (!inited)
+        return;
 
-    wlock->unlock();
+    d->end_batch();
+    d->queue_lock.unlock();
 }
 
 void Console::flush_proxy()
 {
-    lock_guard <recursive_mutex> g(*wlock);
-    if (inited)
-        d->flush();
+    if (!inited)
+        return;
+
+    lock_guard <recursive_mutex> g(d->queue_lock);
+    d->flush();
 }
 
 void Console::add_text(color_value color, const std::string &text)
 {
-    lock_guard <recursive_mutex> g(*wlock);
-    if (inited)
-        d->print_text(color, text);
+    if (!inited)
+        return;
+
+    lock_guard <recursive_mutex> g(d->queue_lock);
+    d->queue_text(color, text);
 }
 
 int Console::get_columns(void)
@@ -28,6 +28,8 @@ distribution.
 #include <vector>
 #include <map>
 #include <set>
+#include <deque>
+#include <algorithm>
 #include <cstdio>
 #include <cstring>
 #include <iterator>
@@ -48,7 +50,11 @@ using namespace std;
 #include "modules/World.h"
 #include "modules/Graphic.h"
 #include "modules/Windows.h"
+#include "modules/Spatial.h"
+#include "modules/ItemCensus.h"
+#include "modules/Job.h"
 #include "RemoteServer.h"
+#include "MiscUtils.h"
 using namespace DFHack;
 
 #include "df/ui.h"
@@ -113,43 +119,44 @@ struct Core::Private
     thread::id df_suspend_thread;
     int df_suspend_depth;
 
+    // pending hotkey commands, see Core::setHotkeyCmd
+    struct HotkeyJob
+    {
+        std::string cmdline;
+        std::string command;
+        std::vector<std::string> args;
+        // runs are serialized per plugin; NULL if the command doesn't need it
+        Plugin *owner;
+        uint64_t queued_at;
+    };
+    tthread::mutex HotkeyQueueMutex;
+    tthread::condition_variable HotkeyQueueCond;
+    std::deque<HotkeyJob> hotkey_jobs;
+    std::set<Plugin*> busy_plugins;
+    std::map<std::string, HotkeyCommandStats> hotkey_stats;
+
     Private() {
         df_suspend_depth = 0;
     }
-};
-
-void cheap_tokenise(string const& input, vector<string> &output)
-{
-    string *cur = NULL;
-
-    for (size_t i = 0; i < input.size(); i++) {
-        unsigned char c = input[i];
-        if (isspace(c)) {
-            cur = NULL;
-        } else {
-            if (!cur) {
-                output.push_back("");
-                cur = &output.back();
-            }
 
-            if (c == '"') {
-                for (i++; i < input.size(); i++) {
-                    c = input[i];
-                    if (c == '"')
-                        break;
-                    else if (c == '\\') {
-                        if (++i < input.size())
-                            cur->push_back(input[i]);
-                    }
-                    else
-                        cur->push_back(c);
-                }
-            } else {
-                cur->push_back(c);
-            }
+    HotkeyCommandStats &getHotkeyStats(const std::string &command)
+    {
+        auto it = hotkey_stats.find(command);
+        if (it == hotkey_stats.end())
+        {
+            HotkeyCommandStats stats;
+            stats.command = command;
+            stats.runs = stats.dropped = 0;
+            stats.total_wait = stats.max_wait = 0;
+            stats.total_run = stats.max_run = 0;
+            it = hotkey_stats.insert(std::make_pair(command, stats)).first;
         }
+        return it->second;
     }
-}
+};
+
+// hotkey commands that can be waiting to run at once
+static const size_t MAX_PENDING_HOTKEYS = 16;
 
 struct IODATA
 {
@@ -160,7 +167,9 @@ struct IODATA
 // A thread function... for handling hotkeys. This is needed because
 // all the plugin commands are expected to be run from foreign threads.
 // Running them from one of the main DF threads will result in deadlock!
-void fHKthread(void * iodata)
+// There are a few of these, so that a slow command doesn't hold up the
+// others; commands of one plugin still run one at a time, in order.
+void Core::fHKthread(void * iodata)
 {
     Core * core = ((IODATA*) iodata)->core;
     PluginManager * plug_mgr = ((IODATA*) iodata)->plug_mgr;
@@ -169,29 +178,58 @@ void fHKthread(void * iodata)
         cerr << "Hotkey thread has croaked." << endl;
         return;
     }
+    Private * d = core->d;
     while(1)
     {
-        std::string stuff = core->getHotkeyCmd(); // waits on mutex!
-        if(!stuff.empty())
+        Private::HotkeyJob job;
         {
-            color_ostream_proxy out(core->getConsole());
-
-            vector <string> args;
-            cheap_tokenise(stuff, args);
-            if (args.empty()) {
-                out.printerr("Empty hotkey command.\n");
-                continue;
+            tthread::lock_guard<tthread::mutex> lock(d->HotkeyQueueMutex);
+            for(;;)
+            {
+                // the oldest job whose plugin isn't busy
+                auto it = d->hotkey_jobs.begin();
+                while (it != d->hotkey_jobs.end() && it->owner && d->busy_plugins.count(it->owner))
+                    ++it;
+                if (it != d->hotkey_jobs.end())
+                {
+                    job = *it;
+                    d->hotkey_jobs.erase(it);
+                    break;
+                }
+                d->HotkeyQueueCond.wait(d->HotkeyQueueMutex);
             }
+            if (job.owner)
+                d->busy_plugins.insert(job.owner);
+        }
 
-            string first = args[0];
-            args.erase(args.begin());
-            command_result cr = plug_mgr->InvokeCommand(out, first, args);
+        uint64_t start = GetTimeMs64();
+        {
+            color_ostream_proxy out(core->getConsole());
+            command_result cr = plug_mgr->InvokeCommand(out, job.command, job.args);
 
             if(cr == CR_NEEDS_CONSOLE)
             {
                 out.printerr("It isn't possible to run an interactive command outside the console.\n");
             }
         }
+        uint64_t end = GetTimeMs64();
+
+        {
+            tthread::lock_guard<tthread::mutex> lock(d->HotkeyQueueMutex);
+            if (job.owner)
+                d->busy_plugins.erase(job.owner);
+
+            HotkeyCommandStats &stats = d->getHotkeyStats(job.command);
+            uint64_t wait = start - job.queued_at;
+            uint64_t run = end - start;
+            stats.runs++;
+            stats.total_wait += wait;
+            stats.max_wait = std::max(stats.max_wait, wait);
+            stats.total_run += run;
+            stats.max_run = std::max(stats.max_run, run);
+        }
+        // jobs of the plugin may be runnable now
+        d->HotkeyQueueCond.notify_all();
     }
 }
 
@@ -210,6 +248,45 @@ struct sortable
     };
 };
 
+enum builtin_command
+{
+    BI_NONE,
+    BI_HELP,
+    BI_LOAD,
+    BI_RELOAD,
+    BI_UNLOAD,
+    BI_LS,
+    BI_PLUG,
+    BI_KEYBINDING,
+    BI_FPAUSE,
+    BI_CLS,
+    BI_DIE,
+    BI_SCRIPT
+};
+
+static builtin_command findBuiltin(const string &name)
+{
+    static std::map<string, builtin_command> builtins;
+
+    if (builtins.empty())
+    {
+        builtins["help"] = builtins["?"] = builtins["man"] = BI_HELP;
+        builtins["load"] = BI_LOAD;
+        builtins["reload"] = BI_RELOAD;
+        builtins["unload"] = BI_UNLOAD;
+        builtins["ls"] = builtins["dir"] = BI_LS;
+        builtins["plug"] = BI_PLUG;
+        builtins["keybinding"] = BI_KEYBINDING;
+        builtins["fpause"] = BI_FPAUSE;
+        builtins["cls"] = BI_CLS;
+        builtins["die"] = BI_DIE;
+        builtins["script"] = BI_SCRIPT;
+    }
+
+    auto it = builtins.find(name);
+    return it != builtins.end() ? it->second : BI_NONE;
+}
+
 static void runInteractiveCommand(Core *core, PluginManager *plug_mgr, int &clueless_counter, const string &command)
 {
     Console & con = core->getConsole();
@@ -230,9 +307,11 @@ static void runInteractiveCommand(Core *core, PluginManager *plug_mgr, int &clue
         if (first[0] == '#') return;
 
         cerr << "Invoking: " << command << endl;
-        
+
+        builtin_command builtin = findBuiltin(first);
+
         // let's see what we actually got
-        if(first=="help" || first == "?" || first == "man")
+        if(builtin == BI_HELP)
         {
             if(!parts.size())
             {
@@ -282,7 +361,7 @@ static void runInteractiveCommand(Core *core, PluginManager *plug_mgr, int &clue
                 con.printerr("not implemented yet\n");
             }
         }
-        else if( first == "load" )
+        else if(builtin == BI_LOAD)
         {
             if(parts.size())
             {
@@ -309,7 +388,7 @@ static void runInteractiveCommand(Core *core, PluginManager *plug_mgr, int &clue
                 }
             }
         }
-        else if( first == "reload" )
+        else if(builtin == BI_RELOAD)
         {
             if(parts.size())
             {
@@ -336,7 +415,7 @@ static void runInteractiveCommand(Core *core, PluginManager *plug_mgr, int &clue
                 }
             }
         }
-        else if( first == "unload" )
+        else if(builtin == BI_UNLOAD)
         {
             if(parts.size())
             {
@@ -363,7 +442,7 @@ static void runInteractiveCommand(Core *core, PluginManager *plug_mgr, int &clue
                 }
             }
         }
-        else if(first == "ls" || first == "dir")
+        else if(builtin == BI_LS)
         {
             if(parts.size())
             {
@@ -421,7 +500,7 @@ static void runInteractiveCommand(Core *core, PluginManager *plug_mgr, int &clue
                 }
             }
         }
-        else if(first == "plug")
+        else if(builtin == BI_PLUG)
         {
             for(size_t i = 0; i < plug_mgr->size();i++)
             {
@@ -431,7 +510,7 @@ static void runInteractiveCommand(Core *core, PluginManager *plug_mgr, int &clue
                 con.print("%s\n", plug->getName().c_str());
             }
         }
-        else if(first == "keybinding")
+        else if(builtin == BI_KEYBINDING)
         {
             if (parts.size() >= 3 && (parts[0] == "set" || parts[0] == "add"))
             {
@@ -464,6 +543,23 @@ static void runInteractiveCommand(Core *core, PluginManager *plug_mgr, int &clue
                 for (size_t i = 0; i < list.size(); i++)
                     con << "  " << list[i] << endl;
             }
+            else if (parts.size() == 1 && parts[0] == "stats")
+            {
+                std::vector<HotkeyCommandStats> stats = core->getHotkeyStats();
+                if (stats.empty())
+                    con << "No hotkey commands were run." << endl;
+                else
+                    con.print("  %-20s %6s %7s %14s %14s\n", "command", "runs", "dropped", "wait avg/max", "run avg/max");
+                for (size_t i = 0; i < stats.size(); i++)
+                {
+                    HotkeyCommandStats &st = stats[i];
+                    unsigned runs = std::max(st.runs, 1U);
+                    con.print("  %-20s %6u %7u %6u/%-7u %6u/%-7u\n",
+                              st.command.c_str(), st.runs, st.dropped,
+                              unsigned(st.total_wait / runs), unsigned(st.max_wait),
+                              unsigned(st.total_run / runs), unsigned(st.max_run));
+                }
+            }
             else
             {
                 con << "Usage:" << endl
@@ -471,24 +567,25 @@ static void runInteractiveCommand(Core *core, PluginManager *plug_mgr, int &clue
                     << "  keybinding clear <key> <key>..." << endl
                     << "  keybinding set <key> \"cmdline\" \"cmdline\"..." << endl
                     << "  keybinding add <key> \"cmdline\" \"cmdline\"..." << endl
+                    << "  keybinding stats" << endl
                     << "Later adds, and earlier items within one command have priority." << endl;
             }
         }
-        else if(first == "fpause")
+        else if(builtin == BI_FPAUSE)
         {
             World * w = core->getWorld();
             w->SetPauseState(true);
             con.print("The game was forced to pause!");
         }
-        else if(first == "cls")
+        else if(builtin == BI_CLS)
         {
             con.clear();
         }
-        else if(first == "die")
+        else if(builtin == BI_DIE)
         {
             _exit(666);
         }
-        else if(first == "script")
+        else if(builtin == BI_SCRIPT)
         {
             if(parts.size() == 1)
             {
@@ -604,9 +701,8 @@ Core::Core()
     memset(&(s_mods), 0, sizeof(s_mods));
 
     // set up hotkey capture
-    hotkey_set = false;
     HotkeyMutex = 0;
-    HotkeyCond = 0;
+    hotkey_table = NULL;
     misc_data_mutex=0;
     last_world_data_ptr = NULL;
     last_local_map_ptr = NULL;
@@ -715,8 +811,9 @@ bool Core::Init()
     cerr << "Starting DF input capture thread.\n";
     // set up hotkey capture
     HotkeyMutex = new mutex();
-    HotkeyCond = new condition_variable();
-    thread * HK = new thread(fHKthread, (void *) temp);
+    unsigned hotkey_threads = std::max(2U, std::min(thread::hardware_concurrency(), 4U));
+    for (unsigned i = 0; i < hotkey_threads; i++)
+        new thread(fHKthread, (void *) temp);
     screen_window = new Windows::top_level_window();
     screen_window->addChild(new Windows::dfhack_dummy(5,10));
     started = true;
@@ -729,33 +826,58 @@ bool Core::Init()
     cerr << "DFHack is running.\n";
     return true;
 }
-/// sets the current hotkey command
+/// queues a hotkey command for the hotkey threads
 bool Core::setHotkeyCmd( std::string cmd )
 {
-    // access command
-    HotkeyMutex->lock();
+    Private::HotkeyJob job;
+    cheap_tokenise(cmd, job.args);
+    if (job.args.empty())
     {
-        hotkey_set = true;
-        hotkey_cmd = cmd;
-        HotkeyCond->notify_all();
+        if (!cmd.empty())
+            printerr("Empty hotkey command.\n");
+        return false;
+    }
+
+    job.cmdline = cmd;
+    job.command = job.args[0];
+    job.args.erase(job.args.begin());
+    // this runs on the render thread, so only look at the lock-free table
+    const PluginManager::CommandInfo *info =
+        PluginManager::findCommand(atomic_load_ptr(plug_mgr->command_table), job.command);
+    job.owner = (info && !info->concurrent) ? info->plugin : NULL;
+    job.queued_at = GetTimeMs64();
+
+    {
+        tthread::lock_guard<tthread::mutex> lock(d->HotkeyQueueMutex);
+
+        // repeated presses of a key that hasn't been serviced yet only run once
+        for (auto it = d->hotkey_jobs.begin(); it != d->hotkey_jobs.end(); ++it)
+        {
+            if (it->cmdline == cmd)
+                return true;
+        }
+
+        if (d->hotkey_jobs.size() >= MAX_PENDING_HOTKEYS)
+        {
+            d->getHotkeyStats(job.command).dropped++;
+            return false;
+        }
+
+        d->hotkey_jobs.push_back(job);
     }
-    HotkeyMutex->unlock();
+    d->HotkeyQueueCond.notify_all();
     return true;
 }
-/// removes the hotkey command and gives it to the caller thread
-std::string Core::getHotkeyCmd( void )
+
+std::vector<HotkeyCommandStats> Core::getHotkeyStats()
 {
-    string returner;
-    HotkeyMutex->lock();
-    while ( ! hotkey_set )
-    {
-        HotkeyCond->wait(*HotkeyMutex);
-    }
-    hotkey_set = false;
-    returner = hotkey_cmd;
-    hotkey_cmd.clear();
-    HotkeyMutex->unlock();
-    return returner;
+    std::vector<HotkeyCommandStats> rv;
+
+    tthread::lock_guard<tthread::mutex> lock(d->HotkeyQueueMutex);
+    for (auto it = d->hotkey_stats.begin(); it != d->hotkey_stats.end(); ++it)
+        rv.push_back(it->second);
+
+    return rv;
 }
 
 void Core::print(const char *format, ...)
@@ -877,6 +999,11 @@ int Core::Update()
         d->df_suspend_depth = 1000;
     }
 
+    // buildings and jobs may have changed since the last frame; the indexes
+    // catch up on the next query, including ones from state change handlers
+    Spatial::invalidate();
+    invalidateJobIndex();
+
     // detect if the game was loaded or unloaded in the meantime
     void *new_wdata = NULL;
     void *new_mapdata = NULL;
@@ -898,6 +1025,12 @@ int Core::Update()
         last_local_map_ptr = new_mapdata;
 
         getWorld()->ClearPersistentCache();
+        if (mapchange)
+        {
+            Spatial::clear();
+            ItemCensus::reset();
+            clearJobIndex();
+        }
 
         // and if the world is going away, we report the map change first
         if(!new_wdata && mapchange)
@@ -912,9 +1045,15 @@ int Core::Update()
     {
         last_local_map_ptr = new_mapdata;
         getWorld()->ClearPersistentCache();
+        Spatial::clear();
+        ItemCensus::reset();
+        clearJobIndex();
         plug_mgr->OnStateChange(out, new_mapdata ? SC_MAP_LOADED : SC_MAP_UNLOADED);
     }
 
+    // write persistent data out after the game saves
+    getWorld()->CheckPersistentSave();
+
     // detect if the viewscreen changed
     if (df::global::gview) 
     {
@@ -928,6 +1067,9 @@ int Core::Update()
         }
     }
 
+    // item counts are refreshed for the census that are due
+    ItemCensus::update(out);
+
     // notify all the plugins that a game tick is finished
     plug_mgr->OnUpdate(out);
 
@@ -975,6 +1117,14 @@ int Core::Shutdown ( void )
         delete plug_mgr;
         plug_mgr = 0;
     }
+    // the hotkey tables point into the plugin command tables
+    delete hotkey_table;
+    hotkey_table = NULL;
+    for(size_t i = 0; i < old_hotkey_tables.size(); i++)
+    {
+        delete old_hotkey_tables[i];
+    }
+    old_hotkey_tables.clear();
     // invalidate all modules
     for(size_t i = 0 ; i < allModules.size(); i++)
     {
@@ -1099,6 +1249,68 @@ int Core::SDL_Event(SDL::Event* ev)
     // do stuff with the events...
 }
 
+/*
+ * The key bindings, compiled for SelectHotkey. The bindings of every key
+ * and modifier combination are stored in priority order, with their
+ * commands already looked up in a snapshot of the plugin command table.
+ * Like the command tables, a table is immutable once published and is
+ * kept until shutdown after it's replaced; a new one is built when the
+ * bindings change, or when SelectHotkey finds that the plugin commands
+ * changed since it was built.
+ */
+struct Core::HotkeyTable
+{
+    struct Binding
+    {
+        std::string cmdline;
+        const PluginManager::CommandInfo *command;
+    };
+
+    // the plugin command table the bindings were resolved against
+    const PluginManager::CommandTable *commands;
+    // indexed by sym*8 + modifiers
+    std::vector<std::vector<Binding> > keys;
+
+    const std::vector<Binding> *find(int sym, int modifiers) const
+    {
+        size_t idx = size_t(sym)*8 + modifiers;
+        if (sym < 0 || modifiers < 0 || modifiers >= 8 || idx >= keys.size())
+            return NULL;
+        return &keys[idx];
+    }
+};
+
+// must hold HotkeyMutex
+void Core::updateHotkeyTable()
+{
+    HotkeyTable *table = new HotkeyTable();
+    table->commands = atomic_load_ptr(plug_mgr->command_table);
+
+    for (auto it = key_bindings.begin(); it != key_bindings.end(); ++it)
+    {
+        std::vector<KeyBinding> &bindings = it->second;
+        for (int i = bindings.size()-1; i >= 0; --i)
+        {
+            // bindings to anything else than plugin commands can never fire
+            HotkeyTable::Binding binding;
+            binding.cmdline = bindings[i].cmdline;
+            binding.command = PluginManager::findCommand(table->commands, bindings[i].command[0]);
+            if (!binding.command)
+                continue;
+
+            size_t idx = size_t(it->first)*8 + bindings[i].modifiers;
+            if (idx >= table->keys.size())
+                table->keys.resize(idx+1);
+            table->keys[idx].push_back(binding);
+        }
+    }
+
+    HotkeyTable *old_table = hotkey_table;
+    atomic_store_ptr(hotkey_table, table);
+    if (old_table)
+        old_hotkey_tables.push_back(old_table);
+}
+
 bool Core::SelectHotkey(int sym, int modifiers)
 {
     // Find the topmost viewscreen
@@ -1110,21 +1322,34 @@ bool Core::SelectHotkey(int sym, int modifiers)
         screen = screen->child;
 
     std::string cmd;
-    
+
     {
-        tthread::lock_guard<tthread::mutex> lock(*HotkeyMutex);
-    
         // Check the internal keybindings
-        std::vector<KeyBinding> &bindings = key_bindings[sym];
-        for (int i = bindings.size()-1; i >= 0; --i) {
-            if (bindings[i].modifiers != modifiers)
-                continue;
-            if (!plug_mgr->CanInvokeHotkey(bindings[i].command[0], screen))
-                continue;
-            cmd = bindings[i].cmdline;
-            break;
+        atomic_add(plug_mgr->hotkey_readers, 1);
+
+        HotkeyTable *table = atomic_load_ptr(hotkey_table);
+        if (!table || table->commands != atomic_load_ptr(plug_mgr->command_table))
+        {
+            // plugins were loaded or unloaded since the table was built
+            tthread::lock_guard<tthread::mutex> lock(*HotkeyMutex);
+            updateHotkeyTable();
+            table = hotkey_table;
         }
 
+        if (const std::vector<HotkeyTable::Binding> *bindings = table->find(sym, modifiers))
+        {
+            for (size_t i = 0; i < bindings->size(); i++)
+            {
+                const HotkeyTable::Binding &binding = (*bindings)[i];
+                if (!PluginManager::checkHotkey(*binding.command, screen))
+                    continue;
+                cmd = binding.cmdline;
+                break;
+            }
+        }
+
+        atomic_add(plug_mgr->hotkey_readers, -1);
+
         if (cmd.empty()) {
             // Check the hotkey keybindings
             int idx = sym - SDL::K_F1;
@@ -1193,6 +1418,7 @@ bool Core::ClearKeyBindings(std::string keyspec)
             bindings.erase(bindings.begin()+i);
     }
 
+    updateHotkeyTable();
     return true;
 }
 
@@ -1219,6 +1445,7 @@ bool Core::AddKeyBinding(std::string keyspec, std::string cmdline)
 
     binding.cmdline = cmdline;
     bindings.push_back(binding);
+    updateHotkeyTable();
     return true;
 }
 
@@ -1276,6 +1503,107 @@ void ClassNameCheck::getKnownClassNames(std::vector<std::string> &names)
         names.push_back(*it);
 }
 
+// Likewise the platform-independent part of the memory map index
+
+static MemClass classifyRange(const t_memrange &range)
+{
+    if (!range.read)
+        return MEM_UNMAPPED;
+    if (strncmp(range.name, "[stack", 6) == 0)
+        return MEM_STACK;
+    // Some kernels don't report [heap], and the heap can consist of
+    // more segments than just the one labeled with it.
+    if (range.write && !range.shared &&
+        (range.name[0] == 0 || strcmp(range.name, "[heap]") == 0))
+        return MEM_HEAP;
+    if (range.execute)
+        return MEM_CODE;
+    if (range.name[0] && range.name[0] != '[')
+        return MEM_IMAGE;
+    return MEM_DATA;
+}
+
+static bool memRangeLess(const t_memrange &a, const t_memrange &b)
+{
+    return a.start < b.start;
+}
+
+void Process::setMemRanges(std::vector<t_memrange> &ranges)
+{
+    std::sort(ranges.begin(), ranges.end(), memRangeLess);
+    mem_ranges.swap(ranges);
+    mem_index.resize(mem_ranges.size());
+    for (size_t i = 0; i < mem_ranges.size(); i++)
+    {
+        mem_index[i].start = (const char*)mem_ranges[i].start;
+        mem_index[i].end = (const char*)mem_ranges[i].end;
+        mem_index[i].mclass = classifyRange(mem_ranges[i]);
+    }
+    mem_map_valid = true;
+}
+
+void Process::getMemRanges(std::vector<t_memrange> &ranges)
+{
+    refreshMemRanges();
+    ranges.insert(ranges.end(), mem_ranges.begin(), mem_ranges.end());
+}
+
+int Process::findMemIndex(const void *address, int hint)
+{
+    const char *addr = (const char*)address;
+    if (hint >= 0 && mem_index[hint].start <= addr && addr < mem_index[hint].end)
+        return hint;
+
+    // the last range that starts at or before addr
+    int lo = 0, hi = int(mem_index.size());
+    while (lo < hi)
+    {
+        int mid = (lo + hi) / 2;
+        if (mem_index[mid].start <= addr)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo == 0 || addr >= mem_index[lo-1].end)
+        return -1;
+    return lo-1;
+}
+
+const t_memrange *Process::findMemRange(const void *address)
+{
+    if (!mem_map_valid)
+        refreshMemRanges();
+    int i = findMemIndex(address);
+    return i < 0 ? NULL : &mem_ranges[i];
+}
+
+MemClass Process::classifyAddress(const void *address)
+{
+    if (!mem_map_valid)
+        refreshMemRanges();
+    int i = findMemIndex(address);
+    return i < 0 ? MEM_UNMAPPED : mem_index[i].mclass;
+}
+
+void Process::classifyAddresses(const void * const *addresses, size_t count, MemClass *out)
+{
+    if (!mem_map_valid)
+        refreshMemRanges();
+    // pointers found near each other tend to point near each other
+    int last = -1;
+    for (size_t i = 0; i < count; i++)
+    {
+        int idx = findMemIndex(addresses[i], last);
+        if (idx < 0)
+        {
+            out[i] = MEM_UNMAPPED;
+            continue;
+        }
+        out[i] = mem_index[idx].mclass;
+        last = idx;
+    }
+}
+
 /*******************************************************************************
                                 M O D U L E S
 *******************************************************************************/
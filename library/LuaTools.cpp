@@ -37,6 +37,9 @@ distribution.
 #include "DataIdentity.h"
 
 #include "modules/World.h"
+#include "modules/Units.h"
+#include "modules/Items.h"
+#include "modules/Buildings.h"
 
 #include "LuaWrapper.h"
 #include "LuaTools.h"
@@ -725,6 +728,49 @@ static int dfhack_persistent_delete(lua_State *state)
     return 1;
 }
 
+static int dfhack_persistent_delete_all(lua_State *state)
+{
+    CoreSuspender suspend;
+
+    const char *str = luaL_checkstring(state, 1);
+    bool prefix = (lua_gettop(state)>=2 ? lua_toboolean(state,2) : false);
+
+    int count = Core::getInstance().getWorld()->DeletePersistentData(str, prefix);
+
+    lua_pushinteger(state, count);
+    return 1;
+}
+
+static int dfhack_persistent_batch(lua_State *state)
+{
+    luaL_checktype(state, 1, LUA_TFUNCTION);
+
+    int rv;
+    {
+        // The whole function runs within one suspend, so the get/save/delete
+        // calls inside only bump the recursion count of the lock, and no DF
+        // frame or other tool sees the store while it runs. If f fails,
+        // the world module puts back every entry it changed.
+        CoreSuspender suspend;
+        World *world = Core::getInstance().getWorld();
+
+        size_t mark = world->BeginPersistentBatch();
+
+        lua_pushcfunction(state, dfhack_onerror);
+        lua_insert(state, 1);
+
+        rv = lua_pcall(state, lua_gettop(state)-2, LUA_MULTRET, 1);
+        lua_remove(state, 1);
+
+        world->EndPersistentBatch(mark, rv == LUA_OK);
+    }
+
+    if (rv != LUA_OK)
+        lua_error(state);
+
+    return lua_gettop(state);
+}
+
 static int dfhack_persistent_get_all(lua_State *state)
 {
     CoreSuspender suspend;
@@ -796,6 +842,9 @@ static int dfhack_persistent_save(lua_State *state)
         added = true;
     }
 
+    if (!added)
+        Core::getInstance().getWorld()->PreparePersistentChange(ref);
+
     lua_getfield(state, 1, "value");
     if (const char *str = lua_tostring(state, -1))
         ref.val() = str;
@@ -823,7 +872,9 @@ static const luaL_Reg dfhack_persistent_funcs[] = {
     { "get", dfhack_persistent_get },
     { "delete", dfhack_persistent_delete },
     { "get_all", dfhack_persistent_get_all },
+    { "delete_all", dfhack_persistent_delete_all },
     { "save", dfhack_persistent_save },
+    { "batch", dfhack_persistent_batch },
     { NULL, NULL }
 };
 
@@ -840,6 +891,59 @@ static void OpenPersistent(lua_State *state)
     lua_pop(state, 1);
 }
 
+/************************
+ *  Id lookup functions *
+ ************************/
+
+static int dfhack_units_find(lua_State *state)
+{
+    CoreSuspender suspend;
+
+    int id = luaL_checkint(state, 1);
+    Lua::PushDFObject(state, Units::FindById(id));
+    return 1;
+}
+
+static int dfhack_items_find(lua_State *state)
+{
+    CoreSuspender suspend;
+
+    int id = luaL_checkint(state, 1);
+    Lua::PushDFObject(state, Items::findItemByID(id));
+    return 1;
+}
+
+static int dfhack_buildings_find(lua_State *state)
+{
+    CoreSuspender suspend;
+
+    int id = luaL_checkint(state, 1);
+    Lua::PushDFObject(state, Buildings::findBuildingByID(id));
+    return 1;
+}
+
+static const luaL_Reg dfhack_units_funcs[] = {
+    { "find", dfhack_units_find },
+    { NULL, NULL }
+};
+
+static const luaL_Reg dfhack_items_funcs[] = {
+    { "find", dfhack_items_find },
+    { NULL, NULL }
+};
+
+static const luaL_Reg dfhack_buildings_funcs[] = {
+    { "find", dfhack_buildings_find },
+    { NULL, NULL }
+};
+
+static void OpenModule(lua_State *state, const char *mname, const luaL_Reg *reg)
+{
+    luaL_getsubtable(state, lua_gettop(state), mname);
+    luaL_setfuncs(state, reg, 0);
+    lua_pop(state, 1);
+}
+
 lua_State *DFHack::Lua::Open(color_ostream &out, lua_State *state)
 {
     if (!state)
@@ -867,6 +971,9 @@ lua_State *DFHack::Lua::Open(color_ostream &out, lua_State *state)
     luaL_setfuncs(state, dfhack_funcs, 0);
 
     OpenPersistent(state);
+    OpenModule(state, "units", dfhack_units_funcs);
+    OpenModule(state, "items", dfhack_items_funcs);
+    OpenModule(state, "buildings", dfhack_buildings_funcs);
 
     lua_setglobal(state, "dfhack");
 
@@ -0,0 +1,611 @@
+/*
+https://github.com/peterix/dfhack
+Copyright (c) 2009-2011 Petr Mrázek (peterix@gmail.com)
+
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any
+damages arising from the use of this software.
+
+Permission is granted to anyone to use this software for any
+purpose, including commercial applications, and to alter it and
+redistribute it freely, subject to the following restrictions:
+
+1. The origin of this software must not be misrepresented; you must
+not claim that you wrote the original software. If you use this
+software in a product, an acknowledgment in the product documentation
+would be appreciated but is not required.
+
+2. Altered source versions must be plainly marked as such, and
+must not be misrepresented as being the original software.
+
+3. This notice may not be removed or altered from any source
+distribution.
+*/
+
+#include "Internal.h"
+
+#include <string.h>
+#include <vector>
+#include <algorithm>
+using namespace std;
+
+#include "MemAccess.h"
+#include "MemScan.h"
+#include "MiscUtils.h"
+
+#include "tinythread.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #define MEMSCAN_SSE2
+    #include <emmintrin.h>
+    #ifdef _MSC_VER
+        #include <intrin.h>
+    #endif
+#endif
+
+using namespace DFHack;
+using namespace DFHack::MemScan;
+
+/*
+ * Snapshot
+ */
+
+Snapshot::Snapshot()
+{
+}
+
+Snapshot::~Snapshot()
+{
+    clear();
+}
+
+void Snapshot::clear()
+{
+    regions_.clear();
+    for (size_t i = 0; i < copies_.size(); i++)
+        delete[] copies_[i];
+    copies_.clear();
+}
+
+static bool regionLess(const Region &a, const Region &b)
+{
+    return a.addr < b.addr;
+}
+
+void Snapshot::capture(Process *p, int filter, bool copy_data)
+{
+    clear();
+
+    vector<t_memrange> ranges;
+    p->getMemRanges(ranges);
+
+    for (size_t i = 0; i < ranges.size(); i++)
+    {
+        t_memrange &range = ranges[i];
+
+        if (!range.read || range.end <= range.start)
+            continue;
+        if ((filter & WRITABLE) && !range.write)
+            continue;
+        if ((filter & PRIVATE) && range.shared)
+            continue;
+        // Some kernels don't report [heap], and the heap can consist of
+        // more segments than just the one labeled with it.
+        if ((filter & HEAP) == HEAP && range.name[0] && strcmp(range.name, "[heap]") != 0)
+            continue;
+
+        Region region;
+        region.addr = (uint8_t*)range.start;
+        region.size = (uint8_t*)range.end - region.addr;
+        region.data = region.addr;
+
+        if (copy_data)
+        {
+            uint8_t *copy = new uint8_t[region.size];
+            memcpy(copy, region.addr, region.size);
+            copies_.push_back(copy);
+            region.data = copy;
+        }
+
+        regions_.push_back(region);
+    }
+
+    std::sort(regions_.begin(), regions_.end(), regionLess);
+}
+
+void Snapshot::clip(void *start, void *end)
+{
+    uint8_t *cstart = (uint8_t*)start;
+    uint8_t *cend = (uint8_t*)end;
+    vector<Region> clipped;
+
+    for (size_t i = 0; i < regions_.size(); i++)
+    {
+        Region region = regions_[i];
+        uint8_t *rstart = std::max(region.addr, cstart);
+        uint8_t *rend = std::min(region.end(), cend);
+        if (rstart >= rend)
+            continue;
+
+        region.data += rstart - region.addr;
+        region.addr = rstart;
+        region.size = rend - rstart;
+        clipped.push_back(region);
+    }
+
+    regions_.swap(clipped);
+}
+
+size_t Snapshot::totalSize() const
+{
+    size_t size = 0;
+    for (size_t i = 0; i < regions_.size(); i++)
+        size += regions_[i].size;
+    return size;
+}
+
+const Region *Snapshot::find(const void *addr) const
+{
+    const uint8_t *ptr = (const uint8_t*)addr;
+
+    // the last region starting at or before addr
+    size_t lo = 0, hi = regions_.size();
+    while (lo < hi)
+    {
+        size_t mid = (lo + hi) / 2;
+        if (regions_[mid].addr <= ptr)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    if (lo == 0)
+        return NULL;
+    const Region &region = regions_[lo-1];
+    return ptr < region.end() ? &region : NULL;
+}
+
+bool Snapshot::read(const void *addr, void *out, size_t size) const
+{
+    const Region *region = find(addr);
+    if (!region)
+        return false;
+
+    size_t offset = (const uint8_t*)addr - region->addr;
+    if (region->size - offset < size)
+        return false;
+
+    memcpy(out, region->data + offset, size);
+    return true;
+}
+
+/*
+ * Pattern
+ */
+
+void Pattern::addByte(uint8_t value)
+{
+    bytes.push_back(value);
+    mask.push_back(0xFF);
+}
+
+void Pattern::addDWord(uint32_t value)
+{
+    for (int i = 0; i < 4; i++)
+        addByte(uint8_t(value >> (8*i)));
+}
+
+void Pattern::addAny(size_t count)
+{
+    bytes.insert(bytes.end(), count, 0);
+    mask.insert(mask.end(), count, 0);
+}
+
+size_t Pattern::first_fixed() const
+{
+    size_t i = 0;
+    while (i < mask.size() && !mask[i])
+        i++;
+    return i;
+}
+
+size_t Pattern::last_fixed() const
+{
+    size_t i = mask.size();
+    while (i > 0 && !mask[i-1])
+        i--;
+    return i-1;
+}
+
+bool Pattern::matches(const uint8_t *data) const
+{
+    for (size_t i = 0; i < bytes.size(); i++)
+    {
+        if ((data[i] ^ bytes[i]) & mask[i])
+            return false;
+    }
+    return true;
+}
+
+#ifdef MEMSCAN_SSE2
+static inline unsigned lowestBit(unsigned bits)
+{
+#ifdef _MSC_VER
+    unsigned long idx;
+    _BitScanForward(&idx, bits);
+    return idx;
+#else
+    return __builtin_ctz(bits);
+#endif
+}
+#endif
+
+void Pattern::search(std::vector<size_t> &out, const uint8_t *data,
+                     size_t begin, size_t end, size_t limit, bool first_only) const
+{
+    size_t n = bytes.size();
+    if (n == 0 || limit < n)
+        return;
+    end = std::min(end, limit - n + 1);
+
+    size_t first = first_fixed();
+    if (first == n)
+    {
+        // nothing but wildcards
+        for (size_t i = begin; i < end; i++)
+        {
+            out.push_back(i);
+            if (first_only)
+                return;
+        }
+        return;
+    }
+
+    size_t i = begin;
+
+#ifdef MEMSCAN_SSE2
+    // Compare 16 candidate positions at once on the first and the last
+    // fixed byte, and only check the rest of the pattern where both match.
+    size_t last = last_fixed();
+    const __m128i want_first = _mm_set1_epi8((char)bytes[first]);
+    const __m128i want_last = _mm_set1_epi8((char)bytes[last]);
+
+    for (; i + 16 <= end; i += 16)
+    {
+        __m128i at_first = _mm_loadu_si128((const __m128i*)(data + i + first));
+        __m128i at_last = _mm_loadu_si128((const __m128i*)(data + i + last));
+        __m128i hit = _mm_and_si128(_mm_cmpeq_epi8(at_first, want_first),
+                                    _mm_cmpeq_epi8(at_last, want_last));
+        unsigned bits = _mm_movemask_epi8(hit);
+
+        while (bits)
+        {
+            size_t pos = i + lowestBit(bits);
+            bits &= bits - 1;
+
+            if (matches(data + pos))
+            {
+                out.push_back(pos);
+                if (first_only)
+                    return;
+            }
+        }
+    }
+#endif
+
+    // memchr is vectorized by the C library; use it to skip to the candidates
+    while (i < end)
+    {
+        const uint8_t *hit = (const uint8_t*)memchr(data + i + first, bytes[first], end - i);
+        if (!hit)
+            break;
+
+        i = hit - data - first;
+        if (matches(data + i))
+        {
+            out.push_back(i);
+            if (first_only)
+                return;
+        }
+        i++;
+    }
+}
+
+/*
+ * Parallel scanning
+ */
+
+namespace {
+    // big enough to make the per-chunk overhead negligible, small enough
+    // to spread the work evenly over the threads
+    const size_t CHUNK_SIZE = 4 << 20;
+    const unsigned MAX_THREADS = 16;
+
+    struct Chunk
+    {
+        const Region *region;
+        size_t begin, end;
+    };
+
+    struct ScanJob
+    {
+        vector<Chunk> chunks;
+        volatile int next;
+
+        ScanJob(const Snapshot &snapshot)
+        {
+            next = 0;
+
+            const vector<Region> &regions = snapshot.regions();
+            for (size_t i = 0; i < regions.size(); i++)
+            {
+                for (size_t begin = 0; begin < regions[i].size; begin += CHUNK_SIZE)
+                {
+                    Chunk chunk;
+                    chunk.region = &regions[i];
+                    chunk.begin = begin;
+                    chunk.end = std::min(begin + CHUNK_SIZE, regions[i].size);
+                    chunks.push_back(chunk);
+                }
+            }
+        }
+        virtual ~ScanJob() {}
+
+        virtual void run(size_t idx) = 0;
+    };
+
+    void scanThread(void *arg)
+    {
+        ScanJob *job = (ScanJob*)arg;
+
+        for (;;)
+        {
+            int idx = atomic_add(job->next, 1) - 1;
+            if (idx >= int(job->chunks.size()))
+                break;
+            job->run(idx);
+        }
+    }
+
+    void runJob(ScanJob &job)
+    {
+        unsigned num_threads = std::min(tthread::thread::hardware_concurrency(), MAX_THREADS);
+        num_threads = std::min(num_threads, unsigned(job.chunks.size()));
+
+        // the calling thread does its share too
+        vector<tthread::thread*> threads;
+        for (unsigned i = 1; i < num_threads; i++)
+            threads.push_back(new tthread::thread(scanThread, &job));
+
+        scanThread(&job);
+
+        for (size_t i = 0; i < threads.size(); i++)
+        {
+            threads[i]->join();
+            delete threads[i];
+        }
+    }
+
+    struct PatternJob : ScanJob
+    {
+        const Pattern &pattern;
+        size_t align;
+        vector<vector<void*> > results;
+
+        PatternJob(const Snapshot &snapshot, const Pattern &pattern, size_t align)
+            : ScanJob(snapshot), pattern(pattern), align(align)
+        {
+            results.resize(chunks.size());
+        }
+
+        void run(size_t idx)
+        {
+            const Chunk &chunk = chunks[idx];
+            const Region &region = *chunk.region;
+
+            // matches may extend past the end of the chunk, but not of the region
+            vector<size_t> hits;
+            pattern.search(hits, region.data, chunk.begin, chunk.end, region.size);
+
+            vector<void*> &out = results[idx];
+            for (size_t i = 0; i < hits.size(); i++)
+            {
+                uint8_t *addr = region.addr + hits[i];
+                if (align <= 1 || uintptr_t(addr) % align == 0)
+                    out.push_back(addr);
+            }
+        }
+    };
+}
+
+void MemScan::findAll(std::vector<void*> &out, const Snapshot &snapshot,
+                      const Pattern &pattern, size_t align)
+{
+    if (pattern.empty())
+        return;
+
+    PatternJob job(snapshot, pattern, align);
+    runJob(job);
+
+    for (size_t i = 0; i < job.results.size(); i++)
+        out.insert(out.end(), job.results[i].begin(), job.results[i].end());
+}
+
+void *MemScan::findFirst(const Snapshot &snapshot, const Pattern &pattern, const void *from)
+{
+    if (pattern.empty())
+        return NULL;
+
+    const vector<Region> &regions = snapshot.regions();
+    const uint8_t *start = (const uint8_t*)from;
+    vector<size_t> hits;
+
+    for (size_t i = 0; i < regions.size(); i++)
+    {
+        const Region &region = regions[i];
+        if (region.end() <= start)
+            continue;
+
+        size_t begin = start > region.addr ? start - region.addr : 0;
+        pattern.search(hits, region.data, begin, region.size, region.size, true);
+        if (!hits.empty())
+            return region.addr + hits[0];
+    }
+
+    return NULL;
+}
+
+/*
+ * Vectors
+ */
+
+namespace {
+    struct VecTriplet
+    {
+        void *start;
+        void *end;
+        void *alloc_end;
+    };
+
+    bool mightBeVec(const Snapshot &heap, const VecTriplet &vec)
+    {
+        if ((vec.start > vec.end) || (vec.end > vec.alloc_end))
+            return false;
+
+        // Vector length might not be a multiple of 4 if, for example,
+        // it's a vector of uint8_t or uint16_t.  However, the actual memory
+        // allocated to the vector should be 4 byte aligned.
+        if ((uintptr_t(vec.start) % 4 != 0) || (uintptr_t(vec.alloc_end) % 4 != 0))
+            return false;
+
+        const Region *region = heap.find(vec.start);
+        return region && region == heap.find(vec.alloc_end);
+    }
+
+    struct VectorJob : ScanJob
+    {
+        const Snapshot &heap;
+        vector<vector<VectorHit> > results;
+
+        VectorJob(const Snapshot &scan, const Snapshot &heap)
+            : ScanJob(scan), heap(heap)
+        {
+            results.resize(chunks.size());
+        }
+
+        void run(size_t idx)
+        {
+            const Chunk &chunk = chunks[idx];
+            const Region &region = *chunk.region;
+            const size_t ptr_size = sizeof(void*);
+
+            // pointer-aligned addresses only
+            size_t pos = chunk.begin;
+            size_t misalign = uintptr_t(region.addr + pos) % ptr_size;
+            if (misalign)
+                pos += ptr_size - misalign;
+
+            for (; pos < chunk.end && pos + ptr_size <= region.size; pos += ptr_size)
+            {
+                VecTriplet vec;
+                VectorHit hit;
+                hit.addr = region.addr + pos;
+
+                // Is it an embedded vector?
+                if (pos + sizeof(vec) <= region.size)
+                {
+                    memcpy(&vec, region.data + pos, sizeof(vec));
+                    if (mightBeVec(heap, vec))
+                    {
+                        hit.indirect = false;
+                        hit.start = vec.start;
+                        hit.end = vec.end;
+                        hit.alloc_end = vec.alloc_end;
+                        results[idx].push_back(hit);
+                        continue;
+                    }
+                }
+
+                // Is it a vector pointer?
+                void *ptr;
+                memcpy(&ptr, region.data + pos, ptr_size);
+                if (heap.read(ptr, &vec, sizeof(vec)) && mightBeVec(heap, vec))
+                {
+                    hit.indirect = true;
+                    hit.start = vec.start;
+                    hit.end = vec.end;
+                    hit.alloc_end = vec.alloc_end;
+                    results[idx].push_back(hit);
+                }
+            }
+        }
+    };
+}
+
+void MemScan::findVectors(std::vector<VectorHit> &out, const Snapshot &scan, const Snapshot &heap)
+{
+    VectorJob job(scan, heap);
+    runJob(job);
+
+    // The chunks are scanned independently, so words inside an embedded
+    // vector are only dropped here, once the hits are in order.
+    uint8_t *skip_until = NULL;
+    for (size_t i = 0; i < job.results.size(); i++)
+    {
+        vector<VectorHit> &hits = job.results[i];
+        for (size_t j = 0; j < hits.size(); j++)
+        {
+            uint8_t *addr = (uint8_t*)hits[j].addr;
+            if (addr < skip_until)
+                continue;
+            if (!hits[j].indirect)
+                skip_until = addr + sizeof(VecTriplet);
+            out.push_back(hits[j]);
+        }
+    }
+}
+
+/*
+ * Diffing
+ */
+
+void MemScan::diffWords(std::vector<size_t> &out, const uint8_t *a, const uint8_t *b, size_t len)
+{
+    size_t i = 0;
+
+#ifdef MEMSCAN_SSE2
+    for (; i + 16 <= len; i += 16)
+    {
+        __m128i va = _mm_loadu_si128((const __m128i*)(a + i));
+        __m128i vb = _mm_loadu_si128((const __m128i*)(b + i));
+        unsigned same = _mm_movemask_epi8(_mm_cmpeq_epi32(va, vb));
+        if (same == 0xFFFF)
+            continue;
+
+        // four mask bits per word
+        for (size_t w = 0; w < 4; w++)
+            if (((same >> (w*4)) & 0xF) != 0xF)
+                out.push_back(i + w*4);
+    }
+#else
+    for (; i + 8 <= len; i += 8)
+    {
+        uint64_t va, vb;
+        memcpy(&va, a + i, 8);
+        memcpy(&vb, b + i, 8);
+        if (va == vb)
+            continue;
+
+        if (memcmp(a + i, b + i, 4) != 0)
+            out.push_back(i);
+        if (memcmp(a + i + 4, b + i + 4, 4) != 0)
+            out.push_back(i + 4);
+    }
+#endif
+
+    for (; i < len; i += 4)
+    {
+        if (memcmp(a + i, b + i, std::min(len - i, size_t(4))) != 0)
+            out.push_back(i);
+    }
+}
@@ -114,6 +114,54 @@ std::string toLower(const std::string &str)
     return rv;
 }
 
+void cheap_tokenise(std::string const& input, std::vector<std::string> &output)
+{
+    size_t i = 0, size = input.size();
+
+    while (i < size)
+    {
+        if (isspace((unsigned char)input[i]))
+        {
+            i++;
+            continue;
+        }
+
+        output.push_back(std::string());
+        std::string &cur = output.back();
+
+        while (i < size && !isspace((unsigned char)input[i]))
+        {
+            if (input[i] == '"')
+            {
+                for (i++; i < size; i++)
+                {
+                    char c = input[i];
+                    if (c == '"')
+                    {
+                        i++;
+                        break;
+                    }
+                    else if (c == '\\')
+                    {
+                        if (++i < size)
+                            cur.push_back(input[i]);
+                    }
+                    else
+                        cur.push_back(c);
+                }
+            }
+            else
+            {
+                // copy a run of plain characters in one go
+                size_t start = i;
+                while (i < size && input[i] != '"' && !isspace((unsigned char)input[i]))
+                    i++;
+                cur.append(input, start, i-start);
+            }
+        }
+    }
+}
+
 #ifdef LINUX_BUILD // Linux
 uint64_t GetTimeMs64()
 {
@@ -26,6 +26,7 @@ distribution.
 #include "Core.h"
 #include "MemAccess.h"
 #include "PluginManager.h"
+#include "VersionInfo.h"
 #include "RemoteServer.h"
 #include "Console.h"
 
@@ -37,6 +38,9 @@ using namespace DFHack;
 #include <string>
 #include <vector>
 #include <map>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
 using namespace std;
 
 #include "tinythread.h"
@@ -50,6 +54,8 @@ using namespace tthread;
 #endif
 
 #include <assert.h>
+#include <stdio.h>
+#include <sys/stat.h>
 
 static int getdir (string dir, vector<string> &files)
 {
@@ -150,6 +156,9 @@ Plugin::Plugin(Core * core, const std::string & filepath, const std::string & _f
     plugin_onstatechange = 0;
     plugin_rpcconnect = 0;
     state = PS_UNLOADED;
+    lazy = false;
+    eager = false;
+    event_mask = ~0U;
     access = new RefLock();
 }
 
@@ -173,6 +182,13 @@ bool Plugin::load(color_ostream &con)
     {
         return true;
     }
+    if(lazy)
+    {
+        // drop the commands known from the cache, plugin_init provides the real ones
+        parent->unregisterCommands(this);
+        commands.clear();
+        lazy = false;
+    }
     DFLibrary * plug = OpenPlugin(filename.c_str());
     if(!plug)
     {
@@ -210,6 +226,9 @@ bool Plugin::load(color_ostream &con)
     plugin_shutdown = (command_result (*)(color_ostream &)) LookupPlugin(plug, "plugin_shutdown");
     plugin_onstatechange = (command_result (*)(color_ostream &, state_change_event)) LookupPlugin(plug, "plugin_onstatechange");
     plugin_rpcconnect = (RPCService* (*)(color_ostream &)) LookupPlugin(plug, "plugin_rpcconnect");
+    eager = LookupPlugin(plug, "plugin_eager") != NULL;
+    unsigned * plug_event_mask = (unsigned *) LookupPlugin(plug, "plugin_event_mask");
+    event_mask = plug_event_mask ? *plug_event_mask : ~0U;
     this->name = *plug_name;
     plugin_lib = plug;
     commands.clear();
@@ -217,6 +236,7 @@ bool Plugin::load(color_ostream &con)
     {
         state = PS_LOADED;
         parent->registerCommands(this);
+        parent->updateDispatchTable();
         return true;
     }
     else
@@ -243,11 +263,13 @@ bool Plugin::unload(color_ostream &con)
         access->wait();
         // cleanup...
         parent->unregisterCommands(this);
+        parent->waitHotkeyReaders();
         commands.clear();
         if(cr == CR_OK)
         {
             ClosePlugin(plugin_lib);
             state = PS_UNLOADED;
+            parent->updateDispatchTable();
             access->unlock();
             return true;
         }
@@ -255,12 +277,19 @@ bool Plugin::unload(color_ostream &con)
         {
             con.printerr("Plugin %s has failed to shutdown!\n",name.c_str());
             state = PS_BROKEN;
+            parent->updateDispatchTable();
             access->unlock();
             return false;
         }
     }
     else if(state == PS_UNLOADED)
     {
+        if(lazy)
+        {
+            parent->unregisterCommands(this);
+            commands.clear();
+            lazy = false;
+        }
         access->unlock();
         return true;
     }
@@ -284,6 +313,17 @@ command_result Plugin::invoke(color_ostream &out, const std::string & command, s
     Core & c = Core::getInstance();
     command_result cr = CR_NOT_IMPLEMENTED;
     access->lock_add();
+    bool need_load = lazy;
+    access->lock_sub();
+    if(need_load)
+    {
+        // first use of a plugin known from the cache.
+        // plugin_init expects DF to be stopped, like it is at startup.
+        CoreSuspender suspend(&c);
+        if(!load(out))
+            return CR_FAILURE;
+    }
+    access->lock_add();
     if(state == PS_LOADED)
     {
         for (size_t i = 0; i < commands.size();i++)
@@ -332,7 +372,8 @@ bool Plugin::can_invoke_hotkey(const std::string & command, df::viewscreen *top
     Core & c = Core::getInstance();
     bool cr = false;
     access->lock_add();
-    if(state == PS_LOADED)
+    // commands of lazy plugins never have guards, so the cached ones will do
+    if(state == PS_LOADED || lazy)
     {
         for (size_t i = 0; i < commands.size();i++)
         {
@@ -418,28 +459,337 @@ Plugin::plugin_state Plugin::getState() const
     return state;
 }
 
+// Plugins that only provide plain commands can wait until one of them is used.
+bool Plugin::can_defer() const
+{
+    if(eager || plugin_onupdate || plugin_onstatechange || plugin_rpcconnect)
+        return false;
+    for (size_t i = 0; i < commands.size();i++)
+    {
+        if(commands[i].guard)
+            return false;
+    }
+    return true;
+}
+
+/*
+ * Command name lookup table. It is immutable once built: changes to the
+ * set of commands build a new table and publish it atomically, so that
+ * command dispatch doesn't need to take cmdlist_mutex. Replaced tables
+ * are kept until shutdown, since a reader may still be using them; they
+ * only change when plugins are loaded or unloaded.
+ */
+struct PluginManager::CommandTable
+{
+    struct Entry
+    {
+        std::string name;
+        CommandInfo info;
+    };
+
+    // open addressing with linear probing; size is a power of 2
+    std::vector<Entry> slots;
+    size_t mask;
+
+    static size_t hash(const char *str, size_t len)
+    {
+        // FNV-1a
+        uint32_t hv = 2166136261U;
+        for (size_t i = 0; i < len; i++)
+        {
+            hv ^= (uint8_t)str[i];
+            hv *= 16777619U;
+        }
+        return hv;
+    }
+
+    CommandTable(const std::map<std::string, CommandInfo> &commands)
+    {
+        size_t size = 16;
+        while (size < commands.size()*2)
+            size *= 2;
+
+        Entry empty;
+        empty.info.plugin = NULL;
+        empty.info.guard = NULL;
+        empty.info.interactive = false;
+        empty.info.concurrent = false;
+        slots.resize(size, empty);
+        mask = size-1;
+
+        for (auto it = commands.begin(); it != commands.end(); ++it)
+        {
+            size_t idx = hash(it->first.data(), it->first.size()) & mask;
+            while (slots[idx].info.plugin)
+                idx = (idx+1) & mask;
+
+            slots[idx].name = it->first;
+            slots[idx].info = it->second;
+        }
+    }
+
+    const CommandInfo *find(const std::string &name) const
+    {
+        size_t idx = hash(name.data(), name.size()) & mask;
+
+        for (;;)
+        {
+            const Entry &entry = slots[idx];
+            if (!entry.info.plugin)
+                return NULL;
+            if (entry.name == name)
+                return &entry.info;
+            idx = (idx+1) & mask;
+        }
+    }
+};
+
+/*
+ * The plugin cache remembers the commands of every plugin that loaded
+ * fine, keyed on the size and mtime of its file. Plugins that only provide
+ * commands (no update or state change hooks, no rpc services, no hotkey
+ * guards) are then registered from the cache on the next start without
+ * opening them, and get initialized on the first use of one of their
+ * commands. Everything else is still loaded at startup.
+ */
+static const char *plugin_cache_magic = "DFHack plugin cache 1";
+
+struct CachedPlugin
+{
+    int64_t size;
+    int64_t mtime;
+    bool lazy;
+    string name;
+    vector <PluginCommand> commands;
+};
+
+static string escapeCacheLine(const string &str)
+{
+    string rv;
+    rv.reserve(str.size());
+    for (size_t i = 0; i < str.size(); i++)
+    {
+        switch (str[i])
+        {
+        case '\\': rv += "\\\\"; break;
+        case '\n': rv += "\\n"; break;
+        case '\r': rv += "\\r"; break;
+        default: rv += str[i];
+        }
+    }
+    return rv;
+}
+
+static string unescapeCacheLine(const string &str)
+{
+    string rv;
+    rv.reserve(str.size());
+    for (size_t i = 0; i < str.size(); i++)
+    {
+        if (str[i] != '\\' || i+1 == str.size())
+        {
+            rv += str[i];
+            continue;
+        }
+        switch (str[++i])
+        {
+        case 'n': rv += '\n'; break;
+        case 'r': rv += '\r'; break;
+        default: rv += str[i];
+        }
+    }
+    return rv;
+}
+
+static bool statPlugin(const string &path, int64_t *size, int64_t *mtime)
+{
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0)
+        return false;
+    *size = st.st_size;
+    *mtime = st.st_mtime;
+    return true;
+}
+
+static bool parsePluginCache(const string &text, const string &key, map<string, CachedPlugin> &cache)
+{
+    istringstream in(text);
+    string line;
+
+    if (!getline(in, line) || line != plugin_cache_magic)
+        return false;
+    if (!getline(in, line) || line != escapeCacheLine(key))
+        return false;
+
+    CachedPlugin *cur = NULL;
+    while (getline(in, line))
+    {
+        size_t split = line.find(' ');
+        if (split == string::npos)
+            return false;
+        string field = line.substr(0, split);
+        string value = unescapeCacheLine(line.substr(split+1));
+
+        if (field == "plugin")
+        {
+            cur = &cache[value];
+            cur->size = cur->mtime = -1;
+            cur->lazy = false;
+            continue;
+        }
+        if (!cur)
+            return false;
+
+        if (field == "stat")
+        {
+            long long size, mtime;
+            if (sscanf(value.c_str(), "%lld %lld", &size, &mtime) != 2)
+                return false;
+            cur->size = size;
+            cur->mtime = mtime;
+        }
+        else if (field == "name")
+            cur->name = value;
+        else if (field == "lazy")
+            cur->lazy = (value == "1");
+        else if (field == "command" || field == "interactive")
+        {
+            cur->commands.push_back(PluginCommand(value.c_str(), "", NULL, field == "interactive"));
+        }
+        else if (field == "description" && !cur->commands.empty())
+            cur->commands.back().description = value;
+        else if (field == "usage" && !cur->commands.empty())
+            cur->commands.back().usage = value;
+        else if (field == "concurrent" && !cur->commands.empty())
+            cur->commands.back().concurrent = (value == "1");
+        else
+            return false;
+    }
+
+    return true;
+}
+
+static void formatCachedPlugin(ostream &out, const string &file, const CachedPlugin &entry)
+{
+    out << "plugin " << escapeCacheLine(file) << "\n"
+        << "stat " << (long long)entry.size << " " << (long long)entry.mtime << "\n"
+        << "name " << escapeCacheLine(entry.name) << "\n"
+        << "lazy " << (entry.lazy ? 1 : 0) << "\n";
+
+    for (size_t i = 0; i < entry.commands.size(); i++)
+    {
+        const PluginCommand &cmd = entry.commands[i];
+        out << (cmd.interactive ? "interactive " : "command ") << escapeCacheLine(cmd.name) << "\n";
+        out << "description " << escapeCacheLine(cmd.description) << "\n";
+        if (!cmd.usage.empty())
+            out << "usage " << escapeCacheLine(cmd.usage) << "\n";
+        if (cmd.concurrent)
+            out << "concurrent 1\n";
+    }
+}
+
 PluginManager::PluginManager(Core * core)
 {
 #ifdef LINUX_BUILD
     string path = core->p->getPath() + "/hack/plugins/";
+    string cache_path = core->p->getPath() + "/hack/plugins.cache";
     const string searchstr = ".plug.so";
 #else
     string path = core->p->getPath() + "\\hack\\plugins\\";
+    string cache_path = core->p->getPath() + "\\hack\\plugins.cache";
     const string searchstr = ".plug.dll";
 #endif
     cmdlist_mutex = new mutex();
+    command_table = new CommandTable(belongs);
+    dispatch_table = new DispatchTable();
+    hotkey_readers = 0;
+    color_ostream &con = core->getConsole();
+
+    // plugins may register different commands depending on the DF version
+    string cache_key = string(DFHACK_VERSION) + " " + core->vinfo->getVersion();
+    string cache_text;
+    {
+        ifstream in(cache_path.c_str(), ios::binary);
+        if (in)
+        {
+            stringstream buf;
+            buf << in.rdbuf();
+            cache_text = buf.str();
+        }
+    }
+    map <string, CachedPlugin> cache;
+    if (!parsePluginCache(cache_text, cache_key, cache))
+        cache.clear();
+
     vector <string> filez;
+    vector <string> plugin_files;
+    vector <Plugin *> eager_plugins;
     getdir(path, filez);
+    std::sort(filez.begin(), filez.end());
     for(size_t i = 0; i < filez.size();i++)
     {
         if(hasEnding(filez[i],searchstr))
         {
             Plugin * p = new Plugin(core, path + filez[i], filez[i], this);
             all_plugins.push_back(p);
-            // make all plugins load by default (until a proper design emerges).
-            p->load(core->getConsole());
+            plugin_files.push_back(filez[i]);
+
+            int64_t size, mtime;
+            auto it = cache.find(filez[i]);
+            if (it != cache.end() && it->second.lazy &&
+                statPlugin(p->filename, &size, &mtime) &&
+                size == it->second.size && mtime == it->second.mtime)
+            {
+                p->name = it->second.name;
+                p->commands = it->second.commands;
+                p->lazy = true;
+                registerCommands(p);
+            }
+            else
+                eager_plugins.push_back(p);
         }
     }
+
+    for(size_t i = 0; i < eager_plugins.size();i++)
+        eager_plugins[i]->load(con);
+
+    // remember what was learned about the plugins for the next start
+    ostringstream new_cache;
+    new_cache << plugin_cache_magic << "\n" << escapeCacheLine(cache_key) << "\n";
+    for(size_t i = 0; i < all_plugins.size();i++)
+    {
+        Plugin *p = all_plugins[i];
+        CachedPlugin entry;
+        if (p->lazy)
+            entry = cache[plugin_files[i]];
+        else if (p->state == Plugin::PS_LOADED &&
+                 statPlugin(p->filename, &entry.size, &entry.mtime))
+        {
+            entry.name = p->name;
+            entry.lazy = p->can_defer();
+            if (entry.lazy)
+                entry.commands = p->commands;
+        }
+        else
+            continue;
+        formatCachedPlugin(new_cache, plugin_files[i], entry);
+    }
+    if (new_cache.str() != cache_text)
+    {
+        ofstream out(cache_path.c_str(), ios::binary | ios::trunc);
+        out << new_cache.str();
+    }
+    // no other threads can be looking at the tables yet
+    for(size_t i = 0; i < old_command_tables.size();i++)
+    {
+        delete old_command_tables[i];
+    }
+    old_command_tables.clear();
+    for(size_t i = 0; i < old_dispatch_tables.size();i++)
+    {
+        delete old_dispatch_tables[i];
+    }
+    old_dispatch_tables.clear();
 }
 
 PluginManager::~PluginManager()
@@ -449,6 +799,16 @@ PluginManager::~PluginManager()
         delete all_plugins[i];
     }
     all_plugins.clear();
+    delete command_table;
+    for(size_t i = 0; i < old_command_tables.size();i++)
+    {
+        delete old_command_tables[i];
+    }
+    delete dispatch_table;
+    for(size_t i = 0; i < old_dispatch_tables.size();i++)
+    {
+        delete old_dispatch_tables[i];
+    }
     delete cmdlist_mutex;
 }
 
@@ -462,14 +822,15 @@ Plugin *PluginManager::getPluginByName (const std::string & name)
     return 0;
 }
 
+const PluginManager::CommandInfo *PluginManager::findCommand(const CommandTable *table, const std::string &name)
+{
+    return table->find(name);
+}
+
 Plugin *PluginManager::getPluginByCommand(const std::string &command)
 {
-    tthread::lock_guard<tthread::mutex> lock(*cmdlist_mutex);
-    map <string, Plugin *>::iterator iter = belongs.find(command);
-    if (iter != belongs.end())
-        return iter->second;
-    else
-        return NULL;    
+    const CommandInfo *info = atomic_load_ptr(command_table)->find(command);
+    return info ? info->plugin : NULL;
 }
 
 // FIXME: handle name collisions...
@@ -481,24 +842,85 @@ command_result PluginManager::InvokeCommand(color_ostream &out, const std::strin
 
 bool PluginManager::CanInvokeHotkey(const std::string &command, df::viewscreen *top)
 {
-    Plugin *plugin = getPluginByCommand(command);
-    return plugin ? plugin->can_invoke_hotkey(command, top) : false;
+    atomic_add(hotkey_readers, 1);
+    const CommandInfo *info = atomic_load_ptr(command_table)->find(command);
+    bool rv = info ? checkHotkey(*info, top) : false;
+    atomic_add(hotkey_readers, -1);
+    return rv;
+}
+
+/*
+ * Hotkey checks run on the render thread for every key press, so they
+ * don't take the plugin lock. Instead, the callers count themselves in
+ * hotkey_readers around their use of the command table, and unloading a
+ * plugin waits for the checks that may still see its commands before the
+ * library with the guard functions is closed.
+ */
+bool PluginManager::checkHotkey(const CommandInfo &info, df::viewscreen *top)
+{
+    if (info.interactive)
+        return false;
+    else if (info.guard)
+        return info.guard(top);
+    else
+        return Gui::default_hotkey(top);
 }
 
+void PluginManager::waitHotkeyReaders()
+{
+    // the table without the plugin is already published, so this can't starve
+    while (atomic_add(hotkey_readers, 0) != 0)
+        tthread::this_thread::yield();
+}
+
+/*
+ * OnUpdate runs every frame, so it only visits the plugins that have
+ * plugin_onupdate. A table can name a plugin that was unloaded since;
+ * on_update checks the state under the plugin lock anyway.
+ */
 void PluginManager::OnUpdate(color_ostream &out)
 {
-    for(size_t i = 0; i < all_plugins.size(); i++)
+    const std::vector <Plugin *> &list = atomic_load_ptr(dispatch_table)->update;
+    for(size_t i = 0; i < list.size(); i++)
     {
-        all_plugins[i]->on_update(out);
+        list[i]->on_update(out);
     }
 }
 
 void PluginManager::OnStateChange(color_ostream &out, state_change_event event)
 {
+    if(event < 0 || event >= SC_EVENT_COUNT)
+        return;
+    const std::vector <Plugin *> &list = atomic_load_ptr(dispatch_table)->state_change[event];
+    for(size_t i = 0; i < list.size(); i++)
+    {
+        list[i]->on_state_change(out, event);
+    }
+}
+
+void PluginManager::updateDispatchTable()
+{
+    cmdlist_mutex->lock();
+    DispatchTable *table = new DispatchTable();
     for(size_t i = 0; i < all_plugins.size(); i++)
     {
-        all_plugins[i]->on_state_change(out, event);
+        Plugin *p = all_plugins[i];
+        if(p->state != Plugin::PS_LOADED)
+            continue;
+        if(p->plugin_onupdate)
+            table->update.push_back(p);
+        if(!p->plugin_onstatechange)
+            continue;
+        for(int event = 0; event < SC_EVENT_COUNT; event++)
+        {
+            if(p->event_mask & (1U << event))
+                table->state_change[event].push_back(p);
+        }
     }
+    DispatchTable *old_table = dispatch_table;
+    atomic_store_ptr(dispatch_table, table);
+    old_dispatch_tables.push_back(old_table);
+    cmdlist_mutex->unlock();
 }
 
 // FIXME: doesn't check name collisions!
@@ -508,8 +930,13 @@ void PluginManager::registerCommands( Plugin * p )
     vector <PluginCommand> & cmds = p->commands;
     for(size_t i = 0; i < cmds.size();i++)
     {
-        belongs[cmds[i].name] = p;
+        CommandInfo &info = belongs[cmds[i].name];
+        info.plugin = p;
+        info.guard = cmds[i].guard;
+        info.interactive = cmds[i].interactive;
+        info.concurrent = cmds[i].concurrent;
     }
+    updateCommandTable();
     cmdlist_mutex->unlock();
 }
 
@@ -522,5 +949,14 @@ void PluginManager::unregisterCommands( Plugin * p )
     {
         belongs.erase(cmds[i].name);
     }
+    updateCommandTable();
     cmdlist_mutex->unlock();
-}
\ No newline at end of file
+}
+
+// must hold cmdlist_mutex
+void PluginManager::updateCommandTable()
+{
+    CommandTable *old_table = command_table;
+    atomic_store_ptr(command_table, new CommandTable(belongs));
+    old_command_tables.push_back(old_table);
+}
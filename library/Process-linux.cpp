@@ -26,7 +26,9 @@ distribution.
 #include <dirent.h>
 #include <errno.h>
 #include <unistd.h>
+#include <elf.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
 
 #include <string>
 #include <vector>
@@ -34,6 +36,8 @@ distribution.
 #include <set>
 #include <cstdio>
 #include <cstring>
+#include <fstream>
+#include <sstream>
 using namespace std;
 
 #include <md5wrapper.h>
@@ -44,6 +48,129 @@ using namespace std;
 #include <string.h>
 using namespace DFHack;
 
+/*
+ * Hashing the whole executable takes a noticeable part of the startup time,
+ * so the hash is cached on disk together with the device, inode, size,
+ * mtime and GNU build-id of the file it was computed for. It is only
+ * computed again when one of those changes.
+ */
+namespace {
+    const char * exe_cache_name = "hack/exe-md5.cache";
+
+    struct ExeStamp
+    {
+        unsigned long long dev, ino, size, mtime;
+        string build_id;
+    };
+
+    template<class Ehdr, class Phdr>
+    string readBuildId(FILE *f)
+    {
+        Ehdr eh;
+        if (fseek(f, 0, SEEK_SET) != 0 || fread(&eh, sizeof(eh), 1, f) != 1)
+            return "";
+
+        for (int i = 0; i < eh.e_phnum; i++)
+        {
+            Phdr ph;
+            if (fseek(f, eh.e_phoff + i * eh.e_phentsize, SEEK_SET) != 0 ||
+                fread(&ph, sizeof(ph), 1, f) != 1)
+                return "";
+            if (ph.p_type != PT_NOTE || ph.p_filesz > 0x10000)
+                continue;
+
+            vector<char> notes(ph.p_filesz);
+            if (notes.empty() || fseek(f, ph.p_offset, SEEK_SET) != 0 ||
+                fread(&notes[0], notes.size(), 1, f) != 1)
+                continue;
+
+            // note headers are the same for both ELF classes
+            size_t pos = 0;
+            while (pos + sizeof(Elf32_Nhdr) <= notes.size())
+            {
+                Elf32_Nhdr nh;
+                memcpy(&nh, &notes[pos], sizeof(nh));
+                size_t name_pos = pos + sizeof(nh);
+                size_t desc_pos = name_pos + ((nh.n_namesz + 3) & ~3);
+                size_t next_pos = desc_pos + ((nh.n_descsz + 3) & ~3);
+                if (next_pos > notes.size())
+                    break;
+
+                if (nh.n_type == NT_GNU_BUILD_ID && nh.n_namesz == 4 &&
+                    memcmp(&notes[name_pos], "GNU", 4) == 0)
+                {
+                    string id;
+                    char hex[3];
+                    for (size_t j = 0; j < nh.n_descsz; j++)
+                    {
+                        snprintf(hex, sizeof(hex), "%02x", (uint8_t)notes[desc_pos + j]);
+                        id += hex;
+                    }
+                    return id;
+                }
+                pos = next_pos;
+            }
+        }
+        return "";
+    }
+
+    bool getExeStamp(const char * path, ExeStamp & stamp)
+    {
+        struct stat st;
+        if (stat(path, &st) != 0)
+            return false;
+
+        stamp.dev = st.st_dev;
+        stamp.ino = st.st_ino;
+        stamp.size = st.st_size;
+        stamp.mtime = st.st_mtime;
+        stamp.build_id = "none";
+
+        FILE *f = fopen(path, "rb");
+        if (!f)
+            return false;
+
+        unsigned char ident[EI_NIDENT];
+        if (fread(ident, sizeof(ident), 1, f) == 1 && memcmp(ident, ELFMAG, SELFMAG) == 0)
+        {
+            string id;
+            if (ident[EI_CLASS] == ELFCLASS32)
+                id = readBuildId<Elf32_Ehdr, Elf32_Phdr>(f);
+            else if (ident[EI_CLASS] == ELFCLASS64)
+                id = readBuildId<Elf64_Ehdr, Elf64_Phdr>(f);
+            if (!id.empty())
+                stamp.build_id = id;
+        }
+
+        fclose(f);
+        return true;
+    }
+
+    string stampKey(const ExeStamp & stamp)
+    {
+        ostringstream key;
+        key << stamp.dev << " " << stamp.ino << " " << stamp.size << " "
+            << stamp.mtime << " " << stamp.build_id;
+        return key.str();
+    }
+
+    bool loadCachedHash(const ExeStamp & stamp, string & hash)
+    {
+        ifstream in(exe_cache_name);
+        string key;
+        if (!getline(in, key) || !getline(in, hash))
+            return false;
+        return key == stampKey(stamp) && hash.size() == 32;
+    }
+
+    void saveCachedHash(const ExeStamp & stamp, const string & hash)
+    {
+        ofstream out(exe_cache_name, ios::trunc);
+        if (out)
+            out << stampKey(stamp) << endl << hash << endl;
+    }
+}
+
 Process::Process(VersionInfoFactory * known_versions)
 {
     const char * dir_name = "/proc/self/";
@@ -54,15 +181,27 @@ Process::Process(VersionInfoFactory * known_versions)
 
     identified = false;
     my_descriptor = 0;
+    mem_map_valid = false;
 
     md5wrapper md5;
-    uint32_t length;
+    uint32_t length = 0;
     uint8_t first_kb [1024];
     memset(first_kb, 0, sizeof(first_kb));
-    // get hash of the running DF process
-    string hash = md5.getHashFromFile(exe_link_name, length, (char *) first_kb);
+    // get hash of the running DF process, from the cache if the executable didn't change
+    ExeStamp stamp;
+    bool have_stamp = getExeStamp(exe_link_name, stamp);
+    string hash;
+    VersionInfo * vinfo = 0;
+    if (have_stamp && loadCachedHash(stamp, hash))
+        vinfo = known_versions->getVersionInfoByMD5(hash);
+    if (!vinfo)
+    {
+        hash = md5.getHashFromFile(exe_link_name, length, (char *) first_kb);
+        vinfo = known_versions->getVersionInfoByMD5(hash);
+        if (vinfo && have_stamp)
+            saveCachedHash(stamp, hash);
+    }
     // create linux process, add it to the vector
-    VersionInfo * vinfo = known_versions->getVersionInfoByMD5(hash);
     if(vinfo)
     {
         my_descriptor = new VersionInfo(*vinfo);
@@ -120,24 +259,43 @@ string Process::doReadClassName (void * vptr)
 }
 
 //FIXME: cross-reference with ELF segment entries?
-void Process::getMemRanges( vector<t_memrange> & ranges )
+bool Process::refreshMemRanges()
 {
-    char buffer[1024];
-    char permissions[5]; // r/-, w/-, x/-, p/s, 0
-
+    // Reading the file is cheap, parsing it is not. Only parse if it changed.
+    string raw;
     FILE *mapFile = ::fopen("/proc/self/maps", "r");
+    if (!mapFile)
+        return false;
+    char buffer[4096];
+    size_t count;
+    while ((count = fread(buffer, 1, sizeof(buffer), mapFile)) > 0)
+        raw.append(buffer, count);
+    fclose(mapFile);
+
+    if (mem_map_valid && raw == mem_map_raw)
+        return false;
+
+    vector<t_memrange> ranges;
+    char permissions[5]; // r/-, w/-, x/-, p/s, 0
     size_t start, end, offset, device1, device2, node;
 
-    while (fgets(buffer, 1024, mapFile))
+    for (size_t pos = 0; pos < raw.size(); )
     {
+        size_t eol = raw.find('\n', pos);
+        if (eol == string::npos)
+            eol = raw.size();
+        string line = raw.substr(pos, eol - pos);
+        pos = eol + 1;
+
         t_memrange temp;
         temp.name[0] = 0;
-        sscanf(buffer, "%zx-%zx %s %zx %2zx:%2zx %zu %[^\n]",
+        if (sscanf(line.c_str(), "%zx-%zx %4s %zx %2zx:%2zx %zu %1023[^\n]",
                &start,
                &end,
                (char*)&permissions,
                &offset, &device1, &device2, &node,
-               (char*)temp.name);
+               (char*)temp.name) < 7)
+            continue;
         temp.start = (void *) start;
         temp.end = (void *) end;
         temp.read = permissions[0] == 'r';
@@ -147,6 +305,10 @@ void Process::getMemRanges( vector<t_memrange> & ranges )
         temp.valid = true;
         ranges.push_back(temp);
     }
+
+    mem_map_raw.swap(raw);
+    setMemRanges(ranges);
+    return true;
 }
 
 uint32_t Process::getBase()
@@ -121,6 +121,7 @@ Process::Process(VersionInfoFactory * factory)
     bool found = false;
     identified = false;
     my_descriptor = NULL;
+    mem_map_valid = false;
 
     d = new PlatformSpecific();
     // open process
@@ -235,8 +236,16 @@ struct HeapBlock
 */
 // FIXME: NEEDS TESTING!
 // FIXME: <warmist> i noticed that if you enumerate it twice, second time it returns wrong .text region size
-void Process::getMemRanges( vector<t_memrange> & ranges )
+static bool sameMemRange(const t_memrange &a, const t_memrange &b)
 {
+    return a.start == b.start && a.end == b.end &&
+           a.read == b.read && a.write == b.write && a.execute == b.execute &&
+           a.shared == b.shared && strcmp(a.name, b.name) == 0;
+}
+
+bool Process::refreshMemRanges()
+{
+    vector<t_memrange> ranges;
     MEMORY_BASIC_INFORMATION MBI;
     //map<char *, unsigned int> heaps;
     uint64_t movingStart = 0;
@@ -263,6 +272,7 @@ void Process::getMemRanges( vector<t_memrange> & ranges )
         temp.read    = MBI.Protect & PAGE_EXECUTE_READ || MBI.Protect & PAGE_EXECUTE_READWRITE || MBI.Protect & PAGE_READONLY || MBI.Protect & PAGE_READWRITE;
         temp.write   = MBI.Protect & PAGE_EXECUTE_READWRITE || MBI.Protect & PAGE_READWRITE;
         temp.execute = MBI.Protect & PAGE_EXECUTE_READ || MBI.Protect & PAGE_EXECUTE_READWRITE || MBI.Protect & PAGE_EXECUTE;
+        temp.shared = !(MBI.Type & MEM_PRIVATE);
         temp.valid = true;
         if(!GetModuleBaseName(d->my_handle, (HMODULE) temp.start, temp.name, 1024))
         {
@@ -302,6 +312,19 @@ void Process::getMemRanges( vector<t_memrange> & ranges )
         }
         ranges.push_back(temp);
     }
+
+    // There is nothing like a file to compare here, so compare the result
+    if (mem_map_valid && ranges.size() == mem_ranges.size())
+    {
+        size_t i = 0;
+        while (i < ranges.size() && sameMemRange(ranges[i], mem_ranges[i]))
+            i++;
+        if (i == ranges.size())
+            return false;
+    }
+
+    setMemRanges(ranges);
+    return true;
 }
 
 uint32_t Process::getBase()
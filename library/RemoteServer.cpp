@@ -63,8 +63,6 @@ using namespace DFHack;
 #include "tinythread.h"
 using namespace tthread;
 
-using dfproto::CoreTextNotification;
-using dfproto::CoreTextFragment;
 using google::protobuf::MessageLite;
 
 bool readFullBuffer(CSimpleSocket *socket, void *buf, int size);
@@ -121,6 +119,7 @@ ServerConnection::ServerConnection(CActiveSocket *socket)
 
 ServerConnection::~ServerConnection()
 {
+    stream.stop();
     in_error = true;
     socket->Close();
     delete socket;
@@ -165,34 +164,180 @@ ServerFunctionBase *ServerConnection::findFunction(color_ostream &out, const std
     return svc->getFunction(name);
 }
 
+/*
+ * Text output is encoded straight into the wire format of
+ * CoreTextNotification, and sent as one message once enough
+ * text has accumulated, some time has passed since the last
+ * send, or the call completes. While a command runs, a flusher
+ * thread sends the text that has been waiting for longer than
+ * that, so that it doesn't sit there until the next output.
+ */
+
+static const size_t MAX_TEXT_FRAME_SIZE = 64*1024;
+static const uint64_t MAX_TEXT_FRAME_DELAY = 50;
+
+static void append_varint(std::vector<uint8_t> &buf, uint32_t val)
+{
+    while (val >= 0x80)
+    {
+        buf.push_back(uint8_t(val | 0x80));
+        val >>= 7;
+    }
+    buf.push_back(uint8_t(val));
+}
+
+static size_t varint_size(uint32_t val)
+{
+    size_t size = 1;
+    while (val >= 0x80)
+    {
+        val >>= 7;
+        size++;
+    }
+    return size;
+}
+
+ServerConnection::connection_ostream::connection_ostream(ServerConnection *owner)
+    : owner(owner), last_send(0), stopping(false)
+{
+    frame.reserve(MAX_TEXT_FRAME_SIZE + 1024);
+    frame.resize(sizeof(RPCMessageHeader));
+
+    frame_mutex = new mutex();
+    frame_cond = new condition_variable();
+    flusher = new thread(flusherFn, (void*)this);
+}
+
+ServerConnection::connection_ostream::~connection_ostream()
+{
+    stop();
+    delete frame_cond;
+    delete frame_mutex;
+}
+
+void ServerConnection::connection_ostream::stop()
+{
+    if (!flusher)
+        return;
+
+    frame_mutex->lock();
+    stopping = true;
+    frame_cond->notify_one();
+    frame_mutex->unlock();
+
+    flusher->join();
+    delete flusher;
+    flusher = NULL;
+}
+
+void ServerConnection::connection_ostream::flusherFn(void *arg)
+{
+    ((connection_ostream*)arg)->flusherFn();
+}
+
+void ServerConnection::connection_ostream::flusherFn()
+{
+    lock_guard<mutex> lock(*frame_mutex);
+
+    while (!stopping)
+    {
+        if (frame.size() <= sizeof(RPCMessageHeader))
+        {
+            frame_cond->wait(*frame_mutex);
+            continue;
+        }
+
+        uint64_t now = GetTimeMs64();
+        uint64_t due = last_send + MAX_TEXT_FRAME_DELAY;
+        if (now >= due)
+        {
+            send_pending();
+            continue;
+        }
+
+        frame_mutex->unlock();
+        this_thread::sleep_for(chrono::milliseconds(due - now));
+        frame_mutex->lock();
+    }
+}
+
 void ServerConnection::connection_ostream::flush_proxy()
 {
+    lock_guard<mutex> lock(*frame_mutex);
+
     if (owner->in_error)
     {
         buffer.clear();
+        frame.resize(sizeof(RPCMessageHeader));
         return;
     }
 
     if (buffer.empty())
         return;
 
-    CoreTextNotification msg;
-
     for (auto it = buffer.begin(); it != buffer.end(); ++it)
     {
-        auto frag = msg.add_fragments();
-        frag->set_text(it->second);
-        if (it->first >= 0)
-            frag->set_color(CoreTextFragment::Color(it->first));
+        const std::string &text = it->second;
+        int color = it->first;
+
+        // CoreTextFragment: text = 1, color = 2
+        size_t size = 1 + varint_size(text.size()) + text.size();
+        if (color >= 0)
+            size += 1 + varint_size(color);
+
+        // CoreTextNotification: fragments = 1
+        frame.push_back(0x0A);
+        append_varint(frame, size);
+
+        frame.push_back(0x0A);
+        append_varint(frame, text.size());
+        frame.insert(frame.end(), text.begin(), text.end());
+
+        if (color >= 0)
+        {
+            frame.push_back(0x10);
+            append_varint(frame, color);
+        }
     }
 
     buffer.clear();
 
-    if (!sendRemoteMessage(owner->socket, RPC_REPLY_TEXT, &msg, false))
+    if (frame.size() >= MAX_TEXT_FRAME_SIZE ||
+        GetTimeMs64() - last_send >= MAX_TEXT_FRAME_DELAY)
+        send_pending();
+    else
+        frame_cond->notify_one();
+}
+
+void ServerConnection::connection_ostream::send_frame()
+{
+    lock_guard<mutex> lock(*frame_mutex);
+    send_pending();
+}
+
+// must hold frame_mutex
+void ServerConnection::connection_ostream::send_pending()
+{
+    last_send = GetTimeMs64();
+
+    if (owner->in_error)
+        frame.resize(sizeof(RPCMessageHeader));
+    if (frame.size() <= sizeof(RPCMessageHeader))
+        return;
+
+    RPCMessageHeader *hdr = (RPCMessageHeader*)frame.data();
+    hdr->id = RPC_REPLY_TEXT;
+    hdr->size = frame.size() - sizeof(RPCMessageHeader);
+
+    int fullsz = frame.size();
+
+    if (owner->socket->Send(frame.data(), fullsz) != fullsz)
     {
         owner->in_error = true;
         Core::printerr("Error writing text into client socket.\n");
     }
+
+    frame.resize(sizeof(RPCMessageHeader));
 }
 
 void ServerConnection::threadFn(void *arg)
@@ -321,6 +466,7 @@ void ServerConnection::threadFn()
         }
 
         stream.flush();
+        stream.send_frame();
 
         if (res == CR_OK && reply)
         {
@@ -554,7 +554,7 @@ static command_result ListUnits(color_ostream &stream,
     {
         for (int i = 0; i < in->id_list_size(); i++)
         {
-            auto unit = df::unit::find(in->id_list(i));
+            auto unit = Units::FindById(in->id_list(i));
             if (unit)
                 describeUnit(out->add_value(), unit, mask);
         }
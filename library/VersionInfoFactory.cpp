@@ -29,6 +29,15 @@ distribution.
 #include <algorithm>
 #include <map>
 #include <iostream>
+#include <cstdio>
+#include <cstring>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef LINUX_BUILD
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 using namespace std;
 
 #include "VersionInfoFactory.h"
@@ -37,10 +46,12 @@ using namespace std;
 using namespace DFHack;
 
 #include <tinyxml.h>
+#include <md5wrapper.h>
 
 VersionInfoFactory::VersionInfoFactory()
 {
     error = false;
+    from_cache = false;
 }
 
 VersionInfoFactory::~VersionInfoFactory()
@@ -56,27 +67,307 @@ void VersionInfoFactory::clear()
         delete versions[i];
     }
     versions.clear();
+    md5_index.clear();
+    pe_index.clear();
     error = false;
 }
 
 VersionInfo * VersionInfoFactory::getVersionInfoByMD5(string hash)
 {
-    for(size_t i = 0; i < versions.size();i++)
+    string key = "md5:" + hash;
+    useTablesFor(key);
+
+    auto it = md5_index.find(hash);
+    VersionInfo *mem = it != md5_index.end() ? it->second : 0;
+    if (mem)
+        cacheVersion(key, mem);
+    return mem;
+}
+
+VersionInfo * VersionInfoFactory::getVersionInfoByPETimestamp(uint32_t timestamp)
+{
+    char buf[16];
+    snprintf(buf, sizeof(buf), "pe:%08x", timestamp);
+    string key = buf;
+    useTablesFor(key);
+
+    auto it = pe_index.find(timestamp);
+    VersionInfo *mem = it != pe_index.end() ? it->second : 0;
+    if (mem)
+        cacheVersion(key, mem);
+    return mem;
+}
+
+// The cache only has the table of the executable it was written for;
+// any other one needs the whole xml.
+void VersionInfoFactory::useTablesFor(const string &key)
+{
+    if (!from_cache || key == cache_key)
+        return;
+
+    try
     {
-        if(versions[i]->hasMD5(hash))
-            return versions[i];
+        loadXml();
+    }
+    catch (Error::All &err)
+    {
+        error = true;
+        cerr << "Error while reading " << xml_path << ": " << err.what() << endl;
     }
-    return 0;
 }
 
-VersionInfo * VersionInfoFactory::getVersionInfoByPETimestamp(uint32_t timestamp)
+void VersionInfoFactory::cacheVersion(const string &key, VersionInfo *mem)
 {
-    for(size_t i = 0; i < versions.size();i++)
+    if (xml_hash.empty() || key == cache_key)
+        return;
+
+    saveCache(key, mem);
+    cache_key = key;
+}
+
+void VersionInfoFactory::addVersion(VersionInfo* mem)
+{
+    versions.push_back(mem);
+
+    // the first version that lists a hash wins, as with a linear search
+    for (size_t i = 0; i < mem->md5_list.size(); i++)
+        md5_index.insert(std::make_pair(mem->md5_list[i], mem));
+    for (size_t i = 0; i < mem->PE_list.size(); i++)
+        pe_index.insert(std::make_pair(mem->PE_list[i], mem));
+}
+
+/*
+ * Binary symbol table cache.
+ *
+ * Parsing symbols.xml builds a DOM of every version ever shipped, so once
+ * the executable has been identified, its table is written to a flat file
+ * next to the xml. On the next start that table is used as long as the md5
+ * of the xml contents is the same, and the executable is looked up by the
+ * same md5 hash or PE timestamp; anything else parses the xml again.
+ * The file is a header, then
+ *
+ *   str xml_md5, str key,
+ *   str name, u32 os, u32 base,
+ *   u32 count, str md5[count],
+ *   u32 count, u32 timestamp[count],
+ *   u32 count, { str name, u32 address }[count]
+ *
+ * where key is "md5:" and the hash or "pe:" and the timestamp in hex,
+ * and str is a u16 length followed by the bytes. Everything is in host
+ * byte order; a cache from another platform fails the header check.
+ */
+namespace {
+    struct CacheHeader
+    {
+        char magic[8];
+        uint32_t format;
+    };
+
+    const char cache_magic[8] = { 'D','F','H','S','Y','M','S','\0' };
+    const uint32_t cache_format = 2 + (sizeof(void*) << 8);
+
+    struct CacheReader
+    {
+        const char *pos, *end;
+        bool ok;
+
+        CacheReader(const char *data, size_t size) : pos(data), end(data + size), ok(true) {}
+
+        bool get(void *out, size_t size)
+        {
+            if (!ok || size_t(end - pos) < size)
+                return ok = false;
+            memcpy(out, pos, size);
+            pos += size;
+            return true;
+        }
+        uint32_t u32()
+        {
+            uint32_t v = 0;
+            get(&v, sizeof(v));
+            return v;
+        }
+        // a count of items that take at least item_size bytes each
+        uint32_t count(size_t item_size)
+        {
+            uint32_t v = u32();
+            if (ok && v > size_t(end - pos) / item_size)
+                return (ok = false), 0;
+            return v;
+        }
+        string str()
+        {
+            uint16_t len = 0;
+            if (!get(&len, sizeof(len)) || size_t(end - pos) < len)
+                return (ok = false), string();
+            string v(pos, len);
+            pos += len;
+            return v;
+        }
+    };
+
+    void putU32(string &buf, uint32_t v)
+    {
+        buf.append((const char*)&v, sizeof(v));
+    }
+
+    void putStr(string &buf, const string &v)
+    {
+        uint16_t len = uint16_t(std::min(v.size(), size_t(0xFFFF)));
+        buf.append((const char*)&len, sizeof(len));
+        buf.append(v, 0, len);
+    }
+
+    // Maps the file read-only where possible, else reads it into memory.
+    class CacheFile
+    {
+    public:
+        CacheFile(const string &path) : data(NULL), size(0), mapped(false)
+        {
+#ifdef LINUX_BUILD
+            int fd = open(path.c_str(), O_RDONLY);
+            if (fd < 0)
+                return;
+            struct stat st;
+            if (fstat(fd, &st) == 0 && st.st_size > 0)
+            {
+                void *p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (p != MAP_FAILED)
+                {
+                    data = (const char*)p;
+                    size = st.st_size;
+                    mapped = true;
+                }
+            }
+            close(fd);
+#else
+            FILE *f = fopen(path.c_str(), "rb");
+            if (!f)
+                return;
+            fseek(f, 0, SEEK_END);
+            long len = ftell(f);
+            fseek(f, 0, SEEK_SET);
+            if (len > 0)
+            {
+                buffer.resize(len);
+                if (fread(&buffer[0], len, 1, f) == 1)
+                {
+                    data = &buffer[0];
+                    size = len;
+                }
+            }
+            fclose(f);
+#endif
+        }
+        ~CacheFile()
+        {
+#ifdef LINUX_BUILD
+            if (mapped)
+                munmap((void*)data, size);
+#endif
+        }
+
+        const char *data;
+        size_t size;
+
+    private:
+        bool mapped;
+        vector<char> buffer;
+    };
+}
+
+bool VersionInfoFactory::loadCache()
+{
+    CacheFile file(cache_path);
+    if (!file.data)
+        return false;
+
+    CacheReader in(file.data, file.size);
+    CacheHeader header;
+    if (!in.get(&header, sizeof(header)) ||
+        memcmp(header.magic, cache_magic, sizeof(cache_magic)) != 0 ||
+        header.format != cache_format ||
+        in.str() != xml_hash)
+        return false;
+
+    const size_t min_string = 2;
+
+    string key = in.str();
+
+    VersionInfo *mem = new VersionInfo();
+    mem->setVersion(in.str());
+    mem->setOS(OSType(in.u32()));
+    mem->setBase(in.u32());
+
+    uint32_t count = in.count(min_string);
+    for (uint32_t j = 0; j < count && in.ok; j++)
+        mem->addMD5(in.str());
+
+    count = in.count(4);
+    for (uint32_t j = 0; j < count && in.ok; j++)
+        mem->addPE(in.u32());
+
+    count = in.count(min_string + 4);
+    if (in.ok)
+        mem->Addresses.reserve(count);
+    for (uint32_t j = 0; j < count && in.ok; j++)
+    {
+        string name = in.str();
+        mem->setAddress(name, in.u32());
+    }
+
+    if (!in.ok || in.pos != in.end || key.empty())
     {
-        if(versions[i]->hasPE(timestamp))
-            return versions[i];
+        delete mem;
+        return false;
     }
-    return 0;
+
+    clear();
+    addVersion(mem);
+    cache_key = key;
+    from_cache = true;
+    return true;
+}
+
+void VersionInfoFactory::saveCache(const string &key, VersionInfo *mem)
+{
+    CacheHeader header;
+    memcpy(header.magic, cache_magic, sizeof(cache_magic));
+    header.format = cache_format;
+
+    string buf((const char*)&header, sizeof(header));
+    putStr(buf, xml_hash);
+    putStr(buf, key);
+
+    putStr(buf, mem->version);
+    putU32(buf, mem->OS);
+    putU32(buf, mem->base);
+
+    putU32(buf, mem->md5_list.size());
+    for (size_t j = 0; j < mem->md5_list.size(); j++)
+        putStr(buf, mem->md5_list[j]);
+
+    putU32(buf, mem->PE_list.size());
+    for (size_t j = 0; j < mem->PE_list.size(); j++)
+        putU32(buf, mem->PE_list[j]);
+
+    putU32(buf, mem->Addresses.size());
+    for (auto it = mem->Addresses.begin(); it != mem->Addresses.end(); ++it)
+    {
+        putStr(buf, it->first);
+        putU32(buf, it->second);
+    }
+
+    // write to a temporary first, so that a crash never leaves half a cache
+    string tmp = cache_path + ".tmp";
+    FILE *f = fopen(tmp.c_str(), "wb");
+    if (!f)
+        return;
+    bool ok = fwrite(buf.data(), buf.size(), 1, f) == 1;
+    ok = (fclose(f) == 0) && ok;
+    remove(cache_path.c_str());
+    if (!ok || rename(tmp.c_str(), cache_path.c_str()) != 0)
+        remove(tmp.c_str());
 }
 
 void VersionInfoFactory::ParseVersion (TiXmlElement* entry, VersionInfo* mem)
@@ -151,8 +442,33 @@ void VersionInfoFactory::ParseVersion (TiXmlElement* entry, VersionInfo* mem)
 // load the XML file with offsets
 bool VersionInfoFactory::loadFile(string path_to_xml)
 {
-    TiXmlDocument doc( path_to_xml.c_str() );
-    std::cerr << "Loading " << path_to_xml << " ... ";
+    xml_path = path_to_xml;
+    cache_path = path_to_xml.substr(0, path_to_xml.rfind('.')) + ".cache";
+    cache_key.clear();
+    from_cache = false;
+
+    md5wrapper md5;
+    uint32_t length = 0;
+    xml_hash = md5.getHashFromFile(path_to_xml, length);
+    if (xml_hash.size() != 32)
+        xml_hash.clear();
+
+    if (!xml_hash.empty() && loadCache())
+    {
+        error = false;
+        std::cerr << "Loaded the DF symbol table for " << versions[0]->version << " from " << cache_path << std::endl;
+        return true;
+    }
+
+    return loadXml();
+}
+
+bool VersionInfoFactory::loadXml()
+{
+    from_cache = false;
+
+    TiXmlDocument doc( xml_path.c_str() );
+    std::cerr << "Loading " << xml_path << " ... ";
     //bool loadOkay = doc.LoadFile();
     if (!doc.LoadFile())
     {
@@ -198,7 +514,7 @@ bool VersionInfoFactory::loadFile(string path_to_xml)
             {
                 VersionInfo *version = new VersionInfo();
                 ParseVersion( pMemInfo , version );
-                versions.push_back(version);
+                addVersion(version);
             }
         }
     }
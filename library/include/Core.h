@@ -72,6 +72,21 @@ namespace DFHack
     void * LookupPlugin (DFLibrary * plugin ,const char * function);
     void ClosePlugin (DFLibrary * plugin);
 
+    /// Timing of the hotkey commands, see Core::getHotkeyStats
+    struct HotkeyCommandStats
+    {
+        std::string command;
+        uint32_t runs;
+        /// commands rejected because the queue was full
+        uint32_t dropped;
+        /// milliseconds spent waiting in the queue
+        uint64_t total_wait;
+        uint64_t max_wait;
+        /// milliseconds spent running
+        uint64_t total_run;
+        uint64_t max_run;
+    };
+
     // Core is a singleton. Why? Because it is closely tied to SDL calls. It tracks the global state of DF.
     // There should never be more than one instance
     // Better than tracking some weird variables all over the place.
@@ -111,10 +126,10 @@ namespace DFHack
         Notes * getNotes();
         /// get the graphic module
         Graphic * getGraphic();
-        /// sets the current hotkey command
+        /// queues a hotkey command; fails if too many commands are already pending
         bool setHotkeyCmd( std::string cmd );
-        /// removes the hotkey command and gives it to the caller thread
-        std::string getHotkeyCmd( void );
+        /// per-command timing of the hotkey commands run so far
+        std::vector<HotkeyCommandStats> getHotkeyStats();
 
         /// adds a named pointer (for later or between plugins)
         void RegisterData(void *p,std::string key);
@@ -131,6 +146,7 @@ namespace DFHack
         static df::viewscreen *getTopViewscreen() { return getInstance().top_viewscreen; }
 
         DFHack::Console &getConsole() { return con; }
+        DFHack::PluginManager *getPluginManager() { return plug_mgr; }
 
         DFHack::Process * p;
         DFHack::VersionInfo * vinfo;
@@ -187,10 +203,15 @@ namespace DFHack
 
         std::map<int, std::vector<KeyBinding> > key_bindings;
         std::map<int, bool> hotkey_states;
-        std::string hotkey_cmd;
-        bool hotkey_set;
         tthread::mutex * HotkeyMutex;
-        tthread::condition_variable * HotkeyCond;
+
+        // key_bindings compiled for SelectHotkey, swapped on every change
+        struct HotkeyTable;
+        HotkeyTable * volatile hotkey_table;
+        std::vector<HotkeyTable *> old_hotkey_tables;
+        void updateHotkeyTable();
+
+        static void fHKthread(void * iodata);
 
         int UnicodeAwareSym(const SDL::KeyboardEvent& ke);
         bool SelectHotkey(int key, int modifiers);
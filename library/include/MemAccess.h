@@ -33,6 +33,8 @@ distribution.
 #include <iostream>
 #include <cstring>
 #include <map>
+#include <string>
+#include <vector>
 
 namespace DFHack
 {
@@ -84,7 +86,7 @@ namespace DFHack
         bool execute : 1;
         // is a shared region
         bool shared : 1;
-        inline bool isInRange( void * address)
+        inline bool isInRange( const void * address) const
         {
             if (address >= start && address < end) return true;
             return false;
@@ -93,6 +95,20 @@ namespace DFHack
         uint8_t * buffer;
     };
 
+    /**
+     * What an address points into, as far as the memory map can tell.
+     * \ingroup grp_context
+     */
+    enum MemClass
+    {
+        MEM_UNMAPPED = 0,   ///< not in any readable range
+        MEM_DATA,           ///< readable, but none of the below
+        MEM_HEAP,           ///< private writable memory, anonymous or [heap]
+        MEM_STACK,          ///< the main thread stack
+        MEM_IMAGE,          ///< data mapped from the executable or a library
+        MEM_CODE            ///< executable memory
+    };
+
     /**
      * Allows low-level access to the memory of an OS process.
      * \ingroup grp_context
@@ -267,8 +283,21 @@ namespace DFHack
             };
             /// find the thread IDs of the process
             bool getThreadIDs(std::vector<uint32_t> & threads );
-            /// get virtual memory ranges of the process (what is mapped where)
+            /// get virtual memory ranges of the process (what is mapped where),
+            /// sorted by address and appended to ranges
             void getMemRanges(std::vector<t_memrange> & ranges );
+            /**
+             * Re-read the memory map if it changed since the last time.
+             * Returns true if it did. The lookups below work on the map as
+             * of the last refresh, so call this once before a batch of them.
+             * Like the rest of Process, not thread-safe.
+             */
+            bool refreshMemRanges();
+            /// the range containing address, or NULL
+            const t_memrange *findMemRange(const void * address);
+            MemClass classifyAddress(const void * address);
+            /// classify count addresses at once; faster when they are close together
+            void classifyAddresses(const void * const * addresses, size_t count, MemClass * out);
 
             /// get the symbol table extension of this process
             VersionInfo *getDescriptor()
@@ -290,6 +319,20 @@ namespace DFHack
         uint32_t my_pid;
         uint32_t base;
         std::map<void *, std::string> classNameCache;
+
+        // the cached memory map, see refreshMemRanges
+        struct MemIndexEntry
+        {
+            const char * start;
+            const char * end;
+            MemClass mclass;
+        };
+        std::vector<t_memrange> mem_ranges;
+        std::vector<MemIndexEntry> mem_index;
+        std::string mem_map_raw;
+        bool mem_map_valid;
+        void setMemRanges(std::vector<t_memrange> & ranges);
+        int findMemIndex(const void * address, int hint = -1);
     };
 
     class DFHACK_EXPORT ClassNameCheck
@@ -0,0 +1,191 @@
+/*
+https://github.com/peterix/dfhack
+Copyright (c) 2009-2011 Petr Mrázek (peterix@gmail.com)
+
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any
+damages arising from the use of this software.
+
+Permission is granted to anyone to use this software for any
+purpose, including commercial applications, and to alter it and
+redistribute it freely, subject to the following restrictions:
+
+1. The origin of this software must not be misrepresented; you must
+not claim that you wrote the original software. If you use this
+software in a product, an acknowledgment in the product documentation
+would be appreciated but is not required.
+
+2. Altered source versions must be plainly marked as such, and
+must not be misrepresented as being the original software.
+
+3. This notice may not be removed or altered from any source
+distribution.
+*/
+
+#pragma once
+
+#ifndef MEMSCAN_H_INCLUDED
+#define MEMSCAN_H_INCLUDED
+
+#include "Pragma.h"
+#include "Export.h"
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * \defgroup grp_memscan MemScan: searching the memory of the DF process
+ * @ingroup grp_context
+ */
+namespace DFHack
+{
+    class Process;
+
+namespace MemScan
+{
+    /// Which memory ranges Snapshot::capture takes
+    enum RangeFilter
+    {
+        READABLE = 0,   ///< every readable range
+        WRITABLE = 1,   ///< only writable ones
+        PRIVATE = 2,    ///< no shared mappings
+        /// ranges that might be part of the heap: private, writable,
+        /// and either anonymous or named [heap]
+        HEAP = 4 | WRITABLE | PRIVATE
+    };
+
+    /**
+     * A contiguous piece of memory to scan. addr is where it is in the
+     * process, data where its contents can be read: the same as addr for
+     * live memory, or a private copy.
+     */
+    struct Region
+    {
+        uint8_t *addr;
+        const uint8_t *data;
+        size_t size;
+
+        uint8_t *end() const { return addr + size; }
+    };
+
+    /**
+     * The memory ranges to scan, sorted by address.
+     *
+     * Scanning live memory requires DF to be suspended for as long as the
+     * snapshot is in use. A snapshot that copies the data can be scanned
+     * and compared at leisure, at the cost of holding the copy.
+     * \ingroup grp_memscan
+     */
+    class DFHACK_EXPORT Snapshot
+    {
+    public:
+        Snapshot();
+        ~Snapshot();
+
+        /// take the ranges of p that match the filter
+        void capture(Process *p, int filter = READABLE, bool copy_data = false);
+        /// only keep the parts of the ranges within [start, end)
+        void clip(void *start, void *end);
+        void clear();
+
+        const std::vector<Region> &regions() const { return regions_; }
+        size_t totalSize() const;
+
+        /// the region containing addr, or NULL
+        const Region *find(const void *addr) const;
+        bool contains(const void *addr) const { return find(addr) != NULL; }
+        /// copy size bytes at addr, if they are all within one region
+        bool read(const void *addr, void *out, size_t size) const;
+
+    private:
+        Snapshot(const Snapshot &);
+        void operator=(const Snapshot &);
+
+        std::vector<Region> regions_;
+        std::vector<uint8_t*> copies_;
+    };
+
+    /**
+     * A byte pattern with wildcards, e.g. for finding code or data by a
+     * signature. Wildcard positions match any byte.
+     * \ingroup grp_memscan
+     */
+    class DFHACK_EXPORT Pattern
+    {
+    public:
+        Pattern() {}
+
+        void addByte(uint8_t value);
+        /// a little-endian 4-byte value
+        void addDWord(uint32_t value);
+        void addAny(size_t count = 1);
+
+        size_t size() const { return bytes.size(); }
+        bool empty() const { return bytes.empty(); }
+
+        /// does the pattern match at data, which has at least size() bytes
+        bool matches(const uint8_t *data) const;
+
+        /**
+         * Positions in [begin, end) of data where the pattern matches
+         * completely within [0, limit), appended to out in order. Stops
+         * after the first match if first_only is set.
+         */
+        void search(std::vector<size_t> &out, const uint8_t *data,
+                    size_t begin, size_t end, size_t limit,
+                    bool first_only = false) const;
+
+    private:
+        std::vector<uint8_t> bytes;
+        std::vector<uint8_t> mask;
+        // positions of the first and last fixed bytes
+        size_t first_fixed() const;
+        size_t last_fixed() const;
+    };
+
+    /**
+     * Every address in the snapshot where the pattern matches, in order.
+     * The work is split across threads. Only addresses that are multiples
+     * of align are reported.
+     * \ingroup grp_memscan
+     */
+    DFHACK_EXPORT void findAll(std::vector<void*> &out, const Snapshot &snapshot,
+                               const Pattern &pattern, size_t align = 1);
+
+    /// The first match at or after from, or NULL
+    DFHACK_EXPORT void *findFirst(const Snapshot &snapshot, const Pattern &pattern,
+                                  const void *from = NULL);
+
+    /**
+     * Offsets of the 4-byte words that differ between a and b, both len
+     * bytes long, appended to out in order. A partial word at the end
+     * counts as a word. Identical stretches are skipped 16 bytes at a time.
+     * \ingroup grp_memscan
+     */
+    DFHACK_EXPORT void diffWords(std::vector<size_t> &out, const uint8_t *a,
+                                 const uint8_t *b, size_t len);
+
+    /// A std::vector found in memory
+    struct VectorHit
+    {
+        /// where the vector, or the pointer to it, was found
+        void *addr;
+        /// addr holds a pointer to the vector rather than the vector itself
+        bool indirect;
+        void *start;
+        void *end;
+        void *alloc_end;
+    };
+
+    /**
+     * Look for std::vector triplets (start, end, alloc_end pointing into
+     * heap) and for pointers to them among the pointer-aligned words of
+     * scan. Words that are part of a vector found directly are skipped.
+     * \ingroup grp_memscan
+     */
+    DFHACK_EXPORT void findVectors(std::vector<VectorHit> &out, const Snapshot &scan,
+                                   const Snapshot &heap);
+}
+}
+
+#endif
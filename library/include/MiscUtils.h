@@ -221,6 +221,151 @@ CT *binsearch_in_vector(const std::vector<CT*> &vec, FT CT::*field, FT value)
     return idx < 0 ? NULL : vec[idx];
 }
 
+/*
+ * Hashed id lookup in a vector of objects sorted by id.
+ *
+ * The table maps id to vector position. Objects appended since the last
+ * lookup (ids above the highest one seen) are added to it as they show up.
+ * Hits are verified against the vector; when an entry is stale, because
+ * earlier objects were removed, or the id was never seen, binary search
+ * finds the object and its entry is fixed. So the table is only rebuilt
+ * when it fills up, and a stale table never returns a wrong or dangling
+ * object.
+ */
+
+template<typename CT>
+class id_index
+{
+    struct Slot
+    {
+        int32_t id;
+        int32_t pos;
+    };
+
+    std::vector<Slot> slots;
+    size_t mask;
+    // used slots, including ids that have left the vector
+    size_t count;
+    // the highest id in the table
+    int32_t last_id;
+
+    static size_t hash(int32_t id)
+    {
+        return uint32_t(id) * 2654435761U;
+    }
+
+    void rebuild(const std::vector<CT*> &vec)
+    {
+        size_t cap = 64;
+        while (cap < vec.size()*2)
+            cap *= 2;
+
+        Slot empty = { 0, -1 };
+        slots.assign(cap, empty);
+        mask = cap-1;
+        count = 0;
+
+        for (size_t i = 0; i < vec.size(); i++)
+            put(vec[i]->id, i);
+
+        last_id = vec.empty() ? INT_MIN : vec.back()->id;
+    }
+
+    // adds or moves an entry; there must be room for it
+    void put(int32_t id, size_t pos)
+    {
+        size_t idx = hash(id) & mask;
+        while (slots[idx].pos >= 0 && slots[idx].id != id)
+            idx = (idx+1) & mask;
+
+        if (slots[idx].pos < 0)
+            count++;
+        slots[idx].id = id;
+        slots[idx].pos = int32_t(pos);
+    }
+
+    // adds the objects appended since the last call
+    void update(const std::vector<CT*> &vec)
+    {
+        if (slots.empty())
+        {
+            rebuild(vec);
+            return;
+        }
+        if (vec.empty() || vec.back()->id <= last_id)
+            return;
+
+        // the first object above last_id
+        size_t lo = 0, hi = vec.size();
+        while (lo < hi)
+        {
+            size_t mid = (lo + hi) / 2;
+            if (vec[mid]->id <= last_id)
+                lo = mid+1;
+            else
+                hi = mid;
+        }
+
+        if ((count + vec.size() - lo)*2 > slots.size())
+        {
+            rebuild(vec);
+            return;
+        }
+
+        for (size_t i = lo; i < vec.size(); i++)
+            put(vec[i]->id, i);
+        last_id = vec.back()->id;
+    }
+
+    int lookup(const std::vector<CT*> &vec, int32_t id) const
+    {
+        for (size_t idx = hash(id) & mask;; idx = (idx+1) & mask)
+        {
+            const Slot &slot = slots[idx];
+            if (slot.pos < 0)
+                return -1;
+            if (slot.id == id)
+                return (size_t(slot.pos) < vec.size() && vec[slot.pos]->id == id) ? slot.pos : -1;
+        }
+    }
+
+public:
+    id_index() : mask(0), count(0), last_id(INT_MIN) {}
+
+    void clear()
+    {
+        slots.clear();
+        count = 0;
+        last_id = INT_MIN;
+    }
+
+    int index_of(const std::vector<CT*> &vec, int32_t id)
+    {
+        update(vec);
+
+        int pos = lookup(vec, id);
+        if (pos >= 0)
+            return pos;
+
+        // moved by removals, or not seen yet; fix the entry
+        pos = binsearch_index(vec, &CT::id, id);
+        if (pos >= 0)
+        {
+            if ((count+1)*2 > slots.size())
+                rebuild(vec);
+            else
+                put(id, pos);
+        }
+        return pos;
+    }
+
+    CT *find(const std::vector<CT*> &vec, int32_t id)
+    {
+        int pos = index_of(vec, id);
+        return pos < 0 ? NULL : vec[pos];
+    }
+};
+
 /*
  * List
  */
@@ -246,6 +391,53 @@ Link *linked_list_insert_after(Link *pos, Link *link)
     return link;
 }
 
+/*
+ * Pointers to immutable data shared between threads.
+ *
+ * The writer fully builds the new object before publishing it
+ * with atomic_store_ptr; readers pick it up with atomic_load_ptr
+ * without taking any locks.
+ */
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+template<typename T>
+inline T *atomic_load_ptr(T *const volatile &ptr)
+{
+    T *rv = ptr;
+#ifdef _MSC_VER
+    _ReadWriteBarrier();
+#else
+    __sync_synchronize();
+#endif
+    return rv;
+}
+
+template<typename T>
+inline void atomic_store_ptr(T *volatile &ptr, T *value)
+{
+#ifdef _MSC_VER
+    _ReadWriteBarrier();
+    ptr = value;
+#else
+    __sync_synchronize();
+    ptr = value;
+    __sync_synchronize();
+#endif
+}
+
+/// adds delta to value as one atomic step, with a full barrier; returns the new value
+inline int atomic_add(volatile int &value, int delta)
+{
+#ifdef _MSC_VER
+    return _InterlockedExchangeAdd((volatile long*)&value, delta) + delta;
+#else
+    return __sync_add_and_fetch(&value, delta);
+#endif
+}
+
 /*
  * MISC
  */
@@ -258,6 +450,12 @@ DFHACK_EXPORT std::string join_strings(const std::string &separator, const std::
 DFHACK_EXPORT std::string toUpper(const std::string &str);
 DFHACK_EXPORT std::string toLower(const std::string &str);
 
+/**
+ * Split a command line into words, honoring "quotes" and \ escapes.
+ * The words are appended to output.
+ */
+DFHACK_EXPORT void cheap_tokenise(std::string const& input, std::vector<std::string> &output);
+
 inline bool bits_match(unsigned required, unsigned ok, unsigned mask)
 {
     return (required & mask) == (required & mask & ok);
@@ -58,6 +58,8 @@ namespace DFHack
         SC_MAP_UNLOADED,
         SC_VIEWSCREEN_CHANGED
     };
+    /// the number of state_change_event values
+    const int SC_EVENT_COUNT = SC_VIEWSCREEN_CHANGED + 1;
     struct DFHACK_EXPORT PluginCommand
     {
         typedef command_result (*command_function)(color_ostream &out, std::vector <std::string> &);
@@ -74,7 +76,7 @@ namespace DFHack
                      )
             : name(_name), description(_description),
               function(function_), interactive(interactive_),
-              guard(NULL), usage(usage_)
+              guard(NULL), usage(usage_), concurrent(false)
         {
         }
 
@@ -85,7 +87,7 @@ namespace DFHack
                       const char * usage_ = "")
             : name(_name), description(_description),
               function(function_), interactive(false),
-              guard(guard_), usage(usage_)
+              guard(guard_), usage(usage_), concurrent(false)
         {
         }
 
@@ -97,6 +99,9 @@ namespace DFHack
         bool interactive;
         command_hotkey_guard guard;
         std::string usage;
+        /// Hotkey commands of a plugin are run one at a time. Set this if the
+        /// command can run while other commands of the same plugin are running.
+        bool concurrent;
     };
     class Plugin
     {
@@ -115,6 +120,7 @@ namespace DFHack
         command_result on_update(color_ostream &out);
         command_result on_state_change(color_ostream &out, state_change_event event);
         void detach_connection(RPCService *svc);
+        bool can_defer() const;
     public:
         bool load(color_ostream &out);
         bool unload(color_ostream &out);
@@ -147,6 +153,12 @@ namespace DFHack
         DFLibrary * plugin_lib;
         PluginManager * parent;
         plugin_state state;
+        // commands were registered from the plugin cache, plugin_init hasn't run yet
+        bool lazy;
+        // set if the plugin asked to be initialized at startup
+        bool eager;
+        // bit (1 << event) is set for the state changes plugin_onstatechange wants
+        unsigned event_mask;
         command_result (*plugin_init)(color_ostream &, std::vector <PluginCommand> &);
         command_result (*plugin_status)(color_ostream &, std::string &);
         command_result (*plugin_shutdown)(color_ostream &);
@@ -183,8 +195,36 @@ namespace DFHack
         }
     // DATA
     private:
+        struct CommandInfo
+        {
+            Plugin *plugin;
+            PluginCommand::command_hotkey_guard guard;
+            bool interactive;
+            bool concurrent;
+        };
+        struct CommandTable;
+        void updateCommandTable();
+        static const CommandInfo *findCommand(const CommandTable *table, const std::string &name);
+        // the loaded plugins that handle each kind of event
+        struct DispatchTable
+        {
+            std::vector <Plugin *> update;
+            std::vector <Plugin *> state_change[SC_EVENT_COUNT];
+        };
+        void updateDispatchTable();
+        static bool checkHotkey(const CommandInfo &info, df::viewscreen *top);
+        void waitHotkeyReaders();
+
         tthread::mutex * cmdlist_mutex;
-        std::map <std::string, Plugin *> belongs;
+        std::map <std::string, CommandInfo> belongs;
+        // lock-free snapshot of belongs, swapped on every change
+        CommandTable * volatile command_table;
+        // hotkey checks in progress, which may be calling guards without a plugin lock
+        volatile int hotkey_readers;
+        std::vector <CommandTable *> old_command_tables;
+        // swapped like command_table whenever a plugin is loaded or unloaded
+        DispatchTable * volatile dispatch_table;
+        std::vector <DispatchTable *> old_dispatch_tables;
         std::vector <Plugin *> all_plugins;
         std::string plugin_path;
     };
@@ -201,3 +241,11 @@ namespace DFHack
 /// You have to have this in every plugin you write - just once. Ideally on top of the main file.
 #define DFHACK_PLUGIN(plugin_name) DFhackDataExport const char * version = DFHACK_VERSION;\
 DFhackDataExport const char * name = plugin_name;
+
+/// Plugins that only provide commands are not initialized until one of them is used.
+/// Use this in plugins that must run plugin_init at startup anyway.
+#define DFHACK_PLUGIN_IS_EAGER DFhackDataExport bool plugin_eager = true;
+
+/// plugin_onstatechange gets every kind of event, unless the plugin lists the ones it wants:
+/// DFHACK_PLUGIN_EVENTS((1 << SC_MAP_LOADED) | (1 << SC_MAP_UNLOADED))
+#define DFHACK_PLUGIN_EVENTS(mask) DFhackDataExport unsigned plugin_event_mask = (mask);
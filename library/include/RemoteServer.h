@@ -210,11 +210,32 @@ namespace  DFHack
         class connection_ostream : public buffered_color_ostream {
             ServerConnection *owner;
 
+            // Encoded CoreTextNotification waiting to be sent,
+            // preceded by space for the message header.
+            std::vector<uint8_t> frame;
+            uint64_t last_send;
+
+            // frame is shared with the flusher thread, which sends text
+            // that is still waiting when MAX_TEXT_FRAME_DELAY runs out
+            tthread::mutex *frame_mutex;
+            tthread::condition_variable *frame_cond;
+            tthread::thread *flusher;
+            bool stopping;
+
+            static void flusherFn(void *);
+            void flusherFn();
+            void send_pending();
+
         protected:
             virtual void flush_proxy();
 
         public:
-            connection_ostream(ServerConnection *owner) : owner(owner) {}
+            connection_ostream(ServerConnection *owner);
+            ~connection_ostream();
+
+            void send_frame();
+            /// stops the flusher; call before closing the socket
+            void stop();
         };
 
         bool in_error;
@@ -29,6 +29,7 @@ distribution.
 #include "Export.h"
 #include "Types.h"
 #include <map>
+#include <unordered_map>
 #include <sys/types.h>
 #include <vector>
 #include <algorithm>
@@ -48,9 +49,11 @@ namespace DFHack
     struct DFHACK_EXPORT VersionInfo
     {
     private:
+        friend class VersionInfoFactory;
         std::vector <std::string> md5_list;
         std::vector <uint32_t> PE_list;
-        std::map <std::string, uint32_t> Addresses;
+        // hashed, as every global is looked up by name during init
+        std::unordered_map <std::string, uint32_t> Addresses;
         uint32_t base;
         std::string version;
         OSType OS;
@@ -27,6 +27,10 @@ distribution.
 
 #include "Pragma.h"
 #include "Export.h"
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <unordered_map>
 
 class TiXmlElement;
 namespace DFHack
@@ -46,6 +50,18 @@ namespace DFHack
             void clear();
         private:
             void ParseVersion (TiXmlElement* version, VersionInfo* mem);
+            void addVersion (VersionInfo* mem);
+            bool loadXml ();
+            bool loadCache ();
+            void saveCache (const std::string &key, VersionInfo* mem);
+            void useTablesFor (const std::string &key);
+            void cacheVersion (const std::string &key, VersionInfo* mem);
             bool error;
+            // the cache holds one table, for the executable identified by cache_key
+            std::string xml_path, cache_path, xml_hash, cache_key;
+            bool from_cache;
+            // md5 hashes and PE timestamps of all versions, first one wins
+            std::unordered_map<std::string, VersionInfo*> md5_index;
+            std::unordered_map<uint32_t, VersionInfo*> pe_index;
     };
 }
@@ -78,6 +78,11 @@ DFHACK_EXPORT uint32_t getNumBuildings ();
  */
 DFHACK_EXPORT bool Read (const uint32_t index, t_building & building);
 
+/**
+ * Look for a particular building by ID, through a hash index of world->buildings.all
+ */
+DFHACK_EXPORT df::building * findBuildingByID(int32_t id);
+
 /**
  * read mapping from custom_type value to building RAW name
  * custom_type of -1 implies ordinary building
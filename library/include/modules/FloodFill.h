@@ -0,0 +1,261 @@
+/*
+https://github.com/peterix/dfhack
+Copyright (c) 2009-2011 Petr Mrázek (peterix@gmail.com)
+
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any
+damages arising from the use of this software.
+
+Permission is granted to anyone to use this software for any
+purpose, including commercial applications, and to alter it and
+redistribute it freely, subject to the following restrictions:
+
+1. The origin of this software must not be misrepresented; you must
+not claim that you wrote the original software. If you use this
+software in a product, an acknowledgment in the product documentation
+would be appreciated but is not required.
+
+2. Altered source versions must be plainly marked as such, and
+must not be misrepresented as being the original software.
+
+3. This notice may not be removed or altered from any source
+distribution.
+*/
+
+#pragma once
+#ifndef MAPEXTRAS_FLOODFILL_H
+#define MAPEXTRAS_FLOODFILL_H
+
+#include "modules/MapCache.h"
+#include <map>
+#include <vector>
+
+namespace MapExtras
+{
+
+/// How the flood reached a tile
+enum FloodDirection
+{
+    FLOOD_SIDE = 0, ///< from a neighbour on the same z-level (or the start tile)
+    FLOOD_UP = 1,   ///< from the tile below
+    FLOOD_DOWN = 2  ///< from the tile above
+};
+
+/**
+ * Scanline flood fill over a MapCache.
+ *
+ * Each z-level is filled in horizontal spans; a span is grown left and right
+ * from its seed and the rows above and below it are scanned for new seeds.
+ * Visited tiles are kept in a 16x16 bitset per map block, so the tiles
+ * themselves never need to be modified to mark progress.
+ *
+ * The Fill argument of run() supplies the region and the action:
+ *
+ *   bool inside(Block *block, df::coord2d local, DFCoord pos);
+ *       Is pos part of the region. Must not depend on what visit() changes.
+ *   void visit(Block *block, df::coord2d local, DFCoord pos, FloodDirection how);
+ *       Called exactly once for every tile of the region.
+ *   int vertical(Block *block, df::coord2d local, DFCoord pos);
+ *       Mask of FLOOD_UP / FLOOD_DOWN: z-neighbours of pos the region continues into.
+ *   void border(Block *block, df::coord2d local, DFCoord pos, FloodDirection how);
+ *       A tile adjacent to the region that is not inside it. May be reported
+ *       more than once.
+ */
+class FloodFill
+{
+public:
+    FloodFill(MapCache &mc, bool diagonal = false)
+        : mc(mc), diagonal(diagonal), last_state(NULL)
+    {
+        last_bcoord.clear();
+    }
+
+    /// Fill the region containing start; returns the number of visited tiles.
+    template<class Fill>
+    size_t run(DFCoord start, Fill &fill)
+    {
+        size_t count = 0;
+
+        if (probe(start, fill) != TILE_FREE)
+            return 0;
+
+        std::vector<Seed> seeds;
+        seeds.push_back(Seed(start, FLOOD_SIDE));
+
+        while (!seeds.empty())
+        {
+            Seed seed = seeds.back();
+            seeds.pop_back();
+
+            DFCoord pos = seed.pos;
+            if (visited(pos))
+                continue;
+
+            // grow the span in both directions
+            int16_t x1 = pos.x, x2 = pos.x;
+            int left, right;
+            while ((left = probe(DFCoord(x1-1, pos.y, pos.z), fill)) == TILE_FREE)
+                x1--;
+            while ((right = probe(DFCoord(x2+1, pos.y, pos.z), fill)) == TILE_FREE)
+                x2++;
+
+            for (int16_t x = x1; x <= x2; x++)
+            {
+                DFCoord cur(x, pos.y, pos.z);
+                BlockState *st = state(cur);
+                df::coord2d local(x & 15, pos.y & 15);
+
+                st->visited[local.y] |= uint16_t(1 << local.x);
+                count++;
+
+                fill.visit(st->block, local, cur, x == pos.x ? seed.how : FLOOD_SIDE);
+
+                int vert = fill.vertical(st->block, local, cur);
+                if (vert & FLOOD_UP)
+                    pushVertical(seeds, cur + 1, FLOOD_UP, fill);
+                if (vert & FLOOD_DOWN)
+                    pushVertical(seeds, cur - 1, FLOOD_DOWN, fill);
+            }
+
+            if (left == TILE_OUTSIDE)
+                reportBorder(DFCoord(x1-1, pos.y, pos.z), FLOOD_SIDE, fill);
+            if (right == TILE_OUTSIDE)
+                reportBorder(DFCoord(x2+1, pos.y, pos.z), FLOOD_SIDE, fill);
+
+            int16_t sx1 = diagonal ? x1-1 : x1;
+            int16_t sx2 = diagonal ? x2+1 : x2;
+            scanRow(seeds, sx1, sx2, pos.y-1, pos.z, fill);
+            scanRow(seeds, sx1, sx2, pos.y+1, pos.z, fill);
+        }
+
+        return count;
+    }
+
+    /// Has the flood already passed through pos
+    bool visited(DFCoord pos)
+    {
+        BlockState *st = state(pos);
+        return st && st->block && (st->visited[pos.y & 15] & (1 << (pos.x & 15)));
+    }
+
+private:
+    enum TileState
+    {
+        TILE_INVALID,
+        TILE_OUTSIDE,
+        TILE_FREE,
+        TILE_VISITED
+    };
+
+    struct Seed
+    {
+        DFCoord pos;
+        FloodDirection how;
+        Seed(DFCoord pos, FloodDirection how) : pos(pos), how(how) {}
+    };
+
+    struct BlockState
+    {
+        Block *block;
+        uint16_t visited[16];
+    };
+
+    MapCache &mc;
+    bool diagonal;
+    std::map<DFCoord, BlockState> states;
+    DFCoord last_bcoord;
+    BlockState *last_state;
+
+    BlockState *state(DFCoord pos)
+    {
+        if (pos.x < 0 || pos.y < 0 || pos.z < 0)
+            return NULL;
+
+        DFCoord bcoord(pos.x >> 4, pos.y >> 4, pos.z);
+        if (last_state && bcoord == last_bcoord)
+            return last_state;
+
+        auto it = states.find(bcoord);
+        if (it == states.end())
+        {
+            BlockState st;
+            st.block = mc.BlockAt(bcoord);
+            if (st.block && !st.block->valid)
+                st.block = NULL;
+            memset(st.visited, 0, sizeof(st.visited));
+            it = states.insert(std::make_pair(bcoord, st)).first;
+        }
+
+        last_bcoord = bcoord;
+        last_state = &it->second;
+        return last_state;
+    }
+
+    template<class Fill>
+    int probe(DFCoord pos, Fill &fill)
+    {
+        BlockState *st = state(pos);
+        if (!st || !st->block)
+            return TILE_INVALID;
+
+        df::coord2d local(pos.x & 15, pos.y & 15);
+        if (st->visited[local.y] & (1 << local.x))
+            return TILE_VISITED;
+
+        return fill.inside(st->block, local, pos) ? TILE_FREE : TILE_OUTSIDE;
+    }
+
+    template<class Fill>
+    void reportBorder(DFCoord pos, FloodDirection how, Fill &fill)
+    {
+        BlockState *st = state(pos);
+        fill.border(st->block, df::coord2d(pos.x & 15, pos.y & 15), pos, how);
+    }
+
+    template<class Fill>
+    void pushVertical(std::vector<Seed> &seeds, DFCoord pos, FloodDirection how, Fill &fill)
+    {
+        switch (probe(pos, fill))
+        {
+        case TILE_FREE:
+            seeds.push_back(Seed(pos, how));
+            break;
+        case TILE_OUTSIDE:
+            reportBorder(pos, how, fill);
+            break;
+        default:
+            break;
+        }
+    }
+
+    template<class Fill>
+    void scanRow(std::vector<Seed> &seeds, int16_t x1, int16_t x2, int16_t y, int16_t z, Fill &fill)
+    {
+        bool in_run = false;
+
+        for (int16_t x = x1; x <= x2; x++)
+        {
+            DFCoord pos(x, y, z);
+
+            switch (probe(pos, fill))
+            {
+            case TILE_FREE:
+                // one seed per run; the span fill picks up the rest
+                if (!in_run)
+                    seeds.push_back(Seed(pos, FLOOD_SIDE));
+                in_run = true;
+                break;
+            case TILE_OUTSIDE:
+                reportBorder(pos, FLOOD_SIDE, fill);
+                in_run = false;
+                break;
+            default:
+                in_run = false;
+                break;
+            }
+        }
+    }
+};
+
+}
+#endif
@@ -0,0 +1,119 @@
+/*
+https://github.com/peterix/dfhack
+Copyright (c) 2009-2011 Petr Mrázek (peterix@gmail.com)
+
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any
+damages arising from the use of this software.
+
+Permission is granted to anyone to use this software for any
+purpose, including commercial applications, and to alter it and
+redistribute it freely, subject to the following restrictions:
+
+1. The origin of this software must not be misrepresented; you must
+not claim that you wrote the original software. If you use this
+software in a product, an acknowledgment in the product documentation
+would be appreciated but is not required.
+
+2. Altered source versions must be plainly marked as such, and
+must not be misrepresented as being the original software.
+
+3. This notice may not be removed or altered from any source
+distribution.
+*/
+
+
+#pragma once
+#ifndef CL_MOD_ITEMCENSUS
+#define CL_MOD_ITEMCENSUS
+
+#include "Export.h"
+#include "DataDefs.h"
+#include "df/item_type.h"
+#include "df/items_other_id.h"
+
+namespace DFHack
+{
+class color_ostream;
+
+/**
+ * \defgroup grp_itemcensus Running item counts
+ * @ingroup grp_modules
+ */
+
+/**
+ * Running counts of the items in a world->items.other vector, grouped by
+ * item type, subtype and material.
+ *
+ * A census remembers the key, flags and stack size of every item it has
+ * seen. Core refreshes each census every few frames by merging that list
+ * with the current item vector, so only items that were added, removed or
+ * changed touch the counts. Plugins can watch a count with a pair of
+ * thresholds and get called back when it crosses them, instead of
+ * counting the items themselves.
+ *
+ * All functions must be called with the core suspended.
+ * \ingroup grp_itemcensus
+ */
+namespace ItemCensus
+{
+    /// What the items are counted by. In queries, -1 matches any value.
+    struct Key
+    {
+        df::item_type type;
+        int16_t subtype;
+        int16_t mat_type;
+        int32_t mat_index;
+
+        Key(df::item_type type = df::item_type(-1), int16_t subtype = -1,
+            int16_t mat_type = -1, int32_t mat_index = -1)
+            : type(type), subtype(subtype), mat_type(mat_type), mat_index(mat_index) {}
+
+        bool operator< (const Key &other) const;
+        bool operator== (const Key &other) const;
+        bool matches(const Key &query) const;
+    };
+
+    struct Count
+    {
+        int items;   ///< number of items
+        int amount;  ///< sum of their stack sizes
+
+        Count() : items(0), amount(0) {}
+    };
+
+    /**
+     * Start counting world->items.other[list], leaving out items that have
+     * any of ignore_flags set. The counts are refreshed every interval frames,
+     * or only by refresh() if interval is 0. Returns the census id.
+     */
+    DFHACK_EXPORT int addCensus(df::items_other_id list, uint32_t ignore_flags, int interval = 100);
+    DFHACK_EXPORT void removeCensus(int census);
+
+    /// Bring the counts of the census up to date right away, and run the threshold callbacks.
+    DFHACK_EXPORT void refresh(color_ostream &out, int census);
+
+    /// Total of all the keys that match the query.
+    DFHACK_EXPORT Count getCount(int census, const Key &query);
+    /// Grows with every item that was added, removed, or had its flags or stack size changed.
+    DFHACK_EXPORT uint32_t getChangeCount(int census);
+
+    typedef void (*ThresholdCallback)(color_ostream &out, void *data, const Key &key, int count, bool above);
+
+    /**
+     * Call back when the number of items matching key drops to low or
+     * below, or rises above high. Items are counted, not stack sizes. Each crossing is reported once, so a gap
+     * between low and high keeps the callback from flapping. Returns the
+     * threshold id.
+     */
+    DFHACK_EXPORT int addThreshold(int census, const Key &key, int low, int high,
+                                   ThresholdCallback callback, void *data = NULL);
+    DFHACK_EXPORT void removeThreshold(int threshold);
+
+    /// Refresh the census that are due and run their callbacks; called by Core every tick.
+    DFHACK_EXPORT void update(color_ostream &out);
+    /// Forget all counts; called by Core when the map is loaded or unloaded.
+    DFHACK_EXPORT void reset();
+}
+}
+#endif
@@ -28,7 +28,10 @@ distribution.
 
 #include "Export.h"
 #include "Module.h"
+#include "DataDefs.h"
+#include "df/job_type.h"
 #include <ostream>
+#include <vector>
 
 namespace df
 {
@@ -36,6 +39,7 @@ namespace df
     struct job_item;
     struct job_item_filter;
     struct building;
+    struct item;
 }
 
 namespace DFHack
@@ -54,6 +58,27 @@ namespace DFHack
     DFHACK_EXPORT df::building *getJobHolder(df::job *job);
 
     DFHACK_EXPORT bool linkJobIntoWorld(df::job *job, bool new_id = true);
+
+    /*
+     * Index of the live jobs in world->job_list by id, holder building,
+     * job type and attached items. Core marks it stale every frame and the
+     * first lookup after that merges the job list into it; only jobs that
+     * appeared, disappeared, or changed holder, type or items are re-indexed.
+     * Pointers returned by the lookups are only valid until the next frame.
+     */
+
+    DFHACK_EXPORT df::job *findJobById(int32_t id);
+    DFHACK_EXPORT void findJobsByHolder(std::vector<df::job*> &out, df::building *holder);
+    DFHACK_EXPORT void findJobsByType(std::vector<df::job*> &out, df::job_type type);
+    DFHACK_EXPORT size_t countLiveJobs();
+
+    // The first job the item is attached to, and the number of such jobs.
+    DFHACK_EXPORT df::job *getItemJob(df::item *item);
+    DFHACK_EXPORT int countItemJobs(df::item *item);
+
+    // Called by Core once per frame, and on map change.
+    DFHACK_EXPORT void invalidateJobIndex();
+    DFHACK_EXPORT void clearJobIndex();
 }
 #endif
 
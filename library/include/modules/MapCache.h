@@ -499,6 +499,17 @@ class MapCache
         }
         return true;
     }
+    /// write a single block back and drop it from the cache
+    bool WriteBlock(DFCoord blockcoord)
+    {
+        std::map<DFCoord, Block *>::iterator p = blocks.find(blockcoord);
+        if(p == blocks.end())
+            return false;
+        bool ok = p->second->Write();
+        delete p->second;
+        blocks.erase(p);
+        return ok;
+    }
     void trash()
     {
         std::map<DFCoord, Block *>::iterator p;
@@ -0,0 +1,89 @@
+/*
+https://github.com/peterix/dfhack
+Copyright (c) 2009-2011 Petr Mrázek (peterix@gmail.com)
+
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any
+damages arising from the use of this software.
+
+Permission is granted to anyone to use this software for any
+purpose, including commercial applications, and to alter it and
+redistribute it freely, subject to the following restrictions:
+
+1. The origin of this software must not be misrepresented; you must
+not claim that you wrote the original software. If you use this
+software in a product, an acknowledgment in the product documentation
+would be appreciated but is not required.
+
+2. Altered source versions must be plainly marked as such, and
+must not be misrepresented as being the original software.
+
+3. This notice may not be removed or altered from any source
+distribution.
+*/
+
+#pragma once
+#ifndef CL_MOD_SPATIAL
+#define CL_MOD_SPATIAL
+
+#include "Export.h"
+#include "DataDefs.h"
+#include "df/coord.h"
+
+#include <vector>
+
+namespace df
+{
+    struct unit;
+    struct building;
+}
+
+/**
+ * \defgroup grp_spatial Spatial index of units and buildings
+ * @ingroup grp_modules
+ */
+namespace DFHack
+{
+/**
+ * Position lookups for units and buildings.
+ *
+ * Units and building extents are bucketed into a grid of map-block sized
+ * cells, allocated per z-level on first use. Nothing is done until a query
+ * arrives: the first query after the index went stale brings it up to
+ * date, moving only the objects that changed cell. Units are only looked
+ * at again once the game tick has advanced or the unit list changed, since
+ * they don't move while the game is paused; buildings, which are few and
+ * can be edited while paused, after every frame. Queries then cost roughly
+ * the number of objects near the requested area.
+ *
+ * All functions must be called with the core suspended.
+ * \ingroup grp_spatial
+ */
+namespace Spatial
+{
+    /// Mark the buildings as out of date; called by Core every frame.
+    DFHACK_EXPORT void invalidate();
+    /// Mark the units as out of date, for code that moves them itself.
+    DFHACK_EXPORT void unitsMoved();
+    /// Drop everything; called by Core when the map is loaded or unloaded.
+    DFHACK_EXPORT void clear();
+
+    /// Units standing inside the inclusive box, in id order.
+    DFHACK_EXPORT void getUnitsInBox(std::vector<df::unit*> &out,
+                                     int16_t x1, int16_t y1, int16_t z1,
+                                     int16_t x2, int16_t y2, int16_t z2);
+    /// Units within radius (euclidean, in tiles) of center, on center.z +/- zradius.
+    DFHACK_EXPORT void getUnitsInRadius(std::vector<df::unit*> &out,
+                                        df::coord center, int radius, int zradius = 0);
+    /// Units standing exactly at pos.
+    DFHACK_EXPORT void getUnitsAt(std::vector<df::unit*> &out, df::coord pos);
+
+    /// Buildings whose x1..x2,y1..y2 rectangle intersects the inclusive box, in id order.
+    DFHACK_EXPORT void getBuildingsInBox(std::vector<df::building*> &out,
+                                         int16_t x1, int16_t y1, int16_t z1,
+                                         int16_t x2, int16_t y2, int16_t z2);
+    /// Buildings whose rectangle contains pos, in id order.
+    DFHACK_EXPORT void getBuildingsAt(std::vector<df::building*> &out, df::coord pos);
+}
+}
+#endif
@@ -183,6 +183,8 @@ DFHACK_EXPORT bool ReadOwnedItemsByIdx(const uint32_t index, std::vector<int32_t
 DFHACK_EXPORT bool ReadOwnedItemsByPtr(const df::unit * unit, std::vector<int32_t> & item);
 
 DFHACK_EXPORT int32_t FindIndexById(int32_t id);
+/// Look up a unit by id through a hash index of world->units.all
+DFHACK_EXPORT df::unit * FindById(int32_t id);
 
 /* Getters */
 DFHACK_EXPORT uint32_t GetDwarfRaceIndex ( void );
@@ -25,6 +25,13 @@ distribution.
 #pragma once
 #include "Export.h"
 #include <cstddef>
+#include <string>
+#include <vector>
+
+namespace tthread
+{
+    class mutex;
+}
 
 namespace DFHack
 {
@@ -186,6 +193,8 @@ namespace Windows
         virtual painter * lock();
         bool unlock (painter * painter);
         virtual bool addChild(df_window *);
+        /// detach a child without deleting it
+        virtual bool removeChild(df_window *);
         virtual df_tilebuf getBuffer() = 0;
     public:
         df_screentile* buffer;
@@ -201,14 +210,23 @@ namespace Windows
         painter * current_painter;
     };
 
+    /**
+     * The DF screen. It is painted on the render thread, so children can be
+     * added and removed from any thread.
+     */
     class DFHACK_EXPORT top_level_window : public df_window
     {
     public:
         top_level_window();
+        virtual ~top_level_window();
         virtual bool move (int left_, int top_, unsigned int width_, unsigned int height_);
         virtual void paint ();
         virtual painter * lock();
+        virtual bool addChild(df_window *);
+        virtual bool removeChild(df_window *);
         virtual df_tilebuf getBuffer();
+    private:
+        tthread::mutex * children_mutex;
     };
     class DFHACK_EXPORT buffered_window : public df_window
     {
@@ -245,6 +263,50 @@ namespace Windows
             return buf;
         };
     };
+    /**
+     * Tiles drawn over the DF screen, filled from any one thread.
+     *
+     * The producer paints into the back buffer (through lock() or
+     * getBuffer()) and publishes it with swap(). Painting the window
+     * composites the newest published frame, so the render thread never
+     * waits for a frame to be finished. Tiles with symbol 0 are
+     * transparent. The covered cells are listed when a frame is published,
+     * so compositing only visits those, and skips the ones the screen
+     * already shows.
+     *
+     * Add it to Core::screen_window; remove it before deleting it.
+     */
+    class DFHACK_EXPORT overlay_window : public df_window
+    {
+    public:
+        overlay_window(int x, int y, unsigned int width, unsigned int height);
+        virtual ~overlay_window();
+        /// only the position can change
+        virtual bool move (int left_, int top_, unsigned int width_, unsigned int height_);
+        virtual void paint ();
+        virtual df_tilebuf getBuffer();
+        /// make the back buffer transparent
+        void clear();
+        /// publish the back buffer, which then starts out as a copy of it;
+        /// fails while a painter from lock() is still out, since it points
+        /// into the back buffer
+        bool swap();
+    private:
+        struct frame
+        {
+            df_screentile * tiles;
+            // indices of the tiles that are not transparent
+            std::vector<unsigned int> cells;
+        };
+        // back is the producer's, front the render thread's; ready is the
+        // newest published frame, swapped into front when fresh is set
+        frame frames[3];
+        int back, ready, front;
+        bool fresh;
+        int new_left, new_top;
+        tthread::mutex * swap_mutex;
+    };
+
     class DFHACK_EXPORT dfhack_dummy : public buffered_window
     {
     public:
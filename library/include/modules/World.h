@@ -134,15 +134,29 @@ namespace DFHack
         bool WriteGameMode(const t_gamemodes & wr); // this is very dangerous
         std::string ReadWorldFolder();
 
-        // Store data in fake historical figure names.
-        // This ensures that the values are stored in save games.
+        // Store data in a key/value table that is written to the save
+        // folder whenever DF saves the game.
         PersistentDataItem AddPersistentData(const std::string &key);
         PersistentDataItem GetPersistentData(const std::string &key);
         PersistentDataItem GetPersistentData(int entry_id);
         void GetPersistentData(std::vector<PersistentDataItem> *vec,
                                const std::string &key, bool prefix = false);
         bool DeletePersistentData(const PersistentDataItem &item);
-
+        // Delete all entries with the key, or under key/ if prefix is set.
+        int DeletePersistentData(const std::string &key, bool prefix);
+
+        // Changes made between Begin and End of a batch are undone if it
+        // ends without commit; batches can nest. Changes to the value or
+        // ints of an item must be announced with PreparePersistentChange.
+        size_t BeginPersistentBatch();
+        void EndPersistentBatch(size_t mark, bool commit);
+        void PreparePersistentChange(const PersistentDataItem &item);
+
+        // Write the table to disk if the game was saved since the last
+        // write; also done by ClearPersistentCache.
+        void SavePersistentData();
+        // Called by the core every frame; checks for saves once a second.
+        void CheckPersistentSave();
         void ClearPersistentCache();
 
     private:
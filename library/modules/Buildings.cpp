@@ -37,6 +37,7 @@ using namespace std;
 #include "modules/Buildings.h"
 #include "ModuleFactory.h"
 #include "Core.h"
+#include "MiscUtils.h"
 using namespace DFHack;
 
 #include "DataDefs.h"
@@ -53,6 +54,15 @@ uint32_t Buildings::getNumBuildings()
     return world->buildings.all.size();
 }
 
+static id_index<df::building> building_index;
+
+df::building * Buildings::findBuildingByID(int32_t id)
+{
+    if (id < 0)
+        return NULL;
+    return building_index.find(world->buildings.all, id);
+}
+
 bool Buildings::Read (const uint32_t index, t_building & building)
 {
     Core & c = Core::getInstance();
@@ -0,0 +1,372 @@
+/*
+https://github.com/peterix/dfhack
+Copyright (c) 2009-2011 Petr Mrázek (peterix@gmail.com)
+
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any
+damages arising from the use of this software.
+
+Permission is granted to anyone to use this software for any
+purpose, including commercial applications, and to alter it and
+redistribute it freely, subject to the following restrictions:
+
+1. The origin of this software must not be misrepresented; you must
+not claim that you wrote the original software. If you use this
+software in a product, an acknowledgment in the product documentation
+would be appreciated but is not required.
+
+2. Altered source versions must be plainly marked as such, and
+must not be misrepresented as being the original software.
+
+3. This notice may not be removed or altered from any source
+distribution.
+*/
+
+#include "Internal.h"
+
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+using namespace std;
+
+#include "modules/ItemCensus.h"
+#include "MiscUtils.h"
+#include "ColorText.h"
+
+#include "DataDefs.h"
+#include "df/world.h"
+#include "df/item.h"
+
+using namespace DFHack;
+using namespace DFHack::ItemCensus;
+using df::global::world;
+
+bool ItemCensus::Key::operator< (const Key &other) const
+{
+    if (type != other.type)
+        return type < other.type;
+    if (subtype != other.subtype)
+        return subtype < other.subtype;
+    if (mat_type != other.mat_type)
+        return mat_type < other.mat_type;
+    return mat_index < other.mat_index;
+}
+
+bool ItemCensus::Key::operator== (const Key &other) const
+{
+    return type == other.type && subtype == other.subtype &&
+           mat_type == other.mat_type && mat_index == other.mat_index;
+}
+
+bool ItemCensus::Key::matches(const Key &query) const
+{
+    return (query.type == df::item_type(-1) || query.type == type) &&
+           (query.subtype == -1 || query.subtype == subtype) &&
+           (query.mat_type == -1 || query.mat_type == mat_type) &&
+           (query.mat_index == -1 || query.mat_index == mat_index);
+}
+
+namespace {
+    // What the census knew about an item as of its last refresh.
+    struct ItemEntry
+    {
+        df::item *item;
+        int32_t id;
+        Key key;
+        uint32_t flags;
+        bool counted;
+        int amount;
+    };
+
+    struct Census
+    {
+        df::items_other_id list;
+        uint32_t ignore_flags;
+        int interval;
+        int countdown;
+        uint32_t changes;
+
+        // Parallel to world->items.other[list], which is sorted by id.
+        std::vector<ItemEntry> items;
+        std::map<Key, Count> counts;
+    };
+
+    struct Threshold
+    {
+        int census;
+        Key key;
+        int low, high;
+        ThresholdCallback callback;
+        void *data;
+        int state; // -1 unknown, 0 at or below low, 1 above high
+    };
+
+    std::map<int, Census> census_list;
+    std::map<int, Threshold> thresholds;
+    int next_id = 1;
+
+    Census *findCensus(int id)
+    {
+        auto it = census_list.find(id);
+        return it != census_list.end() ? &it->second : NULL;
+    }
+
+    void adjust(Census &census, const ItemEntry &entry, int sign)
+    {
+        if (!entry.counted)
+            return;
+
+        Count &count = census.counts[entry.key];
+        count.items += sign;
+        count.amount += sign * entry.amount;
+        if (count.items == 0)
+            census.counts.erase(entry.key);
+    }
+
+    void fill(ItemEntry &entry, df::item *item, uint32_t ignore_flags)
+    {
+        entry.flags = item->flags.whole;
+        entry.counted = !(entry.flags & ignore_flags);
+        entry.amount = entry.counted ? item->getStackSize() : 0;
+    }
+
+    ItemEntry makeEntry(df::item *item, uint32_t ignore_flags)
+    {
+        ItemEntry entry;
+        entry.item = item;
+        entry.id = item->id;
+        entry.key = Key(item->getType(), item->getSubtype(),
+                        item->getActualMaterial(), item->getActualMaterialIndex());
+        fill(entry, item, ignore_flags);
+        return entry;
+    }
+
+    /*
+     * Merge the cached entries with the current item vector. Both are sorted
+     * by id, so this is a single pass; the key of an item is only looked up
+     * when it first shows up.
+     */
+    void refreshCensus(Census &census)
+    {
+        auto &current = world->items.other[census.list];
+        auto &old = census.items;
+
+        std::vector<ItemEntry> items;
+        items.reserve(current.size());
+
+        size_t j = 0;
+        for (size_t i = 0; i < current.size(); i++)
+        {
+            df::item *item = current[i];
+
+            for (; j < old.size() && old[j].id < item->id; j++)
+            {
+                adjust(census, old[j], -1);
+                census.changes++;
+            }
+
+            if (j < old.size() && old[j].id == item->id && old[j].item == item)
+            {
+                const ItemEntry &prev = old[j++];
+                if (item->flags.whole == prev.flags && (!prev.counted || item->getStackSize() == prev.amount))
+                {
+                    items.push_back(prev);
+                    continue;
+                }
+
+                ItemEntry entry = prev;
+                fill(entry, item, census.ignore_flags);
+                adjust(census, prev, -1);
+                adjust(census, entry, 1);
+                census.changes++;
+                items.push_back(entry);
+            }
+            else
+            {
+                if (j < old.size() && old[j].id == item->id)
+                {
+                    adjust(census, old[j++], -1);
+                    census.changes++;
+                }
+
+                items.push_back(makeEntry(item, census.ignore_flags));
+                adjust(census, items.back(), 1);
+                census.changes++;
+            }
+        }
+
+        for (; j < old.size(); j++)
+        {
+            adjust(census, old[j], -1);
+            census.changes++;
+        }
+
+        census.items.swap(items);
+        census.countdown = census.interval;
+    }
+
+    Count countMatching(Census &census, const Key &query)
+    {
+        Count total;
+        auto it = census.counts.begin();
+        auto end = census.counts.end();
+
+        // the map is ordered by type first, so a fixed type narrows it to one range
+        if (query.type != df::item_type(-1))
+        {
+            it = census.counts.lower_bound(Key(query.type, INT16_MIN, INT16_MIN, INT32_MIN));
+            end = census.counts.upper_bound(Key(query.type, INT16_MAX, INT16_MAX, INT32_MAX));
+        }
+
+        for (; it != end; ++it)
+        {
+            if (!it->first.matches(query))
+                continue;
+            total.items += it->second.items;
+            total.amount += it->second.amount;
+        }
+        return total;
+    }
+
+    void checkThresholds(color_ostream &out, int census_id, Census &census)
+    {
+        // callbacks may add or remove thresholds, so walk by id
+        int id = 0;
+        for (;;)
+        {
+            auto it = thresholds.upper_bound(id);
+            if (it == thresholds.end())
+                break;
+            id = it->first;
+
+            Threshold &th = it->second;
+            if (th.census != census_id)
+                continue;
+
+            int count = countMatching(census, th.key).items;
+            int state = th.state;
+            if (count <= th.low)
+                state = 0;
+            else if (count > th.high)
+                state = 1;
+
+            if (state == th.state)
+                continue;
+
+            th.state = state;
+            th.callback(out, th.data, th.key, count, state == 1);
+        }
+    }
+}
+
+int ItemCensus::addCensus(df::items_other_id list, uint32_t ignore_flags, int interval)
+{
+    Census census;
+    census.list = list;
+    census.ignore_flags = ignore_flags;
+    census.interval = std::max(interval, 0);
+    census.countdown = 0;
+    census.changes = 0;
+
+    int id = next_id++;
+    census_list[id] = census;
+    return id;
+}
+
+void ItemCensus::removeCensus(int census)
+{
+    census_list.erase(census);
+
+    for (auto it = thresholds.begin(); it != thresholds.end();)
+    {
+        if (it->second.census == census)
+            thresholds.erase(it++);
+        else
+            ++it;
+    }
+}
+
+void ItemCensus::refresh(color_ostream &out, int census)
+{
+    Census *c = findCensus(census);
+    if (!c || !world)
+        return;
+
+    refreshCensus(*c);
+    checkThresholds(out, census, *c);
+}
+
+Count ItemCensus::getCount(int census, const Key &query)
+{
+    Census *c = findCensus(census);
+    return c ? countMatching(*c, query) : Count();
+}
+
+uint32_t ItemCensus::getChangeCount(int census)
+{
+    Census *c = findCensus(census);
+    return c ? c->changes : 0;
+}
+
+int ItemCensus::addThreshold(int census, const Key &key, int low, int high,
+                             ThresholdCallback callback, void *data)
+{
+    if (!findCensus(census) || !callback)
+        return -1;
+
+    Threshold th;
+    th.census = census;
+    th.key = key;
+    th.low = low;
+    th.high = std::max(low, high);
+    th.callback = callback;
+    th.data = data;
+    th.state = -1;
+
+    int id = next_id++;
+    thresholds[id] = th;
+    return id;
+}
+
+void ItemCensus::removeThreshold(int threshold)
+{
+    thresholds.erase(threshold);
+}
+
+void ItemCensus::update(color_ostream &out)
+{
+    if (!world || census_list.empty())
+        return;
+
+    int id = 0;
+    for (;;)
+    {
+        auto it = census_list.upper_bound(id);
+        if (it == census_list.end())
+            break;
+        id = it->first;
+
+        Census &census = it->second;
+        if (census.interval == 0 || --census.countdown > 0)
+            continue;
+
+        refreshCensus(census);
+        checkThresholds(out, id, census);
+    }
+}
+
+void ItemCensus::reset()
+{
+    for (auto it = census_list.begin(); it != census_list.end(); ++it)
+    {
+        Census &census = it->second;
+        census.items.clear();
+        census.counts.clear();
+        census.countdown = 0;
+        census.changes++;
+    }
+
+    for (auto it = thresholds.begin(); it != thresholds.end(); ++it)
+        it->second.state = -1;
+}
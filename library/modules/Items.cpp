@@ -386,11 +386,13 @@ bool ItemTypeInfo::matches(const df::job_item &item, MaterialInfo *mat)
            bits_match(item.flags3.whole, item_ok3.whole, item_mask3.whole);
 }
 
+static id_index<df::item> item_index;
+
 df::item * Items::findItemByID(int32_t id)
 {
     if (id < 0)
         return 0;
-    return df::item::find(id);
+    return item_index.find(world->items.all, id);
 }
 
 bool Items::copyItem(df::item * itembase, DFHack::dfh_item &item)
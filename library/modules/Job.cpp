@@ -28,6 +28,9 @@ distribution.
 #include <string>
 #include <vector>
 #include <map>
+#include <unordered_map>
+#include <algorithm>
+#include <climits>
 #include <cassert>
 using namespace std;
 
@@ -45,6 +48,8 @@ using namespace std;
 #include "df/job.h"
 #include "df/job_item.h"
 #include "df/job_list_link.h"
+#include "df/job_item_ref.h"
+#include "df/item.h"
 #include "df/general_ref.h"
 #include "df/general_ref_unit_workerst.h"
 #include "df/general_ref_building_holderst.h"
@@ -233,6 +238,8 @@ bool DFHack::linkJobIntoWorld(df::job *job, bool new_id)
 
     assert(!job->list_link);
 
+    invalidateJobIndex();
+
     if (new_id) {
         job->id = (*job_next_id)++;
 
@@ -254,3 +261,281 @@ bool DFHack::linkJobIntoWorld(df::job *job, bool new_id)
         return true;
     }
 }
+
+/*
+ * Job index
+ */
+
+namespace {
+    struct JobEntry
+    {
+        df::job *job;
+        df::job_list_link *link;
+        int32_t id;
+        df::building *holder;
+        df::job_type type;
+        std::vector<df::general_ref*> refs;  // the holder is only looked up again if these change
+        std::vector<df::item*> items;
+        std::vector<int32_t> item_ids;
+    };
+
+    /*
+     * The entries are kept in job list order, which is by id, so refreshing
+     * is a single merge pass. Indexed jobs may already be deleted when they
+     * are removed again, so only the cached fields are used for that.
+     */
+    struct JobIndex
+    {
+        bool stale;
+        std::vector<JobEntry> entries;
+
+        std::unordered_map<int32_t, df::job*> by_id;
+        std::map<df::building*, std::vector<df::job*> > by_holder;
+        std::vector<std::map<int32_t, df::job*> > by_type;
+        std::unordered_map<int32_t, std::vector<df::job*> > by_item;
+
+        JobIndex() : stale(true) {}
+    };
+
+    JobIndex job_index;
+
+    JobEntry makeEntry(df::job *job)
+    {
+        JobEntry entry;
+        entry.job = job;
+        entry.link = job->list_link;
+        entry.id = job->id;
+        entry.holder = getJobHolder(job);
+        entry.type = job->job_type;
+        entry.refs = job->references;
+
+        for (size_t i = 0; i < job->items.size(); i++)
+        {
+            df::item *item = job->items[i]->item;
+            if (!item)
+                continue;
+            entry.items.push_back(item);
+            entry.item_ids.push_back(item->id);
+        }
+
+        return entry;
+    }
+
+    bool entryUpToDate(const JobEntry &entry, df::job *job)
+    {
+        if (entry.job != job || entry.link != job->list_link || entry.type != job->job_type)
+            return false;
+
+        size_t count = 0;
+        for (size_t i = 0; i < job->items.size(); i++)
+        {
+            df::item *item = job->items[i]->item;
+            if (!item)
+                continue;
+            if (count >= entry.items.size() || entry.items[count] != item)
+                return false;
+            count++;
+        }
+
+        if (count != entry.items.size())
+            return false;
+
+        // unchanged references mean an unchanged holder, without finding the building again
+        return job->references == entry.refs;
+    }
+
+    void addEntry(const JobEntry &entry)
+    {
+        job_index.by_id[entry.id] = entry.job;
+
+        if (entry.holder)
+            job_index.by_holder[entry.holder].push_back(entry.job);
+
+        if (size_t(entry.type) < job_index.by_type.size())
+            job_index.by_type[entry.type][entry.id] = entry.job;
+
+        for (size_t i = 0; i < entry.item_ids.size(); i++)
+            job_index.by_item[entry.item_ids[i]].push_back(entry.job);
+    }
+
+    void removeEntry(const JobEntry &entry)
+    {
+        auto id_it = job_index.by_id.find(entry.id);
+        if (id_it != job_index.by_id.end() && id_it->second == entry.job)
+            job_index.by_id.erase(id_it);
+
+        if (entry.holder)
+        {
+            auto it = job_index.by_holder.find(entry.holder);
+            if (it != job_index.by_holder.end())
+            {
+                auto &jobs = it->second;
+                jobs.erase(std::remove(jobs.begin(), jobs.end(), entry.job), jobs.end());
+                if (jobs.empty())
+                    job_index.by_holder.erase(it);
+            }
+        }
+
+        if (size_t(entry.type) < job_index.by_type.size())
+            job_index.by_type[entry.type].erase(entry.id);
+
+        for (size_t i = 0; i < entry.item_ids.size(); i++)
+        {
+            auto it = job_index.by_item.find(entry.item_ids[i]);
+            if (it == job_index.by_item.end())
+                continue;
+
+            auto &jobs = it->second;
+            auto pos = std::find(jobs.begin(), jobs.end(), entry.job);
+            if (pos != jobs.end())
+                jobs.erase(pos);
+            if (jobs.empty())
+                job_index.by_item.erase(it);
+        }
+    }
+
+    void rebuildIndex()
+    {
+        using df::global::world;
+
+        job_index.entries.clear();
+        job_index.by_id.clear();
+        job_index.by_holder.clear();
+        job_index.by_item.clear();
+        job_index.by_type.assign(ENUM_LAST_ITEM(job_type)+1, std::map<int32_t, df::job*>());
+
+        for (df::job_list_link *p = world->job_list.next; p; p = p->next)
+        {
+            if (!p->item)
+                continue;
+            job_index.entries.push_back(makeEntry(p->item));
+            addEntry(job_index.entries.back());
+        }
+    }
+
+    void refreshIndex()
+    {
+        using df::global::world;
+
+        if (!job_index.stale)
+            return;
+        job_index.stale = false;
+
+        if (!world)
+            return;
+
+        if (job_index.by_type.empty())
+        {
+            rebuildIndex();
+            return;
+        }
+
+        std::vector<JobEntry> &old = job_index.entries;
+        std::vector<JobEntry> entries;
+        entries.reserve(old.size() + 16);
+
+        size_t j = 0;
+        int32_t last_id = INT_MIN;
+
+        for (df::job_list_link *p = world->job_list.next; p; p = p->next)
+        {
+            df::job *job = p->item;
+            if (!job)
+                continue;
+
+            // the merge relies on the list being sorted by id
+            if (job->id <= last_id)
+            {
+                rebuildIndex();
+                return;
+            }
+            last_id = job->id;
+
+            for (; j < old.size() && old[j].id < job->id; j++)
+                removeEntry(old[j]);
+
+            if (j < old.size() && old[j].id == job->id)
+            {
+                JobEntry &prev = old[j++];
+                if (entryUpToDate(prev, job))
+                {
+                    entries.push_back(JobEntry());
+                    std::swap(entries.back(), prev);
+                    continue;
+                }
+                removeEntry(prev);
+            }
+
+            entries.push_back(makeEntry(job));
+            addEntry(entries.back());
+        }
+
+        for (; j < old.size(); j++)
+            removeEntry(old[j]);
+
+        job_index.entries.swap(entries);
+    }
+}
+
+df::job *DFHack::findJobById(int32_t id)
+{
+    refreshIndex();
+
+    auto it = job_index.by_id.find(id);
+    return it != job_index.by_id.end() ? it->second : NULL;
+}
+
+void DFHack::findJobsByHolder(std::vector<df::job*> &out, df::building *holder)
+{
+    refreshIndex();
+
+    out.clear();
+    auto it = job_index.by_holder.find(holder);
+    if (it != job_index.by_holder.end())
+        out = it->second;
+}
+
+void DFHack::findJobsByType(std::vector<df::job*> &out, df::job_type type)
+{
+    refreshIndex();
+
+    out.clear();
+    if (size_t(type) >= job_index.by_type.size())
+        return;
+
+    auto &jobs = job_index.by_type[type];
+    for (auto it = jobs.begin(); it != jobs.end(); ++it)
+        out.push_back(it->second);
+}
+
+size_t DFHack::countLiveJobs()
+{
+    refreshIndex();
+    return job_index.entries.size();
+}
+
+df::job *DFHack::getItemJob(df::item *item)
+{
+    refreshIndex();
+
+    auto it = job_index.by_item.find(item->id);
+    return it != job_index.by_item.end() ? it->second.front() : NULL;
+}
+
+int DFHack::countItemJobs(df::item *item)
+{
+    refreshIndex();
+
+    auto it = job_index.by_item.find(item->id);
+    return it != job_index.by_item.end() ? int(it->second.size()) : 0;
+}
+
+void DFHack::invalidateJobIndex()
+{
+    job_index.stale = true;
+}
+
+void DFHack::clearJobIndex()
+{
+    job_index = JobIndex();
+}
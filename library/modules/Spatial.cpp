@@ -0,0 +1,452 @@
+/*
+https://github.com/peterix/dfhack
+Copyright (c) 2009-2011 Petr Mrázek (peterix@gmail.com)
+
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any
+damages arising from the use of this software.
+
+Permission is granted to anyone to use this software for any
+purpose, including commercial applications, and to alter it and
+redistribute it freely, subject to the following restrictions:
+
+1. The origin of this software must not be misrepresented; you must
+not claim that you wrote the original software. If you use this
+software in a product, an acknowledgment in the product documentation
+would be appreciated but is not required.
+
+2. Altered source versions must be plainly marked as such, and
+must not be misrepresented as being the original software.
+
+3. This notice may not be removed or altered from any source
+distribution.
+*/
+
+#include "Internal.h"
+
+#include <string>
+#include <vector>
+#include <algorithm>
+using namespace std;
+
+#include "modules/Spatial.h"
+#include "MiscUtils.h"
+
+#include "DataDefs.h"
+#include "df/world.h"
+#include "df/unit.h"
+#include "df/building.h"
+
+using namespace DFHack;
+using df::global::world;
+using df::global::cur_year;
+using df::global::cur_year_tick;
+
+namespace {
+    // One map block worth of tiles.
+    struct Cell
+    {
+        std::vector<df::unit*> units;
+        std::vector<df::building*> buildings;
+    };
+
+    struct Level
+    {
+        std::vector<Cell> cells;
+    };
+
+    struct UnitEntry
+    {
+        df::unit *unit;
+        df::coord pos;
+    };
+
+    struct BuildingEntry
+    {
+        df::building *building;
+        int16_t x1, y1, x2, y2, z;
+    };
+
+    struct SpatialIndex
+    {
+        bool buildings_stale, units_stale;
+        // game time of the last unit sync
+        int32_t unit_year, unit_tick;
+        int xblocks, yblocks, zblocks;
+        std::vector<Level*> levels;
+
+        // Parallel to world->units.all and world->buildings.all as of the last refresh.
+        std::vector<UnitEntry> units;
+        std::vector<BuildingEntry> buildings;
+
+        SpatialIndex()
+            : buildings_stale(true), units_stale(true), unit_year(-1), unit_tick(-1),
+              xblocks(0), yblocks(0), zblocks(0) {}
+    };
+
+    SpatialIndex spatial;
+}
+
+static Cell *getCell(int x, int y, int z, bool create)
+{
+    if (x < 0 || y < 0 || z < 0 || z >= spatial.zblocks)
+        return NULL;
+
+    int bx = x >> 4, by = y >> 4;
+    if (bx >= spatial.xblocks || by >= spatial.yblocks)
+        return NULL;
+
+    Level *level = spatial.levels[z];
+    if (!level)
+    {
+        if (!create)
+            return NULL;
+
+        level = spatial.levels[z] = new Level();
+        level->cells.resize(spatial.xblocks * spatial.yblocks);
+    }
+
+    return &level->cells[by * spatial.xblocks + bx];
+}
+
+template<class T>
+static void removeFrom(std::vector<T*> &vec, T *item)
+{
+    for (size_t i = 0; i < vec.size(); i++)
+    {
+        if (vec[i] != item)
+            continue;
+
+        vec[i] = vec.back();
+        vec.pop_back();
+        return;
+    }
+}
+
+static void addUnit(df::unit *unit, const df::coord &pos)
+{
+    if (!pos.isValid())
+        return;
+    if (Cell *cell = getCell(pos.x, pos.y, pos.z, true))
+        cell->units.push_back(unit);
+}
+
+static void removeUnit(df::unit *unit, const df::coord &pos)
+{
+    if (!pos.isValid())
+        return;
+    if (Cell *cell = getCell(pos.x, pos.y, pos.z, false))
+        removeFrom(cell->units, unit);
+}
+
+static void forBuildingCells(const BuildingEntry &entry, bool add)
+{
+    if (entry.x1 < 0 || entry.y1 < 0 || entry.x2 < entry.x1 || entry.y2 < entry.y1)
+        return;
+
+    int bx2 = std::min(entry.x2 >> 4, spatial.xblocks - 1);
+    int by2 = std::min(entry.y2 >> 4, spatial.yblocks - 1);
+
+    for (int by = entry.y1 >> 4; by <= by2; by++)
+    {
+        for (int bx = entry.x1 >> 4; bx <= bx2; bx++)
+        {
+            Cell *cell = getCell(bx << 4, by << 4, entry.z, add);
+            if (!cell)
+                continue;
+
+            if (add)
+                cell->buildings.push_back(entry.building);
+            else
+                removeFrom(cell->buildings, entry.building);
+        }
+    }
+}
+
+static BuildingEntry makeEntry(df::building *building)
+{
+    BuildingEntry entry;
+    entry.building = building;
+    entry.x1 = building->x1;
+    entry.y1 = building->y1;
+    entry.x2 = building->x2;
+    entry.y2 = building->y2;
+    entry.z = building->z;
+    return entry;
+}
+
+static bool sameExtent(const BuildingEntry &entry, df::building *building)
+{
+    return entry.x1 == building->x1 && entry.y1 == building->y1 &&
+           entry.x2 == building->x2 && entry.y2 == building->y2 &&
+           entry.z == building->z;
+}
+
+static void syncUnits()
+{
+    auto &all = world->units.all;
+    auto &cache = spatial.units;
+
+    // Units are almost always appended, so the cache stays aligned with
+    // the vector; anything after the first mismatch is simply re-added.
+    size_t i = 0;
+    for (; i < cache.size() && i < all.size(); i++)
+    {
+        UnitEntry &entry = cache[i];
+        df::unit *unit = all[i];
+
+        if (entry.unit != unit)
+            break;
+        if (entry.pos == unit->pos)
+            continue;
+
+        if (!(entry.pos.z == unit->pos.z &&
+              (entry.pos.x >> 4) == (unit->pos.x >> 4) &&
+              (entry.pos.y >> 4) == (unit->pos.y >> 4)))
+        {
+            removeUnit(unit, entry.pos);
+            addUnit(unit, unit->pos);
+        }
+        entry.pos = unit->pos;
+    }
+
+    for (size_t j = i; j < cache.size(); j++)
+        removeUnit(cache[j].unit, cache[j].pos);
+    cache.resize(i);
+
+    for (; i < all.size(); i++)
+    {
+        UnitEntry entry;
+        entry.unit = all[i];
+        entry.pos = all[i]->pos;
+        addUnit(entry.unit, entry.pos);
+        cache.push_back(entry);
+    }
+}
+
+static void syncBuildings()
+{
+    auto &all = world->buildings.all;
+    auto &cache = spatial.buildings;
+
+    size_t i = 0;
+    for (; i < cache.size() && i < all.size(); i++)
+    {
+        BuildingEntry &entry = cache[i];
+        df::building *building = all[i];
+
+        if (entry.building != building)
+            break;
+        if (sameExtent(entry, building))
+            continue;
+
+        // zones can be resized in place
+        forBuildingCells(entry, false);
+        entry = makeEntry(building);
+        forBuildingCells(entry, true);
+    }
+
+    for (size_t j = i; j < cache.size(); j++)
+        forBuildingCells(cache[j], false);
+    cache.resize(i);
+
+    for (; i < all.size(); i++)
+    {
+        BuildingEntry entry = makeEntry(all[i]);
+        forBuildingCells(entry, true);
+        cache.push_back(entry);
+    }
+}
+
+static bool refresh()
+{
+    if (!world || !world->map.block_index)
+    {
+        Spatial::clear();
+        return false;
+    }
+
+    if (spatial.xblocks != world->map.x_count_block ||
+        spatial.yblocks != world->map.y_count_block ||
+        spatial.zblocks != world->map.z_count_block)
+    {
+        Spatial::clear();
+        spatial.xblocks = world->map.x_count_block;
+        spatial.yblocks = world->map.y_count_block;
+        spatial.zblocks = world->map.z_count_block;
+        spatial.levels.resize(spatial.zblocks, NULL);
+    }
+
+    int32_t year = cur_year ? *cur_year : -1;
+    int32_t tick = cur_year_tick ? *cur_year_tick : -1;
+    auto &units = world->units.all;
+
+    // without the clock, fall back to syncing every frame
+    if (spatial.units_stale || tick < 0 ||
+        year != spatial.unit_year || tick != spatial.unit_tick ||
+        units.size() != spatial.units.size() ||
+        (!units.empty() && units.back() != spatial.units.back().unit))
+    {
+        syncUnits();
+        spatial.units_stale = false;
+        spatial.unit_year = year;
+        spatial.unit_tick = tick;
+    }
+
+    if (spatial.buildings_stale)
+    {
+        syncBuildings();
+        spatial.buildings_stale = false;
+    }
+
+    return true;
+}
+
+void Spatial::invalidate()
+{
+    spatial.buildings_stale = true;
+}
+
+void Spatial::unitsMoved()
+{
+    spatial.units_stale = true;
+}
+
+void Spatial::clear()
+{
+    for (size_t i = 0; i < spatial.levels.size(); i++)
+        delete spatial.levels[i];
+
+    spatial.levels.clear();
+    spatial.units.clear();
+    spatial.buildings.clear();
+    spatial.xblocks = spatial.yblocks = spatial.zblocks = 0;
+    spatial.buildings_stale = spatial.units_stale = true;
+}
+
+static bool compareUnitId(df::unit *a, df::unit *b)
+{
+    return a->id < b->id;
+}
+
+static bool compareBuildingId(df::building *a, df::building *b)
+{
+    return a->id < b->id;
+}
+
+template<class T>
+static inline void sortBox(T &a, T &b)
+{
+    if (b < a)
+        std::swap(a, b);
+}
+
+void Spatial::getUnitsInBox(std::vector<df::unit*> &out,
+                            int16_t x1, int16_t y1, int16_t z1,
+                            int16_t x2, int16_t y2, int16_t z2)
+{
+    out.clear();
+    if (!refresh())
+        return;
+
+    sortBox(x1, x2); sortBox(y1, y2); sortBox(z1, z2);
+
+    int bx1 = std::max(x1 >> 4, 0), bx2 = std::min(x2 >> 4, spatial.xblocks - 1);
+    int by1 = std::max(y1 >> 4, 0), by2 = std::min(y2 >> 4, spatial.yblocks - 1);
+    int zmin = std::max<int>(z1, 0), zmax = std::min<int>(z2, spatial.zblocks - 1);
+
+    for (int z = zmin; z <= zmax; z++)
+    {
+        Level *level = spatial.levels[z];
+        if (!level)
+            continue;
+
+        for (int by = by1; by <= by2; by++)
+        {
+            for (int bx = bx1; bx <= bx2; bx++)
+            {
+                Cell &cell = level->cells[by * spatial.xblocks + bx];
+                for (size_t i = 0; i < cell.units.size(); i++)
+                {
+                    df::unit *unit = cell.units[i];
+                    if (unit->pos.x >= x1 && unit->pos.x <= x2 &&
+                        unit->pos.y >= y1 && unit->pos.y <= y2)
+                        out.push_back(unit);
+                }
+            }
+        }
+    }
+
+    std::sort(out.begin(), out.end(), compareUnitId);
+}
+
+void Spatial::getUnitsInRadius(std::vector<df::unit*> &out,
+                               df::coord center, int radius, int zradius)
+{
+    radius = std::max(radius, 0);
+    zradius = std::max(zradius, 0);
+
+    getUnitsInBox(out, center.x - radius, center.y - radius, center.z - zradius,
+                       center.x + radius, center.y + radius, center.z + zradius);
+
+    size_t cnt = 0;
+    for (size_t i = 0; i < out.size(); i++)
+    {
+        int dx = out[i]->pos.x - center.x;
+        int dy = out[i]->pos.y - center.y;
+        if (dx*dx + dy*dy <= radius*radius)
+            out[cnt++] = out[i];
+    }
+    out.resize(cnt);
+}
+
+void Spatial::getUnitsAt(std::vector<df::unit*> &out, df::coord pos)
+{
+    getUnitsInBox(out, pos.x, pos.y, pos.z, pos.x, pos.y, pos.z);
+}
+
+void Spatial::getBuildingsInBox(std::vector<df::building*> &out,
+                                int16_t x1, int16_t y1, int16_t z1,
+                                int16_t x2, int16_t y2, int16_t z2)
+{
+    out.clear();
+    if (!refresh())
+        return;
+
+    sortBox(x1, x2); sortBox(y1, y2); sortBox(z1, z2);
+
+    int bx1 = std::max(x1 >> 4, 0), bx2 = std::min(x2 >> 4, spatial.xblocks - 1);
+    int by1 = std::max(y1 >> 4, 0), by2 = std::min(y2 >> 4, spatial.yblocks - 1);
+    int zmin = std::max<int>(z1, 0), zmax = std::min<int>(z2, spatial.zblocks - 1);
+
+    for (int z = zmin; z <= zmax; z++)
+    {
+        Level *level = spatial.levels[z];
+        if (!level)
+            continue;
+
+        for (int by = by1; by <= by2; by++)
+        {
+            for (int bx = bx1; bx <= bx2; bx++)
+            {
+                Cell &cell = level->cells[by * spatial.xblocks + bx];
+                for (size_t i = 0; i < cell.buildings.size(); i++)
+                {
+                    df::building *bld = cell.buildings[i];
+                    if (bld->x1 <= x2 && x1 <= bld->x2 &&
+                        bld->y1 <= y2 && y1 <= bld->y2)
+                        out.push_back(bld);
+                }
+            }
+        }
+    }
+
+    // large buildings and zones span several cells
+    std::sort(out.begin(), out.end(), compareBuildingId);
+    out.erase(std::unique(out.begin(), out.end()), out.end());
+}
+
+void Spatial::getBuildingsAt(std::vector<df::building*> &out, df::coord pos)
+{
+    getBuildingsInBox(out, pos.x, pos.y, pos.z, pos.x, pos.y, pos.z);
+}
@@ -42,8 +42,10 @@ using namespace std;
 #include "modules/Units.h"
 #include "modules/Materials.h"
 #include "modules/Translation.h"
+#include "modules/Spatial.h"
 #include "ModuleFactory.h"
 #include "Core.h"
+#include "MiscUtils.h"
 
 #include "df/world.h"
 #include "df/ui.h"
@@ -83,29 +85,26 @@ int32_t Units::GetCreatureInBox (int32_t index, df::unit ** furball,
                                 const uint16_t x1, const uint16_t y1, const uint16_t z1,
                                 const uint16_t x2, const uint16_t y2, const uint16_t z2)
 {
-    if (!isValid())
+    *furball = NULL;
+    if (!isValid() || x2 <= x1 || y2 <= y1 || z2 <= z1)
         return -1;
 
-    size_t size = world->units.all.size();
-    while (size_t(index) < size)
+    // the upper bounds are exclusive here, and inclusive in Spatial
+    std::vector<df::unit*> units;
+    Spatial::getUnitsInBox(units, x1, y1, z1, x2-1, y2-1, z2-1);
+
+    // the first one at or after index in units.all
+    int32_t found = -1;
+    for (size_t i = 0; i < units.size(); i++)
     {
-        // read pointer from vector at position
-        df::unit * temp = world->units.all[index];
-        if (temp->pos.x >= x1 && temp->pos.x < x2)
+        int32_t pos = FindIndexById(units[i]->id);
+        if (pos >= index && (found < 0 || pos < found))
         {
-            if (temp->pos.y >= y1 && temp->pos.y < y2)
-            {
-                if (temp->pos.z >= z1 && temp->pos.z < z2)
-                {
-                    *furball = temp;
-                    return index;
-                }
-            }
+            found = pos;
+            *furball = units[i];
         }
-        index++;
     }
-    *furball = NULL;
-    return -1;
+    return found;
 }
 
 void Units::CopyCreature(df::unit * source, t_unit & furball)
@@ -223,9 +222,16 @@ void Units::CopyCreature(df::unit * source, t_unit & furball)
         furball.current_job.active = false;
     }
 }
+static id_index<df::unit> unit_index;
+
 int32_t Units::FindIndexById(int32_t creature_id)
 {
-    return df::unit::binsearch_index(world->units.all, creature_id);
+    return unit_index.index_of(world->units.all, creature_id);
+}
+
+df::unit * Units::FindById(int32_t creature_id)
+{
+    return unit_index.find(world->units.all, creature_id);
 }
 /*
 bool Creatures::WriteLabors(const uint32_t index, uint8_t labors[NUM_CREATURE_LABORS])
@@ -26,6 +26,10 @@ distribution.
 #include "Module.h"
 #include "BitArray.h"
 #include <string>
+#include <cstring>
+#include <algorithm>
+
+#include "tinythread.h"
 
 #include "DataDefs.h"
 #include "df/init.h"
@@ -67,6 +71,16 @@ bool Windows::df_window::addChild( df_window * child)
     return true;
 }
 
+bool Windows::df_window::removeChild( df_window * child)
+{
+    auto iter = std::find(children.begin(), children.end(), child);
+    if(iter == children.end())
+        return false;
+    children.erase(iter);
+    child->parent = 0;
+    return true;
+}
+
 bool Windows::df_window::unlock (painter * painter)
 {
     if(current_painter == painter)
@@ -82,6 +96,25 @@ bool Windows::df_window::unlock (painter * painter)
 Windows::top_level_window::top_level_window(): df_window(0,0,df::global::gps->dimx,df::global::gps->dimy)
 {
     buffer = 0;
+    children_mutex = new tthread::mutex();
+}
+
+Windows::top_level_window::~top_level_window()
+{
+    delete children_mutex;
+}
+
+bool Windows::top_level_window::addChild( df_window * child)
+{
+    tthread::lock_guard<tthread::mutex> lock(*children_mutex);
+    return df_window::addChild(child);
+}
+
+bool Windows::top_level_window::removeChild( df_window * child)
+{
+    // once this returns, the child is not being painted either
+    tthread::lock_guard<tthread::mutex> lock(*children_mutex);
+    return df_window::removeChild(child);
 }
 
 bool Windows::top_level_window::move (int left_, int top_, unsigned int width_, unsigned int height_)
@@ -100,6 +133,7 @@ Windows::painter * Windows::top_level_window::lock()
 
 void Windows::top_level_window::paint ()
 {
+    tthread::lock_guard<tthread::mutex> lock(*children_mutex);
     for(auto iter = children.begin();iter != children.end();iter++)
     {
         (*iter)->paint();
@@ -113,4 +147,104 @@ Windows::df_tilebuf Windows::top_level_window::getBuffer()
     buf.height = df::global::gps->dimy;
     buf.width = df::global::gps->dimx;
     return buf;
-}
\ No newline at end of file
+}
+
+Windows::overlay_window::overlay_window(int x, int y, unsigned int width, unsigned int height)
+:df_window(x, y, width, height), back(0), ready(1), front(2), fresh(false), new_left(x), new_top(y)
+{
+    for(int i = 0; i < 3; i++)
+    {
+        frames[i].tiles = new df_screentile[width*height];
+        memset(frames[i].tiles, 0, sizeof(df_screentile)*width*height);
+    }
+    buffer = frames[back].tiles;
+    swap_mutex = new tthread::mutex();
+}
+
+Windows::overlay_window::~overlay_window()
+{
+    for(int i = 0; i < 3; i++)
+        delete [] frames[i].tiles;
+    delete swap_mutex;
+}
+
+bool Windows::overlay_window::move (int left_, int top_, unsigned int width_, unsigned int height_)
+{
+    if(width_ != width || height_ != height)
+        return false;
+    tthread::lock_guard<tthread::mutex> lock(*swap_mutex);
+    new_left = left_;
+    new_top = top_;
+    return true;
+}
+
+Windows::df_tilebuf Windows::overlay_window::getBuffer()
+{
+    df_tilebuf buf;
+    buf.data = buffer;
+    buf.width = width;
+    buf.height = height;
+    return buf;
+}
+
+void Windows::overlay_window::clear()
+{
+    memset(buffer, 0, sizeof(df_screentile)*width*height);
+}
+
+bool Windows::overlay_window::swap()
+{
+    if(current_painter)
+        return false;
+
+    // the covered cells are listed here, on the producer's time
+    frame &done = frames[back];
+    done.cells.clear();
+    for(unsigned int i = 0; i < width*height; i++)
+    {
+        if(done.tiles[i].symbol)
+            done.cells.push_back(i);
+    }
+
+    tthread::lock_guard<tthread::mutex> lock(*swap_mutex);
+    std::swap(back, ready);
+    fresh = true;
+    // keep painting on top of the frame just published
+    memcpy(frames[back].tiles, frames[ready].tiles, sizeof(df_screentile)*width*height);
+    buffer = frames[back].tiles;
+    return true;
+}
+
+void Windows::overlay_window::paint ()
+{
+    int x, y;
+    {
+        tthread::lock_guard<tthread::mutex> lock(*swap_mutex);
+        if(fresh)
+        {
+            std::swap(front, ready);
+            fresh = false;
+        }
+        x = left = new_left;
+        y = top = new_top;
+    }
+
+    const frame &shown = frames[front];
+    if(shown.cells.empty() || !parent)
+        return;
+
+    df_tilebuf par = parent->getBuffer();
+    for(size_t i = 0; i < shown.cells.size(); i++)
+    {
+        unsigned int cell = shown.cells[i];
+        unsigned int parx = x + cell / height;
+        unsigned int pary = y + cell % height;
+        if(parx >= par.width || pary >= par.height)
+            continue;
+
+        const df_screentile &src = shown.tiles[cell];
+        df_screentile &dst = par.data[parx * par.height + pary];
+        if(memcmp(&dst, &src, sizeof(df_screentile)) != 0)
+            dst = src;
+    }
+}
@@ -28,6 +28,9 @@ distribution.
 #include <vector>
 #include <map>
 #include <cstring>
+#include <cstdio>
+#include <fstream>
+#include <sys/stat.h>
 using namespace std;
 
 #include "modules/World.h"
@@ -53,12 +56,25 @@ Module* DFHack::createWorld()
     return new World();
 }
 
+struct PersistentEntry
+{
+    int id;
+    std::string key;
+    std::string value;
+    int ints[PersistentDataItem::NumInts];
+};
+
 struct World::Private
 {
     Private()
     {
         Inited = PauseInited = StartedWeather = StartedMode = false;
-        next_persistent_id = 0;
+        persistent_loaded = persistent_file_exists = false;
+        next_persistent_id = -100;
+        save_stamp_valid = false;
+        save_size = save_mtime = 0;
+        last_save_check = 0;
+        batch_depth = 0;
     }
     bool Inited;
 
@@ -73,8 +89,38 @@ struct World::Private
     void * controlmode_offset;
     void * controlmodecopy_offset;
 
+    bool persistent_loaded;
+    bool persistent_file_exists;
+    std::string persistent_folder;
     int next_persistent_id;
+    std::map<int, PersistentEntry*> persistent_entries;
     std::multimap<std::string, int> persistent_index;
+    // Undo log of the open batches: the state of an entry before each
+    // change, or NULL for entries the batch added.
+    struct UndoRecord
+    {
+        int id;
+        PersistentEntry *old;
+    };
+    std::vector<UndoRecord> undo_log;
+    int batch_depth;
+    // world.sav as of the last time the table was in sync with the save
+    bool save_stamp_valid;
+    int64_t save_size, save_mtime;
+    uint64_t last_save_check;
+
+    typedef std::multimap<std::string, int>::iterator T_index_iter;
+    typedef std::pair<T_index_iter, T_index_iter> T_index_range;
+    T_index_range getPersistentRange(const std::string &key, bool prefix);
+    void insertPersistentEntry(PersistentEntry *entry);
+    void removePersistentEntry(int id);
+    void recordUndo(int id, PersistentEntry *entry);
+    void clearUndo(size_t mark);
+    bool loadPersistentFile(const std::string &fname);
+    bool migratePersistentFigures();
+    bool readSaveStamp(int64_t *size, int64_t *mtime);
+    bool gameWasSaved();
+    void savePersistentFile();
 
     Process * owner;
 };
@@ -107,6 +153,7 @@ World::World()
 
 World::~World()
 {
+    ClearPersistentCache();
     delete d;
 }
 
@@ -218,42 +265,341 @@ string World::ReadWorldFolder()
     return world->cur_savegame.save_dir;
 }
 
-static PersistentDataItem dataFromHFig(df::historical_figure *hfig)
+/*
+ * Persistent data store.
+ *
+ * Entries are kept in an id-ordered map with a key index on the side, and
+ * written to a compact binary file in the save folder whenever DF saves the
+ * game, so that the file always matches the savegame next to it. Saves are
+ * noticed by world.sav changing. Older versions stored entries as fake
+ * historical figures with ids <= -100; these are imported and removed from
+ * the figure vector, so they leave the savegame with the next save, which
+ * also writes them to the file.
+ */
+
+static const char persistent_magic[4] = { 'D', 'F', 'H', 'P' };
+static const uint32_t persistent_version = 1;
+
+static std::string persistentFileName(const std::string &folder)
+{
+    return "data/save/" + folder + "/dfhack-persistent.dat";
+}
+
+static std::string saveGameFileName(const std::string &folder)
+{
+    return "data/save/" + folder + "/world.sav";
+}
+
+static PersistentDataItem dataFromEntry(PersistentEntry *entry)
+{
+    return PersistentDataItem(entry->id, entry->key, &entry->value, entry->ints);
+}
+
+template<class T>
+static bool readRaw(std::istream &in, T *pval)
+{
+    return !!in.read((char*)pval, sizeof(T));
+}
+
+// end is the size of the file; a length past it means the data is corrupt
+static bool readString(std::istream &in, std::string *pval, std::streamoff end)
+{
+    uint32_t size;
+    if (!readRaw(in, &size))
+        return false;
+    std::streamoff pos = in.tellg();
+    if (pos < 0 || std::streamoff(size) > end - pos)
+        return false;
+    pval->resize(size);
+    return size == 0 || !!in.read(&(*pval)[0], size);
+}
+
+template<class T>
+static void writeRaw(std::ostream &out, const T &val)
+{
+    out.write((const char*)&val, sizeof(T));
+}
+
+static void writeString(std::ostream &out, const std::string &val)
+{
+    writeRaw(out, uint32_t(val.size()));
+    out.write(val.data(), val.size());
+}
+
+void World::Private::insertPersistentEntry(PersistentEntry *entry)
+{
+    persistent_entries[entry->id] = entry;
+    persistent_index.insert(T_persistent_item(entry->key, -entry->id));
+
+    if (entry->id <= next_persistent_id)
+        next_persistent_id = entry->id-1;
+}
+
+void World::Private::removePersistentEntry(int id)
+{
+    auto entry = persistent_entries.find(id);
+    if (entry == persistent_entries.end())
+        return;
+
+    auto eqrange = persistent_index.equal_range(entry->second->key);
+    for (auto it = eqrange.first; it != eqrange.second; ++it)
+    {
+        if (it->second == -id)
+        {
+            persistent_index.erase(it);
+            break;
+        }
+    }
+
+    delete entry->second;
+    persistent_entries.erase(entry);
+}
+
+// entry is the one about to change, or NULL if it is being added
+void World::Private::recordUndo(int id, PersistentEntry *entry)
+{
+    if (!batch_depth)
+        return;
+
+    UndoRecord rec;
+    rec.id = id;
+    rec.old = entry ? new PersistentEntry(*entry) : NULL;
+    undo_log.push_back(rec);
+}
+
+void World::Private::clearUndo(size_t mark)
+{
+    for (size_t i = mark; i < undo_log.size(); i++)
+        delete undo_log[i].old;
+    undo_log.resize(mark);
+}
+
+bool World::Private::loadPersistentFile(const std::string &fname)
+{
+    std::ifstream in(fname.c_str(), std::ios::in | std::ios::binary);
+    if (!in.good())
+        return false;
+
+    in.seekg(0, std::ios::end);
+    std::streamoff end = in.tellg();
+    in.seekg(0, std::ios::beg);
+
+    char magic[4];
+    uint32_t version, count;
+
+    if (!readRaw(in, &magic) || memcmp(magic, persistent_magic, sizeof(magic)) != 0 ||
+        !readRaw(in, &version) || version != persistent_version ||
+        !readRaw(in, &count))
+    {
+        cerr << "Invalid persistent data file: " << fname << endl;
+        return false;
+    }
+
+    // Read everything first, so that a corrupt file is rejected as a whole
+    std::vector<PersistentEntry*> loaded;
+    bool ok = true;
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        PersistentEntry *entry = new PersistentEntry();
+        loaded.push_back(entry);
+
+        if (!readRaw(in, &entry->id) || !readString(in, &entry->key, end) ||
+            !readString(in, &entry->value, end) || !readRaw(in, &entry->ints))
+        {
+            cerr << "Corrupt persistent data file: " << fname << endl;
+            ok = false;
+            break;
+        }
+    }
+
+    for (size_t i = 0; i < loaded.size(); i++)
+    {
+        PersistentEntry *entry = loaded[i];
+
+        if (!ok || entry->id > -100 || entry->key.empty() || persistent_entries.count(entry->id))
+        {
+            delete entry;
+            continue;
+        }
+
+        insertPersistentEntry(entry);
+    }
+
+    return ok;
+}
+
+bool World::Private::migratePersistentFigures()
 {
-    return PersistentDataItem(hfig->id, hfig->name.first_name, &hfig->name.nickname, hfig->name.words);
+    std::vector<df::historical_figure*> &hfvec = df::historical_figure::get_vector();
+
+    // The fake figures are sorted in front of all real ones
+    size_t count = 0;
+    for (; count < hfvec.size() && hfvec[count]->id <= -100; count++)
+    {
+        df::historical_figure *hfig = hfvec[count];
+        if (!hfig->name.has_name || hfig->name.first_name.empty())
+            continue;
+
+        PersistentEntry *entry = new PersistentEntry();
+        entry->id = hfig->id;
+        entry->key = hfig->name.first_name;
+        entry->value = hfig->name.nickname;
+        memcpy(entry->ints, hfig->name.words, sizeof(entry->ints));
+
+        // Already migrated, but the game wasn't saved since
+        if (persistent_entries.count(entry->id))
+        {
+            delete entry;
+            continue;
+        }
+
+        insertPersistentEntry(entry);
+    }
+
+    if (!count)
+        return false;
+
+    for (size_t i = 0; i < count; i++)
+        delete hfvec[i];
+    hfvec.erase(hfvec.begin(), hfvec.begin()+count);
+
+    return true;
+}
+
+bool World::Private::readSaveStamp(int64_t *size, int64_t *mtime)
+{
+    struct stat st;
+    if (persistent_folder.empty() ||
+        stat(saveGameFileName(persistent_folder).c_str(), &st) != 0)
+        return false;
+    *size = st.st_size;
+    *mtime = st.st_mtime;
+    return true;
+}
+
+bool World::Private::gameWasSaved()
+{
+    // Without a savegame to watch, fall back to writing every time
+    if (!save_stamp_valid)
+        return true;
+
+    int64_t size, mtime;
+    if (!readSaveStamp(&size, &mtime))
+        return false;
+    return size != save_size || mtime != save_mtime;
+}
+
+void World::SavePersistentData()
+{
+    if (d->persistent_loaded && d->gameWasSaved())
+        d->savePersistentFile();
+}
+
+void World::CheckPersistentSave()
+{
+    if (!d->persistent_loaded || !d->save_stamp_valid)
+        return;
+
+    // a stat() per second is plenty to catch saves, autosaves included
+    uint64_t now = GetTimeMs64();
+    if (now - d->last_save_check < 1000)
+        return;
+    d->last_save_check = now;
+
+    SavePersistentData();
+}
+
+void World::Private::savePersistentFile()
+{
+    if (persistent_folder.empty())
+        return;
+
+    // Don't create a file for worlds that never used the store
+    if (persistent_entries.empty() && !persistent_file_exists)
+        return;
+
+    std::string fname = persistentFileName(persistent_folder);
+    std::string tmpname = fname + ".tmp";
+    {
+        std::ofstream out(tmpname.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+        if (!out.good())
+        {
+            cerr << "Could not write persistent data: " << fname << endl;
+            return;
+        }
+
+        out.write(persistent_magic, sizeof(persistent_magic));
+        writeRaw(out, persistent_version);
+        writeRaw(out, uint32_t(persistent_entries.size()));
+
+        for (auto it = persistent_entries.begin(); it != persistent_entries.end(); ++it)
+        {
+            PersistentEntry *entry = it->second;
+            writeRaw(out, entry->id);
+            writeString(out, entry->key);
+            writeString(out, entry->value);
+            writeRaw(out, entry->ints);
+        }
+
+        if (!out.good())
+        {
+            cerr << "Could not write persistent data: " << fname << endl;
+            return;
+        }
+    }
+
+    remove(fname.c_str());
+    if (rename(tmpname.c_str(), fname.c_str()) != 0)
+    {
+        cerr << "Could not replace persistent data: " << fname << endl;
+        return;
+    }
+
+    persistent_file_exists = true;
+    if (save_stamp_valid)
+        save_stamp_valid = readSaveStamp(&save_size, &save_mtime);
 }
 
 void World::ClearPersistentCache()
 {
-    d->next_persistent_id = 0;
+    SavePersistentData();
+
+    for (auto it = d->persistent_entries.begin(); it != d->persistent_entries.end(); ++it)
+        delete it->second;
+    d->clearUndo(0);
+
+    d->persistent_loaded = false;
+    d->persistent_file_exists = false;
+    d->persistent_folder.clear();
+    d->next_persistent_id = -100;
+    d->save_stamp_valid = false;
+    d->persistent_entries.clear();
     d->persistent_index.clear();
 }
 
 bool World::BuildPersistentCache()
 {
-    if (d->next_persistent_id)
+    if (d->persistent_loaded)
         return true;
     if (!Core::getInstance().isWorldLoaded())
         return false;
 
-    std::vector<df::historical_figure*> &hfvec = df::historical_figure::get_vector();
-
-    // Determine the next entry id as min(-100, lowest_id-1)
+    d->persistent_loaded = true;
+    d->persistent_folder = ReadWorldFolder();
     d->next_persistent_id = -100;
 
-    if (hfvec.size() > 0 && hfvec[0]->id <= -100)
-        d->next_persistent_id = hfvec[0]->id-1;
+    if (!d->persistent_folder.empty())
+        d->persistent_file_exists = d->loadPersistentFile(persistentFileName(d->persistent_folder));
 
-    // Add the entries to the lookup table
-    d->persistent_index.clear();
+    d->save_stamp_valid = d->readSaveStamp(&d->save_size, &d->save_mtime);
+    d->last_save_check = GetTimeMs64();
 
-    for (size_t i = 0; i < hfvec.size() && hfvec[i]->id <= -100; i++)
-    {
-        if (!hfvec[i]->name.has_name || hfvec[i]->name.first_name.empty())
-            continue;
+    // Pull in entries stored by older versions. They are written out with
+    // the next save, which is also the first one without the figures.
+    d->migratePersistentFigures();
 
-        d->persistent_index.insert(T_persistent_item(hfvec[i]->name.first_name, -hfvec[i]->id));
-    }
+    return true;
 }
 
 PersistentDataItem World::AddPersistentData(const std::string &key)
@@ -261,19 +607,15 @@ PersistentDataItem World::AddPersistentData(const std::string &key)
     if (!BuildPersistentCache() || key.empty())
         return PersistentDataItem();
 
-    std::vector<df::historical_figure*> &hfvec = df::historical_figure::get_vector();
-
-    df::historical_figure *hfig = new df::historical_figure();
-    hfig->id = d->next_persistent_id--;
-    hfig->name.has_name = true;
-    hfig->name.first_name = key;
-    memset(hfig->name.words, 0xFF, sizeof(hfig->name.words));
-
-    hfvec.insert(hfvec.begin(), hfig);
+    PersistentEntry *entry = new PersistentEntry();
+    entry->id = d->next_persistent_id;
+    entry->key = key;
+    memset(entry->ints, 0xFF, sizeof(entry->ints));
 
-    d->persistent_index.insert(T_persistent_item(key, -hfig->id));
+    d->recordUndo(entry->id, NULL);
+    d->insertPersistentEntry(entry);
 
-    return dataFromHFig(hfig);
+    return dataFromEntry(entry);
 }
 
 PersistentDataItem World::GetPersistentData(const std::string &key)
@@ -292,45 +634,45 @@ PersistentDataItem World::GetPersistentData(int entry_id)
 {
     if (entry_id < 100)
         return PersistentDataItem();
+    if (!BuildPersistentCache())
+        return PersistentDataItem();
 
-    auto hfig = df::historical_figure::find(-entry_id);
-    if (hfig && hfig->name.has_name)
-        return dataFromHFig(hfig);
+    auto it = d->persistent_entries.find(-entry_id);
+    if (it != d->persistent_entries.end())
+        return dataFromEntry(it->second);
 
     return PersistentDataItem();
 }
 
+World::Private::T_index_range World::Private::getPersistentRange(const std::string &key, bool prefix)
+{
+    if (!prefix)
+        return persistent_index.equal_range(key);
+
+    if (key.empty())
+        return T_index_range(persistent_index.begin(), persistent_index.end());
+
+    std::string bound = key;
+    if (bound[bound.size()-1] != '/')
+        bound += "/";
+    auto first = persistent_index.lower_bound(bound);
+
+    bound[bound.size()-1]++;
+    return T_index_range(first, persistent_index.lower_bound(bound));
+}
+
 void World::GetPersistentData(std::vector<PersistentDataItem> *vec, const std::string &key, bool prefix)
 {
     if (!BuildPersistentCache())
         return;
 
-    auto eqrange = d->persistent_index.equal_range(key);
-
-    if (prefix)
-    {
-        if (key.empty())
-        {
-            eqrange.first = d->persistent_index.begin();
-            eqrange.second = d->persistent_index.end();
-        }
-        else
-        {
-            std::string bound = key;
-            if (bound[bound.size()-1] != '/')
-                bound += "/";
-            eqrange.first = d->persistent_index.lower_bound(bound);
-
-            bound[bound.size()-1]++;
-            eqrange.second = d->persistent_index.lower_bound(bound);
-        }
-    }
+    auto eqrange = d->getPersistentRange(key, prefix);
 
     for (auto it = eqrange.first; it != eqrange.second; ++it)
     {
-        auto hfig = df::historical_figure::find(-it->second);
-        if (hfig && hfig->name.has_name)
-            vec->push_back(dataFromHFig(hfig));
+        auto entry = d->persistent_entries.find(-it->second);
+        if (entry != d->persistent_entries.end())
+            vec->push_back(dataFromEntry(entry->second));
     }
 }
 
@@ -341,8 +683,6 @@ bool World::DeletePersistentData(const PersistentDataItem &item)
     if (!BuildPersistentCache())
         return false;
 
-    std::vector<df::historical_figure*> &hfvec = df::historical_figure::get_vector();
-
     auto eqrange = d->persistent_index.equal_range(item.key_value);
 
     for (auto it = eqrange.first; it != eqrange.second; ++it)
@@ -352,11 +692,12 @@ bool World::DeletePersistentData(const PersistentDataItem &item)
 
         d->persistent_index.erase(it);
 
-        int idx = binsearch_index(hfvec, item.id);
-
-        if (idx >= 0) {
-            delete hfvec[idx];
-            hfvec.erase(hfvec.begin()+idx);
+        auto entry = d->persistent_entries.find(item.id);
+        if (entry != d->persistent_entries.end())
+        {
+            d->recordUndo(item.id, entry->second);
+            delete entry->second;
+            d->persistent_entries.erase(entry);
         }
 
         return true;
@@ -364,3 +705,72 @@ bool World::DeletePersistentData(const PersistentDataItem &item)
 
     return false;
 }
+
+int World::DeletePersistentData(const std::string &key, bool prefix)
+{
+    if (!BuildPersistentCache())
+        return 0;
+
+    auto eqrange = d->getPersistentRange(key, prefix);
+    int count = 0;
+
+    for (auto it = eqrange.first; it != eqrange.second; ++it, ++count)
+    {
+        auto entry = d->persistent_entries.find(-it->second);
+        if (entry != d->persistent_entries.end())
+        {
+            d->recordUndo(entry->first, entry->second);
+            delete entry->second;
+            d->persistent_entries.erase(entry);
+        }
+    }
+
+    d->persistent_index.erase(eqrange.first, eqrange.second);
+    return count;
+}
+
+void World::PreparePersistentChange(const PersistentDataItem &item)
+{
+    auto entry = d->persistent_entries.find(item.id);
+    if (entry != d->persistent_entries.end())
+        d->recordUndo(item.id, entry->second);
+}
+
+size_t World::BeginPersistentBatch()
+{
+    d->batch_depth++;
+    return d->undo_log.size();
+}
+
+void World::EndPersistentBatch(size_t mark, bool commit)
+{
+    if (d->batch_depth <= 0)
+        return;
+    d->batch_depth--;
+
+    // the store may have been dropped and rebuilt in between
+    if (mark > d->undo_log.size())
+        return;
+
+    if (!commit)
+    {
+        // newest first, so each entry ends up as it was at the mark
+        for (size_t i = d->undo_log.size(); i > mark; i--)
+        {
+            Private::UndoRecord &rec = d->undo_log[i-1];
+
+            d->removePersistentEntry(rec.id);
+            if (rec.old)
+            {
+                d->insertPersistentEntry(rec.old);
+                rec.old = NULL;
+            }
+            else
+                d->next_persistent_id = rec.id;
+        }
+    }
+
+    // an outer batch may still need to undo these
+    if (!commit || d->batch_depth == 0)
+        d->clearUndo(mark);
+}
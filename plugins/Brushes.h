@@ -1,11 +1,104 @@
 #pragma once
+#include "modules/FloodFill.h"
+#include <algorithm>
+#include <map>
 
 typedef vector <df::coord> coord_vec;
+
+/**
+ * The tiles of one map block touched by a brush.
+ * Bit x of mask[y] is set for every selected tile (x,y) of the block.
+ */
+struct BrushBlock
+{
+    MapExtras::Block *block;
+    DFHack::DFCoord bcoord;
+    uint16_t mask[16];
+
+    BrushBlock(MapExtras::Block *block, DFHack::DFCoord bcoord)
+        : block(block), bcoord(bcoord)
+    {
+        memset(mask, 0, sizeof(mask));
+    }
+    void set(df::coord2d p)
+    {
+        mask[p.y] |= uint16_t(1 << p.x);
+    }
+    bool test(df::coord2d p) const
+    {
+        return (mask[p.y] & (1 << p.x)) != 0;
+    }
+    DFHack::DFCoord tile(df::coord2d p) const
+    {
+        return DFHack::DFCoord(bcoord.x*16 + p.x, bcoord.y*16 + p.y, bcoord.z);
+    }
+};
+
+/**
+ * Receives the output of a brush, one map block at a time.
+ * Blocks are always valid and each is passed at most once per brush application,
+ * so a visitor may drop a block from the cache once it is done with it.
+ */
+class BrushVisitor
+{
+public:
+    virtual ~BrushVisitor(){};
+    virtual void visit(BrushBlock &blk) = 0;
+};
+
+/**
+ * Passes each block on to another visitor, then writes it back and drops
+ * it from the cache, so that painting a large area doesn't keep every
+ * block it touched in memory.
+ */
+class WriteBackVisitor : public BrushVisitor
+{
+public:
+    WriteBackVisitor(MapExtras::MapCache & mc, BrushVisitor &inner)
+        : mc(mc), inner(inner), ok(true) {}
+    void visit(BrushBlock &blk)
+    {
+        inner.visit(blk);
+        if (!mc.WriteBlock(blk.bcoord))
+            ok = false;
+    }
+    /// false if any block failed to write
+    bool written() const { return ok; }
+private:
+    MapExtras::MapCache & mc;
+    BrushVisitor &inner;
+    bool ok;
+};
+
 class Brush
 {
 public:
     virtual ~Brush(){};
-    virtual coord_vec points(MapExtras::MapCache & mc,DFHack::DFCoord start) = 0;
+    /// stream the brush area to the visitor, grouped by map block
+    virtual void blocks(MapExtras::MapCache & mc, DFHack::DFCoord start, BrushVisitor &visitor) = 0;
+    /// the brush area as a list of coordinates
+    coord_vec points(MapExtras::MapCache & mc, DFHack::DFCoord start)
+    {
+        struct Collect : BrushVisitor
+        {
+            coord_vec v;
+            void visit(BrushBlock &blk)
+            {
+                for (int16_t y = 0; y < 16; y++)
+                    for (int16_t x = 0; x < 16; x++)
+                        if (blk.test(df::coord2d(x,y)))
+                            v.push_back(blk.tile(df::coord2d(x,y)));
+            }
+        } collect;
+        blocks(mc, start, collect);
+        return collect.v;
+    }
+protected:
+    static MapExtras::Block *validBlock(MapExtras::MapCache & mc, DFHack::DFCoord bcoord)
+    {
+        MapExtras::Block *b = mc.BlockAt(bcoord);
+        return (b && b->valid) ? b : NULL;
+    }
 };
 /**
  * generic 3D rectangle brush. you can specify the dimensions of
@@ -32,28 +125,40 @@ public:
         y_ = y;
         z_ = z;
     };
-    coord_vec points(MapExtras::MapCache & mc, DFHack::DFCoord start)
+    void blocks(MapExtras::MapCache & mc, DFHack::DFCoord start, BrushVisitor &visitor)
     {
-        coord_vec v;
-        DFHack::DFCoord iterstart(start.x - cx_, start.y - cy_, start.z - cz_);
-        DFHack::DFCoord iter = iterstart;
-        for(int xi = 0; xi < x_; xi++)
+        int x1 = start.x - cx_, x2 = x1 + x_ - 1;
+        int y1 = start.y - cy_, y2 = y1 + y_ - 1;
+        int z1 = start.z - cz_, z2 = z1 + z_ - 1;
+
+        // only the parts of the rectangle that are on the map
+        x1 = std::max(x1, 0);
+        y1 = std::max(y1, 0);
+        z1 = std::max(z1, 0);
+        if (x2 < x1 || y2 < y1 || z2 < z1)
+            return;
+
+        for (int z = z1; z <= z2; z++)
         {
-            for(int yi = 0; yi < y_; yi++)
+            for (int by = y1 >> 4; by <= y2 >> 4; by++)
             {
-                for(int zi = 0; zi < z_; zi++)
+                for (int bx = x1 >> 4; bx <= x2 >> 4; bx++)
                 {
-                    if(mc.testCoord(iter))
-                        v.push_back(iter);
-                    iter.z++;
+                    DFHack::DFCoord bcoord(bx, by, z);
+                    MapExtras::Block *b = validBlock(mc, bcoord);
+                    if (!b)
+                        continue;
+
+                    BrushBlock blk(b, bcoord);
+                    int lx1 = std::max(x1 - bx*16, 0), lx2 = std::min(x2 - bx*16, 15);
+                    int ly1 = std::max(y1 - by*16, 0), ly2 = std::min(y2 - by*16, 15);
+                    uint16_t row = uint16_t(((1 << (lx2 + 1)) - 1) & ~((1 << lx1) - 1));
+                    for (int ly = ly1; ly <= ly2; ly++)
+                        blk.mask[ly] = row;
+                    visitor.visit(blk);
                 }
-                iter.z = iterstart.z;
-                iter.y++;
             }
-            iter.y = iterstart.y;
-            iter.x ++;
         }
-        return v;
     };
     ~RectangleBrush(){};
 private:
@@ -69,25 +174,15 @@ class BlockBrush : public Brush
 public:
     BlockBrush(){};
     ~BlockBrush(){};
-    coord_vec points(MapExtras::MapCache & mc, DFHack::DFCoord start)
+    void blocks(MapExtras::MapCache & mc, DFHack::DFCoord start, BrushVisitor &visitor)
     {
-        coord_vec v;
         DFHack::DFCoord blockc = start / 16;
-        DFHack::DFCoord iterc = blockc * 16;
-        if( !mc.testCoord(start) )
-            return v;
-        auto starty = iterc.y;
-        for(int xi = 0; xi < 16; xi++)
-        {
-            for(int yi = 0; yi < 16; yi++)
-            {
-                v.push_back(iterc);
-                iterc.y++;
-            }
-            iterc.y = starty;
-            iterc.x ++;
-        }
-        return v;
+        MapExtras::Block *b = validBlock(mc, blockc);
+        if (!b)
+            return;
+        BrushBlock blk(b, blockc);
+        memset(blk.mask, 0xFF, sizeof(blk.mask));
+        visitor.visit(blk);
     };
 };
 
@@ -100,22 +195,23 @@ class ColumnBrush : public Brush
 public:
     ColumnBrush(){};
     ~ColumnBrush(){};
-    coord_vec points(MapExtras::MapCache & mc, DFHack::DFCoord start)
+    void blocks(MapExtras::MapCache & mc, DFHack::DFCoord start, BrushVisitor &visitor)
     {
-        coord_vec v;
         bool juststarted = true;
-        while (mc.testCoord(start))
+        while (MapExtras::Block *b = validBlock(mc, start / 16))
         {
-            df::tiletype tt = mc.tiletypeAt(start);
+            df::coord2d local = start % 16;
+            df::tiletype tt = b->TileTypeAt(local);
             if(DFHack::LowPassable(tt) || juststarted && DFHack::HighPassable(tt))
             {
-                v.push_back(start);
+                BrushBlock blk(b, start / 16);
+                blk.set(local);
+                visitor.visit(blk);
                 juststarted = false;
                 start.z++;
             }
             else break;
         }
-        return v;
     };
 };
 
@@ -128,51 +224,46 @@ class FloodBrush : public Brush
 public:
     FloodBrush(Core *c){c_ = c;};
     ~FloodBrush(){};
-    coord_vec points(MapExtras::MapCache & mc, DFHack::DFCoord start)
+    void blocks(MapExtras::MapCache & mc, DFHack::DFCoord start, BrushVisitor &visitor)
     {
-        coord_vec v;
-
-        std::stack<DFCoord> to_flood;
-        to_flood.push(start);
-
-        std::set<DFCoord> seen;
-
-        while (!to_flood.empty()) {
-            DFCoord xy = to_flood.top();
-            to_flood.pop();
-
-                        df::tile_designation des = mc.designationAt(xy);
-
-            if (seen.find(xy) == seen.end()
-                            && des.bits.flow_size
-                            && des.bits.liquid_type == tile_liquid::Water) {
-                v.push_back(xy);
-                seen.insert(xy);
+        // The whole area has to be known before anything is changed, since
+        // visitors may well drain the water the flood is following.
+        WaterFill fill;
+        MapExtras::FloodFill flood(mc);
+        flood.run(start, fill);
 
-                maybeFlood(DFCoord(xy.x - 1, xy.y, xy.z), to_flood, mc);
-                maybeFlood(DFCoord(xy.x + 1, xy.y, xy.z), to_flood, mc);
-                maybeFlood(DFCoord(xy.x, xy.y - 1, xy.z), to_flood, mc);
-                maybeFlood(DFCoord(xy.x, xy.y + 1, xy.z), to_flood, mc);
-
-                df::tiletype tt = mc.tiletypeAt(xy);
-                if (LowPassable(tt))
-                {
-                    maybeFlood(DFCoord(xy.x, xy.y, xy.z - 1), to_flood, mc);
-                }
-                if (HighPassable(tt))
-                {
-                    maybeFlood(DFCoord(xy.x, xy.y, xy.z + 1), to_flood, mc);
-                }
-            }
-        }
-
-        return v;
+        for (auto it = fill.blocks.begin(); it != fill.blocks.end(); ++it)
+            visitor.visit(it->second);
     }
 private:
-    void maybeFlood(DFCoord c, std::stack<DFCoord> &to_flood, MapExtras::MapCache &mc) {
-        if (mc.testCoord(c)) {
-            to_flood.push(c);
+    struct WaterFill
+    {
+        std::map<DFHack::DFCoord, BrushBlock> blocks;
+
+        bool inside(MapExtras::Block *b, df::coord2d p, DFCoord)
+        {
+            df::tile_designation des = b->DesignationAt(p);
+            return des.bits.flow_size && des.bits.liquid_type == tile_liquid::Water;
         }
-    }
+        void visit(MapExtras::Block *b, df::coord2d p, DFCoord c, MapExtras::FloodDirection)
+        {
+            DFHack::DFCoord bcoord = c / 16;
+            auto it = blocks.find(bcoord);
+            if (it == blocks.end())
+                it = blocks.insert(std::make_pair(bcoord, BrushBlock(b, bcoord))).first;
+            it->second.set(p);
+        }
+        int vertical(MapExtras::Block *b, df::coord2d p, DFCoord)
+        {
+            df::tiletype tt = b->TileTypeAt(p);
+            int dirs = 0;
+            if (LowPassable(tt))
+                dirs |= MapExtras::FLOOD_DOWN;
+            if (HighPassable(tt))
+                dirs |= MapExtras::FLOOD_UP;
+            return dirs;
+        }
+        void border(MapExtras::Block *, df::coord2d, DFCoord, MapExtras::FloodDirection) {}
+    };
     Core *c_;
 };
@@ -3,8 +3,9 @@
 #include <vector>
 #include "Core.h" //for some reason process.h needs core
 #include "MemAccess.h"
+#include "MemScan.h"
 
-//(not yet)implemented using Boyer-Moore algorithm
+//searches using DFHack::MemScan, which is also where the wildcards are handled
 
 class Hexsearch
 {
@@ -18,20 +19,20 @@ public:
 	Hexsearch(const SearchArgType &args,char * startpos,char * endpos);
 	~Hexsearch();
 
-	void Reset(){pos_=startpos_;};
-	void SetStart(char * pos){pos_=pos;};
+	void Reset(){pos_=startpos_;snapshot_valid_=false;};
+	void SetStart(char * pos){pos_=pos;snapshot_valid_=false;};
 
 	void * FindNext();
 	std::vector<void *> FindAll();
 	
 private:
-	bool Compare(int a,int b);
 	void ReparseArgs();
+	void TakeSnapshot();
 	SearchArgType args_;
 	char * pos_,* startpos_,* endpos_;
-	std::vector<int> BadCharShifts,GoodSuffixShift;
-	void PrepareGoodSuffixTable();
-	void PrepareBadCharShift();
+	DFHack::MemScan::Pattern pattern_;
+	DFHack::MemScan::Snapshot snapshot_;
+	bool snapshot_valid_;
 };
 
 #endif
\ No newline at end of file
@@ -1,116 +1,84 @@
 #include "hexsearch.h"
 
 
-Hexsearch::Hexsearch(const SearchArgType &args,char * startpos,char * endpos):args_(args),pos_(startpos),startpos_(startpos),endpos_(endpos)
+Hexsearch::Hexsearch(const SearchArgType &args,char * startpos,char * endpos):args_(args),pos_(startpos),startpos_(startpos),endpos_(endpos),snapshot_valid_(false)
 {
 	ReparseArgs();
 }
 Hexsearch::~Hexsearch()
 {
 
-}
-inline bool Hexsearch::Compare(int a,int b)
-{
-	if(b==Hexsearch::ANYBYTE)
-		return true;
-	if(a==b)
-		return true;
-	return false;
 }
 void Hexsearch::ReparseArgs()
 {
-	union
-	{
-		uint32_t val;
-		uint8_t bytes[4];
-	}B;
-	SearchArgType targ;
-	targ=args_;
-	args_.clear();
+	const SearchArgType &targ=args_;
 	for(size_t i=0;i<targ.size();)
 	{
 		if(targ[i]==DWORD_)
 		{
 			i++;
-			B.val=targ[i];
-			for(int j=0;j<4;j++)
-			{
-				args_.push_back(B.bytes[j]);
-			}
+			if(i<targ.size())
+				pattern_.addDWord(targ[i]);
 			i++;
 		}
 		else if (targ[i]==ANYDWORD)
 		{
 			i++;
-			for(int j=0;j<4;j++)
-				args_.push_back(ANYBYTE);
+			pattern_.addAny(4);
+		}
+		else if (targ[i]==ANYBYTE)
+		{
+			pattern_.addAny();
+			i++;
 		}
 		else
 		{
-			args_.push_back(targ[i]);
+			pattern_.addByte(targ[i]);
 			i++;
 		}
 	}
 }
-void * Hexsearch::FindNext() //TODO rewrite using Boyer-Moore algorithm
+void Hexsearch::TakeSnapshot()
 {
+	// only the readable parts of the range, the rest can't match anyway
 	DFHack::Core &inst=DFHack::Core::getInstance();
-	DFHack::Process *p=inst.p;
-	uint8_t *buf;
-	buf=new uint8_t[args_.size()];
-	while(pos_<endpos_)
+	snapshot_.capture(inst.p);
+	snapshot_.clip(startpos_,endpos_);
+	snapshot_valid_=true;
+}
+void * Hexsearch::FindNext()
+{
+	if(pos_>=endpos_)
+		return 0;
+	if(!snapshot_valid_)
+		TakeSnapshot();
+	char * found=(char *)DFHack::MemScan::findFirst(snapshot_,pattern_,pos_);
+	if(!found)
 	{
-		bool found=true;
-		p->readByte(pos_,buf[0]);
-		if(Compare(buf[0],args_[0])) 
-		{
-			p->read(pos_,args_.size(),buf);
-			for(size_t i=0;i<args_.size();i++)
-			{
-				if(!Compare(buf[i],args_[i]))
-				{
-					pos_+=i;
-					found=false;
-					break;
-				}
-			}
-			if(found)
-			{
-				pos_+=args_.size();
-				delete [] buf;
-				return pos_-args_.size();
-			}
-		}
-		pos_ = pos_ + 1;
+		pos_=endpos_;
+		return 0;
 	}
-	delete [] buf;
-	return 0;
+	pos_=found+pattern_.size();
+	return found;
 }
 
 std::vector<void *> Hexsearch::FindAll()
 {
 	std::vector<void *> ret;
-	void * cpos=pos_;
-	while(cpos!=0)
+	if(pos_>=endpos_)
+		return ret;
+	if(!snapshot_valid_)
+		TakeSnapshot();
+	std::vector<void *> found;
+	DFHack::MemScan::findAll(found,snapshot_,pattern_);
+	// same as calling FindNext until the end: matches from pos_ on, not overlapping
+	for(size_t i=0;i<found.size();i++)
 	{
-		cpos=FindNext();
-		if(cpos!=0)
-			ret.push_back(cpos);
+		if((char *)found[i]<pos_)
+			continue;
+		ret.push_back(found[i]);
+		pos_=(char *)found[i]+pattern_.size();
 	}
+	pos_=endpos_;
 	return ret;
 }
-void Hexsearch::PrepareBadCharShift()
-{
-	BadCharShifts.resize(256,-1);
-	int i=0;
-	for(SearchArgType::reverse_iterator it=args_.rbegin();it!=args_.rend();it++)
-	{
-		BadCharShifts[*it]=i;
-		i++;
-	}
-}
-void Hexsearch::PrepareGoodSuffixTable()
-{
-	GoodSuffixShift.resize(args_.size()+1,0);
-
-}
\ No newline at end of file
@@ -0,0 +1,220 @@
+#pragma once
+#include <vector>
+#include <deque>
+#include <algorithm>
+#include <climits>
+
+/**
+ * Min-cost max-flow on a small graph.
+ *
+ * Shortest paths are found with SPFA, so edge costs may be negative. The
+ * solver can be warm-started by pushing flow along known paths first; any
+ * negative cycles this leaves in the residual graph are cancelled before
+ * augmenting, which keeps the result optimal. All work is done in bounded
+ * steps so that a solve can be spread over several frames.
+ */
+class MinCostFlow
+{
+public:
+    MinCostFlow() : source(-1), sink(-1), need_cancel(false), searches(0) {}
+
+    void reset(int nodes, int s, int t)
+    {
+        edges.clear();
+        adj.assign(nodes, std::vector<int>());
+        source = s;
+        sink = t;
+        need_cancel = false;
+        searches = 0;
+    }
+
+    /// adds an edge and returns its id
+    int addEdge(int from, int to, int cap, int cost)
+    {
+        int id = int(edges.size());
+        edges.push_back(Edge(to, cap, cost));
+        edges.push_back(Edge(from, 0, -cost));
+        adj[from].push_back(id);
+        adj[to].push_back(id+1);
+        return id;
+    }
+
+    int flow(int edge) const { return edges[edge^1].cap; }
+    int residual(int edge) const { return edges[edge].cap; }
+
+    /// push one unit along a chain of edges, if they all have room for it
+    bool pushPath(const std::vector<int> &path)
+    {
+        for (size_t i = 0; i < path.size(); i++)
+            if (edges[path[i]].cap <= 0)
+                return false;
+
+        for (size_t i = 0; i < path.size(); i++)
+            push(path[i], 1);
+
+        need_cancel = true;
+        return true;
+    }
+
+    /**
+     * Do up to budget path searches. Returns true when the flow is maximal
+     * and of minimum cost; false if the budget ran out first.
+     */
+    bool step(int &budget)
+    {
+        while (budget > 0)
+        {
+            budget--;
+            searches++;
+
+            if (need_cancel)
+            {
+                if (!cancelCycle())
+                    need_cancel = false;
+                continue;
+            }
+
+            if (!augment())
+                return true;
+        }
+        return false;
+    }
+
+    /// path searches done since the last reset
+    int searchCount() const { return searches; }
+
+private:
+    struct Edge
+    {
+        int to;
+        int cap;
+        int cost;
+        Edge(int to, int cap, int cost) : to(to), cap(cap), cost(cost) {}
+    };
+
+    std::vector<Edge> edges;
+    std::vector<std::vector<int> > adj;
+    int source, sink;
+    bool need_cancel;
+    int searches;
+
+    std::vector<long long> dist;
+    std::vector<int> pred;
+    std::vector<int> length;
+    std::vector<char> queued;
+
+    int from(int edge) const { return edges[edge^1].to; }
+
+    void push(int edge, int amount)
+    {
+        edges[edge].cap -= amount;
+        edges[edge^1].cap += amount;
+    }
+
+    /*
+     * SPFA from the given start nodes. Returns -1 if done, or a node whose
+     * shortest path got at least as long as the node count, which means it
+     * leads through a negative cycle.
+     */
+    int relax(const std::vector<int> &start)
+    {
+        int n = int(adj.size());
+        dist.assign(n, LLONG_MAX);
+        pred.assign(n, -1);
+        length.assign(n, 0);
+        queued.assign(n, 0);
+
+        std::deque<int> queue;
+        for (size_t i = 0; i < start.size(); i++)
+        {
+            dist[start[i]] = 0;
+            queued[start[i]] = 1;
+            queue.push_back(start[i]);
+        }
+
+        while (!queue.empty())
+        {
+            int u = queue.front();
+            queue.pop_front();
+            queued[u] = 0;
+
+            for (size_t i = 0; i < adj[u].size(); i++)
+            {
+                int e = adj[u][i];
+                const Edge &edge = edges[e];
+                if (edge.cap <= 0 || dist[u] + edge.cost >= dist[edge.to])
+                    continue;
+
+                dist[edge.to] = dist[u] + edge.cost;
+                pred[edge.to] = e;
+                length[edge.to] = length[u] + 1;
+                if (length[edge.to] >= n)
+                    return edge.to;
+
+                if (!queued[edge.to])
+                {
+                    queued[edge.to] = 1;
+                    queue.push_back(edge.to);
+                }
+            }
+        }
+        return -1;
+    }
+
+    bool cancelCycle()
+    {
+        std::vector<int> all(adj.size());
+        for (size_t i = 0; i < all.size(); i++)
+            all[i] = int(i);
+
+        int v = relax(all);
+        if (v < 0)
+            return false;
+
+        // walk back far enough to be on the cycle itself; a chain that
+        // ends at a start node means there was no cycle after all
+        for (size_t i = 0; i < adj.size(); i++)
+        {
+            if (pred[v] < 0)
+                return false;
+            v = from(pred[v]);
+        }
+
+        int amount = INT_MAX;
+        int u = v;
+        do {
+            if (pred[u] < 0)
+                return false;
+            amount = std::min(amount, edges[pred[u]].cap);
+            u = from(pred[u]);
+        } while (u != v);
+
+        u = v;
+        do {
+            push(pred[u], amount);
+            u = from(pred[u]);
+        } while (u != v);
+
+        return true;
+    }
+
+    bool augment()
+    {
+        std::vector<int> start(1, source);
+        if (relax(start) >= 0)
+        {
+            need_cancel = true;
+            return true;
+        }
+        if (dist[sink] == LLONG_MAX)
+            return false;
+
+        int amount = INT_MAX;
+        for (int u = sink; u != source; u = from(pred[u]))
+            amount = std::min(amount, edges[pred[u]].cap);
+        for (int u = sink; u != source; u = from(pred[u]))
+            push(pred[u], amount);
+
+        return true;
+    }
+};
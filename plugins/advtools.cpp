@@ -52,6 +52,7 @@ command_result adv_bodyswap (color_ostream &out, std::vector <std::string> & par
 command_result adv_tools (color_ostream &out, std::vector <std::string> & parameters);
 
 DFHACK_PLUGIN("advtools");
+DFHACK_PLUGIN_EVENTS((1 << SC_WORLD_LOADED) | (1 << SC_WORLD_UNLOADED))
 
 DFhackCExport command_result plugin_init (color_ostream &out, std::vector <PluginCommand> &commands)
 {
@@ -5,8 +5,12 @@
 #include <Console.h>
 #include <Export.h>
 #include <PluginManager.h>
+#include <MiscUtils.h>
+#include <modules/Units.h>
 
 #include <vector>
+#include <map>
+#include <set>
 #include <algorithm>
 
 // DF data structure definition headers
@@ -18,10 +22,14 @@
 #include <df/unit_labor.h>
 #include <df/unit_skill.h>
 #include <df/job.h>
+#include <df/job_list_link.h>
+#include <df/general_ref.h>
 #include <df/building.h>
 #include <df/workshop_type.h>
 #include <df/unit_misc_trait.h>
 
+#include "LaborSolver.h"
+
 using std::string;
 using std::endl;
 using namespace DFHack;
@@ -69,6 +77,7 @@ command_result autolabor (color_ostream &out, std::vector <std::string> & parame
 // A plugin must be able to return its name and version.
 // The name string provided must correspond to the filename - autolabor.plug.so or autolabor.plug.dll in this case
 DFHACK_PLUGIN("autolabor");
+DFHACK_PLUGIN_EVENTS((1 << SC_MAP_LOADED) | (1 << SC_MAP_UNLOADED))
 
 enum labor_mode {
 	DISABLE,
@@ -332,6 +341,96 @@ static const dwarf_state dwarf_states[] = {
 	OTHER /* ExecuteCriminal */
 };
 
+/*
+ * Labors of the jobs whose labor doesn't depend on the materials. The
+ * solver uses the queued jobs of these to estimate the demand for labors.
+ */
+static const struct { df::job_type job; df::unit_labor labor; } job_labors[] = {
+	{ job_type::CarveFortification, unit_labor::DETAIL },
+	{ job_type::DetailWall, unit_labor::DETAIL },
+	{ job_type::DetailFloor, unit_labor::DETAIL },
+	{ job_type::EngraveSlab, unit_labor::DETAIL },
+	{ job_type::Dig, unit_labor::MINE },
+	{ job_type::CarveUpwardStaircase, unit_labor::MINE },
+	{ job_type::CarveDownwardStaircase, unit_labor::MINE },
+	{ job_type::CarveUpDownStaircase, unit_labor::MINE },
+	{ job_type::CarveRamp, unit_labor::MINE },
+	{ job_type::DigChannel, unit_labor::MINE },
+	{ job_type::FellTree, unit_labor::CUTWOOD },
+	{ job_type::GatherPlants, unit_labor::HERBALIST },
+	{ job_type::Fish, unit_labor::FISH },
+	{ job_type::CatchLiveFish, unit_labor::FISH },
+	{ job_type::Hunt, unit_labor::HUNT },
+	{ job_type::CatchLiveLandAnimal, unit_labor::TRAPPER },
+	{ job_type::BaitTrap, unit_labor::TRAPPER },
+	{ job_type::MakeRawGlass, unit_labor::GLASSMAKER },
+	{ job_type::CutGems, unit_labor::CUT_GEM },
+	{ job_type::EncrustWithGems, unit_labor::ENCRUST_GEM },
+	{ job_type::SmeltOre, unit_labor::SMELT },
+	{ job_type::MeltMetalObject, unit_labor::SMELT },
+	{ job_type::ExtractMetalStrands, unit_labor::EXTRACT_STRAND },
+	{ job_type::MintCoins, unit_labor::METAL_CRAFT },
+	{ job_type::PlantSeeds, unit_labor::PLANT },
+	{ job_type::HarvestPlants, unit_labor::PLANT },
+	{ job_type::FertilizeField, unit_labor::PLANT },
+	{ job_type::TrainHuntingAnimal, unit_labor::ANIMALTRAIN },
+	{ job_type::TrainWarAnimal, unit_labor::ANIMALTRAIN },
+	{ job_type::TameVermin, unit_labor::ANIMALTRAIN },
+	{ job_type::TameAnimal, unit_labor::ANIMALTRAIN },
+	{ job_type::ConstructCatapultParts, unit_labor::SIEGECRAFT },
+	{ job_type::ConstructBallistaParts, unit_labor::SIEGECRAFT },
+	{ job_type::AssembleSiegeAmmo, unit_labor::SIEGECRAFT },
+	{ job_type::LoadCatapult, unit_labor::SIEGEOPERATE },
+	{ job_type::LoadBallista, unit_labor::SIEGEOPERATE },
+	{ job_type::FireCatapult, unit_labor::SIEGEOPERATE },
+	{ job_type::FireBallista, unit_labor::SIEGEOPERATE },
+	{ job_type::ButcherAnimal, unit_labor::BUTCHER },
+	{ job_type::SlaughterAnimal, unit_labor::BUTCHER },
+	{ job_type::PrepareRawFish, unit_labor::CLEAN_FISH },
+	{ job_type::ExtractFromRawFish, unit_labor::DISSECT_FISH },
+	{ job_type::MillPlants, unit_labor::MILLER },
+	{ job_type::MilkCreature, unit_labor::MILK },
+	{ job_type::MakeCheese, unit_labor::MAKE_CHEESE },
+	{ job_type::ProcessPlants, unit_labor::PROCESS_PLANT },
+	{ job_type::ProcessPlantsBag, unit_labor::PROCESS_PLANT },
+	{ job_type::ProcessPlantsVial, unit_labor::PROCESS_PLANT },
+	{ job_type::ProcessPlantsBarrel, unit_labor::PROCESS_PLANT },
+	{ job_type::PrepareMeal, unit_labor::COOK },
+	{ job_type::WeaveCloth, unit_labor::WEAVER },
+	{ job_type::BrewDrink, unit_labor::BREWER },
+	{ job_type::ConstructMechanisms, unit_labor::MECHANIC },
+	{ job_type::LinkBuildingToTrigger, unit_labor::MECHANIC },
+	{ job_type::LoadCageTrap, unit_labor::MECHANIC },
+	{ job_type::LoadStoneTrap, unit_labor::MECHANIC },
+	{ job_type::LoadWeaponTrap, unit_labor::MECHANIC },
+	{ job_type::CleanTrap, unit_labor::MECHANIC },
+	{ job_type::DiagnosePatient, unit_labor::DIAGNOSE },
+	{ job_type::Surgery, unit_labor::SURGERY },
+	{ job_type::SetBone, unit_labor::BONE_SETTING },
+	{ job_type::ImmobilizeBreak, unit_labor::BONE_SETTING },
+	{ job_type::PlaceInTraction, unit_labor::BONE_SETTING },
+	{ job_type::ApplyCast, unit_labor::BONE_SETTING },
+	{ job_type::Suture, unit_labor::SUTURING },
+	{ job_type::DressWound, unit_labor::DRESSING_WOUNDS },
+	{ job_type::GiveWater, unit_labor::FEED_WATER_CIVILIANS },
+	{ job_type::GiveFood, unit_labor::FEED_WATER_CIVILIANS },
+	{ job_type::GiveWater2, unit_labor::FEED_WATER_CIVILIANS },
+	{ job_type::GiveFood2, unit_labor::FEED_WATER_CIVILIANS },
+	{ job_type::MakeCharcoal, unit_labor::BURN_WOOD },
+	{ job_type::MakeAsh, unit_labor::BURN_WOOD },
+	{ job_type::MakeLye, unit_labor::LYE_MAKING },
+	{ job_type::MakePotashFromLye, unit_labor::POTASH_MAKING },
+	{ job_type::MakePotashFromAsh, unit_labor::POTASH_MAKING },
+	{ job_type::DyeThread, unit_labor::DYER },
+	{ job_type::DyeCloth, unit_labor::DYER },
+	{ job_type::OperatePump, unit_labor::OPERATE_PUMP },
+	{ job_type::ShearCreature, unit_labor::SHEARER },
+	{ job_type::SpinThread, unit_labor::SPINNER },
+	{ job_type::CollectClay, unit_labor::POTTERY },
+	{ job_type::InstallColonyInHive, unit_labor::BEEKEEPING },
+	{ job_type::CollectHiveProducts, unit_labor::BEEKEEPING },
+};
+
 struct labor_info
 {
 	labor_mode mode;
@@ -425,6 +524,24 @@ static const df::job_skill noble_skills[] = {
 	df::enums::job_skill::RECORD_KEEPING,
 };
 
+/*
+ * Skill summary of a dwarf, kept between update cycles. It is recomputed only
+ * when the signature of the unit's skill list changes, i.e. when a skill is
+ * learned or its rating or experience goes up.
+ */
+struct dwarf_skills_t
+{
+	uint32_t signature;
+	int last_cycle;
+	int highest_skill;
+	int total_skill;
+	int noble_level[ARRAY_COUNT(noble_skills)];
+	int noble_experience[ARRAY_COUNT(noble_skills)];
+	// skill level in each labor, and the part of the preference value it contributes
+	std::vector<int> labor_level;
+	std::vector<int> labor_value;
+};
+
 struct dwarf_info_t
 {
 	int highest_skill;
@@ -434,8 +551,129 @@ struct dwarf_info_t
 	int assigned_jobs;
 	dwarf_state state;
 	bool has_exclusive_labor;
+	dwarf_skills_t *skills;
+};
+
+static std::map<int32_t, dwarf_skills_t> skill_cache;
+
+// labor -> skill, skill -> index in noble_skills and job -> labor, filled in plugin_init
+static std::vector<df::job_skill> labor_to_skill;
+static std::vector<int> skill_to_noble;
+static std::vector<df::unit_labor> job_to_labor;
+static std::vector<bool> labor_has_jobs;  // the labor appears in job_to_labor
+
+/*
+ * Candidate order for each labor, as indices into the dwarf list of the
+ * update that produced it. Preference values change little from one cycle
+ * to the next, so the previous order only needs a few swaps to become the
+ * new one. The order is reset whenever the set of dwarves changes.
+ */
+static std::vector<int32_t> ranked_dwarfs;
+static std::vector<std::vector<int> > labor_ranking;
+
+static int cycle_count = 0;
+
+// The workshop scan is repeated only when the building list changes
+static size_t building_count = 0;
+static int32_t last_building_id = -1;
+static bool has_butchers = false;
+static bool has_fishery = false;
+
+// Timing of the update cycles, see 'autolabor timing'
+static uint64_t last_update_ms = 0;
+static uint64_t max_update_ms = 0;
+static uint64_t total_update_ms = 0;
+static int timed_updates = 0;
+static int last_rescored = 0;
+static bool last_reranked = false;
+static int last_reassignments = 0;
+
+// Optional assignment by the min-cost flow solver, see 'autolabor solver'
+static bool use_solver = false;
+static int solver_budget = 200;  // path searches per frame
+
+static const int SOLVER_CHURN_COST = 300;  // enabling a labor the dwarf doesn't have
+static const int SOLVER_SLOT_COST = 150;   // each further labor on the same dwarf
+static const int SOLVER_IDLE_BONUS = 500;  // the first labor of an idle dwarf
+static const int SOLVER_NOBLE_COST = 400;  // any labor of a likely noble
+
+struct solver_dwarf_t
+{
+	int32_t id;
+	dwarf_state state;
+	int node;
+	int gate_node;
+	int gate;                // edge from the exclusive labor gate, -1 if closed
+	std::vector<int> slots;  // edges to the sink
 };
 
+struct solver_labor_t
+{
+	df::unit_labor labor;
+	int demand;
+	int node;
+	int supply;              // edge from the source
+	std::vector<std::pair<int, int> > edges;  // candidate dwarf and its edge
+};
+
+static MinCostFlow solver;
+static std::vector<solver_dwarf_t> solver_dwarfs;
+static std::vector<solver_labor_t> solver_labors;
+static bool solver_pending = false;
+
+// (labor, unit id) pairs of the last solution, to warm-start the next solve
+static std::set<std::pair<int, int32_t> > solver_assignment;
+
+static int last_demand = 0;
+static int last_covered = 0;
+static int last_searches = 0;
+static uint64_t last_solver_ms = 0;
+
+static void init_skill_tables()
+{
+	labor_to_skill.assign(ENUM_LAST_ITEM(unit_labor) + 1, df::enums::job_skill::NONE);
+	skill_to_noble.assign(ENUM_LAST_ITEM(job_skill) + 1, -1);
+
+	FOR_ENUM_ITEMS(job_skill, skill)
+	{
+		int labor = ENUM_ATTR(job_skill, labor, skill);
+		if (labor != df::enums::unit_labor::NONE)
+			labor_to_skill[labor] = skill;
+	}
+
+	for (int i = 0; i < ARRAY_COUNT(noble_skills); i++)
+		skill_to_noble[noble_skills[i]] = i;
+
+	job_to_labor.assign(ENUM_LAST_ITEM(job_type) + 1, df::enums::unit_labor::NONE);
+	labor_has_jobs.assign(ENUM_LAST_ITEM(unit_labor) + 1, false);
+	for (int i = 0; i < ARRAY_COUNT(job_labors); i++)
+	{
+		job_to_labor[job_labors[i].job] = job_labors[i].labor;
+		labor_has_jobs[job_labors[i].labor] = true;
+	}
+}
+
+// drop a solve that is spread over several frames, and its graph
+static void cancel_solver()
+{
+	solver_pending = false;
+	solver.reset(0, -1, -1);
+	solver_dwarfs.clear();
+	solver_labors.clear();
+}
+
+static void reset_caches()
+{
+	skill_cache.clear();
+	ranked_dwarfs.clear();
+	labor_ranking.clear();
+	building_count = 0;
+	last_building_id = -1;
+	has_butchers = has_fishery = false;
+	solver_assignment.clear();
+	cancel_solver();
+}
+
 DFhackCExport command_result plugin_init ( color_ostream &out, std::vector <PluginCommand> &commands)
 {
     // initialize labor infos table from default table
@@ -445,6 +683,7 @@ DFhackCExport command_result plugin_init ( color_ostream &out, std::vector <Plug
     for (int i = 0; i < ARRAY_COUNT(default_labor_infos); i++) {
         labor_infos[i] = default_labor_infos[i];
     }
+    init_skill_tables();
     // Fill the command list with your commands.
     commands.push_back(PluginCommand(
         "autolabor", "Automatically manage dwarf labors.",
@@ -461,12 +700,24 @@ DFhackCExport command_result plugin_init ( color_ostream &out, std::vector <Plug
 		"    Turn off autolabor for a specific labor.\n"
 		"  autolabor list\n"
 		"    List current status of all labors.\n"
+		"  autolabor timing\n"
+		"    Show how long the update cycles take.\n"
+		"  autolabor solver enable\n"
+		"  autolabor solver disable\n"
+		"    Assign the labors with an optimizing solver instead of one by one.\n"
+		"  autolabor solver budget <n>\n"
+		"    Limit the work the solver does in one frame.\n"
 		"Function:\n"
 		"  When enabled, autolabor periodically checks your dwarves and enables or\n"
 		"  disables labors. It tries to keep as many dwarves as possible busy but\n"
 		"  also tries to have dwarves specialize in specific skills.\n"
 		"  Warning: autolabor will override any manual changes you make to labors\n"
 		"  while it is enabled.\n"
+		"  In solver mode, each labor gets as many dwarves as it has queued jobs,\n"
+		"  or as many as it is given one by one if its jobs depend on materials,\n"
+		"  within its minimum and maximum, and the assignment as a whole is\n"
+		"  optimized to use skilled and idle dwarves while changing as few labors\n"
+		"  as possible from one cycle to the next.\n"
 		"Examples:\n"
 		"  autolabor MINE 2\n"
 		"    Keep at least 2 dwarves with mining enabled.\n"
@@ -484,6 +735,21 @@ DFhackCExport command_result plugin_shutdown ( color_ostream &out )
 {
 	// release the labor info table;
 	delete [] labor_infos;
+	reset_caches();
+
+	return CR_OK;
+}
+
+DFhackCExport command_result plugin_onstatechange(color_ostream &out, state_change_event event)
+{
+	switch (event) {
+	case SC_MAP_LOADED:
+	case SC_MAP_UNLOADED:
+		reset_caches();
+		break;
+	default:
+		break;
+	}
 
 	return CR_OK;
 }
@@ -520,287 +786,206 @@ struct values_sorter
     std::vector<int> & values;
 };
 
-DFhackCExport command_result plugin_onupdate ( color_ostream &out )
+static uint32_t skill_signature(df::unit_soul *soul)
 {
-	static int step_count = 0;
-    // check run conditions
-    if(!world->map.block_index || !enable_autolabor)
-    {
-        // give up if we shouldn't be running'
-        return CR_OK;
-    }
-
-	if (++step_count < 60)
-		return CR_OK;
-	step_count = 0;
-
-    uint32_t race = ui->race_id;
-    uint32_t civ = ui->civ_id;
-
-	std::vector<df::unit *> dwarfs;
-
-	bool has_butchers = false;
-	bool has_fishery = false;
-
-	for (int i = 0; i < world->buildings.all.size(); ++i)
+	uint32_t sig = 2166136261U;
+	for (auto s = soul->skills.begin(); s != soul->skills.end(); s++)
 	{
-		df::building *build = world->buildings.all[i];
-		auto type = build->getType();
-		if (df::enums::building_type::Workshop == type)
-		{
-			auto subType = build->getSubtype();
-			if (df::enums::workshop_type::Butchers == subType)
-				has_butchers = true;
-			if (df::enums::workshop_type::Fishery == subType)
-				has_fishery = true;
-		}
+		sig = (sig ^ uint32_t((*s)->id)) * 16777619U;
+		sig = (sig ^ uint32_t((*s)->rating)) * 16777619U;
+		sig = (sig ^ uint32_t((*s)->experience)) * 16777619U;
 	}
+	return sig ^ uint32_t(soul->skills.size());
+}
 
-    for (int i = 0; i < world->units.all.size(); ++i)
-    {
-        df::unit* cre = world->units.all[i];
-		if (cre->race == race && cre->civ_id == civ && !cre->flags1.bits.marauder && !cre->flags1.bits.diplomat && !cre->flags1.bits.merchant &&
-			!cre->flags1.bits.dead && !cre->flags1.bits.forest) {
-			dwarfs.push_back(cre);
-        }
-    }
-
-	int n_dwarfs = dwarfs.size();
-
-	if (n_dwarfs == 0)
-		return CR_OK;
-
-	std::vector<dwarf_info_t> dwarf_info(n_dwarfs);
-
-    std::vector<int> best_noble(ARRAY_COUNT(noble_skills));
-    std::vector<int> highest_noble_skill(ARRAY_COUNT(noble_skills));
-    std::vector<int> highest_noble_experience(ARRAY_COUNT(noble_skills));
-
-	// Find total skill and highest skill for each dwarf. More skilled dwarves shouldn't be used for minor tasks.
+static void compute_skills(dwarf_skills_t &ds, df::unit_soul *soul)
+{
+	ds.highest_skill = 0;
+	ds.total_skill = 0;
+	for (int i = 0; i < ARRAY_COUNT(noble_skills); i++)
+		ds.noble_level[i] = ds.noble_experience[i] = 0;
+	ds.labor_level.assign(labor_to_skill.size(), 0);
+	ds.labor_value.assign(labor_to_skill.size(), 0);
 
-	for (int dwarf = 0; dwarf < n_dwarfs; dwarf++)
+	for (auto s = soul->skills.begin(); s != soul->skills.end(); s++)
 	{
-		assert(dwarfs[dwarf]->status.souls.size() > 0);
-
-		for (auto s = dwarfs[dwarf]->status.souls[0]->skills.begin(); s != dwarfs[dwarf]->status.souls[0]->skills.end(); s++)
-		{
-			df::job_skill skill = (*s)->id;
-
-			df::job_skill_class skill_class = ENUM_ATTR(job_skill, type, skill);
+		df::job_skill skill = (*s)->id;
 
-			int skill_level = (*s)->rating;
-			int skill_experience = (*s)->experience;
+		int skill_level = (*s)->rating;
+		int skill_experience = (*s)->experience;
 
-			// Track the dwarfs with the best Appraisal, Organization, and Record Keeping skills.
-			// They are likely to have appointed noble positions, so should be kept free where possible.
-
-			int noble_skill_id = -1;
-            for (int i = 0; i < ARRAY_COUNT(noble_skills); i++)
-			{
-				if (skill == noble_skills[i])
-					noble_skill_id = i;
-			}
+		if (skill < 0 || skill >= int(skill_to_noble.size()))
+			continue;
 
-			if (noble_skill_id >= 0)
-			{
-                assert(noble_skill_id < ARRAY_COUNT(noble_skills));
-
-				if (highest_noble_skill[noble_skill_id] < skill_level ||
-					(highest_noble_skill[noble_skill_id] == skill_level &&
-						highest_noble_experience[noble_skill_id] < skill_experience))
-				{
-					highest_noble_skill[noble_skill_id] = skill_level;
-					highest_noble_experience[noble_skill_id] = skill_experience;
-					best_noble[noble_skill_id] = dwarf;
-				}
-			}
+		// Remember the Appraisal, Organization, and Record Keeping skills; the dwarfs best at
+		// them are likely to have appointed noble positions, so should be kept free where possible.
 
-			// Track total & highest skill among normal/medical skills. (We don't care about personal or social skills.)
+		int noble_skill_id = skill_to_noble[skill];
+		if (noble_skill_id >= 0)
+		{
+			ds.noble_level[noble_skill_id] = skill_level;
+			ds.noble_experience[noble_skill_id] = skill_experience;
+		}
 
-			if (skill_class != df::enums::job_skill_class::Normal && skill_class != df::enums::job_skill_class::Medical)
-				continue;
+		// Preference for the labor that uses this skill
 
-			if (dwarf_info[dwarf].highest_skill < skill_level)
-				dwarf_info[dwarf].highest_skill = skill_level;
-			dwarf_info[dwarf].total_skill += skill_level;
+		int labor = ENUM_ATTR(job_skill, labor, skill);
+		if (labor != df::enums::unit_labor::NONE && labor_to_skill[labor] == skill)
+		{
+			int value = skill_level * 100;
+			value += skill_experience / 20;
+			if (skill_level > 0 || skill_experience > 0)
+				value += 200;
+			if (skill_level >= 15)
+				value += 1000 * (skill_level - 14);
+
+			ds.labor_level[labor] = skill_level;
+			ds.labor_value[labor] = value;
 		}
-	}
 
-	// Mark the best nobles, so we try to keep them non-busy. (It would be better to find the actual assigned nobles.)
+		// Track total & highest skill among normal/medical skills. (We don't care about personal or social skills.)
 
-	for (int i = 0; i < ARRAY_COUNT(noble_skills); i++)
-	{
-		assert(best_noble[i] >= 0);
-		assert(best_noble[i] < n_dwarfs);
+		df::job_skill_class skill_class = ENUM_ATTR(job_skill, type, skill);
+		if (skill_class != df::enums::job_skill_class::Normal && skill_class != df::enums::job_skill_class::Medical)
+			continue;
 
-		dwarf_info[best_noble[i]].is_best_noble = true;
+		if (ds.highest_skill < skill_level)
+			ds.highest_skill = skill_level;
+		ds.total_skill += skill_level;
 	}
+}
 
-	// Calculate a base penalty for using each dwarf for a task he isn't good at.
+static dwarf_skills_t *get_skills(df::unit *unit)
+{
+	assert(unit->status.souls.size() > 0);
 
-	for (int dwarf = 0; dwarf < n_dwarfs; dwarf++)
-	{
-		dwarf_info[dwarf].mastery_penalty -= 40 * dwarf_info[dwarf].highest_skill;
-		dwarf_info[dwarf].mastery_penalty -= 10 * dwarf_info[dwarf].total_skill;
-		if (dwarf_info[dwarf].is_best_noble)
-			dwarf_info[dwarf].mastery_penalty -= 250;
+	df::unit_soul *soul = unit->status.souls[0];
+	uint32_t sig = skill_signature(soul);
 
-		for (int labor = ENUM_FIRST_ITEM(unit_labor); labor <= ENUM_LAST_ITEM(unit_labor); labor++)
-		{
-			if (labor == df::enums::unit_labor::NONE)
-				continue;
+	auto it = skill_cache.find(unit->id);
+	bool fresh = (it == skill_cache.end());
+	if (fresh)
+		it = skill_cache.insert(std::make_pair(unit->id, dwarf_skills_t())).first;
 
-            /*
-			assert(labor >= 0);
-			assert(labor < ARRAY_COUNT(labor_infos));
-			*/
+	dwarf_skills_t &ds = it->second;
+	ds.last_cycle = cycle_count;
 
-			if (labor_infos[labor].is_exclusive && dwarfs[dwarf]->status.labors[labor])
-				dwarf_info[dwarf].mastery_penalty -= 100;
-		}
+	if (fresh || ds.signature != sig)
+	{
+		ds.signature = sig;
+		compute_skills(ds, soul);
+		last_rescored++;
 	}
 
-	// Find the activity state for each dwarf. It's important to get this right - a dwarf who we think is IDLE but
-	// can't work will gum everything up. In the future I might add code to auto-detect slacker dwarves.
-
-	state_count.clear();
-	state_count.resize(NUM_STATE);
+	return &ds;
+}
 
-	for (int dwarf = 0; dwarf < n_dwarfs; dwarf++)
-	{
-		bool is_on_break = false;
+static void scan_workshops()
+{
+	auto &all = world->buildings.all;
+	int32_t last_id = all.empty() ? -1 : all.back()->id;
+	if (all.size() == building_count && last_id == last_building_id)
+		return;
 
-		for (auto p = dwarfs[dwarf]->status.misc_traits.begin(); p < dwarfs[dwarf]->status.misc_traits.end(); p++)
-		{
-			// 7 / 0x7 = Newly arrived migrant, will not work yet
-			// 17 / 0x11 = On break
-			if ((*p)->id == 0x07 || (*p)->id == 0x11)
-				is_on_break = true;
-		}
+	building_count = all.size();
+	last_building_id = last_id;
+	has_butchers = has_fishery = false;
 
-		if (dwarfs[dwarf]->profession == df::enums::profession::BABY ||
-			dwarfs[dwarf]->profession == df::enums::profession::CHILD ||
-			dwarfs[dwarf]->profession == df::enums::profession::DRUNK)
-		{
-			dwarf_info[dwarf].state = CHILD;
-		}
-		else if (ENUM_ATTR(profession, military, dwarfs[dwarf]->profession))
-			dwarf_info[dwarf].state = MILITARY;
-		else if (dwarfs[dwarf]->job.current_job == NULL)
-		{
-			if (is_on_break)
-				dwarf_info[dwarf].state = OTHER;
-			else if (dwarfs[dwarf]->meetings.size() > 0)
-				dwarf_info[dwarf].state = OTHER;
-			else
-				dwarf_info[dwarf].state = IDLE;
-		}
-		else
+	for (int i = 0; i < all.size(); ++i)
+	{
+		df::building *build = all[i];
+		auto type = build->getType();
+		if (df::enums::building_type::Workshop == type)
 		{
-			int job = dwarfs[dwarf]->job.current_job->job_type;
-
-            /*
-			assert(job >= 0);
-			assert(job < ARRAY_COUNT(dwarf_states));
-			*/
-
-			dwarf_info[dwarf].state = dwarf_states[job];
+			auto subType = build->getSubtype();
+			if (df::enums::workshop_type::Butchers == subType)
+				has_butchers = true;
+			if (df::enums::workshop_type::Fishery == subType)
+				has_fishery = true;
 		}
-
-		state_count[dwarf_info[dwarf].state]++;
-
-		if (print_debug)
-			out.print("Dwarf %i \"%s\": penalty %i, state %s\n", dwarf, dwarfs[dwarf]->name.first_name.c_str(), dwarf_info[dwarf].mastery_penalty, state_names[dwarf_info[dwarf].state]);
 	}
+}
 
-	// Generate labor -> skill mapping
-
-	df::job_skill labor_to_skill[ENUM_LAST_ITEM(unit_labor) + 1];
-	for (int i = 0; i <= ENUM_LAST_ITEM(unit_labor); i++)
-		labor_to_skill[i] = df::enums::job_skill::NONE;
+// Dwarfs and their state in the current update cycle
+static std::vector<df::unit *> dwarfs;
+static std::vector<dwarf_info_t> dwarf_info;
 
-	FOR_ENUM_ITEMS(job_skill, skill)
+// Insertion sort by descending value; fast when the order is already nearly right.
+static void sort_by_value(std::vector<int> &order, const std::vector<int> &values)
+{
+	for (size_t i = 1; i < order.size(); i++)
 	{
-		int labor = ENUM_ATTR(job_skill, labor, skill);
-		if (labor != df::enums::unit_labor::NONE)
-		{
-            /*
-			assert(labor >= 0);
-			assert(labor < ARRAY_COUNT(labor_to_skill));
-			*/
-
-			labor_to_skill[labor] = skill;
-		}
+		int dwarf = order[i];
+		int value = values[dwarf];
+		size_t j = i;
+		for (; j > 0 && values[order[j-1]] < value; j--)
+			order[j] = order[j-1];
+		order[j] = dwarf;
 	}
+}
 
-	std::vector<df::unit_labor> labors;
+/*
+ * Calculate a preference value of each dwarf for the labor, and bring the
+ * candidate ranking of the labor up to date with it.
+ */
+static std::vector<int> &rank_dwarfs(df::unit_labor labor, std::vector<int> &values)
+{
+	int n_dwarfs = dwarfs.size();
+	values.assign(n_dwarfs, 0);
 
-	FOR_ENUM_ITEMS(unit_labor, labor)
+	for (int dwarf = 0; dwarf < n_dwarfs; dwarf++)
 	{
-		if (labor == df::enums::unit_labor::NONE)
-			continue;
-
-        /*
-		assert(labor >= 0);
-		assert(labor < ARRAY_COUNT(labor_infos));
-		*/
+		int value = dwarf_info[dwarf].mastery_penalty;
+		value += dwarf_info[dwarf].skills->labor_value[labor];
 
-		labor_infos[labor].active_dwarfs = 0;
+		if (dwarfs[dwarf]->status.labors[labor])
+		{
+			value += 5;
+			if (labor_infos[labor].is_exclusive)
+				value += 350;
+		}
 
-		labors.push_back(labor);
+		values[dwarf] = value;
 	}
-    laborinfo_sorter lasorter;
-	std::sort(labors.begin(), labors.end(), lasorter);
 
-	// Handle DISABLED skills (just bookkeeping)
-	for (auto lp = labors.begin(); lp != labors.end(); ++lp)
+	std::vector<int> &ranking = labor_ranking[labor];
+	if (last_reranked)
 	{
-		auto labor = *lp;
-
-		if (labor_infos[labor].mode != DISABLE)
-			continue;
+		values_sorter ivs(values);
+		std::stable_sort(ranking.begin(), ranking.end(), ivs);
+	}
+	else
+		sort_by_value(ranking, values);
 
-		for (int dwarf = 0; dwarf < n_dwarfs; dwarf++)
-		{
-			if (dwarfs[dwarf]->status.labors[labor])
-			{
-				if (labor_infos[labor].is_exclusive)
-					dwarf_info[dwarf].has_exclusive_labor = true;
+	return ranking;
+}
 
-				dwarf_info[dwarf].assigned_jobs++;
-			}
-		}
-	}
+// Assign the AUTOMATIC labors one by one, each to the dwarfs that suit it best.
+static void assign_greedy(color_ostream &out, const std::vector<df::unit_labor> &labors)
+{
+	int n_dwarfs = dwarfs.size();
 
-	// Handle all skills except those marked HAULERS
+	static std::vector<int> values;
+	static std::vector<int> candidates;
+	static std::vector<bool> previously_enabled;
 
 	for (auto lp = labors.begin(); lp != labors.end(); ++lp)
 	{
 		auto labor = *lp;
 
-        /*
-		assert(labor >= 0);
-		assert(labor < ARRAY_COUNT(labor_infos));
-		*/
-
-		df::job_skill skill = labor_to_skill[labor];
-
 		if (labor_infos[labor].mode != AUTOMATIC)
 			continue;
 
-		int best_dwarf = 0;
-		int best_value = -10000;
-
-		std::vector<int> values(n_dwarfs);
-		std::vector<int> candidates;
-		std::map<int, int> dwarf_skill;
-		std::vector<bool> previously_enabled(n_dwarfs);
+		previously_enabled.assign(n_dwarfs, false);
 
-		auto mode = labor_infos[labor].mode;
+		std::vector<int> &ranking = rank_dwarfs(labor, values);
 
-		// Find candidate dwarfs, and calculate a preference value for each dwarf
-		for (int dwarf = 0; dwarf < n_dwarfs; dwarf++)
+		// Find candidate dwarfs in order of preference
+		candidates.clear();
+		for (int i = 0; i < n_dwarfs; i++)
 		{
+			int dwarf = ranking[i];
+
 			if (dwarf_info[dwarf].state == CHILD)
 				continue;
 			if (dwarf_info[dwarf].state == MILITARY)
@@ -809,54 +994,9 @@ DFhackCExport command_result plugin_onupdate ( color_ostream &out )
 			if (labor_infos[labor].is_exclusive && dwarf_info[dwarf].has_exclusive_labor)
 				continue;
 
-			int value = dwarf_info[dwarf].mastery_penalty;
-
-			if (skill != df::enums::job_skill::NONE)
-			{
-				int skill_level = 0;
-				int skill_experience = 0;
-
-				for (auto s = dwarfs[dwarf]->status.souls[0]->skills.begin(); s < dwarfs[dwarf]->status.souls[0]->skills.end(); s++)
-				{
-					if ((*s)->id == skill)
-					{
-						skill_level = (*s)->rating;
-						skill_experience = (*s)->experience;
-						break;
-					}
-				}
-
-				dwarf_skill[dwarf] = skill_level;
-
-				value += skill_level * 100;
-				value += skill_experience / 20;
-				if (skill_level > 0 || skill_experience > 0)
-					value += 200;
-				if (skill_level >= 15)
-					value += 1000 * (skill_level - 14);
-			}
-			else
-			{
-				dwarf_skill[dwarf] = 0;
-			}
-
-			if (dwarfs[dwarf]->status.labors[labor])
-			{
-				value += 5;
-				if (labor_infos[labor].is_exclusive)
-					value += 350;
-			}
-
-			values[dwarf] = value;
-
 			candidates.push_back(dwarf);
-
 		}
 
-		// Sort candidates by preference value
-        values_sorter ivs(values);
-		std::sort(candidates.begin(), candidates.end(), ivs);
-
 		// Disable the labor on everyone
 		for (int dwarf = 0; dwarf < n_dwarfs; dwarf++)
 		{
@@ -901,7 +1041,7 @@ DFhackCExport command_result plugin_onupdate ( color_ostream &out )
 			bool preferred_dwarf = false;
 			if (want_idle_dwarf && dwarf_info[dwarf].state == IDLE)
 				preferred_dwarf = true;
-			if (dwarf_skill[dwarf] > 0)
+			if (dwarf_info[dwarf].skills->labor_level[labor] > 0)
 				preferred_dwarf = true;
 			if (previously_enabled[dwarf] && labor_infos[labor].is_exclusive)
 				preferred_dwarf = true;
@@ -930,7 +1070,18 @@ DFhackCExport command_result plugin_onupdate ( color_ostream &out )
 			if (dwarf_info[dwarf].state == IDLE)
 				want_idle_dwarf = false;
 		}
+
+		for (int dwarf = 0; dwarf < n_dwarfs; dwarf++)
+		{
+			if (dwarf_info[dwarf].state != CHILD && previously_enabled[dwarf] != dwarfs[dwarf]->status.labors[labor])
+				last_reassignments++;
+		}
 	}
+}
+
+static void assign_haulers(color_ostream &out)
+{
+	int n_dwarfs = dwarfs.size();
 
 	// Set about 1/3 of the dwarfs as haulers. The haulers have all HAULER labors enabled. Having a lot of haulers helps
 	// make sure that hauling jobs are handled quickly rather than building up.
@@ -959,11 +1110,6 @@ DFhackCExport command_result plugin_onupdate ( color_ostream &out )
 		if (labor == df::enums::unit_labor::NONE)
 			continue;
 
-        /*
-		assert(labor >= 0);
-		assert(labor < ARRAY_COUNT(labor_infos));
-		*/
-
 		if (labor_infos[labor].mode != HAULERS)
 			continue;
 
@@ -997,6 +1143,581 @@ DFhackCExport command_result plugin_onupdate ( color_ostream &out )
 			dwarfs[dwarf]->status.labors[labor] = false;
 		}
 	}
+}
+
+/*
+ * Labor assignment as min-cost flow.
+ *
+ * The source feeds each AUTOMATIC labor with its demand, every labor has an
+ * edge to each of its best candidates, and every dwarf drains into the sink
+ * through a few slots of increasing cost. Exclusive labors reach their dwarfs
+ * through a gate of capacity one, so nobody gets two of them. The edge costs
+ * are the usual preference values, plus a penalty for enabling a labor the
+ * dwarf doesn't have right now, so that the solution only moves labors around
+ * when that is clearly better. Idle dwarfs get a bonus for their first labor
+ * and the likely nobles a penalty on all of theirs.
+ *
+ * The previous solution warm-starts the next solve, and each frame does a
+ * limited number of path searches until the solve is complete.
+ */
+
+static void count_pending_jobs(std::vector<int> &pending)
+{
+	pending.assign(ENUM_LAST_ITEM(unit_labor) + 1, 0);
+
+	for (df::job_list_link *p = world->job_list.next; p; p = p->next)
+	{
+		df::job *job = p->item;
+		if (job->job_type < 0 || job->job_type >= job_to_labor.size())
+			continue;
+
+		df::unit_labor labor = job_to_labor[job->job_type];
+		if (labor == df::enums::unit_labor::NONE)
+			continue;
+
+		bool has_worker = false;
+		for (size_t i = 0; i < job->general_refs.size(); i++)
+		{
+			if (job->general_refs[i]->getType() == general_ref_type::UNIT_WORKER)
+				has_worker = true;
+		}
+
+		if (!has_worker)
+			pending[labor]++;
+	}
+}
+
+/*
+ * Demand of a labor whose jobs can't be counted because the labor depends
+ * on the materials (masonry, carpentry, construction...): the number of
+ * dwarfs the greedy assignment would give it, that is the minimum plus
+ * everyone skilled in it, the current holders of an exclusive labor and
+ * one idle dwarf.
+ */
+static int greedy_demand(df::unit_labor labor)
+{
+	int n_dwarfs = dwarfs.size();
+	bool exclusive = labor_infos[labor].is_exclusive;
+	bool want_idle_dwarf = (state_count[IDLE] >= 2);
+	int preferred = 0;
+
+	for (int dwarf = 0; dwarf < n_dwarfs; dwarf++)
+	{
+		if (dwarf_info[dwarf].state == CHILD || dwarf_info[dwarf].state == MILITARY)
+			continue;
+		if (exclusive && dwarf_info[dwarf].has_exclusive_labor)
+			continue;
+
+		if (dwarf_info[dwarf].skills->labor_level[labor] > 0 ||
+			(exclusive && dwarfs[dwarf]->status.labors[labor]))
+			preferred++;
+		else if (want_idle_dwarf && dwarf_info[dwarf].state == IDLE)
+		{
+			preferred++;
+			want_idle_dwarf = false;
+		}
+	}
+
+	return preferred;
+}
+
+static void start_solver(color_ostream &out, const std::vector<df::unit_labor> &labors)
+{
+	int n_dwarfs = dwarfs.size();
+
+	static std::vector<int> pending;
+	count_pending_jobs(pending);
+
+	// Demand of each labor: the jobs waiting for it, or the greedy estimate
+	// where those can't be counted, within the configured limits
+
+	solver_labors.clear();
+	int total_demand = 0;
+
+	for (auto lp = labors.begin(); lp != labors.end(); ++lp)
+	{
+		auto labor = *lp;
+
+		if (labor_infos[labor].mode != AUTOMATIC)
+			continue;
+
+		int wanted = labor_has_jobs[labor] ? pending[labor] : greedy_demand(labor);
+		int demand = std::max(labor_infos[labor].minimum_dwarfs, wanted);
+		demand = std::min(demand, labor_infos[labor].maximum_dwarfs);
+
+		// Special - don't assign hunt without a butchers, or fish without a fishery
+		if (df::enums::unit_labor::HUNT == labor && !has_butchers)
+			demand = 0;
+		if (df::enums::unit_labor::FISH == labor && !has_fishery)
+			demand = 0;
+
+		solver_labor_t sl;
+		sl.labor = labor;
+		sl.demand = demand;
+		solver_labors.push_back(sl);
+
+		total_demand += demand;
+	}
+
+	int workers = 0;
+	for (int dwarf = 0; dwarf < n_dwarfs; dwarf++)
+	{
+		if (dwarf_info[dwarf].state != CHILD && dwarf_info[dwarf].state != MILITARY)
+			workers++;
+	}
+
+	// Enough slots for everything to be covered, with a few to spare so that skills can count
+	int slots = std::max(3, (total_demand + std::max(workers, 1) - 1) / std::max(workers, 1) + 1);
+
+	// Nodes: source, sink, one per labor, then a dwarf and its exclusive labor gate for each dwarf
+	int n_labors = solver_labors.size();
+	solver.reset(2 + n_labors + 2 * n_dwarfs, 0, 1);
+
+	solver_dwarfs.resize(n_dwarfs);
+	for (int dwarf = 0; dwarf < n_dwarfs; dwarf++)
+	{
+		solver_dwarf_t &sd = solver_dwarfs[dwarf];
+		sd.id = dwarfs[dwarf]->id;
+		sd.state = dwarf_info[dwarf].state;
+		sd.node = 2 + n_labors + 2 * dwarf;
+		sd.gate_node = sd.node + 1;
+		sd.gate = -1;
+		sd.slots.clear();
+
+		if (sd.state == CHILD || sd.state == MILITARY)
+			continue;
+
+		for (int i = 0; i < slots; i++)
+		{
+			int cost = i * SOLVER_SLOT_COST;
+			if (i == 0 && sd.state == IDLE)
+				cost -= SOLVER_IDLE_BONUS;
+			if (dwarf_info[dwarf].is_best_noble)
+				cost += SOLVER_NOBLE_COST;
+
+			sd.slots.push_back(solver.addEdge(sd.node, 1, 1, cost));
+		}
+
+		if (!dwarf_info[dwarf].has_exclusive_labor)
+			sd.gate = solver.addEdge(sd.gate_node, sd.node, 1, 0);
+	}
+
+	static std::vector<int> values;
+
+	for (int i = 0; i < n_labors; i++)
+	{
+		solver_labor_t &sl = solver_labors[i];
+		auto labor = sl.labor;
+		bool exclusive = labor_infos[labor].is_exclusive;
+
+		sl.node = 2 + i;
+		sl.supply = solver.addEdge(0, sl.node, sl.demand, 0);
+		sl.edges.clear();
+
+		if (sl.demand == 0)
+			continue;
+
+		std::vector<int> &ranking = rank_dwarfs(labor, values);
+
+		// Only the best candidates and the current holders are worth an edge
+		int limit = sl.demand * 3 + 4;
+		int taken = 0;
+
+		for (int j = 0; j < n_dwarfs; j++)
+		{
+			int dwarf = ranking[j];
+			solver_dwarf_t &sd = solver_dwarfs[dwarf];
+
+			if (sd.slots.empty())
+				continue;
+			if (exclusive && sd.gate < 0)
+				continue;
+
+			bool current = dwarfs[dwarf]->status.labors[labor];
+			if (taken >= limit && !current)
+				continue;
+			taken++;
+
+			int cost = -values[dwarf];
+			if (!current)
+				cost += SOLVER_CHURN_COST;
+
+			int edge = solver.addEdge(sl.node, exclusive ? sd.gate_node : sd.node, 1, cost);
+			sl.edges.push_back(std::make_pair(dwarf, edge));
+		}
+	}
+
+	// Warm start with the previous solution
+
+	std::vector<int> path;
+	for (int i = 0; i < n_labors; i++)
+	{
+		solver_labor_t &sl = solver_labors[i];
+		bool exclusive = labor_infos[sl.labor].is_exclusive;
+
+		for (size_t j = 0; j < sl.edges.size(); j++)
+		{
+			solver_dwarf_t &sd = solver_dwarfs[sl.edges[j].first];
+			if (!solver_assignment.count(std::make_pair(int(sl.labor), sd.id)))
+				continue;
+
+			for (size_t k = 0; k < sd.slots.size(); k++)
+			{
+				path.clear();
+				path.push_back(sl.supply);
+				path.push_back(sl.edges[j].second);
+				if (exclusive)
+					path.push_back(sd.gate);
+				path.push_back(sd.slots[k]);
+
+				if (solver.pushPath(path))
+					break;
+			}
+		}
+	}
+
+	solver_pending = true;
+	last_demand = total_demand;
+	last_solver_ms = 0;
+}
+
+static void apply_solution(color_ostream &out)
+{
+	solver_assignment.clear();
+	last_covered = 0;
+
+	// The solve may have taken a few frames; drop the dwarfs that are gone since
+	for (size_t dwarf = 0; dwarf < solver_dwarfs.size(); dwarf++)
+	{
+		df::unit *unit = Units::FindById(solver_dwarfs[dwarf].id);
+		if (unit)
+		{
+			dwarfs[dwarf] = unit;
+			continue;
+		}
+
+		state_count[dwarf_info[dwarf].state]--;
+		state_count[OTHER]++;
+		dwarf_info[dwarf].state = OTHER;
+		solver_dwarfs[dwarf].state = CHILD;
+	}
+
+	static std::vector<char> assigned;
+
+	for (size_t i = 0; i < solver_labors.size(); i++)
+	{
+		solver_labor_t &sl = solver_labors[i];
+		auto labor = sl.labor;
+
+		assigned.assign(solver_dwarfs.size(), 0);
+		for (size_t j = 0; j < sl.edges.size(); j++)
+		{
+			if (solver.flow(sl.edges[j].second) > 0)
+				assigned[sl.edges[j].first] = 1;
+		}
+
+		for (size_t dwarf = 0; dwarf < solver_dwarfs.size(); dwarf++)
+		{
+			solver_dwarf_t &sd = solver_dwarfs[dwarf];
+			if (sd.state == CHILD)
+				continue;
+
+			df::unit *unit = dwarfs[dwarf];
+
+			bool enable = assigned[dwarf] != 0;
+			if (unit->status.labors[labor] != enable)
+			{
+				unit->status.labors[labor] = enable;
+				last_reassignments++;
+
+				// all the exclusive labors require equipment so this should force the dorf to reequip if needed
+				if (enable && labor_infos[labor].is_exclusive)
+					unit->military.pickup_flags.bits.update = 1;
+			}
+
+			if (!enable)
+				continue;
+
+			dwarf_info[dwarf].assigned_jobs++;
+			if (labor_infos[labor].is_exclusive)
+				dwarf_info[dwarf].has_exclusive_labor = true;
+
+			solver_assignment.insert(std::make_pair(int(labor), sd.id));
+			last_covered++;
+
+			if (sd.state == IDLE || sd.state == BUSY)
+				labor_infos[labor].active_dwarfs++;
+
+			if (print_debug)
+				out.print("Dwarf %i \"%s\" assigned %s: solver\n", int(dwarf), unit->name.first_name.c_str(), ENUM_KEY_STR(unit_labor, labor).c_str());
+		}
+	}
+
+	assign_haulers(out);
+}
+
+static void run_solver(color_ostream &out)
+{
+	uint64_t start = GetTimeMs64();
+
+	int budget = solver_budget;
+	bool done = solver.step(budget);
+
+	last_searches = solver.searchCount();
+	last_solver_ms += GetTimeMs64() - start;
+
+	if (!done)
+		return;
+
+	solver_pending = false;
+	apply_solution(out);
+}
+static void update_labors(color_ostream &out)
+{
+	uint32_t race = ui->race_id;
+	uint32_t civ = ui->civ_id;
+
+	dwarfs.clear();
+
+	scan_workshops();
+
+	for (int i = 0; i < world->units.all.size(); ++i)
+	{
+		df::unit* cre = world->units.all[i];
+		if (cre->race == race && cre->civ_id == civ && !cre->flags1.bits.marauder && !cre->flags1.bits.diplomat && !cre->flags1.bits.merchant &&
+			!cre->flags1.bits.dead && !cre->flags1.bits.forest) {
+			dwarfs.push_back(cre);
+		}
+	}
+
+	int n_dwarfs = dwarfs.size();
+
+	if (n_dwarfs == 0)
+		return;
+
+	dwarf_info.assign(n_dwarfs, dwarf_info_t());
+
+	// Look up the skill summaries, recomputing those whose skills changed, and drop the ones of departed dwarfs.
+
+	cycle_count++;
+
+	bool same_dwarfs = (ranked_dwarfs.size() == n_dwarfs);
+
+	for (int dwarf = 0; dwarf < n_dwarfs; dwarf++)
+	{
+		dwarf_skills_t *ds = get_skills(dwarfs[dwarf]);
+
+		dwarf_info[dwarf].skills = ds;
+		dwarf_info[dwarf].highest_skill = ds->highest_skill;
+		dwarf_info[dwarf].total_skill = ds->total_skill;
+
+		if (same_dwarfs && ranked_dwarfs[dwarf] != dwarfs[dwarf]->id)
+			same_dwarfs = false;
+	}
+
+	if (skill_cache.size() > n_dwarfs)
+	{
+		for (auto it = skill_cache.begin(); it != skill_cache.end(); )
+		{
+			if (it->second.last_cycle != cycle_count)
+				skill_cache.erase(it++);
+			else
+				++it;
+		}
+	}
+
+	// Mark the best nobles, so we try to keep them non-busy. (It would be better to find the actual assigned nobles.)
+
+	for (int i = 0; i < ARRAY_COUNT(noble_skills); i++)
+	{
+		int best_noble = 0;
+		int highest_noble_skill = 0;
+		int highest_noble_experience = 0;
+
+		for (int dwarf = 0; dwarf < n_dwarfs; dwarf++)
+		{
+			dwarf_skills_t *ds = dwarf_info[dwarf].skills;
+
+			if (highest_noble_skill < ds->noble_level[i] ||
+				(highest_noble_skill == ds->noble_level[i] &&
+					highest_noble_experience < ds->noble_experience[i]))
+			{
+				highest_noble_skill = ds->noble_level[i];
+				highest_noble_experience = ds->noble_experience[i];
+				best_noble = dwarf;
+			}
+		}
+
+		dwarf_info[best_noble].is_best_noble = true;
+	}
+
+	// Calculate a base penalty for using each dwarf for a task he isn't good at.
+
+	for (int dwarf = 0; dwarf < n_dwarfs; dwarf++)
+	{
+		dwarf_info[dwarf].mastery_penalty -= 40 * dwarf_info[dwarf].highest_skill;
+		dwarf_info[dwarf].mastery_penalty -= 10 * dwarf_info[dwarf].total_skill;
+		if (dwarf_info[dwarf].is_best_noble)
+			dwarf_info[dwarf].mastery_penalty -= 250;
+
+		for (int labor = ENUM_FIRST_ITEM(unit_labor); labor <= ENUM_LAST_ITEM(unit_labor); labor++)
+		{
+			if (labor == df::enums::unit_labor::NONE)
+				continue;
+
+			if (labor_infos[labor].is_exclusive && dwarfs[dwarf]->status.labors[labor])
+				dwarf_info[dwarf].mastery_penalty -= 100;
+		}
+	}
+
+	// Find the activity state for each dwarf. It's important to get this right - a dwarf who we think is IDLE but
+	// can't work will gum everything up. In the future I might add code to auto-detect slacker dwarves.
+
+	state_count.clear();
+	state_count.resize(NUM_STATE);
+
+	for (int dwarf = 0; dwarf < n_dwarfs; dwarf++)
+	{
+		bool is_on_break = false;
+
+		for (auto p = dwarfs[dwarf]->status.misc_traits.begin(); p < dwarfs[dwarf]->status.misc_traits.end(); p++)
+		{
+			// 7 / 0x7 = Newly arrived migrant, will not work yet
+			// 17 / 0x11 = On break
+			if ((*p)->id == 0x07 || (*p)->id == 0x11)
+				is_on_break = true;
+		}
+
+		if (dwarfs[dwarf]->profession == df::enums::profession::BABY ||
+			dwarfs[dwarf]->profession == df::enums::profession::CHILD ||
+			dwarfs[dwarf]->profession == df::enums::profession::DRUNK)
+		{
+			dwarf_info[dwarf].state = CHILD;
+		}
+		else if (ENUM_ATTR(profession, military, dwarfs[dwarf]->profession))
+			dwarf_info[dwarf].state = MILITARY;
+		else if (dwarfs[dwarf]->job.current_job == NULL)
+		{
+			if (is_on_break)
+				dwarf_info[dwarf].state = OTHER;
+			else if (dwarfs[dwarf]->meetings.size() > 0)
+				dwarf_info[dwarf].state = OTHER;
+			else
+				dwarf_info[dwarf].state = IDLE;
+		}
+		else
+		{
+			int job = dwarfs[dwarf]->job.current_job->job_type;
+
+			dwarf_info[dwarf].state = dwarf_states[job];
+		}
+
+		state_count[dwarf_info[dwarf].state]++;
+
+		if (print_debug)
+			out.print("Dwarf %i \"%s\": penalty %i, state %s\n", dwarf, dwarfs[dwarf]->name.first_name.c_str(), dwarf_info[dwarf].mastery_penalty, state_names[dwarf_info[dwarf].state]);
+	}
+
+	// Start the candidate rankings over if dwarfs came or went
+
+	last_reranked = !same_dwarfs || labor_ranking.empty();
+	if (last_reranked)
+	{
+		ranked_dwarfs.resize(n_dwarfs);
+		for (int dwarf = 0; dwarf < n_dwarfs; dwarf++)
+			ranked_dwarfs[dwarf] = dwarfs[dwarf]->id;
+
+		labor_ranking.assign(ENUM_LAST_ITEM(unit_labor) + 1, std::vector<int>());
+		for (int labor = 0; labor < labor_ranking.size(); labor++)
+		{
+			labor_ranking[labor].resize(n_dwarfs);
+			for (int dwarf = 0; dwarf < n_dwarfs; dwarf++)
+				labor_ranking[labor][dwarf] = dwarf;
+		}
+	}
+
+	std::vector<df::unit_labor> labors;
+
+	FOR_ENUM_ITEMS(unit_labor, labor)
+	{
+		if (labor == df::enums::unit_labor::NONE)
+			continue;
+
+		labor_infos[labor].active_dwarfs = 0;
+
+		labors.push_back(labor);
+	}
+	laborinfo_sorter lasorter;
+	std::sort(labors.begin(), labors.end(), lasorter);
+
+	// Handle DISABLED skills (just bookkeeping)
+	for (auto lp = labors.begin(); lp != labors.end(); ++lp)
+	{
+		auto labor = *lp;
+
+		if (labor_infos[labor].mode != DISABLE)
+			continue;
+
+		for (int dwarf = 0; dwarf < n_dwarfs; dwarf++)
+		{
+			if (dwarfs[dwarf]->status.labors[labor])
+			{
+				if (labor_infos[labor].is_exclusive)
+					dwarf_info[dwarf].has_exclusive_labor = true;
+
+				dwarf_info[dwarf].assigned_jobs++;
+			}
+		}
+	}
+
+	// Handle all skills except those marked HAULERS
+
+	last_reassignments = 0;
+	if (use_solver)
+	{
+		// the haulers are set once the solution is in
+		start_solver(out, labors);
+		return;
+	}
+
+	assign_greedy(out, labors);
+	assign_haulers(out);
+}
+
+DFhackCExport command_result plugin_onupdate ( color_ostream &out )
+{
+	static int step_count = 0;
+    // check run conditions
+    if(!world->map.block_index || !enable_autolabor)
+    {
+        // give up if we shouldn't be running'
+        return CR_OK;
+    }
+
+	// finish the solve of the last cycle before starting another one
+	if (solver_pending)
+		run_solver(out);
+
+	if (++step_count < 60 || solver_pending)
+		return CR_OK;
+	step_count = 0;
+
+	uint64_t start = GetTimeMs64();
+	last_rescored = 0;
+
+	update_labors(out);
+
+	if (solver_pending)
+		run_solver(out);
+
+	last_update_ms = GetTimeMs64() - start;
+	total_update_ms += last_update_ms;
+	if (max_update_ms < last_update_ms)
+		max_update_ms = last_update_ms;
+	timed_updates++;
+
+	if (print_debug)
+		out.print("Update took %d ms, %d dwarfs rescored%s\n", int(last_update_ms), last_rescored, last_reranked ? ", rankings reset" : "");
 
 	print_debug = 0;
 
@@ -1028,11 +1749,35 @@ command_result autolabor (color_ostream &out, std::vector <std::string> & parame
 		 parameters[0] == "1" || parameters[0] == "disable"))
     {
         if (parameters[0] == "0" || parameters[0] == "disable")
+        {
             enable_autolabor = 0;
+            // its dwarves and demands would be stale by the time it's enabled again
+            cancel_solver();
+        }
         else
             enable_autolabor = 1;
         out.print("autolabor %sactivated.\n", (enable_autolabor ? "" : "de"));
     }
+	else if (parameters.size() >= 2 && parameters[0] == "solver") {
+		if (parameters.size() == 2 && (parameters[1] == "enable" || parameters[1] == "disable"))
+		{
+			use_solver = (parameters[1] == "enable");
+			cancel_solver();
+			out.print("autolabor solver %sactivated.\n", (use_solver ? "" : "de"));
+		}
+		else if (parameters.size() == 3 && parameters[1] == "budget")
+		{
+			int budget = atoi(parameters[2].c_str());
+			if (budget < 1)
+			{
+				out.printerr("Syntax: autolabor solver budget <n>\n");
+				return CR_WRONG_USAGE;
+			}
+			solver_budget = budget;
+		}
+		else
+			return CR_WRONG_USAGE;
+	}
     else if (parameters.size() == 2 || parameters.size() == 3) {
 		df::enums::unit_labor::unit_labor labor = df::enums::unit_labor::NONE;
 
@@ -1107,6 +1852,23 @@ command_result autolabor (color_ostream &out, std::vector <std::string> & parame
 	else if (parameters.size() == 1 && parameters[0] == "debug") {
 		print_debug = 1;
 	}
+	else if (parameters.size() == 1 && parameters[0] == "timing") {
+		if (timed_updates == 0)
+		{
+			out << "No updates yet." << endl;
+			return CR_OK;
+		}
+
+		out.print("%d updates: last %d ms, average %d ms, maximum %d ms\n",
+			timed_updates, int(last_update_ms), int(total_update_ms / timed_updates), int(max_update_ms));
+		out.print("Last update: %d of %d dwarfs rescored, rankings %s\n",
+			last_rescored, int(skill_cache.size()), last_reranked ? "reset" : "reused");
+		out.print("Last update: %d labors changed\n", last_reassignments);
+		if (use_solver)
+			out.print("Solver: %d of %d wanted labors covered, %d path searches, %d ms%s\n",
+				last_covered, last_demand, last_searches, int(last_solver_ms),
+				solver_pending ? " (still running)" : "");
+	}
 	else
     {
         out.print("Automatically assigns labors to dwarves.\n"
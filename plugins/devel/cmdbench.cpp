@@ -0,0 +1,83 @@
+// Measure the throughput of command tokenization and dispatch
+
+#include "Core.h"
+#include "Console.h"
+#include "Export.h"
+#include "PluginManager.h"
+#include "MiscUtils.h"
+
+#include <cstdlib>
+
+using std::vector;
+using std::string;
+
+using namespace DFHack;
+
+command_result df_cmdbench_nop (color_ostream &out, vector <string> & parameters)
+{
+    return CR_OK;
+}
+
+command_result df_cmdbench (color_ostream &out, vector <string> & parameters)
+{
+    int count = 100000;
+    if (!parameters.empty())
+        count = atoi(parameters[0].c_str());
+    if (count <= 0)
+        return CR_WRONG_USAGE;
+
+    PluginManager *plug_mgr = Core::getInstance().getPluginManager();
+    const string cmdline = "cmdbench-nop all \"quoted argument\" 42";
+    vector <string> args;
+
+    // lookup only
+    uint64_t start = GetTimeMs64();
+    for (int i = 0; i < count; i++)
+    {
+        if (!plug_mgr->getPluginByCommand("cmdbench-nop"))
+            return CR_FAILURE;
+    }
+    uint64_t lookup_time = GetTimeMs64() - start;
+
+    // full path: tokenize, look up and invoke
+    start = GetTimeMs64();
+    for (int i = 0; i < count; i++)
+    {
+        args.clear();
+        cheap_tokenise(cmdline, args);
+        string first = args[0];
+        args.erase(args.begin());
+        plug_mgr->InvokeCommand(out, first, args);
+    }
+    uint64_t invoke_time = GetTimeMs64() - start;
+
+    if (lookup_time < 1) lookup_time = 1;
+    if (invoke_time < 1) invoke_time = 1;
+
+    out.print("%d lookups in %d ms: %.0f per second\n",
+              count, int(lookup_time), count * 1000.0 / lookup_time);
+    out.print("%d commands in %d ms: %.0f per second\n",
+              count, int(invoke_time), count * 1000.0 / invoke_time);
+    return CR_OK;
+}
+
+DFHACK_PLUGIN("cmdbench");
+
+DFhackCExport command_result plugin_init ( color_ostream &out, std::vector <PluginCommand> &commands)
+{
+    commands.push_back(PluginCommand("cmdbench",
+                                     "Measure command dispatch speed.",
+                                     df_cmdbench, false,
+                                     "  cmdbench [count]\n"
+                                     "    Tokenizes and runs a no-op command count times\n"
+                                     "    (default 100000) and prints commands per second.\n"));
+    commands.push_back(PluginCommand("cmdbench-nop",
+                                     "Does nothing; used by cmdbench.",
+                                     df_cmdbench_nop));
+    return CR_OK;
+}
+
+DFhackCExport command_result plugin_shutdown ( color_ostream &out )
+{
+    return CR_OK;
+}
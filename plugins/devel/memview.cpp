@@ -2,15 +2,20 @@
 #include "Console.h"
 #include "PluginManager.h"
 #include "MemAccess.h"
+#include "MemScan.h"
 #include "MiscUtils.h"
+#include "RemoteServer.h"
+#include "memview.pb.h"
 #include <tinythread.h> //not sure if correct
 #include <string>
 #include <vector>
 #include <sstream>
+#include <algorithm>
 
 using std::vector;
 using std::string;
 using namespace DFHack;
+using namespace dfproto;
 
 uint64_t timeLast=0;
 static tthread::mutex* mymutex=0;
@@ -22,20 +27,77 @@ struct memory_data
 	size_t refresh;
 	int state;
 	uint8_t *buf,*lbuf;
-	vector<t_memrange> ranges;
+	bool shown;
+	vector<const void *> words;
+	vector<MemClass> classes;
+	vector<size_t> changed;
 }memdata;
+
+//a region checked for changes every frame, see memwatch
+struct mem_watch
+{
+	int id;
+	uint8_t *addr;
+	size_t len;
+	string name;
+	vector<uint8_t> last;
+};
+//one changed word of a watched region
+struct mem_change
+{
+	uint64_t seq;
+	uint32_t tick;
+	int watch;
+	uint32_t offset;
+	uint32_t oldval,newval;
+};
+struct watch_data
+{
+	vector<mem_watch> watches;
+	int next_id;
+	uint32_t tick;
+	//change number seq is kept in ring[seq%ring.size()] until overwritten
+	vector<mem_change> ring;
+	uint64_t next_seq;
+	vector<size_t> diff;
+}watchdata;
+static const size_t DEFAULT_LOG_SIZE=4096;
+static const size_t MAX_WATCH_LEN=64*1024*1024;
+//the memory map is read again when a watch is added, and every this many ticks
+static const uint32_t RANGE_CHECK_TICKS=100;
+
 enum HEXVIEW_STATES
 {
 	STATE_OFF,STATE_ON
 };
 command_result memview (color_ostream &out, vector <string> & parameters);
+command_result memwatch (color_ostream &out, vector <string> & parameters);
 
 DFHACK_PLUGIN("memview");
 
 DFhackCExport command_result plugin_init (color_ostream &out, std::vector <PluginCommand> &commands)
 {
 	commands.push_back(PluginCommand("memview","Shows memory in real time. Params: adrr length refresh_rate. If addr==0 then stop viewing",memview));
+	commands.push_back(PluginCommand("memwatch","Logs every change to watched memory regions.",memwatch,false,
+		"  memwatch add <addr> <length> [name]\n"
+		"    Watch length bytes at the hex address addr.\n"
+		"  memwatch remove <id>|all\n"
+		"  memwatch list\n"
+		"  memwatch log [count]\n"
+		"    Show the last count changes, 20 by default.\n"
+		"  memwatch clear\n"
+		"    Forget the logged changes.\n"
+		"  memwatch logsize <count>\n"
+		"    Keep up to count changes, 4096 by default.\n"
+		"Memory is compared a word at a time, once per frame.\n"
+		"Watches on memory that gets unmapped are dropped within 100 frames.\n"
+		"The log can also be read over RPC with GetMemChanges.\n"
+	));
 	memdata.state=STATE_OFF;
+	watchdata.next_id=1;
+	watchdata.tick=0;
+	watchdata.next_seq=0;
+	watchdata.ring.resize(DEFAULT_LOG_SIZE);
 	mymutex=new tthread::mutex;
     return CR_OK;
 }
@@ -49,16 +111,20 @@ size_t convert(const std::string& p,bool ishex=false)
 	conv>>ret;
 	return ret;
 }
-bool isAddr(uint32_t *trg,vector<t_memrange> & ranges)
+//classify every aligned word of the buffer that looks like a pointer, all at once
+void classifyWords(uint8_t *buf,size_t len)
 {
-	if(trg[0]%4==0)
-		for(size_t i=0;i<ranges.size();i++)
-			if(ranges[i].isInRange((void *)trg[0]))
-				return true;
-
-	return false;
+	memdata.words.clear();
+	for(size_t i=0;i+4<=len;i+=4)
+	{
+		uint32_t val=*(uint32_t *)(buf+i);
+		memdata.words.push_back(val%4==0 ? (const void *)(size_t)val : NULL);
+	}
+	memdata.classes.resize(memdata.words.size());
+	if(!memdata.words.empty())
+		Core::getInstance().p->classifyAddresses(&memdata.words[0],memdata.words.size(),&memdata.classes[0]);
 }
-void outputHex(uint8_t *buf,uint8_t *lbuf,size_t len,size_t start,color_ostream &con,vector<t_memrange> & ranges)
+void outputHex(uint8_t *buf,uint8_t *lbuf,size_t len,size_t start,color_ostream &con)
 {
     const size_t page_size=16;
 
@@ -72,7 +138,11 @@ void outputHex(uint8_t *buf,uint8_t *lbuf,size_t len,size_t start,color_ostream
 				{
 					con.reset_color();
 
-					if(isAddr((uint32_t *)(buf+j+i),ranges))
+					size_t word=(i+j)/4;
+					MemClass cls=word<memdata.classes.size() ? memdata.classes[word] : MEM_UNMAPPED;
+					if(cls==MEM_CODE)
+						con.color(Console::COLOR_LIGHTGREEN);
+					else if(cls!=MEM_UNMAPPED)
 						con.color(Console::COLOR_LIGHTRED); //coloring in the middle does not work
                     //TODO make something better?
 				}
@@ -92,6 +162,120 @@ void outputHex(uint8_t *buf,uint8_t *lbuf,size_t len,size_t start,color_ostream
 	}
 	con.print("\n");
 }
+//is all of [addr,addr+len) mapped and readable
+bool isReadable(void *addr,size_t len)
+{
+	Process *p=Core::getInstance().p;
+	const char *pos=(const char *)addr;
+	const char *end=pos+len;
+	if(end<pos)
+		return false;
+	while(pos<end)
+	{
+		const t_memrange *range=p->findMemRange(pos);
+		if(!range || !range->read)
+			return false;
+		pos=(const char *)range->end;
+	}
+	return true;
+}
+uint32_t readWord(const uint8_t *data,size_t avail)
+{
+	uint32_t val=0;
+	memcpy(&val,data,std::min(avail,size_t(4)));
+	return val;
+}
+uint64_t oldestChange()
+{
+	uint64_t size=watchdata.ring.size();
+	return watchdata.next_seq>size ? watchdata.next_seq-size : 0;
+}
+mem_watch *findWatch(int id)
+{
+	for(size_t i=0;i<watchdata.watches.size();i++)
+		if(watchdata.watches[i].id==id)
+			return &watchdata.watches[i];
+	return NULL;
+}
+int addWatch(color_ostream &out,void *addr,size_t len,const string &name)
+{
+	if(len==0 || len>MAX_WATCH_LEN)
+	{
+		out.printerr("Invalid length: %u\n",len);
+		return -1;
+	}
+	Core::getInstance().p->refreshMemRanges();
+	if(!isReadable(addr,len))
+	{
+		out.printerr("Not readable memory: 0x%08x-0x%08x\n",addr,(char *)addr+len);
+		return -1;
+	}
+	mem_watch w;
+	w.id=watchdata.next_id++;
+	w.addr=(uint8_t *)addr;
+	w.len=len;
+	w.name=name;
+	watchdata.watches.push_back(w);
+	mem_watch &added=watchdata.watches.back();
+	added.last.assign(added.addr,added.addr+len);
+	return added.id;
+}
+bool removeWatch(int id)
+{
+	for(size_t i=0;i<watchdata.watches.size();i++)
+		if(watchdata.watches[i].id==id)
+		{
+			watchdata.watches.erase(watchdata.watches.begin()+i);
+			return true;
+		}
+	return false;
+}
+void logChange(mem_watch &w,uint32_t offset,uint32_t oldval,uint32_t newval)
+{
+	mem_change &c=watchdata.ring[watchdata.next_seq%watchdata.ring.size()];
+	c.seq=watchdata.next_seq++;
+	c.tick=watchdata.tick;
+	c.watch=w.id;
+	c.offset=offset;
+	c.oldval=oldval;
+	c.newval=newval;
+}
+void checkWatches(color_ostream &out)
+{
+	watchdata.tick++;
+	if(watchdata.watches.empty())
+		return;
+
+	//drop regions that went away before touching them
+	if(watchdata.tick%RANGE_CHECK_TICKS==0 && Core::getInstance().p->refreshMemRanges())
+		for(size_t i=0;i<watchdata.watches.size();)
+		{
+			mem_watch &w=watchdata.watches[i];
+			if(isReadable(w.addr,w.len))
+			{
+				i++;
+				continue;
+			}
+			out.printerr("memwatch: region %d at 0x%08x was unmapped, removed.\n",w.id,w.addr);
+			watchdata.watches.erase(watchdata.watches.begin()+i);
+		}
+
+	for(size_t i=0;i<watchdata.watches.size();i++)
+	{
+		mem_watch &w=watchdata.watches[i];
+		watchdata.diff.clear();
+		MemScan::diffWords(watchdata.diff,w.addr,&w.last[0],w.len);
+		for(size_t j=0;j<watchdata.diff.size();j++)
+		{
+			size_t off=watchdata.diff[j];
+			size_t avail=w.len-off;
+			uint32_t oldval=readWord(&w.last[off],avail);
+			uint32_t newval=readWord(w.addr+off,avail);
+			memcpy(&w.last[off],w.addr+off,std::min(avail,size_t(4)));
+			logChange(w,off,oldval,newval);
+		}
+	}
+}
 void Deinit()
 {
 	if(memdata.state==STATE_ON)
@@ -105,6 +289,7 @@ DFhackCExport command_result plugin_onupdate (color_ostream &out)
 {
 
 	mymutex->lock();
+	checkWatches(out);
 	if(memdata.state==STATE_OFF)
 	{
 		mymutex->unlock();
@@ -123,7 +308,21 @@ DFhackCExport command_result plugin_onupdate (color_ostream &out)
 	timeLast = time2;
 
 	Core::getInstance().p->read(memdata.addr,memdata.len,memdata.buf);
-	outputHex(memdata.buf,memdata.lbuf,memdata.len,(size_t)memdata.addr,out,memdata.ranges);
+	//only redraw when something changed
+	if(memdata.shown)
+	{
+		memdata.changed.clear();
+		MemScan::diffWords(memdata.changed,memdata.buf,memdata.lbuf,memdata.len);
+		if(memdata.changed.empty())
+		{
+			mymutex->unlock();
+			return CR_OK;
+		}
+	}
+	memdata.shown=true;
+	Core::getInstance().p->refreshMemRanges(); //cheap unless the map changed
+	classifyWords(memdata.buf,memdata.len);
+	outputHex(memdata.buf,memdata.lbuf,memdata.len,(size_t)memdata.addr,out);
     memcpy(memdata.lbuf, memdata.buf, memdata.len);
 	if(memdata.refresh==0)
 		Deinit();
@@ -134,7 +333,7 @@ DFhackCExport command_result plugin_onupdate (color_ostream &out)
 command_result memview (color_ostream &out, vector <string> & parameters)
 {
 	mymutex->lock();
-	Core::getInstance().p->getMemRanges(memdata.ranges);
+	Core::getInstance().p->refreshMemRanges();
 	memdata.addr=(void *)convert(parameters[0],true);
 	if(memdata.addr==0)
 	{
@@ -146,11 +345,7 @@ command_result memview (color_ostream &out, vector <string> & parameters)
 	else
 	{
 		Deinit();
-		bool isValid=false;
-		for(size_t i=0;i<memdata.ranges.size();i++)
-			if(memdata.ranges[i].isInRange(memdata.addr))
-				isValid=true;
-		if(!isValid)
+		if(!Core::getInstance().p->findMemRange(memdata.addr))
 		{
 			out.printerr("Invalid address:%x\n",memdata.addr);
 			mymutex->unlock();
@@ -172,15 +367,171 @@ command_result memview (color_ostream &out, vector <string> & parameters)
 	uint8_t *buf,*lbuf;
 	memdata.buf=new uint8_t[memdata.len];
 	memdata.lbuf=new uint8_t[memdata.len];
-	Core::getInstance().p->getMemRanges(memdata.ranges);
+	memdata.shown=false;
 	mymutex->unlock();
 	return CR_OK;
 }
+void printChange(color_ostream &out,const mem_change &c)
+{
+	mem_watch *w=findWatch(c.watch);
+	out.print("%8u  #%d",c.tick,c.watch);
+	if(w)
+	{
+		if(!w->name.empty())
+			out.print(" %s",w->name.c_str());
+		out.print(" +0x%04x (0x%08x)",c.offset,w->addr+c.offset);
+	}
+	else
+		out.print(" +0x%04x",c.offset);
+	out.print("  %08x -> %08x\n",c.oldval,c.newval);
+}
+command_result memwatch (color_ostream &out, vector <string> & parameters)
+{
+	if(parameters.empty())
+		return CR_WRONG_USAGE;
+
+	tthread::lock_guard<tthread::mutex> lock(*mymutex);
+	const string &cmd=parameters[0];
+	if(cmd=="add" && parameters.size()>=3)
+	{
+		void *addr=(void *)convert(parameters[1],true);
+		size_t len=convert(parameters[2]);
+		int id=addWatch(out,addr,len,parameters.size()>3 ? parameters[3] : "");
+		if(id<0)
+			return CR_FAILURE;
+		out.print("Watching %u bytes at 0x%08x as #%d.\n",len,addr,id);
+	}
+	else if(cmd=="remove" && parameters.size()==2)
+	{
+		if(parameters[1]=="all")
+			watchdata.watches.clear();
+		else if(!removeWatch(convert(parameters[1])))
+		{
+			out.printerr("No watch #%s.\n",parameters[1].c_str());
+			return CR_FAILURE;
+		}
+	}
+	else if(cmd=="list")
+	{
+		if(watchdata.watches.empty())
+			out.print("Nothing is watched.\n");
+		for(size_t i=0;i<watchdata.watches.size();i++)
+		{
+			mem_watch &w=watchdata.watches[i];
+			out.print("#%d  0x%08x  %u bytes  %s\n",w.id,w.addr,w.len,w.name.c_str());
+		}
+		out.print("%u changes logged, %u kept.\n",
+			(unsigned)watchdata.next_seq,(unsigned)(watchdata.next_seq-oldestChange()));
+	}
+	else if(cmd=="log")
+	{
+		uint64_t count=parameters.size()>1 ? convert(parameters[1]) : 20;
+		uint64_t first=oldestChange();
+		if(watchdata.next_seq-first>count)
+			first=watchdata.next_seq-count;
+		for(uint64_t seq=first;seq<watchdata.next_seq;seq++)
+			printChange(out,watchdata.ring[seq%watchdata.ring.size()]);
+	}
+	else if(cmd=="clear")
+	{
+		watchdata.next_seq=0;
+	}
+	else if(cmd=="logsize" && parameters.size()==2)
+	{
+		size_t size=convert(parameters[1]);
+		if(size==0)
+			return CR_WRONG_USAGE;
+		//the log is indexed by sequence number, so it starts over
+		watchdata.ring.assign(size,mem_change());
+		watchdata.next_seq=0;
+	}
+	else
+		return CR_WRONG_USAGE;
+
+	return CR_OK;
+}
+
+static void describeWatch(const mem_watch &w,MemWatchInfo *info)
+{
+	info->set_id(w.id);
+	info->set_address((uint32_t)(size_t)w.addr);
+	info->set_length(w.len);
+	if(!w.name.empty())
+		info->set_name(w.name);
+}
+
+static command_result AddMemWatch(color_ostream &stream, const MemWatchIn *in, MemWatchInfo *out)
+{
+	tthread::lock_guard<tthread::mutex> lock(*mymutex);
+	int id=addWatch(stream,(void *)(size_t)in->address(),in->length(),in->name());
+	if(id<0)
+		return CR_FAILURE;
+	describeWatch(*findWatch(id),out);
+	return CR_OK;
+}
+
+static command_result RemoveMemWatch(color_ostream &stream, const MemWatchRemoveIn *in)
+{
+	tthread::lock_guard<tthread::mutex> lock(*mymutex);
+	if(!in->has_id())
+	{
+		watchdata.watches.clear();
+		return CR_OK;
+	}
+	return removeWatch(in->id()) ? CR_OK : CR_NOT_FOUND;
+}
+
+static command_result ListMemWatches(color_ostream &stream, const EmptyMessage *in, MemWatchList *out)
+{
+	tthread::lock_guard<tthread::mutex> lock(*mymutex);
+	for(size_t i=0;i<watchdata.watches.size();i++)
+		describeWatch(watchdata.watches[i],out->add_watches());
+	return CR_OK;
+}
+
+static command_result GetMemChanges(color_ostream &stream, const MemChangesIn *in, MemChangesOut *out)
+{
+	tthread::lock_guard<tthread::mutex> lock(*mymutex);
+	uint64_t since=in->since();
+	uint64_t first=std::max(since,oldestChange());
+	uint64_t count=in->has_max_count() ? std::max(in->max_count(),0) : 1024;
+	uint64_t last=std::min(watchdata.next_seq,first+count);
+	//a cleared log starts over from 0
+	if(since>watchdata.next_seq)
+		first=last=watchdata.next_seq;
+
+	for(uint64_t seq=first;seq<last;seq++)
+	{
+		const mem_change &c=watchdata.ring[seq%watchdata.ring.size()];
+		MemChange *item=out->add_changes();
+		item->set_seq(c.seq);
+		item->set_tick(c.tick);
+		item->set_watch_id(c.watch);
+		item->set_offset(c.offset);
+		item->set_old_value(c.oldval);
+		item->set_new_value(c.newval);
+	}
+	out->set_next(last);
+	if(first>since)
+		out->set_lost(first-since);
+	return CR_OK;
+}
+
+DFhackCExport RPCService *plugin_rpcconnect(color_ostream &)
+{
+	RPCService *svc=new RPCService();
+	svc->addFunction("AddMemWatch",AddMemWatch);
+	svc->addFunction("RemoveMemWatch",RemoveMemWatch);
+	svc->addFunction("ListMemWatches",ListMemWatches);
+	svc->addFunction("GetMemChanges",GetMemChanges);
+	return svc;
+}
 DFhackCExport command_result plugin_shutdown (color_ostream &out)
 {
 	mymutex->lock();
 	Deinit();
-	delete mymutex;
+	watchdata.watches.clear();
 	mymutex->unlock();
+	delete mymutex;
 	return CR_OK;
 }
@@ -8,6 +8,7 @@
 #include <Export.h>
 #include <PluginManager.h>
 #include <MemAccess.h>
+#include <MemScan.h>
 #include <vector>
 #include <string>
 
@@ -58,8 +59,12 @@ static bool hexOrDec(string &str, uint32_t &value)
     return false;
 }
 
-static bool mightBeVec(vector<t_memrange> &heap_ranges,
-                       t_vecTriplet *vec)
+static bool inHeap(Process *p, void * ptr)
+{
+    return p->classifyAddress(ptr) == MEM_HEAP;
+}
+
+static bool mightBeVec(Process *p, t_vecTriplet *vec)
 {
     if ((vec->start > vec->end) || (vec->end > vec->alloc_end))
         return false;
@@ -70,55 +75,8 @@ static bool mightBeVec(vector<t_memrange> &heap_ranges,
     if (((int)vec->start % 4 != 0) || ((int)vec->alloc_end % 4 != 0))
         return false;
 
-    for (size_t i = 0; i < heap_ranges.size(); i++)
-    {
-        t_memrange &range = heap_ranges[i];
-
-        if (range.isInRange(vec->start) && range.isInRange(vec->alloc_end))
-            return true;
-    }
-
-    return false;
-}
-
-static bool inAnyRange(vector<t_memrange> &ranges, void * ptr)
-{
-    for (size_t i = 0; i < ranges.size(); i++)
-    {
-        if (ranges[i].isInRange(ptr))
-            return true;
-    }
-
-    return false;
-}
-
-static bool getHeapRanges(color_ostream &out, std::vector<t_memrange> &heap_ranges)
-{
-    std::vector<t_memrange> ranges;
-
-    Core::getInstance().p->getMemRanges(ranges);
-
-    for (size_t i = 0; i < ranges.size(); i++)
-    {
-        t_memrange &range = ranges[i];
-
-        // Some kernels don't report [heap], and the heap can consist of
-        // more segments than just the one labeled with [heap], so include
-        // all segments which *might* be part of the heap.
-        if (range.read && range.write && !range.shared)
-        {
-            if (strlen(range.name) == 0 || strcmp(range.name, "[heap]") == 0)
-                heap_ranges.push_back(range);
-        }
-    }
-
-    if (heap_ranges.empty())
-    {
-        out << "No possible heap segments." << std::endl;
-        return false;
-    }
-
-    return true;
+    const t_memrange *range = p->findMemRange(vec->start);
+    return range && range->isInRange(vec->alloc_end) && inHeap(p, vec->start);
 }
 
 ////////////////////////////////////////
@@ -171,78 +129,42 @@ command_result df_vectors (color_ostream &con, vector <string> & parameters)
 
     CoreSuspender suspend;
 
-    std::vector<t_memrange> heap_ranges;
+    Process *p = Core::getInstance().p;
+    p->refreshMemRanges();
 
-    if (!getHeapRanges(con, heap_ranges))
+    const t_memrange *range = p->findMemRange((void *)start);
+    if (!range || !inHeap(p, (void *)start))
     {
+        con << "Address not in any memory range." << std::endl;
         return CR_FAILURE;
     }
 
-    bool startInRange = false;
-    for (size_t i = 0; i < heap_ranges.size(); i++)
+    if (!range->isInRange((void *)end))
     {
-        t_memrange &range = heap_ranges[i];
-
-        if (!range.isInRange((void *)start))
-            continue;
-
-        // Found the range containing the start
-        if (!range.isInRange((void *)end))
-        {
-            con.print("Scanning %u bytes would read past end of memory "
-                      "range.\n", bytes);
-            uint32_t diff = end - (int)range.end;
-            con.print("Cutting bytes down by %u.\n", diff);
+        con.print("Scanning %u bytes would read past end of memory "
+                  "range.\n", bytes);
+        uint32_t diff = end - (int)range->end;
+        con.print("Cutting bytes down by %u.\n", diff);
 
-            end = (uint32_t) range.end;
-        }
-        startInRange = true;
-        break;
-    } // for (size_t i = 0; i < ranges.size(); i++)
-
-    if (!startInRange)
-    {
-        con << "Address not in any memory range." << std::endl;
-        return CR_FAILURE;
+        end = (uint32_t) range->end;
     }
 
-    uint32_t pos = start;
+    // the scan itself is split across threads
+    MemScan::Snapshot heap, scan;
+    heap.capture(p, MemScan::HEAP);
+    scan.capture(p, MemScan::HEAP);
+    scan.clip((void *)start, (void *)end);
 
-    const uint32_t ptr_size = sizeof(void*);
+    std::vector<MemScan::VectorHit> hits;
+    MemScan::findVectors(hits, scan, heap);
 
-    for (uint32_t pos = start; pos < end; pos += ptr_size)
+    for (size_t i = 0; i < hits.size(); i++)
     {
-        // Is it an embeded vector?
-        if (pos <= ( end - sizeof(t_vecTriplet) ))
-        {
-            t_vecTriplet* vec = (t_vecTriplet*) pos;
-
-            if (mightBeVec(heap_ranges, vec))
-            {
-                printVec(con, "VEC:", vec, start, pos);
-                // Skip over rest of vector.
-                pos += sizeof(t_vecTriplet) - ptr_size;
-                continue;
-            }
-        }
-
-        // Is it a vector pointer?
-        if (pos <= (end - ptr_size))
-        {
-            uint32_t ptr = * ( (uint32_t*) pos);
-
-            if (inAnyRange(heap_ranges, (void *) ptr))
-            {
-                t_vecTriplet* vec = (t_vecTriplet*) ptr;
+        MemScan::VectorHit &hit = hits[i];
+        t_vecTriplet vec = { hit.start, hit.end, hit.alloc_end };
 
-                if (mightBeVec(heap_ranges, vec))
-                {
-                    printVec(con, "VEC PTR:", vec, start, pos);
-                    continue;
-                }
-            }
-        }
-    } // for (uint32_t pos = start; pos < end; pos += ptr_size)
+        printVec(con, hit.indirect ? "VEC PTR:" : "VEC:", &vec, start, (uint32_t)hit.addr);
+    }
 
     return CR_OK;
 }
@@ -282,12 +204,8 @@ command_result df_clearvec (color_ostream &con, vector <string> & parameters)
 
     CoreSuspender suspend;
 
-    std::vector<t_memrange> heap_ranges;
-
-    if (!getHeapRanges(con, heap_ranges))
-    {
-        return CR_FAILURE;
-    }
+    Process *p = Core::getInstance().p;
+    p->refreshMemRanges();
 
     for (size_t i = 0; i < parameters.size(); i++)
     {
@@ -305,7 +223,7 @@ command_result df_clearvec (color_ostream &con, vector <string> & parameters)
             continue;
         }
 
-        if (!inAnyRange(heap_ranges, (void *) addr))
+        if (!inHeap(p, (void *) addr))
         {
             con << addr_str << " not in any valid address range." << std::endl;
             continue;
@@ -315,7 +233,7 @@ command_result df_clearvec (color_ostream &con, vector <string> & parameters)
         bool          ptr   = false;
         t_vecTriplet* vec   = (t_vecTriplet*) addr;
 
-        if (mightBeVec(heap_ranges, vec))
+        if (mightBeVec(p, vec))
             valid = true;
         else
         {
@@ -323,7 +241,7 @@ command_result df_clearvec (color_ostream &con, vector <string> & parameters)
             addr = * ( (uint32_t*) addr);
             vec  = (t_vecTriplet*) addr;
 
-            if (inAnyRange(heap_ranges, (void *) addr) && mightBeVec(heap_ranges, vec))
+            if (inHeap(p, (void *) addr) && mightBeVec(p, vec))
             {
                 valid = true;
                 ptr   = true;
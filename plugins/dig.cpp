@@ -5,15 +5,14 @@
 #include "modules/Maps.h"
 #include "modules/Gui.h"
 #include "modules/MapCache.h"
+#include "modules/FloodFill.h"
 #include "modules/Materials.h"
 #include <vector>
 #include <cstdio>
-#include <stack>
 #include <string>
 #include <cmath>
 using std::vector;
 using std::string;
-using std::stack;
 using namespace DFHack;
 using namespace df::enums;
 
@@ -964,6 +963,113 @@ command_result digexp (color_ostream &out, vector <string> & parameters)
     return CR_OK;
 }
 
+// digv and digl share the flood fill and only differ in which tiles belong to the
+// dug out body: the same vein as the start tile, or vein-free layer stone of the
+// same material.
+struct DigFill
+{
+    MapExtras::MapCache &mc;
+    MapExtras::FloodFill &flood;
+    int16_t veinmat;
+    int16_t basemat;
+    bool updown;
+    bool undo;
+    int32_t tx_max;
+    int32_t ty_max;
+
+    DigFill(MapExtras::MapCache &mc, MapExtras::FloodFill &flood)
+        : mc(mc), flood(flood), veinmat(-1), basemat(-1),
+          updown(false), undo(false), tx_max(0), ty_max(0)
+    {}
+
+    bool inside(MapExtras::Block *b, df::coord2d p, DFHack::DFCoord c)
+    {
+        // don't dig the borders
+        if(c.x < 1 || c.x > tx_max - 2 || c.y < 1 || c.y > ty_max - 2)
+            return false;
+
+        df::tiletype tt = b->TileTypeAt(p);
+        if(!DFHack::isWallTerrain(tt))
+            return false;
+        if(b->veinMaterialAt(p) != veinmat)
+            return false;
+
+        if(veinmat == -1)
+        {
+            if(b->baseMaterialAt(p) != basemat)
+                return false;
+
+            // don't dig out LAVA_STONE or MAGMA (semi-molten rock) accidentally
+            if(    tileMaterial(tt)!=tiletype_material::STONE
+                && tileMaterial(tt)!=tiletype_material::SOIL)
+                return false;
+        }
+        return true;
+    }
+
+    // tiles the flood is still going to reach get a stair connecting them to the current one
+    bool needsStair(DFHack::DFCoord c)
+    {
+        MapExtras::Block *b = mc.BlockAt(c / 16);
+        if(!b || !b->valid)
+            return false;
+        return inside(b, c % 16, c) && !flood.visited(c);
+    }
+
+    void visit(MapExtras::Block *b, df::coord2d p, DFHack::DFCoord current, MapExtras::FloodDirection)
+    {
+        df::tile_designation des = b->DesignationAt(p);
+
+        if(updown)
+        {
+            if(needsStair(current-1))
+            {
+                df::tile_designation des_minus = mc.designationAt(current-1);
+                if(des_minus.bits.dig == tile_dig_designation::DownStair)
+                    des_minus.bits.dig = tile_dig_designation::UpDownStair;
+                else
+                    des_minus.bits.dig = tile_dig_designation::UpStair;
+                // undo mode: clear designation
+                if(undo)
+                    des_minus.bits.dig = tile_dig_designation::No;
+                mc.setDesignationAt(current-1,des_minus);
+
+                des.bits.dig = tile_dig_designation::DownStair;
+            }
+            if(needsStair(current+1))
+            {
+                df::tile_designation des_plus = mc.designationAt(current+1);
+                if(des_plus.bits.dig == tile_dig_designation::UpStair)
+                    des_plus.bits.dig = tile_dig_designation::UpDownStair;
+                else
+                    des_plus.bits.dig = tile_dig_designation::DownStair;
+                // undo mode: clear designation
+                if(undo)
+                    des_plus.bits.dig = tile_dig_designation::No;
+                mc.setDesignationAt(current+1,des_plus);
+
+                if(des.bits.dig == tile_dig_designation::DownStair)
+                    des.bits.dig = tile_dig_designation::UpDownStair;
+                else
+                    des.bits.dig = tile_dig_designation::UpStair;
+            }
+        }
+        if(des.bits.dig == tile_dig_designation::No)
+            des.bits.dig = tile_dig_designation::Default;
+        // undo mode: clear designation
+        if(undo)
+            des.bits.dig = tile_dig_designation::No;
+        b->setDesignationAt(p,des);
+    }
+
+    int vertical(MapExtras::Block *, df::coord2d, DFHack::DFCoord)
+    {
+        return updown ? (MapExtras::FLOOD_UP | MapExtras::FLOOD_DOWN) : 0;
+    }
+
+    void border(MapExtras::Block *, df::coord2d, DFHack::DFCoord, MapExtras::FloodDirection) {}
+};
+
 command_result digvx (color_ostream &out, vector <string> & parameters)
 {
     // HOTKEY COMMAND: CORE ALREADY SUSPENDED
@@ -1020,112 +1126,17 @@ command_result digv (color_ostream &out, vector <string> & parameters)
         return CR_FAILURE;
     }
     con.print("%d/%d/%d tiletype: %d, veinmat: %d, designation: 0x%x ... DIGGING!\n", cx,cy,cz, tt, veinmat, des.whole);
-    stack <DFHack::DFCoord> flood;
-    flood.push(xy);
 
-    while( !flood.empty() )
-    {
-        DFHack::DFCoord current = flood.top();
-        flood.pop();
-        int16_t vmat2 = MCache->veinMaterialAt(current);
-        tt = MCache->tiletypeAt(current);
-        if(!DFHack::isWallTerrain(tt))
-            continue;
-        if(vmat2!=veinmat)
-            continue;
+    MapExtras::FloodFill flood(*MCache, true);
+    DigFill fill(*MCache, flood);
+    fill.veinmat = veinmat;
+    fill.updown = updown;
+    fill.tx_max = tx_max;
+    fill.ty_max = ty_max;
+    flood.run(xy, fill);
 
-        // found a good tile, dig+unset material
-        df::tile_designation des = MCache->designationAt(current);
-        df::tile_designation des_minus;
-        df::tile_designation des_plus;
-        des_plus.whole = des_minus.whole = 0;
-        int16_t vmat_minus = -1;
-        int16_t vmat_plus = -1;
-        bool below = 0;
-        bool above = 0;
-        if(updown)
-        {
-            if(MCache->testCoord(current-1))
-            {
-                below = 1;
-                des_minus = MCache->designationAt(current-1);
-                vmat_minus = MCache->veinMaterialAt(current-1);
-            }
-
-            if(MCache->testCoord(current+1))
-            {
-                above = 1;
-                des_plus = MCache->designationAt(current+1);
-                vmat_plus = MCache->veinMaterialAt(current+1);
-            }
-        }
-        if(MCache->testCoord(current))
-        {
-            MCache->clearVeinMaterialAt(current);
-            if(current.x < tx_max - 2)
-            {
-                flood.push(DFHack::DFCoord(current.x + 1, current.y, current.z));
-                if(current.y < ty_max - 2)
-                {
-                    flood.push(DFHack::DFCoord(current.x + 1, current.y + 1,current.z));
-                    flood.push(DFHack::DFCoord(current.x, current.y + 1,current.z));
-                }
-                if(current.y > 1)
-                {
-                    flood.push(DFHack::DFCoord(current.x + 1, current.y - 1,current.z));
-                    flood.push(DFHack::DFCoord(current.x, current.y - 1,current.z));
-                }
-            }
-            if(current.x > 1)
-            {
-                flood.push(DFHack::DFCoord(current.x - 1, current.y,current.z));
-                if(current.y < ty_max - 2)
-                {
-                    flood.push(DFHack::DFCoord(current.x - 1, current.y + 1,current.z));
-                    flood.push(DFHack::DFCoord(current.x, current.y + 1,current.z));
-                }
-                if(current.y > 1)
-                {
-                    flood.push(DFHack::DFCoord(current.x - 1, current.y - 1,current.z));
-                    flood.push(DFHack::DFCoord(current.x, current.y - 1,current.z));
-                }
-            }
-            if(updown)
-            {
-                if(current.z > 0 && below && vmat_minus == vmat2)
-                {
-                    flood.push(current-1);
-
-                    if(des_minus.bits.dig == tile_dig_designation::DownStair)
-                        des_minus.bits.dig = tile_dig_designation::UpDownStair;
-                    else
-                        des_minus.bits.dig = tile_dig_designation::UpStair;
-                    MCache->setDesignationAt(current-1,des_minus);
-
-                    des.bits.dig = tile_dig_designation::DownStair;
-                }
-                if(current.z < z_max - 1 && above && vmat_plus == vmat2)
-                {
-                    flood.push(current+ 1);
-
-                    if(des_plus.bits.dig == tile_dig_designation::UpStair)
-                        des_plus.bits.dig = tile_dig_designation::UpDownStair;
-                    else
-                        des_plus.bits.dig = tile_dig_designation::DownStair;
-                    MCache->setDesignationAt(current+1,des_plus);
-
-                    if(des.bits.dig == tile_dig_designation::DownStair)
-                        des.bits.dig = tile_dig_designation::UpDownStair;
-                    else
-                        des.bits.dig = tile_dig_designation::UpStair;
-                }
-            }
-            if(des.bits.dig == tile_dig_designation::No)
-                des.bits.dig = tile_dig_designation::Default;
-            MCache->setDesignationAt(current,des);
-        }
-    }
     MCache->WriteAll();
+    delete MCache;
     return CR_OK;
 }
 
@@ -1137,12 +1148,6 @@ command_result diglx (color_ostream &out, vector <string> & parameters)
     return digl(out,lol);
 }
 
-// TODO: 
-// digl and digv share the longish floodfill code and only use different conditions
-// to check if a tile should be marked for digging or not.
-// to make the plugin a bit smaller and cleaner a main execute method would be nice
-// (doing the floodfill stuff and do the checks dependin on whether called in
-// "vein" or "layer" mode)
 command_result digl (color_ostream &out, vector <string> & parameters)
 {
     // HOTKEY COMMAND: CORE ALREADY SUSPENDED
@@ -1153,7 +1158,6 @@ command_result digl (color_ostream &out, vector <string> & parameters)
     {
         if(parameters[i]=="x")
         {
-            out << "This might take a while for huge layers..." << std::endl;
             updown = true;
         }
         else if(parameters[i]=="undo")
@@ -1201,142 +1205,18 @@ command_result digl (color_ostream &out, vector <string> & parameters)
         return CR_FAILURE;
     }
     con.print("%d/%d/%d tiletype: %d, basemat: %d, designation: 0x%x ... DIGGING!\n", cx,cy,cz, tt, basemat, des.whole);
-    stack <DFHack::DFCoord> flood;
-    flood.push(xy);
-
-    int i = 0;
-    while( !flood.empty() )
-    {
-        DFHack::DFCoord current = flood.top();
-        flood.pop();
-        int16_t vmat2 = MCache->veinMaterialAt(current);
-        int16_t bmat2 = MCache->baseMaterialAt(current);
-        tt = MCache->tiletypeAt(current);
-
-        if(!DFHack::isWallTerrain(tt))
-            continue;
-        if(vmat2!=-1)
-            continue;
-        if(bmat2!=basemat)
-            continue;
-
-        // don't dig out LAVA_STONE or MAGMA (semi-molten rock) accidentally
-        if(    tileMaterial(tt)!=tiletype_material::STONE
-            && tileMaterial(tt)!=tiletype_material::SOIL)
-            continue;
-
-        // found a good tile, dig+unset material
-        df::tile_designation des = MCache->designationAt(current);
-        df::tile_designation des_minus;
-        df::tile_designation des_plus;
-        des_plus.whole = des_minus.whole = 0;
-        int16_t vmat_minus = -1;
-        int16_t vmat_plus = -1;
-        int16_t bmat_minus = -1;
-        int16_t bmat_plus = -1;
-        df::tiletype tt_minus;
-        df::tiletype tt_plus;
-
-        if(MCache->testCoord(current))
-        {
-            MCache->clearBaseMaterialAt(current);
-            if(current.x < tx_max - 2)
-            {
-                flood.push(DFHack::DFCoord(current.x + 1, current.y, current.z));
-                if(current.y < ty_max - 2)
-                {
-                    flood.push(DFHack::DFCoord(current.x + 1, current.y + 1, current.z));
-                    flood.push(DFHack::DFCoord(current.x, current.y + 1, current.z));
-                }
-                if(current.y > 1)
-                {
-                    flood.push(DFHack::DFCoord(current.x + 1, current.y - 1, current.z));
-                    flood.push(DFHack::DFCoord(current.x, current.y - 1, current.z));
-                }
-            }
-            if(current.x > 1)
-            {
-                flood.push(DFHack::DFCoord(current.x - 1, current.y, current.z));
-                if(current.y < ty_max - 2)
-                {
-                    flood.push(DFHack::DFCoord(current.x - 1, current.y + 1, current.z));
-                    flood.push(DFHack::DFCoord(current.x, current.y + 1, current.z));
-                }
-                if(current.y > 1)
-                {
-                    flood.push(DFHack::DFCoord(current.x - 1, current.y - 1, current.z));
-                    flood.push(DFHack::DFCoord(current.x, current.y - 1, current.z));
-                }
-            }
-            if(updown)
-            {
-                bool below = 0;
-                bool above = 0;
-                if(MCache->testCoord(current-1))
-                {
-                    //below = 1;
-                    des_minus = MCache->designationAt(current-1);
-                    vmat_minus = MCache->veinMaterialAt(current-1);
-                    bmat_minus = MCache->baseMaterialAt(current-1);
-                    tt_minus = MCache->tiletypeAt(current-1);
-                    if (   tileMaterial(tt_minus)==tiletype_material::STONE
-                        || tileMaterial(tt_minus)==tiletype_material::SOIL)
-                        below = 1;
-                }
-                if(MCache->testCoord(current+1))
-                {
-                    //above = 1;
-                    des_plus = MCache->designationAt(current+1);
-                    vmat_plus = MCache->veinMaterialAt(current+1);
-                    bmat_plus = MCache->baseMaterialAt(current+1);
-                    tt_plus = MCache->tiletypeAt(current+1);
-                    if (   tileMaterial(tt_plus)==tiletype_material::STONE
-                        || tileMaterial(tt_plus)==tiletype_material::SOIL)
-                        above = 1;
-                }
-                if(current.z > 0 && below && vmat_minus == -1 && bmat_minus == basemat)
-                {
-                    flood.push(current-1);
 
-                    if(des_minus.bits.dig == tile_dig_designation::DownStair)
-                        des_minus.bits.dig = tile_dig_designation::UpDownStair;
-                    else
-                        des_minus.bits.dig = tile_dig_designation::UpStair;
-                    // undo mode: clear designation
-                    if(undo)
-                        des_minus.bits.dig = tile_dig_designation::No;
-                    MCache->setDesignationAt(current-1,des_minus);
-
-                    des.bits.dig = tile_dig_designation::DownStair;
-                }
-                if(current.z < z_max - 1 && above && vmat_plus == -1 && bmat_plus == basemat)
-                {
-                    flood.push(current+ 1);
+    MapExtras::FloodFill flood(*MCache, true);
+    DigFill fill(*MCache, flood);
+    fill.basemat = basemat;
+    fill.updown = updown;
+    fill.undo = undo;
+    fill.tx_max = tx_max;
+    fill.ty_max = ty_max;
+    flood.run(xy, fill);
 
-                    if(des_plus.bits.dig == tile_dig_designation::UpStair)
-                        des_plus.bits.dig = tile_dig_designation::UpDownStair;
-                    else
-                        des_plus.bits.dig = tile_dig_designation::DownStair;
-                    // undo mode: clear designation
-                    if(undo)
-                        des_plus.bits.dig = tile_dig_designation::No;
-                    MCache->setDesignationAt(current+1,des_plus);
-
-                    if(des.bits.dig == tile_dig_designation::DownStair)
-                        des.bits.dig = tile_dig_designation::UpDownStair;
-                    else
-                        des.bits.dig = tile_dig_designation::UpStair;
-                }
-            }
-            if(des.bits.dig == tile_dig_designation::No)
-                des.bits.dig = tile_dig_designation::Default;
-            // undo mode: clear designation
-            if(undo)
-                des.bits.dig = tile_dig_designation::No;
-            MCache->setDesignationAt(current,des);
-        }
-    }
     MCache->WriteAll();
+    delete MCache;
     return CR_OK;
 }
 
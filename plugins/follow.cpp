@@ -24,6 +24,7 @@ int32_t prevX, prevY, prevZ;
 uint8_t prevMenuWidth;
 
 DFHACK_PLUGIN("follow");
+DFHACK_PLUGIN_EVENTS((1 << SC_MAP_LOADED) | (1 << SC_MAP_UNLOADED))
 
 DFhackCExport command_result plugin_init ( color_ostream &out, std::vector <PluginCommand> &commands)
 {
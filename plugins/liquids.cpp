@@ -314,6 +314,201 @@ command_result df_liquids_here (color_ostream &out, vector <string> & parameters
     return df_liquids_execute(out);
 }
 
+// applies the current mode to the brush area, one map block at a time
+class LiquidsPainter : public BrushVisitor
+{
+public:
+    LiquidsPainter(color_ostream &out) : out(out)
+    {
+        // the settings are strings for the prompt; decode them once here
+        if (mode == "magma")
+            paint = PAINT_MAGMA;
+        else if (mode == "water")
+            paint = PAINT_WATER;
+        else if (mode == "flowbits")
+            paint = PAINT_FLOWBITS;
+        else if (mode == "obsidian")
+            paint = PAINT_OBSIDIAN;
+        else if (mode == "obsidian_floor")
+            paint = PAINT_OBSIDIAN_FLOOR;
+        else if (mode == "riversource")
+            paint = PAINT_RIVERSOURCE;
+        else if (mode == "wclean")
+            paint = PAINT_WCLEAN;
+        else
+            paint = PAINT_NONE;
+
+        if (flowmode == "f+")
+            flow = FLOW_SET;
+        else if (flowmode == "f-")
+            flow = FLOW_CLEAR;
+        else
+            flow = FLOW_READ;
+
+        if (setmode == "s+")
+            level = LEVEL_AT_LEAST;
+        else if (setmode == "s-")
+            level = LEVEL_AT_MOST;
+        else
+            level = LEVEL_EXACT;
+    }
+
+    void visit(BrushBlock &blk)
+    {
+        Block * b = blk.block;
+        bool touched = false;
+
+        for (int16_t y = 0; y < 16; y++)
+        {
+            if (!blk.mask[y])
+                continue;
+            for (int16_t x = 0; x < 16; x++)
+            {
+                df::coord2d p(x, y);
+                if (blk.test(p) && paintTile(b, p))
+                    touched = true;
+            }
+        }
+
+        if (!touched)
+            return;
+
+        switch (paint)
+        {
+        case PAINT_RIVERSOURCE:
+        {
+            DFHack::t_blockflags bf = b->BlockFlags();
+            bf.bits.liquid_1 = true;
+            bf.bits.liquid_2 = true;
+            b->setBlockFlags(bf);
+            break;
+        }
+        case PAINT_MAGMA:
+        case PAINT_WATER:
+        case PAINT_FLOWBITS:
+        {
+            DFHack::t_blockflags bflags = b->BlockFlags();
+            if(flow == FLOW_SET)
+            {
+                bflags.bits.liquid_1 = true;
+                bflags.bits.liquid_2 = true;
+                b->setBlockFlags(bflags);
+            }
+            else if(flow == FLOW_CLEAR)
+            {
+                bflags.bits.liquid_1 = false;
+                bflags.bits.liquid_2 = false;
+                b->setBlockFlags(bflags);
+            }
+            else
+            {
+                out << "flow bit 1 = " << bflags.bits.liquid_1 << endl; 
+                out << "flow bit 2 = " << bflags.bits.liquid_2 << endl;
+            }
+            break;
+        }
+        default:
+            break;
+        }
+    }
+
+private:
+    color_ostream &out;
+
+    enum {
+        PAINT_NONE, PAINT_MAGMA, PAINT_WATER, PAINT_FLOWBITS, PAINT_OBSIDIAN,
+        PAINT_OBSIDIAN_FLOOR, PAINT_RIVERSOURCE, PAINT_WCLEAN
+    } paint;
+    enum { FLOW_SET, FLOW_CLEAR, FLOW_READ } flow;
+    enum { LEVEL_EXACT, LEVEL_AT_LEAST, LEVEL_AT_MOST } level;
+
+    // returns true if the tile was changed
+    bool paintTile(Block * b, df::coord2d p)
+    {
+        switch (paint)
+        {
+        case PAINT_OBSIDIAN:
+        {
+            b->setTiletypeAt(p, tiletype::LavaWall);
+            b->setTemp1At(p,10015);
+            b->setTemp2At(p,10015);
+            df::tile_designation des = b->DesignationAt(p);
+            des.bits.flow_size = 0;
+            b->setDesignationAt(p, des);
+            return true;
+        }
+        case PAINT_OBSIDIAN_FLOOR:
+            b->setTiletypeAt(p, findRandomVariant(tiletype::LavaFloor1));
+            return true;
+        case PAINT_RIVERSOURCE:
+        {
+            b->setTiletypeAt(p, tiletype::RiverSource);
+
+            df::tile_designation a = b->DesignationAt(p);
+            a.bits.liquid_type = tile_liquid::Water;
+            a.bits.liquid_static = false;
+            a.bits.flow_size = 7;
+            b->setTemp1At(p,10015);
+            b->setTemp2At(p,10015);
+            b->setDesignationAt(p,a);
+            return true;
+        }
+        case PAINT_WCLEAN:
+        {
+            df::tile_designation des = b->DesignationAt(p);
+            des.bits.water_salt = false;
+            des.bits.water_stagnant = false;
+            b->setDesignationAt(p,des);
+            return true;
+        }
+        case PAINT_MAGMA:
+        case PAINT_WATER:
+        case PAINT_FLOWBITS:
+        {
+            df::tile_designation des = b->DesignationAt(p);
+            df::tiletype tt = b->TileTypeAt(p);
+            // don't put liquids into places where they don't belong...
+            if(!DFHack::FlowPassable(tt))
+                return false;
+            if(paint == PAINT_FLOWBITS)
+                return true;
+
+            switch (level)
+            {
+            case LEVEL_EXACT:
+                des.bits.flow_size = amount;
+                break;
+            case LEVEL_AT_LEAST:
+                if(des.bits.flow_size < amount)
+                    des.bits.flow_size = amount;
+                break;
+            case LEVEL_AT_MOST:
+                if (des.bits.flow_size > amount)
+                    des.bits.flow_size = amount;
+                break;
+            }
+            if(amount != 0)
+            {
+                des.bits.liquid_type = (paint == PAINT_MAGMA) ? tile_liquid::Magma : tile_liquid::Water;
+                int temp = (paint == PAINT_MAGMA) ? 12000 : 10015;
+                b->setTemp1At(p,temp);
+                b->setTemp2At(p,temp);
+            }
+            else
+            {
+                // reset temperature to sane default
+                b->setTemp1At(p,10015);
+                b->setTemp2At(p,10015);
+            }
+            b->setDesignationAt(p,des);
+            return true;
+        }
+        default:
+            return false;
+        }
+    }
+};
+
 command_result df_liquids_execute(color_ostream &out)
 {
     // create brush type depending on old parameters
@@ -371,154 +566,11 @@ command_result df_liquids_execute(color_ostream &out)
         out << "cursor coords: " << x << "/" << y << "/" << z << endl;
         MapCache mcache;
         DFHack::DFCoord cursor(x,y,z);
-        coord_vec all_tiles = brush->points(mcache,cursor);
         out << "working..." << endl;
-        if(mode == "obsidian")
-        {
-            coord_vec::iterator iter = all_tiles.begin();
-            while (iter != all_tiles.end())
-            {
-                mcache.setTiletypeAt(*iter, tiletype::LavaWall);
-                mcache.setTemp1At(*iter,10015);
-                mcache.setTemp2At(*iter,10015);
-                df::tile_designation des = mcache.designationAt(*iter);
-                des.bits.flow_size = 0;
-                mcache.setDesignationAt(*iter, des);
-                iter ++;
-            }
-        }
-        if(mode == "obsidian_floor")
-        {
-            coord_vec::iterator iter = all_tiles.begin();
-            while (iter != all_tiles.end())
-            {
-                mcache.setTiletypeAt(*iter, findRandomVariant(tiletype::LavaFloor1));
-                iter ++;
-            }
-        }
-        else if(mode == "riversource")
-        {
-            coord_vec::iterator iter = all_tiles.begin();
-            while (iter != all_tiles.end())
-            {
-                mcache.setTiletypeAt(*iter, tiletype::RiverSource);
-
-                df::tile_designation a = mcache.designationAt(*iter);
-                a.bits.liquid_type = tile_liquid::Water;
-                a.bits.liquid_static = false;
-                a.bits.flow_size = 7;
-                mcache.setTemp1At(*iter,10015);
-                mcache.setTemp2At(*iter,10015);
-                mcache.setDesignationAt(*iter,a);
-
-                Block * b = mcache.BlockAt((*iter)/16);
-                DFHack::t_blockflags bf = b->BlockFlags();
-                bf.bits.liquid_1 = true;
-                bf.bits.liquid_2 = true;
-                b->setBlockFlags(bf);
-
-                iter++;
-            }
-        }
-        else if(mode=="wclean")
-        {
-            coord_vec::iterator iter = all_tiles.begin();
-            while (iter != all_tiles.end())
-            {
-                DFHack::DFCoord current = *iter;
-                df::tile_designation des = mcache.designationAt(current);
-                des.bits.water_salt = false;
-                des.bits.water_stagnant = false;
-                mcache.setDesignationAt(current,des);
-                iter++;
-            }
-        }
-        else if(mode== "magma" || mode== "water" || mode == "flowbits")
-        {
-            set <Block *> seen_blocks;
-            coord_vec::iterator iter = all_tiles.begin();
-            while (iter != all_tiles.end())
-            {
-                DFHack::DFCoord current = *iter; // current tile coord
-                DFHack::DFCoord curblock = current /16; // current block coord
-                // check if the block is actually there
-                if(!mcache.BlockAt(curblock))
-                {
-                    iter ++;
-                    continue;
-                }
-                df::tile_designation des = mcache.designationAt(current);
-                df::tiletype tt = mcache.tiletypeAt(current);
-                // don't put liquids into places where they don't belong...
-                if(!DFHack::FlowPassable(tt))
-                {
-                    iter++;
-                    continue;
-                }
-                if(mode != "flowbits")
-                {
-                    if(setmode == "s.")
-                    {
-                        des.bits.flow_size = amount;
-                    }
-                    else if(setmode == "s+")
-                    {
-                        if(des.bits.flow_size < amount)
-                            des.bits.flow_size = amount;
-                    }
-                    else if(setmode == "s-")
-                    {
-                        if (des.bits.flow_size > amount)
-                            des.bits.flow_size = amount;
-                    }
-                    if(amount != 0 && mode == "magma")
-                    {
-                        des.bits.liquid_type =  tile_liquid::Magma;
-                        mcache.setTemp1At(current,12000);
-                        mcache.setTemp2At(current,12000);
-                    }
-                    else if(amount != 0 && mode == "water")
-                    {
-                        des.bits.liquid_type =  tile_liquid::Water;
-                        mcache.setTemp1At(current,10015);
-                        mcache.setTemp2At(current,10015);
-                    }
-                    else if(amount == 0 && (mode == "water" || mode == "magma"))
-                    {
-                        // reset temperature to sane default
-                        mcache.setTemp1At(current,10015);
-                        mcache.setTemp2At(current,10015);
-                    }
-                    mcache.setDesignationAt(current,des);
-                }
-                seen_blocks.insert(mcache.BlockAt(current / 16));
-                iter++;
-            }
-            set <Block *>::iterator biter = seen_blocks.begin();
-            while (biter != seen_blocks.end())
-            {
-                DFHack::t_blockflags bflags = (*biter)->BlockFlags();
-                if(flowmode == "f+")
-                {
-                    bflags.bits.liquid_1 = true;
-                    bflags.bits.liquid_2 = true;
-                    (*biter)->setBlockFlags(bflags);
-                }
-                else if(flowmode == "f-")
-                {
-                    bflags.bits.liquid_1 = false;
-                    bflags.bits.liquid_2 = false;
-                    (*biter)->setBlockFlags(bflags);
-                }
-                else
-                {
-                    out << "flow bit 1 = " << bflags.bits.liquid_1 << endl; 
-                    out << "flow bit 2 = " << bflags.bits.liquid_2 << endl;
-                }
-                biter ++;
-            }
-        }
-        if(mcache.WriteAll())
+        LiquidsPainter painter(out);
+        WriteBackVisitor writer(mcache, painter);
+        brush->blocks(mcache, cursor, writer);
+        if(writer.written())
             out << "OK" << endl;
         else
             out << "Something failed horribly! RUN!" << endl;
@@ -50,6 +50,9 @@ DFhackCExport command_result plugin_init ( color_ostream &out, std::vector <Plug
     commands.push_back(PluginCommand("bprobe",
                                      "A simple building probe",
                                      df_bprobe));
+    // the probes keep no state of their own
+    for (size_t i = 0; i < commands.size(); i++)
+        commands[i].concurrent = true;
     return CR_OK;
 }
 
@@ -14,6 +14,7 @@
 
 using namespace std;
 #include "Core.h"
+#include "tinythread.h"
 #include "Console.h"
 #include "Export.h"
 #include "PluginManager.h"
@@ -23,6 +24,8 @@ using namespace std;
 
 #include "DataDefs.h"
 #include "df/world.h"
+#include "df/map_block.h"
+#include "df/plant.h"
 #include "df/world_data.h"
 #include "df/world_region_details.h"
 #include "df/world_geo_biome.h"
@@ -66,6 +69,11 @@ struct matdata
         }
         return count;
     }
+    void merge(const matdata &other)
+    {
+        add(other.lower_z, 0);
+        add(other.upper_z, other.count);
+    }
     unsigned int count;
     int lower_z;
     int upper_z;
@@ -192,6 +200,7 @@ void printVeins(color_ostream &con, MatMap &mat_map,
 command_result prospector (color_ostream &out, vector <string> & parameters);
 
 DFHACK_PLUGIN("prospector");
+DFHACK_PLUGIN_EVENTS((1 << SC_MAP_LOADED) | (1 << SC_MAP_UNLOADED) | (1 << SC_WORLD_UNLOADED))
 
 DFhackCExport command_result plugin_init ( color_ostream &out, std::vector <PluginCommand> &commands)
 {
@@ -204,6 +213,8 @@ DFhackCExport command_result plugin_init ( color_ostream &out, std::vector <Plug
         "  all   - Scan the whole map, as if it was revealed.\n"
         "  value - Show material value in the output. Most useful for gems.\n"
         "  hell  - Show the Z range of HFS tubes. Implies 'all'.\n"
+        "  incremental - Only recount the map blocks that changed\n"
+        "          since the last scan with the same options.\n"
         "Pre-embark estimate:\n"
         "  If called during the embark selection screen, displays\n"
         "  an estimate of layer stone availability. If the 'all'\n"
@@ -214,8 +225,26 @@ DFhackCExport command_result plugin_init ( color_ostream &out, std::vector <Plug
     return CR_OK;
 }
 
+static void clear_caches();
+
+DFhackCExport command_result plugin_onstatechange(color_ostream &out, state_change_event event)
+{
+    switch (event) {
+    case SC_MAP_LOADED:
+    case SC_MAP_UNLOADED:
+    case SC_WORLD_UNLOADED:
+        clear_caches();
+        break;
+    default:
+        break;
+    }
+
+    return CR_OK;
+}
+
 DFhackCExport command_result plugin_shutdown ( color_ostream &out )
 {
+    clear_caches();
     return CR_OK;
 }
 
@@ -225,6 +254,83 @@ static coord2d biome_delta[] = {
     coord2d(-1,-1), coord2d(0,-1), coord2d(1,-1)
 };
 
+/*
+ * The estimate for a region only depends on its geo biome and on the number
+ * of embark tiles that use it, so it is computed once for each such pair and
+ * kept until the world is unloaded. Moving the embark rectangle around then
+ * only adds up cached estimates.
+ */
+struct BiomeEstimate
+{
+    MatMap layerMats;
+    MatMap veinMats;
+};
+
+static std::map<std::pair<int,int>, BiomeEstimate> estimate_cache;
+static df::world_data *estimate_world = NULL;
+
+static void estimateBiome(BiomeEstimate &est, df::world_geo_biome *geo_biome, int cnt)
+{
+    for (unsigned i = 0; i < geo_biome->layers.size(); i++)
+    {
+        auto layer = geo_biome->layers[i];
+
+        est.layerMats[layer->mat_index].add(layer->bottom_height, 0);
+
+        int level_cnt = layer->top_height - layer->bottom_height + 1;
+        int layer_size = 48*48*cnt*level_cnt;
+
+        int sums[ENUM_LAST_ITEM(inclusion_type)+1] = { 0 };
+
+        for (unsigned j = 0; j < layer->vein_mat.size(); j++)
+            if (is_valid_enum_item<df::inclusion_type>(layer->vein_type[j]))
+                sums[layer->vein_type[j]] += layer->vein_unk_38[j];
+
+        for (unsigned j = 0; j < layer->vein_mat.size(); j++)
+        {
+            // TODO: find out how to estimate the real density
+            // this code assumes that vein_unk_38 is the weight
+            // used when choosing the vein material
+            int size = layer->vein_unk_38[j]*cnt*level_cnt;
+            df::inclusion_type type = layer->vein_type[j];
+
+            switch (type)
+            {
+            case inclusion_type::VEIN:
+                // 3 veins of 80 tiles avg
+                size = size * 80 * 3 / sums[type];
+                break;
+            case inclusion_type::CLUSTER:
+                // 1 cluster of 700 tiles avg
+                size = size * 700 * 1 / sums[type];
+                break;
+            case inclusion_type::CLUSTER_SMALL:
+                size = size * 6 * 7 / sums[type];
+                break;
+            case inclusion_type::CLUSTER_ONE:
+                size = size * 1 * 5 / sums[type];
+                break;
+            default:
+                // shouldn't actually happen
+                size = cnt*level_cnt;
+            }
+
+            est.veinMats[layer->vein_mat[j]].add(layer->bottom_height, 0);
+            est.veinMats[layer->vein_mat[j]].add(layer->top_height, size);
+
+            layer_size -= size;
+        }
+
+        est.layerMats[layer->mat_index].add(layer->top_height, std::max(0,layer_size));
+    }
+}
+
+static void mergeMats(MatMap &dst, const MatMap &src)
+{
+    for (MatMap::const_iterator it = src.begin(); it != src.end(); ++it)
+        dst[it->first].merge(it->second);
+}
+
 static command_result embark_prospector(color_ostream &out, df::viewscreen_choose_start_sitest *screen,
                                         bool showHidden, bool showValue)
 {
@@ -269,73 +375,36 @@ static command_result embark_prospector(color_ostream &out, df::viewscreen_choos
     MatMap layerMats;
     MatMap veinMats;
 
+    if (estimate_world != data)
+        estimate_cache.clear();
+    estimate_world = data;
+
     for (auto biome_it = biomes.begin(); biome_it != biomes.end(); ++biome_it)
     {
         int bx = clip_range(biome_it->first.x, 0, data->world_width-1);
         int by = clip_range(biome_it->first.y, 0, data->world_height-1);
         auto &region = data->region_map[bx][by];
-        df::world_geo_biome *geo_biome = df::world_geo_biome::find(region.geo_index);
-
-        if (!geo_biome)
-        {
-            out.printerr("Region geo-biome not found: (%d,%d)\n", bx, by);
-            return CR_FAILURE;
-        }
 
         int cnt = biome_it->second;
+        auto key = std::make_pair(int(region.geo_index), cnt);
 
-        for (unsigned i = 0; i < geo_biome->layers.size(); i++)
+        auto cached = estimate_cache.find(key);
+        if (cached == estimate_cache.end())
         {
-            auto layer = geo_biome->layers[i];
-
-            layerMats[layer->mat_index].add(layer->bottom_height, 0);
-
-            int level_cnt = layer->top_height - layer->bottom_height + 1;
-            int layer_size = 48*48*cnt*level_cnt;
+            df::world_geo_biome *geo_biome = df::world_geo_biome::find(region.geo_index);
 
-            int sums[ENUM_LAST_ITEM(inclusion_type)+1] = { 0 };
-
-            for (unsigned j = 0; j < layer->vein_mat.size(); j++)
-                if (is_valid_enum_item<df::inclusion_type>(layer->vein_type[j]))
-                    sums[layer->vein_type[j]] += layer->vein_unk_38[j];
-
-            for (unsigned j = 0; j < layer->vein_mat.size(); j++)
+            if (!geo_biome)
             {
-                // TODO: find out how to estimate the real density
-                // this code assumes that vein_unk_38 is the weight
-                // used when choosing the vein material
-                int size = layer->vein_unk_38[j]*cnt*level_cnt;
-                df::inclusion_type type = layer->vein_type[j];
-
-                switch (type)
-                {
-                case inclusion_type::VEIN:
-                    // 3 veins of 80 tiles avg
-                    size = size * 80 * 3 / sums[type];
-                    break;
-                case inclusion_type::CLUSTER:
-                    // 1 cluster of 700 tiles avg
-                    size = size * 700 * 1 / sums[type];
-                    break;
-                case inclusion_type::CLUSTER_SMALL:
-                    size = size * 6 * 7 / sums[type];
-                    break;
-                case inclusion_type::CLUSTER_ONE:
-                    size = size * 1 * 5 / sums[type];
-                    break;
-                default:
-                    // shouldn't actually happen
-                    size = cnt*level_cnt;
-                }
-
-                veinMats[layer->vein_mat[j]].add(layer->bottom_height, 0);
-                veinMats[layer->vein_mat[j]].add(layer->top_height, size);
-
-                layer_size -= size;
+                out.printerr("Region geo-biome not found: (%d,%d)\n", bx, by);
+                return CR_FAILURE;
             }
 
-            layerMats[layer->mat_index].add(layer->top_height, std::max(0,layer_size));
+            cached = estimate_cache.insert(std::make_pair(key, BiomeEstimate())).first;
+            estimateBiome(cached->second, geo_biome, cnt);
         }
+
+        mergeMats(layerMats, cached->second.layerMats);
+        mergeMats(veinMats, cached->second.veinMats);
     }
 
     // Print the report
@@ -353,6 +422,312 @@ static command_result embark_prospector(color_ostream &out, df::viewscreen_choos
     return CR_OK;
 }
 
+/*
+ * Map-wide counting.
+ *
+ * Each block is counted on its own into a short list of (kind, material,
+ * count) entries, which the main thread then adds up. The blocks are spread
+ * over a few worker threads, each with its own MapCache; the game is
+ * suspended for the whole run, so the map is only ever read. The results
+ * are kept per block together with a hash of the block data, and the
+ * incremental mode only recounts blocks whose hash changed.
+ */
+
+enum CountKind
+{
+    COUNT_BASE,
+    COUNT_LAYER,
+    COUNT_VEIN,
+    COUNT_PLANT,
+    COUNT_TREE,
+    COUNT_WATER,
+    COUNT_MAGMA,
+    COUNT_AQUIFER,
+    COUNT_TUBE
+};
+
+struct MatCount
+{
+    uint8_t kind;
+    int16_t mat;
+    uint16_t count;
+};
+
+struct BlockCounts
+{
+    bool counted;
+    uint32_t signature;
+    bool hasLair;
+    bool hasDemonTemple;
+    std::vector<MatCount> mats;
+
+    BlockCounts() : counted(false), signature(0), hasLair(false), hasDemonTemple(false) {}
+};
+
+struct ProspectOptions
+{
+    bool showHidden;
+    bool showPlants;
+    bool showSlade;
+    bool showTemple;
+
+    bool operator== (const ProspectOptions &other) const
+    {
+        return showHidden == other.showHidden && showPlants == other.showPlants &&
+               showSlade == other.showSlade && showTemple == other.showTemple;
+    }
+};
+
+struct ProspectWorker
+{
+    const ProspectOptions *options;
+    std::vector<BlockCounts> *blocks;
+    uint32_t x_max, y_max, z_max;
+    bool reuse;
+    unsigned index, stride; // takes every stride-th row of blocks
+    unsigned recounted;
+};
+
+// The cached counts of the last run
+static std::vector<BlockCounts> block_cache;
+static ProspectOptions cache_options;
+static void *cache_map = NULL;
+
+static void clear_caches()
+{
+    std::vector<BlockCounts>().swap(block_cache);
+    cache_map = NULL;
+    estimate_cache.clear();
+    estimate_world = NULL;
+}
+
+static uint32_t fnvHash(uint32_t hash, const void *data, size_t size)
+{
+    const uint8_t *p = (const uint8_t*)data;
+    for (size_t i = 0; i < size; i++)
+        hash = (hash ^ p[i]) * 16777619U;
+    return hash;
+}
+
+static uint32_t blockSignature(df::map_block *block)
+{
+    uint32_t hash = 2166136261U;
+    hash = fnvHash(hash, block->tiletype, sizeof(block->tiletype));
+    hash = fnvHash(hash, block->designation, sizeof(block->designation));
+    hash = fnvHash(hash, block->occupancy, sizeof(block->occupancy));
+
+    size_t counts[2] = { block->plants.size(), block->block_events.size() };
+    hash = fnvHash(hash, counts, sizeof(counts));
+    if (!block->plants.empty())
+        hash = fnvHash(hash, &block->plants[0], block->plants.size()*sizeof(df::plant*));
+    return hash;
+}
+
+static void countBlock(MapExtras::Block *b, df::coord2d blockCoord, const ProspectOptions &opt, BlockCounts &out)
+{
+    DFHack::t_feature blockFeatureGlobal;
+    DFHack::t_feature blockFeatureLocal;
+
+    { // Find features
+        uint32_t index = b->raw.global_feature;
+        if (index != -1)
+            Maps::GetGlobalFeature(blockFeatureGlobal, index);
+        else
+            blockFeatureGlobal.type = (df::feature_type)-1;
+
+        index = b->raw.local_feature;
+        if (index != -1)
+            Maps::GetLocalFeature(blockFeatureLocal, blockCoord, index);
+        else
+            blockFeatureLocal.type = (df::feature_type)-1;
+    }
+
+    std::map<uint32_t, unsigned> counts;
+#define COUNT(kind, mat) counts[(uint32_t(kind) << 16) | uint16_t(mat)]++
+
+    // Iterate over all the tiles in the block
+    for(uint32_t y = 0; y < 16; y++)
+    {
+        for(uint32_t x = 0; x < 16; x++)
+        {
+            df::coord2d coord(x, y);
+            df::tile_designation des = b->DesignationAt(coord);
+            df::tile_occupancy occ = b->OccupancyAt(coord);
+
+            // Skip hidden tiles
+            if (!opt.showHidden && des.bits.hidden)
+            {
+                continue;
+            }
+
+            // Check for aquifer
+            if (des.bits.water_table)
+            {
+                COUNT(COUNT_AQUIFER, 0);
+            }
+
+            // Check for lairs
+            if (occ.bits.monster_lair)
+            {
+                out.hasLair = true;
+            }
+
+            // Check for liquid
+            if (des.bits.flow_size)
+            {
+                if (des.bits.liquid_type == tile_liquid::Magma)
+                    COUNT(COUNT_MAGMA, 0);
+                else
+                    COUNT(COUNT_WATER, 0);
+            }
+
+            df::tiletype type = b->TileTypeAt(coord);
+            df::tiletype_shape tileshape = tileShape(type);
+            df::tiletype_material tilemat = tileMaterial(type);
+
+            // We only care about these types
+            switch (tileshape)
+            {
+            case tiletype_shape::WALL:
+            case tiletype_shape::FORTIFICATION:
+                break;
+            case tiletype_shape::EMPTY:
+                /* A heuristic: tubes inside adamantine have EMPTY:AIR tiles which
+                   still have feature_local set. Also check the unrevealed status,
+                   so as to exclude any holes mined by the player. */
+                if (tilemat == tiletype_material::AIR &&
+                    des.bits.feature_local && des.bits.hidden &&
+                    blockFeatureLocal.type == feature_type::deep_special_tube)
+                {
+                    COUNT(COUNT_TUBE, 0);
+                }
+            default:
+                continue;
+            }
+
+            // Count the material type
+            COUNT(COUNT_BASE, tilemat);
+
+            // Find the type of the tile
+            switch (tilemat)
+            {
+            case tiletype_material::SOIL:
+            case tiletype_material::STONE:
+                COUNT(COUNT_LAYER, b->baseMaterialAt(coord));
+                break;
+            case tiletype_material::MINERAL:
+                COUNT(COUNT_VEIN, b->veinMaterialAt(coord));
+                break;
+            case tiletype_material::FEATURE:
+                if (blockFeatureLocal.type != -1 && des.bits.feature_local)
+                {
+                    if (blockFeatureLocal.type == feature_type::deep_special_tube
+                            && blockFeatureLocal.main_material == 0) // stone
+                    {
+                        COUNT(COUNT_VEIN, blockFeatureLocal.sub_material);
+                    }
+                    else if (opt.showTemple
+                             && blockFeatureLocal.type == feature_type::deep_surface_portal)
+                    {
+                        out.hasDemonTemple = true;
+                    }
+                }
+
+                if (opt.showSlade && blockFeatureGlobal.type != -1 && des.bits.feature_global
+                        && blockFeatureGlobal.type == feature_type::feature_underworld_from_layer
+                        && blockFeatureGlobal.main_material == 0) // stone
+                {
+                    COUNT(COUNT_LAYER, blockFeatureGlobal.sub_material);
+                }
+                break;
+            case tiletype_material::LAVA_STONE:
+                // TODO ?
+                break;
+            }
+        }
+    }
+
+    // Check plants this way, as the other way wasn't getting them all
+    // and we can check visibility more easily here
+    if (opt.showPlants)
+    {
+        PlantList * plants;
+        if (Maps::ReadVegetation(b->bcoord.x, b->bcoord.y, b->bcoord.z, plants))
+        {
+            for (PlantList::const_iterator it = plants->begin(); it != plants->end(); it++)
+            {
+                const df::plant & plant = *(*it);
+                df::coord2d loc(plant.pos.x, plant.pos.y);
+                loc = loc % 16;
+                if (opt.showHidden || !b->DesignationAt(loc).bits.hidden)
+                {
+                    if(plant.flags.bits.is_shrub)
+                        COUNT(COUNT_PLANT, plant.material);
+                    else
+                        COUNT(COUNT_TREE, plant.material);
+                }
+            }
+        }
+    }
+#undef COUNT
+
+    out.mats.clear();
+    out.mats.reserve(counts.size());
+    for (auto it = counts.begin(); it != counts.end(); ++it)
+    {
+        MatCount mc;
+        mc.kind = uint8_t(it->first >> 16);
+        mc.mat = int16_t(it->first & 0xFFFF);
+        mc.count = uint16_t(it->second);
+        out.mats.push_back(mc);
+    }
+}
+
+static void prospectWorker(void *arg)
+{
+    ProspectWorker *job = (ProspectWorker*)arg;
+    std::vector<BlockCounts> &blocks = *job->blocks;
+    MapExtras::MapCache map;
+
+    uint32_t rows = job->z_max * job->y_max;
+    for (uint32_t row = job->index; row < rows; row += job->stride)
+    {
+        uint32_t z = row / job->y_max;
+        uint32_t b_y = row % job->y_max;
+
+        for(uint32_t b_x = 0; b_x < job->x_max; b_x++)
+        {
+            BlockCounts &counts = blocks[row * job->x_max + b_x];
+
+            df::map_block *raw = Maps::getBlock(b_x, b_y, z);
+            if (!raw)
+            {
+                counts = BlockCounts();
+                continue;
+            }
+
+            uint32_t signature = blockSignature(raw);
+            if (job->reuse && counts.counted && counts.signature == signature)
+                continue;
+
+            counts = BlockCounts();
+            counts.counted = true;
+            counts.signature = signature;
+            job->recounted++;
+
+            // Get the map block
+            MapExtras::Block *b = map.BlockAt(DFHack::DFCoord(b_x, b_y, z));
+            if (!b || !b->valid)
+                continue;
+
+            countBlock(b, df::coord2d(b_x, b_y), *job->options, counts);
+        }
+
+        // Clean uneeded memory
+        map.trash();
+    }
+}
+
 command_result prospector (color_ostream &con, vector <string> & parameters)
 {
     bool showHidden = false;
@@ -361,6 +736,7 @@ command_result prospector (color_ostream &con, vector <string> & parameters)
     bool showTemple = true;
     bool showValue = false;
     bool showTube = false;
+    bool incremental = false;
 
     for(size_t i = 0; i < parameters.size();i++)
     {
@@ -376,6 +752,10 @@ command_result prospector (color_ostream &con, vector <string> & parameters)
         {
             showHidden = showTube = true;
         }
+        else if (parameters[i] == "incremental")
+        {
+            incremental = true;
+        }
         else
             return CR_WRONG_USAGE;
     }
@@ -394,12 +774,49 @@ command_result prospector (color_ostream &con, vector <string> & parameters)
 
     uint32_t x_max = 0, y_max = 0, z_max = 0;
     Maps::getSize(x_max, y_max, z_max);
-    MapExtras::MapCache map;
 
     DFHack::Materials *mats = Core::getInstance().getMaterials();
 
-    DFHack::t_feature blockFeatureGlobal;
-    DFHack::t_feature blockFeatureLocal;
+    ProspectOptions options;
+    options.showHidden = showHidden;
+    options.showPlants = showPlants;
+    options.showSlade = showSlade;
+    options.showTemple = showTemple;
+
+    // The counts of the last run can only be reused for the same map and options
+    size_t num_blocks = size_t(x_max) * y_max * z_max;
+    bool reuse = incremental && cache_map == (void*)world->map.block_index &&
+                 block_cache.size() == num_blocks && cache_options == options;
+    if (!reuse)
+        block_cache.assign(num_blocks, BlockCounts());
+    cache_map = (void*)world->map.block_index;
+    cache_options = options;
+
+    unsigned num_threads = clip_range(tthread::thread::hardware_concurrency(), 1U, 8U);
+    std::vector<ProspectWorker> workers(num_threads);
+    for (unsigned i = 0; i < num_threads; i++)
+    {
+        ProspectWorker &w = workers[i];
+        w.options = &options;
+        w.blocks = &block_cache;
+        w.x_max = x_max;
+        w.y_max = y_max;
+        w.z_max = z_max;
+        w.reuse = reuse;
+        w.index = i;
+        w.stride = num_threads;
+        w.recounted = 0;
+    }
+
+    std::vector<tthread::thread*> threads;
+    for (unsigned i = 1; i < num_threads; i++)
+        threads.push_back(new tthread::thread(prospectWorker, &workers[i]));
+    prospectWorker(&workers[0]);
+    for (size_t i = 0; i < threads.size(); i++)
+    {
+        threads[i]->join();
+        delete threads[i];
+    }
 
     bool hasAquifer = false;
     bool hasDemonTemple = false;
@@ -415,166 +832,42 @@ command_result prospector (color_ostream &con, vector <string> & parameters)
     matdata aquiferTiles;
     matdata tubeTiles;
 
-    uint32_t vegCount = 0;
+    unsigned recounted = 0;
+    for (unsigned i = 0; i < num_threads; i++)
+        recounted += workers[i].recounted;
 
-    for(uint32_t z = 0; z < z_max; z++)
+    // Add up the blocks
+    for (size_t i = 0; i < block_cache.size(); i++)
     {
-        for(uint32_t b_y = 0; b_y < y_max; b_y++)
-        {
-            for(uint32_t b_x = 0; b_x < x_max; b_x++)
-            {
-                // Get the map block
-                df::coord2d blockCoord(b_x, b_y);
-                MapExtras::Block *b = map.BlockAt(DFHack::DFCoord(b_x, b_y, z));
-                if (!b || !b->valid)
-                {
-                    continue;
-                }
+        const BlockCounts &counts = block_cache[i];
+        int global_z = world->map.region_z + int(i / (size_t(x_max) * y_max));
 
-                { // Find features
-                    uint32_t index = b->raw.global_feature;
-                    if (index != -1)
-                        Maps::GetGlobalFeature(blockFeatureGlobal, index);
+        hasLair = hasLair || counts.hasLair;
+        hasDemonTemple = hasDemonTemple || counts.hasDemonTemple;
 
-                    index = b->raw.local_feature;
-                    if (index != -1)
-                        Maps::GetLocalFeature(blockFeatureLocal, blockCoord, index);
-                }
-
-                int global_z = world->map.region_z + z;
-
-                // Iterate over all the tiles in the block
-                for(uint32_t y = 0; y < 16; y++)
-                {
-                    for(uint32_t x = 0; x < 16; x++)
-                    {
-                        df::coord2d coord(x, y);
-                        df::tile_designation des = b->DesignationAt(coord);
-                        df::tile_occupancy occ = b->OccupancyAt(coord);
-
-                        // Skip hidden tiles
-                        if (!showHidden && des.bits.hidden)
-                        {
-                            continue;
-                        }
-
-                        // Check for aquifer
-                        if (des.bits.water_table)
-                        {
-                            hasAquifer = true;
-                            aquiferTiles.add(global_z);
-                        }
-
-                        // Check for lairs
-                        if (occ.bits.monster_lair)
-                        {
-                            hasLair = true;
-                        }
-
-                        // Check for liquid
-                        if (des.bits.flow_size)
-                        {
-                            if (des.bits.liquid_type == tile_liquid::Magma)
-                                liquidMagma.add(global_z);
-                            else
-                                liquidWater.add(global_z);
-                        }
-
-                        df::tiletype type = b->TileTypeAt(coord);
-                        df::tiletype_shape tileshape = tileShape(type);
-                        df::tiletype_material tilemat = tileMaterial(type);
-
-                        // We only care about these types
-                        switch (tileshape)
-                        {
-                        case tiletype_shape::WALL:
-                        case tiletype_shape::FORTIFICATION:
-                            break;
-                        case tiletype_shape::EMPTY:
-                            /* A heuristic: tubes inside adamantine have EMPTY:AIR tiles which
-                               still have feature_local set. Also check the unrevealed status,
-                               so as to exclude any holes mined by the player. */
-                            if (tilemat == tiletype_material::AIR &&
-                                des.bits.feature_local && des.bits.hidden &&
-                                blockFeatureLocal.type == feature_type::deep_special_tube)
-                            {
-                                tubeTiles.add(global_z);
-                            }
-                        default:
-                            continue;
-                        }
-
-                        // Count the material type
-                        baseMats[tilemat].add(global_z);
-
-                        // Find the type of the tile
-                        switch (tilemat)
-                        {
-                        case tiletype_material::SOIL:
-                        case tiletype_material::STONE:
-                            layerMats[b->baseMaterialAt(coord)].add(global_z);
-                            break;
-                        case tiletype_material::MINERAL:
-                            veinMats[b->veinMaterialAt(coord)].add(global_z);
-                            break;
-                        case tiletype_material::FEATURE:
-                            if (blockFeatureLocal.type != -1 && des.bits.feature_local)
-                            {
-                                if (blockFeatureLocal.type == feature_type::deep_special_tube
-                                        && blockFeatureLocal.main_material == 0) // stone
-                                {
-                                    veinMats[blockFeatureLocal.sub_material].add(global_z);
-                                }
-                                else if (showTemple
-                                         && blockFeatureLocal.type == feature_type::deep_surface_portal)
-                                {
-                                    hasDemonTemple = true;
-                                }
-                            }
-
-                            if (showSlade && blockFeatureGlobal.type != -1 && des.bits.feature_global
-                                    && blockFeatureGlobal.type == feature_type::feature_underworld_from_layer
-                                    && blockFeatureGlobal.main_material == 0) // stone
-                            {
-                                layerMats[blockFeatureGlobal.sub_material].add(global_z);
-                            }
-                            break;
-                        case tiletype_material::LAVA_STONE:
-                            // TODO ?
-                            break;
-                        }
-                    }
-                }
-
-                // Check plants this way, as the other way wasn't getting them all
-                // and we can check visibility more easily here
-                if (showPlants)
-                {
-                    PlantList * plants;
-                    if (Maps::ReadVegetation(b_x, b_y, z, plants))
-                    {
-                        for (PlantList::const_iterator it = plants->begin(); it != plants->end(); it++)
-                        {
-                            const df::plant & plant = *(*it);
-                            df::coord2d loc(plant.pos.x, plant.pos.y);
-                            loc = loc % 16;
-                            if (showHidden || !b->DesignationAt(loc).bits.hidden)
-                            {
-                                if(plant.flags.bits.is_shrub)
-                                    plantMats[plant.material].add(global_z);
-                                else
-                                    treeMats[plant.material].add(global_z);
-                            }
-                        }
-                    }
-                }
-                // Block end
-            } // block x
+        for (size_t j = 0; j < counts.mats.size(); j++)
+        {
+            const MatCount &mc = counts.mats[j];
+            switch (mc.kind)
+            {
+            case COUNT_BASE:    baseMats[mc.mat].add(global_z, mc.count); break;
+            case COUNT_LAYER:   layerMats[mc.mat].add(global_z, mc.count); break;
+            case COUNT_VEIN:    veinMats[mc.mat].add(global_z, mc.count); break;
+            case COUNT_PLANT:   plantMats[mc.mat].add(global_z, mc.count); break;
+            case COUNT_TREE:    treeMats[mc.mat].add(global_z, mc.count); break;
+            case COUNT_WATER:   liquidWater.add(global_z, mc.count); break;
+            case COUNT_MAGMA:   liquidMagma.add(global_z, mc.count); break;
+            case COUNT_AQUIFER:
+                hasAquifer = true;
+                aquiferTiles.add(global_z, mc.count);
+                break;
+            case COUNT_TUBE:    tubeTiles.add(global_z, mc.count); break;
+            }
+        }
+    }
 
-            // Clean uneeded memory
-            map.trash();
-        } // block y
-    } // z
+    if (reuse)
+        con << "Recounted " << recounted << " changed blocks." << std::endl << std::endl;
 
     MatMap::const_iterator it;
 
@@ -4,6 +4,7 @@
 #include "PluginManager.h"
 
 #include "modules/Gui.h"
+#include "modules/Units.h"
 
 #include "DataDefs.h"
 #include "df/ui.h"
@@ -137,7 +138,7 @@ static command_result RenameSquad(color_ostream &stream, const RenameSquadIn *in
 
 static command_result RenameUnit(color_ostream &stream, const RenameUnitIn *in)
 {
-    df::unit *unit = df::unit::find(in->unit_id());
+    df::unit *unit = Units::FindById(in->unit_id());
     if (!unit)
         return CR_NOT_FOUND;
 
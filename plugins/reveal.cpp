@@ -9,6 +9,7 @@
 #include "modules/Maps.h"
 #include "modules/World.h"
 #include "modules/MapCache.h"
+#include "modules/FloodFill.h"
 #include "modules/Gui.h"
 #include "df/construction.h"
 #include "df/block_square_event_frozen_liquidst.h"
@@ -323,6 +324,115 @@ command_result revtoggle (color_ostream &out, vector<string> & params)
     }
 }
 
+// how revflood treats a tile, by its shape
+enum reveal_shape
+{
+    REVEAL_SOLID,   // hidden from below, stops the flood
+    REVEAL_OPEN,    // air: can see through it in every direction
+    REVEAL_FLOOR,   // has a floor: can see sideways and up, not down
+    REVEAL_OTHER    // always visible, stops the flood
+};
+
+static reveal_shape classifyShape(df::tiletype tt)
+{
+    switch (tileShape(tt))
+    {
+    // walls:
+    case tiletype_shape::WALL:
+        return REVEAL_SOLID;
+    // air/free space
+    case tiletype_shape::EMPTY:
+    case tiletype_shape::RAMP_TOP:
+    case tiletype_shape::STAIR_UPDOWN:
+    case tiletype_shape::STAIR_DOWN:
+    case tiletype_shape::BROOK_TOP:
+        return REVEAL_OPEN;
+    // has floor
+    case tiletype_shape::FORTIFICATION:
+    case tiletype_shape::STAIR_UP:
+    case tiletype_shape::RAMP:
+    case tiletype_shape::FLOOR:
+    case tiletype_shape::TREE:
+    case tiletype_shape::SAPLING:
+    case tiletype_shape::SHRUB:
+    case tiletype_shape::BOULDER:
+    case tiletype_shape::PEBBLES:
+    case tiletype_shape::BROOK_BED:
+    case tiletype_shape::ENDLESS_PIT:
+        return REVEAL_FLOOR;
+    default:
+        return REVEAL_OTHER;
+    }
+}
+
+// The flood runs through open and floor tiles; walls and other tiles next to
+// them are uncovered as the border of the flood. Anything only seen from
+// below stays hidden.
+struct RevealFill
+{
+    MapCache &mc;
+
+    RevealFill(MapCache &mc) : mc(mc) {}
+
+    static bool passable(reveal_shape shape)
+    {
+        return shape == REVEAL_OPEN || shape == REVEAL_FLOOR;
+    }
+
+    bool passableAt(DFCoord c)
+    {
+        return mc.testCoord(c) && passable(classifyShape(mc.baseTiletypeAt(c)));
+    }
+
+    // a floor reached from below is still seen from the side if the flood
+    // also runs next to it on its own level
+    bool seenFromSide(DFCoord c)
+    {
+        for (int dx = -1; dx <= 1; dx++)
+            for (int dy = -1; dy <= 1; dy++)
+                if ((dx || dy) && passableAt(DFCoord(c.x + dx, c.y + dy, c.z)))
+                    return true;
+        return false;
+    }
+
+    void unhide(MapExtras::Block *b, df::coord2d p)
+    {
+        df::tile_designation des = b->DesignationAt(p);
+        if (!des.bits.hidden)
+            return;
+        des.bits.hidden = false;
+        b->setDesignationAt(p, des);
+    }
+
+    bool inside(MapExtras::Block *b, df::coord2d p, DFCoord)
+    {
+        return passable(classifyShape(b->BaseTileTypeAt(p)));
+    }
+
+    void visit(MapExtras::Block *b, df::coord2d p, DFCoord c, MapExtras::FloodDirection how)
+    {
+        if (how == MapExtras::FLOOD_UP &&
+            classifyShape(b->BaseTileTypeAt(p)) == REVEAL_FLOOR &&
+            !seenFromSide(c))
+            return;
+        unhide(b, p);
+    }
+
+    int vertical(MapExtras::Block *b, df::coord2d p, DFCoord)
+    {
+        if (classifyShape(b->BaseTileTypeAt(p)) == REVEAL_OPEN)
+            return MapExtras::FLOOD_UP | MapExtras::FLOOD_DOWN;
+        return MapExtras::FLOOD_UP;
+    }
+
+    void border(MapExtras::Block *b, df::coord2d p, DFCoord, MapExtras::FloodDirection how)
+    {
+        if (how == MapExtras::FLOOD_UP && classifyShape(b->BaseTileTypeAt(p)) == REVEAL_SOLID)
+            return;
+        unhide(b, p);
+    }
+};
+
 command_result revflood(color_ostream &out, vector<string> & params)
 {
     for(size_t i = 0; i < params.size();i++)
@@ -389,87 +499,10 @@ command_result revflood(color_ostream &out, vector<string> & params)
     }
     MCache->trash();
 
-    typedef std::pair <DFCoord, bool> foo;
-    std::stack < foo > flood;
-    flood.push( foo(xy,false) );
-
-    while( !flood.empty() )
-    {
-        foo tile = flood.top();
-        DFCoord & current = tile.first;
-        bool & from_below = tile.second;
-        flood.pop();
+    RevealFill fill(*MCache);
+    MapExtras::FloodFill flood(*MCache, true);
+    flood.run(xy, fill);
 
-        if(!MCache->testCoord(current))
-            continue;
-        df::tiletype tt = MCache->baseTiletypeAt(current);
-        df::tile_designation des = MCache->designationAt(current);
-        if(!des.bits.hidden)
-        {
-            continue;
-        }
-        bool below = 0;
-        bool above = 0;
-        bool sides = 0;
-        bool unhide = 1;
-        // by tile shape, determine behavior and action
-        switch (tileShape(tt))
-        {
-        // walls:
-        case tiletype_shape::WALL:
-            if(from_below)
-                unhide = 0;
-            break;
-        // air/free space
-        case tiletype_shape::EMPTY:
-        case tiletype_shape::RAMP_TOP:
-        case tiletype_shape::STAIR_UPDOWN:
-        case tiletype_shape::STAIR_DOWN:
-        case tiletype_shape::BROOK_TOP:
-            above = below = sides = true;
-            break;
-        // has floor
-        case tiletype_shape::FORTIFICATION:
-        case tiletype_shape::STAIR_UP:
-        case tiletype_shape::RAMP:
-        case tiletype_shape::FLOOR:
-        case tiletype_shape::TREE:
-        case tiletype_shape::SAPLING:
-        case tiletype_shape::SHRUB:
-        case tiletype_shape::BOULDER:
-        case tiletype_shape::PEBBLES:
-        case tiletype_shape::BROOK_BED:
-        case tiletype_shape::ENDLESS_PIT:
-            if(from_below)
-                unhide = 0;
-            above = sides = true;
-            break;
-        }
-        if(unhide)
-        {
-            des.bits.hidden = false;
-            MCache->setDesignationAt(current,des);
-        }
-        if(sides)
-        {
-            flood.push(foo(DFCoord(current.x + 1, current.y ,current.z),0));
-            flood.push(foo(DFCoord(current.x + 1, current.y + 1 ,current.z),0));
-            flood.push(foo(DFCoord(current.x, current.y + 1 ,current.z),0));
-            flood.push(foo(DFCoord(current.x - 1, current.y + 1 ,current.z),0));
-            flood.push(foo(DFCoord(current.x - 1, current.y ,current.z),0));
-            flood.push(foo(DFCoord(current.x - 1, current.y - 1 ,current.z),0));
-            flood.push(foo(DFCoord(current.x, current.y - 1 ,current.z),0));
-            flood.push(foo(DFCoord(current.x + 1, current.y - 1 ,current.z),0));
-        }
-        if(above)
-        {
-            flood.push(foo(DFCoord(current.x, current.y ,current.z + 1),1));
-        }
-        if(below)
-        {
-            flood.push(foo(DFCoord(current.x, current.y ,current.z - 1),0));
-        }
-    }
     MCache->WriteAll();
     delete MCache;
     return CR_OK;
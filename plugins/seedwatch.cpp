@@ -10,6 +10,7 @@
 #include "PluginManager.h"
 #include "modules/World.h"
 #include "modules/kitchen.h"
+#include "modules/ItemCensus.h"
 #include "VersionInfo.h"
 #include "df/world.h"
 #include "df/plant_raw.h"
@@ -27,21 +28,66 @@ bool running = false; // whether seedwatch is counting the seeds or not
 // abbreviations for the standard plants
 map<string, string> abbreviations;
 
-bool ignoreSeeds(df::item_flags& f) // seeds with the following flags should not be counted
+uint32_t ignoreSeeds() // seeds with the following flags should not be counted
 {
-    return
-        f.bits.dump ||
-        f.bits.forbid ||
-        f.bits.garbage_collect ||
-        f.bits.hidden ||
-        f.bits.hostile ||
-        f.bits.on_fire ||
-        f.bits.rotten ||
-        f.bits.trader ||
-        f.bits.in_building ||
-        f.bits.in_job;
+    df::item_flags f;
+    f.whole = 0;
+    f.bits.dump = true;
+    f.bits.forbid = true;
+    f.bits.garbage_collect = true;
+    f.bits.hidden = true;
+    f.bits.hostile = true;
+    f.bits.on_fire = true;
+    f.bits.rotten = true;
+    f.bits.trader = true;
+    f.bits.in_building = true;
+    f.bits.in_job = true;
+    return f.whole;
 };
 
+// The seeds are counted by the core item census; seedwatch only registers a
+// threshold pair per watched plant and flips the cookery flags when called back.
+int census = -1;
+vector<int> thresholds;
+
+void seedThreshold(color_ostream &out, void *data, const ItemCensus::Key &key, int count, bool above)
+{
+    if (above)
+        Kitchen::allowPlantSeedCookery(key.mat_index);
+    else
+        Kitchen::denyPlantSeedCookery(key.mat_index);
+}
+
+void stopWatching()
+{
+    if (census != -1)
+        ItemCensus::removeCensus(census);
+    census = -1;
+    thresholds.clear();
+}
+
+// (re)register the thresholds after the watch list changed
+void syncThresholds()
+{
+    if (!running)
+        return;
+
+    if (census == -1)
+        census = ItemCensus::addCensus(items_other_id::SEEDS, ignoreSeeds(), 500);
+
+    for (size_t i = 0; i < thresholds.size(); i++)
+        ItemCensus::removeThreshold(thresholds[i]);
+    thresholds.clear();
+
+    map<t_materialIndex, unsigned int> watchMap;
+    Kitchen::fillWatchMap(watchMap);
+    for(auto i = watchMap.begin(); i != watchMap.end(); ++i)
+    {
+        ItemCensus::Key key(item_type::SEEDS, -1, -1, i->first);
+        thresholds.push_back(ItemCensus::addThreshold(census, key, i->second, i->second + buffer, seedThreshold));
+    }
+}
+
 void printHelp(color_ostream &out) // prints help
 {
     out.print(
@@ -132,16 +178,19 @@ command_result df_seedwatch(color_ostream &out, vector<string>& parameters)
         else if(par == "start")
         {
             running = true;
+            syncThresholds();
             out.print("seedwatch supervision started.\n");
         }
         else if(par == "stop")
         {
             running = false;
+            stopWatching();
             out.print("seedwatch supervision stopped.\n");
         }
         else if(par == "clear")
         {
             Kitchen::clearLimits();
+            syncThresholds();
             out.print("seedwatch watchlist cleared\n");
         }
         else if(par == "info")
@@ -199,6 +248,7 @@ command_result df_seedwatch(color_ostream &out, vector<string>& parameters)
             if(materialsReverser.count(token) > 0)
             {
                 Kitchen::removeLimit(materialsReverser[token]);
+                syncThresholds();
                 out.print("%s is not being watched\n", token.c_str());
             }
             else
@@ -216,6 +266,7 @@ command_result df_seedwatch(color_ostream &out, vector<string>& parameters)
             {
                 if(materialsReverser.count(i->second) > 0) Kitchen::setLimit(materialsReverser[i->second], limit);
             }
+            syncThresholds();
         }
         else
         {
@@ -223,6 +274,7 @@ command_result df_seedwatch(color_ostream &out, vector<string>& parameters)
             if(materialsReverser.count(token) > 0)
             {
                 Kitchen::setLimit(materialsReverser[token], limit);
+                syncThresholds();
                 out.print("%s is being watched.\n", token.c_str());
             }
             else
@@ -240,6 +292,7 @@ command_result df_seedwatch(color_ostream &out, vector<string>& parameters)
 }
 
 DFHACK_PLUGIN("seedwatch");
+DFHACK_PLUGIN_EVENTS((1 << SC_MAP_LOADED) | (1 << SC_MAP_UNLOADED))
 
 DFhackCExport command_result plugin_init(color_ostream &out, vector<PluginCommand>& commands)
 {
@@ -277,6 +330,7 @@ DFhackCExport command_result plugin_onstatechange(color_ostream &out, state_chan
         if (running)
             out.printerr("seedwatch deactivated due to game load/unload\n");
         running = false;
+        stopWatching();
         break;
     default:
         break;
@@ -303,38 +357,17 @@ DFhackCExport command_result plugin_onupdate(color_ostream &out)
         {
             // stop running.
             running = false;
+            stopWatching();
             out.printerr("seedwatch deactivated due to game mode switch\n");
             return CR_OK;
         }
-        // this is dwarf mode, continue
-        map<t_materialIndex, unsigned int> seedCount; // the number of seeds
-
-        // count all seeds and plants by RAW material
-        for(size_t i = 0; i < world->items.other[items_other_id::SEEDS].size(); ++i)
-        {
-            df::item * item = world->items.other[items_other_id::SEEDS][i];
-            t_materialIndex materialIndex = item->getMaterialIndex();
-            if(!ignoreSeeds(item->flags)) ++seedCount[materialIndex];
-        }
-
-        map<t_materialIndex, unsigned int> watchMap;
-        Kitchen::fillWatchMap(watchMap);
-        for(auto i = watchMap.begin(); i != watchMap.end(); ++i)
-        {
-            if(seedCount[i->first] <= i->second)
-            {
-                Kitchen::denyPlantSeedCookery(i->first);
-            }
-            else if(i->second + buffer < seedCount[i->first])
-            {
-                Kitchen::allowPlantSeedCookery(i->first);
-            }
-        }
+        // this is dwarf mode; the census does the counting
     }
     return CR_OK;
 }
 
 DFhackCExport command_result plugin_shutdown(Core* pCore)
 {
+    stopWatching();
     return CR_OK;
 }
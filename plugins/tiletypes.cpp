@@ -490,6 +490,139 @@ void help( std::ostream & out, const std::string &option)
 
 CommandHistory tiletypes_hist;
 
+// paints every tile of the brush area that passes the filter
+class TilePainter : public BrushVisitor
+{
+public:
+    TilePainter(const TileType &filter, const TileType &paint)
+        : filter(filter), paint(paint) {}
+
+    void visit(BrushBlock &blk)
+    {
+        for (int16_t y = 0; y < 16; y++)
+        {
+            if (!blk.mask[y])
+                continue;
+            for (int16_t x = 0; x < 16; x++)
+            {
+                df::coord2d p(x, y);
+                if (blk.test(p))
+                    paintTile(blk.block, p);
+            }
+        }
+    }
+
+private:
+    const TileType &filter;
+    const TileType &paint;
+
+    void paintTile(MapExtras::Block *b, df::coord2d p)
+    {
+        const df::tiletype source = b->TileTypeAt(p);
+        df::tile_designation des = b->DesignationAt(p);
+
+        if ((filter.shape > -1 && filter.shape != tileShape(source))
+         || (filter.material > -1 && filter.material != tileMaterial(source))
+         || (filter.special > -1 && filter.special != tileSpecial(source))
+         || (filter.variant > -1 && filter.variant != tileVariant(source))
+         || (filter.dig > -1 && (filter.dig != 0) != (des.bits.dig != tile_dig_designation::No))
+        )
+        {
+            return;
+        }
+
+        df::tiletype_shape shape = paint.shape;
+        if (shape == tiletype_shape::NONE)
+        {
+            shape = tileShape(source);
+        }
+
+        df::tiletype_material material = paint.material;
+        if (material == tiletype_material::NONE)
+        {
+            material = tileMaterial(source);
+        }
+
+        df::tiletype_special special = paint.special;
+        if (special == tiletype_special::NONE)
+        {
+            special = tileSpecial(source);
+        }
+        df::tiletype_variant variant = paint.variant;
+        /*
+         * FIXME: variant should be:
+         * 1. If user variant:
+         * 2.   If user variant \belongs target variants
+         * 3.     use user variant
+         * 4.   Else
+         * 5.     use variant 0
+         * 6. If the source variant \belongs target variants
+         * 7    use source variant
+         * 8  ElseIf num target shape/material variants > 1
+         * 9.   pick one randomly
+         * 10.Else
+         * 11.  use variant 0
+         *
+         * The following variant check has been disabled because it's severely limiting
+         * the usefullness of the tool.
+         */
+        /*
+        if (variant == tiletype_variant::NONE)
+        {
+            variant = tileVariant(source);
+        }
+        */
+        // Remove direction from directionless tiles
+        DFHack::TileDirection direction = tileDirection(source);
+        if (!(material == tiletype_material::RIVER || shape == tiletype_shape::BROOK_BED || shape == tiletype_shape::WALL && (material == tiletype_material::CONSTRUCTION || special == tiletype_special::SMOOTH))) {
+            direction.whole = 0;
+        }
+
+        df::tiletype type = DFHack::findTileType(shape, material, variant, special, direction);
+        // hack for empty space
+        if (shape == tiletype_shape::EMPTY && material == tiletype_material::AIR && variant == tiletype_variant::VAR_1 && special == tiletype_special::NORMAL && direction.whole == 0) {
+            type = tiletype::OpenSpace;
+        }
+        // make sure it's not invalid
+        if(type != tiletype::Void)
+            b->setTiletypeAt(p, type);
+
+        if (paint.hidden > -1)
+        {
+            des.bits.hidden = paint.hidden;
+        }
+
+        if (paint.light > -1)
+        {
+            des.bits.light = paint.light;
+        }
+
+        if (paint.subterranean > -1)
+        {
+            des.bits.subterranean = paint.subterranean;
+        }
+
+        if (paint.skyview > -1)
+        {
+            des.bits.outside = paint.skyview;
+        }
+
+        // Remove liquid from walls, etc
+        if (type != -1 && !DFHack::FlowPassable(type))
+        {
+            des.bits.flow_size = 0;
+            //des.bits.liquid_type = DFHack::liquid_water;
+            //des.bits.water_table = 0;
+            des.bits.flow_forbid = 0;
+            //des.bits.liquid_static = 0;
+            //des.bits.water_stagnant = 0;
+            //des.bits.water_salt = 0;
+        }
+
+        b->setDesignationAt(p, des);
+    }
+};
+
 command_result df_tiletypes (color_ostream &out, vector <string> & parameters);
 
 DFHACK_PLUGIN("tiletypes");
@@ -645,116 +778,12 @@ command_result df_tiletypes (color_ostream &out, vector <string> & parameters)
 
             DFHack::DFCoord cursor(x,y,z);
             MapExtras::MapCache map;
-            coord_vec all_tiles = brush->points(map, cursor);
             con.print("working...\n");
+            TilePainter painter(filter, paint);
+            WriteBackVisitor writer(map, painter);
+            brush->blocks(map, cursor, writer);
 
-            for (coord_vec::iterator iter = all_tiles.begin(); iter != all_tiles.end(); ++iter)
-            {
-                const df::tiletype source = map.tiletypeAt(*iter);
-                df::tile_designation des = map.designationAt(*iter);
-
-                if ((filter.shape > -1 && filter.shape != tileShape(source))
-                 || (filter.material > -1 && filter.material != tileMaterial(source))
-                 || (filter.special > -1 && filter.special != tileSpecial(source))
-                 || (filter.variant > -1 && filter.variant != tileVariant(source))
-                 || (filter.dig > -1 && (filter.dig != 0) != (des.bits.dig != tile_dig_designation::No))
-                )
-                {
-                    continue;
-                }
-
-                df::tiletype_shape shape = paint.shape;
-                if (shape == tiletype_shape::NONE)
-                {
-                    shape = tileShape(source);
-                }
-
-                df::tiletype_material material = paint.material;
-                if (material == tiletype_material::NONE)
-                {
-                    material = tileMaterial(source);
-                }
-
-                df::tiletype_special special = paint.special;
-                if (special == tiletype_special::NONE)
-                {
-                    special = tileSpecial(source);
-                }
-                df::tiletype_variant variant = paint.variant;
-                /*
-                 * FIXME: variant should be:
-                 * 1. If user variant:
-                 * 2.   If user variant \belongs target variants
-                 * 3.     use user variant
-                 * 4.   Else
-                 * 5.     use variant 0
-                 * 6. If the source variant \belongs target variants
-                 * 7    use source variant
-                 * 8  ElseIf num target shape/material variants > 1
-                 * 9.   pick one randomly
-                 * 10.Else
-                 * 11.  use variant 0
-                 *
-                 * The following variant check has been disabled because it's severely limiting
-                 * the usefullness of the tool.
-                 */
-                /*
-                if (variant == tiletype_variant::NONE)
-                {
-                    variant = tileVariant(source);
-                }
-                */
-                // Remove direction from directionless tiles
-                DFHack::TileDirection direction = tileDirection(source);
-                if (!(material == tiletype_material::RIVER || shape == tiletype_shape::BROOK_BED || shape == tiletype_shape::WALL && (material == tiletype_material::CONSTRUCTION || special == tiletype_special::SMOOTH))) {
-                    direction.whole = 0;
-                }
-
-                df::tiletype type = DFHack::findTileType(shape, material, variant, special, direction);
-                // hack for empty space
-                if (shape == tiletype_shape::EMPTY && material == tiletype_material::AIR && variant == tiletype_variant::VAR_1 && special == tiletype_special::NORMAL && direction.whole == 0) {
-                    type = tiletype::OpenSpace;
-                }
-                // make sure it's not invalid
-                if(type != tiletype::Void)
-                    map.setTiletypeAt(*iter, type);
-
-                if (paint.hidden > -1)
-                {
-                    des.bits.hidden = paint.hidden;
-                }
-
-                if (paint.light > -1)
-                {
-                    des.bits.light = paint.light;
-                }
-
-                if (paint.subterranean > -1)
-                {
-                    des.bits.subterranean = paint.subterranean;
-                }
-
-                if (paint.skyview > -1)
-                {
-                    des.bits.outside = paint.skyview;
-                }
-
-                // Remove liquid from walls, etc
-                if (type != -1 && !DFHack::FlowPassable(type))
-                {
-                    des.bits.flow_size = 0;
-                    //des.bits.liquid_type = DFHack::liquid_water;
-                    //des.bits.water_table = 0;
-                    des.bits.flow_forbid = 0;
-                    //des.bits.liquid_static = 0;
-                    //des.bits.water_stagnant = 0;
-                    //des.bits.water_salt = 0;
-                }
-
-                map.setDesignationAt(*iter, des);
-            }
-
-            if (map.WriteAll())
+            if (writer.written())
             {
                 con.print("OK\n");
             }
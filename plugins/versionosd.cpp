@@ -29,6 +29,8 @@ char* file = "Cooz_curses_square_16x16.png";
 Gui* gui;
 
 DFHACK_PLUGIN("versionosd");
+// sets up the overlay in plugin_init
+DFHACK_PLUGIN_IS_EAGER
 
 DFTileSurface* createTile(int x, int y)
 {
@@ -8,6 +8,7 @@
 #include "modules/Items.h"
 #include "modules/Gui.h"
 #include "modules/Job.h"
+#include "modules/Buildings.h"
 #include "modules/World.h"
 
 #include "DataDefs.h"
@@ -56,6 +57,7 @@ static void init_state(color_ostream &out);
 static void cleanup_state(color_ostream &out);
 
 DFHACK_PLUGIN("workflow");
+DFHACK_PLUGIN_EVENTS((1 << SC_MAP_LOADED) | (1 << SC_MAP_UNLOADED))
 
 DFhackCExport command_result plugin_init (color_ostream &out, std::vector <PluginCommand> &commands)
 {
@@ -349,6 +351,9 @@ static TKnownJobs known_jobs;
 static std::vector<ProtectedJob*> pending_recover;
 static std::vector<ItemConstraint*> constraints;
 
+// Changes whenever a constraint is added or removed; see map_job_items
+static int constraints_generation = 0;
+
 static int meltable_count = 0;
 static bool melt_active = false;
 
@@ -371,13 +376,6 @@ static bool isSupportedJob(df::job *job)
             job->job_type == job_type::CollectSand);
 }
 
-static void enumLiveJobs(std::map<int, df::job*> &rv)
-{
-    df::job_list_link *p = world->job_list.next;
-    for (; p; p = p->next)
-        rv[p->item->id] = p->item;
-}
-
 static bool isOptionEnabled(unsigned flag)
 {
     return config.isValid() && (config.ival(0) & flag) != 0;
@@ -420,6 +418,7 @@ static void cleanup_state(color_ostream &out)
     for (size_t i = 0; i < constraints.size(); i++)
         delete constraints[i];
     constraints.clear();
+    constraints_generation++;
 }
 
 static void check_lost_jobs(color_ostream &out, int ticks);
@@ -497,7 +496,7 @@ static bool recover_job(color_ostream &out, ProtectedJob *pj)
         return true;
 
     // Check that the building exists
-    pj->holder = df::building::find(pj->building_id);
+    pj->holder = Buildings::findBuildingByID(pj->building_id);
     if (!pj->holder)
     {
         out.printerr("Forgetting job %d (%s): holder building lost.\n",
@@ -583,13 +582,11 @@ static void check_lost_jobs(color_ostream &out, int ticks)
 
 static void update_job_data(color_ostream &out)
 {
-    df::job_list_link *p = world->job_list.next;
-    for (; p; p = p->next)
+    for (TKnownJobs::const_iterator it = known_jobs.begin(); it != known_jobs.end(); ++it)
     {
-        ProtectedJob *pj = get_known(p->item->id);
-        if (!pj)
-            continue;
-        pj->update(p->item);
+        df::job *job = findJobById(it->first);
+        if (job)
+            it->second->update(job);
     }
 }
 
@@ -714,6 +711,7 @@ static ItemConstraint *get_constraint(color_ostream &out, const std::string &str
     }
 
     constraints.push_back(nct);
+    constraints_generation++;
     return nct;
 }
 
@@ -722,6 +720,7 @@ static void delete_constraint(ItemConstraint *cv)
     int idx = linear_index(constraints, cv);
     if (idx >= 0)
         vector_erase_at(constraints, idx);
+    constraints_generation++;
 
     Core::getInstance().getWorld()->DeletePersistentData(cv->config);
     delete cv;
@@ -1080,6 +1079,8 @@ static bool itemInRealJob(df::item *item)
     if (!item->flags.bits.in_job)
         return false;
 
+    // claimed by something other than exactly one job, or not in the
+    // role of an item being hauled
     if (item->jobs.size() != 1 ||
         item->jobs[0]->unk1 != 2 ||
         item->jobs[0]->job == NULL)
@@ -1089,17 +1090,151 @@ static bool itemInRealJob(df::item *item)
                != job_type_class::Hauling;
 }
 
-static void map_job_items(color_ostream &out)
+/*
+ * Item to constraint matching.
+ *
+ * Constraints are bucketed by item type, with the craft constraints in a
+ * bucket of their own, so an item is only compared with constraints that
+ * can apply to it. Which constraints an item matches depends only on its
+ * type, subtype and material, none of which change, so the result is kept
+ * per item until the set of constraints changes. The cache is sorted by
+ * item id like the item vector, and the two are merged on every scan.
+ */
+
+struct ItemMatches {
+    int32_t id;
+    df::item *item;
+    df::item_type type;
+    bool known;
+    unsigned first, count; // range in match_pool
+};
+
+static int index_generation = -1;
+static std::vector<std::vector<ItemConstraint*> > constraints_by_type;
+static std::vector<ItemConstraint*> craft_constraints;
+static std::vector<bool> craft_item_types;
+
+static std::vector<ItemMatches> item_matches, new_item_matches;
+static std::vector<ItemConstraint*> match_pool, new_match_pool;
+
+static void index_constraints()
 {
+    if (index_generation == constraints_generation)
+        return;
+
+    int num_types = ENUM_LAST_ITEM(item_type)+1;
+
+    if (craft_item_types.empty())
+    {
+        craft_item_types.resize(num_types);
+        for (int i = 0; i < num_types; i++)
+            craft_item_types[i] = isCraftItem(df::item_type(i));
+    }
+
+    constraints_by_type.assign(num_types, std::vector<ItemConstraint*>());
+    craft_constraints.clear();
+
     for (size_t i = 0; i < constraints.size(); i++)
     {
-        constraints[i]->item_amount = 0;
-        constraints[i]->item_count = 0;
-        constraints[i]->item_inuse = 0;
+        ItemConstraint *cv = constraints[i];
+
+        if (cv->is_craft)
+            craft_constraints.push_back(cv);
+        else if (cv->item.type >= 0 && cv->item.type < num_types)
+            constraints_by_type[cv->item.type].push_back(cv);
     }
 
-    meltable_count = 0;
+    item_matches.clear();
+    match_pool.clear();
+    index_generation = constraints_generation;
+}
+
+static void match_item_constraints(df::item *item, df::item_type itype,
+                                   const std::vector<ItemConstraint*> &bucket, bool is_craft)
+{
+    int16_t isubtype = item->getSubtype();
+    int16_t imattype = item->getActualMaterial();
+    int32_t imatindex = item->getActualMaterialIndex();
+
+    TMaterialCache::key_type matkey(imattype, imatindex);
+
+    for (size_t i = 0; i < bucket.size(); i++)
+    {
+        ItemConstraint *cv = bucket[i];
+
+        if (!is_craft && cv->item.subtype != -1 && cv->item.subtype != isubtype)
+            continue;
+
+        TMaterialCache::iterator it = cv->material_cache.find(matkey);
+
+        bool ok = true;
+        if (it != cv->material_cache.end())
+            ok = it->second;
+        else
+        {
+            MaterialInfo mat(imattype, imatindex);
+            ok = mat.matches(cv->material) &&
+                 (cv->mat_mask.whole == 0 || mat.matches(cv->mat_mask));
+            cv->material_cache[matkey] = ok;
+        }
+
+        if (ok)
+            new_match_pool.push_back(cv);
+    }
+}
+
+static ItemMatches &get_item_matches(df::item *item, size_t &cursor)
+{
+    while (cursor < item_matches.size() && item_matches[cursor].id < item->id)
+        cursor++;
+
+    new_item_matches.push_back(ItemMatches());
+    ItemMatches &entry = new_item_matches.back();
+
+    if (cursor < item_matches.size() && item_matches[cursor].item == item &&
+        item_matches[cursor].id == item->id)
+    {
+        const ItemMatches &old = item_matches[cursor];
+        entry = old;
+        entry.first = new_match_pool.size();
+        new_match_pool.insert(new_match_pool.end(),
+                              match_pool.begin() + old.first,
+                              match_pool.begin() + old.first + old.count);
+    }
+    else
+    {
+        entry.id = item->id;
+        entry.item = item;
+        entry.type = item->getType();
+        entry.known = false;
+        entry.first = new_match_pool.size();
+        entry.count = 0;
+    }
+
+    return entry;
+}
+
+static void compute_item_matches(ItemMatches &entry)
+{
+    if (entry.known)
+        return;
+
+    entry.known = true;
+    entry.first = new_match_pool.size();
+
+    if (entry.type >= 0 && entry.type < (int)constraints_by_type.size())
+    {
+        match_item_constraints(entry.item, entry.type, constraints_by_type[entry.type], false);
+
+        if (craft_item_types[entry.type])
+            match_item_constraints(entry.item, entry.type, craft_constraints, true);
+    }
 
+    entry.count = new_match_pool.size() - entry.first;
+}
+
+static void map_job_items(color_ostream &out)
+{
     // Precompute a bitmask with the bad flags
     df::item_flags bad_flags;
     bad_flags.whole = 0;
@@ -1112,19 +1247,34 @@ static void map_job_items(color_ostream &out)
 
     bool dry_buckets = isOptionEnabled(CF_DRYBUCKETS);
 
+    for (size_t i = 0; i < constraints.size(); i++)
+    {
+        constraints[i]->item_amount = 0;
+        constraints[i]->item_count = 0;
+        constraints[i]->item_inuse = 0;
+    }
+
+    meltable_count = 0;
+
+    index_constraints();
+
     std::vector<df::item*> &items = world->items.other[items_other_id::ANY_FREE];
 
+    new_item_matches.clear();
+    new_item_matches.reserve(items.size());
+    new_match_pool.clear();
+
+    size_t cursor = 0;
+
     for (size_t i = 0; i < items.size(); i++)
     {
         df::item *item = items[i];
+        ItemMatches &matches = get_item_matches(item, cursor);
 
         if (item->flags.whole & bad_flags.whole)
             continue;
 
-        df::item_type itype = item->getType();
-        int16_t isubtype = item->getSubtype();
-        int16_t imattype = item->getActualMaterial();
-        int32_t imatindex = item->getActualMaterialIndex();
+        df::item_type itype = matches.type;
 
         bool is_invalid = false;
 
@@ -1150,57 +1300,36 @@ static void map_job_items(color_ostream &out)
             meltable_count++;
 
         // Match to constraints
-        TMaterialCache::key_type matkey(imattype, imatindex);
-
-        for (size_t i = 0; i < constraints.size(); i++)
-        {
-            ItemConstraint *cv = constraints[i];
-
-            if (cv->is_craft)
-            {
-                if (!isCraftItem(itype))
-                    continue;
-            }
-            else
-            {
-                if (cv->item.type != itype ||
-                    (cv->item.subtype != -1 && cv->item.subtype != isubtype))
-                    continue;
-            }
+        compute_item_matches(matches);
+        if (matches.count == 0)
+            continue;
 
-            TMaterialCache::iterator it = cv->material_cache.find(matkey);
+        bool in_use = (is_invalid ||
+                       item->flags.bits.owned ||
+                       item->flags.bits.in_chest ||
+                       item->isAssignedToStockpile() ||
+                       itemInRealJob(item) ||
+                       itemBusy(item));
 
-            bool ok = true;
-            if (it != cv->material_cache.end())
-                ok = it->second;
-            else
-            {
-                MaterialInfo mat(imattype, imatindex);
-                ok = mat.matches(cv->material) &&
-                     (cv->mat_mask.whole == 0 || mat.matches(cv->mat_mask));
-                cv->material_cache[matkey] = ok;
-            }
+        int stack_size = in_use ? 0 : item->getStackSize();
 
-            if (!ok)
-                continue;
+        for (unsigned j = 0; j < matches.count; j++)
+        {
+            ItemConstraint *cv = new_match_pool[matches.first + j];
 
-            if (is_invalid ||
-                item->flags.bits.owned ||
-                item->flags.bits.in_chest ||
-                item->isAssignedToStockpile() ||
-                itemInRealJob(item) ||
-                itemBusy(item))
-            {
+            if (in_use)
                 cv->item_inuse++;
-            }
             else
             {
                 cv->item_count++;
-                cv->item_amount += item->getStackSize();
+                cv->item_amount += stack_size;
             }
         }
     }
 
+    item_matches.swap(new_item_matches);
+    match_pool.swap(new_match_pool);
+
     for (size_t i = 0; i < constraints.size(); i++)
         constraints[i]->computeRequest();
 }
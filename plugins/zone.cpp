@@ -42,6 +42,7 @@ using namespace std;
 #include "modules/Materials.h"
 #include "modules/MapCache.h"
 #include "modules/Buildings.h"
+#include "modules/Spatial.h"
 #include "MiscUtils.h"
 
 #include <df/ui.h>
@@ -169,7 +170,6 @@ bool isPenPasture(df::building * building);
 bool isPit(df::building * building);
 bool isActive(df::building * building);
 
-int32_t findBuildingIndexById(int32_t id);
 int32_t findPenPitAtCursor();
 int32_t findCageAtCursor();
 int32_t findChainAtCursor();
@@ -509,93 +509,42 @@ bool isActive(df::building * building)
         return false;
 }
 
-int32_t findBuildingIndexById(int32_t id)
+// returns id of the first building under the cursor accepted by filter (-1 if nothing found)
+int32_t findBuildingAtCursor(bool (*filter)(df::building*))
 {
-    for (size_t b = 0; b < world->buildings.all.size(); b++)
+    if(cursor->x == -30000)
+        return -1;
+
+    vector<df::building*> buildings;
+    Spatial::getBuildingsAt(buildings, df::coord(cursor->x, cursor->y, cursor->z));
+    for (size_t b = 0; b < buildings.size(); b++)
     {
-        if(world->buildings.all.at(b)->id == id)
-            return b;
+        if(filter(buildings[b]))
+            return buildings[b]->id;
     }
     return -1;
 }
 
+static bool isPenPastureOrPit(df::building* building)
+{
+    return isPenPasture(building) || isPit(building);
+}
+
 // returns id of pen/pit at cursor position (-1 if nothing found)
 int32_t findPenPitAtCursor()
 {
-    int32_t foundID = -1;
-    
-    if(cursor->x == -30000)
-        return -1;
-
-    for (size_t b = 0; b < world->buildings.all.size(); b++)
-    {
-        df::building* building = world->buildings.all[b];
-
-        // find zone under cursor
-        if (!(building->x1 <= cursor->x && cursor->x <= building->x2 &&
-            building->y1 <= cursor->y && cursor->y <= building->y2 &&
-            building->z == cursor->z))
-            continue;
-
-        if(isPenPasture(building) || isPit(building))
-        {
-            foundID = building->id;
-            break;
-        }
-    }
-    return foundID;
+    return findBuildingAtCursor(isPenPastureOrPit);
 }
 
 // returns id of cage at cursor position (-1 if nothing found)
 int32_t findCageAtCursor()
 {
-    int32_t foundID = -1;
-    
-    if(cursor->x == -30000)
-        return -1;
-
-    for (size_t b = 0; b < world->buildings.all.size(); b++)
-    {
-        df::building* building = world->buildings.all[b];
-
-        if (!(building->x1 <= cursor->x && cursor->x <= building->x2 &&
-            building->y1 <= cursor->y && cursor->y <= building->y2 &&
-            building->z == cursor->z))
-            continue;
-
-        if(isCage(building))
-        {
-            foundID = building->id;
-            break;
-        }
-    }
-    return foundID;
+    return findBuildingAtCursor(isCage);
 }
 
 int32_t findChainAtCursor()
 {
-    int32_t foundID = -1;
-    
-    if(cursor->x == -30000)
-        return -1;
-
-    for (size_t b = 0; b < world->buildings.all.size(); b++)
-    {
-        df::building* building = world->buildings.all[b];
-
-        // find zone under cursor
-        if (!(building->x1 <= cursor->x && cursor->x <= building->x2 &&
-            building->y1 <= cursor->y && cursor->y <= building->y2 &&
-            building->z == cursor->z))
-            continue;
-
-        if(isChain(building))
-        {
-            foundID = building->id;
-            break;
-        }
-    }
-    return foundID;
+    return findBuildingAtCursor(isChain);
 }
 
 df::general_ref_building_civzone_assignedst * createCivzoneRef()
@@ -707,9 +656,11 @@ bool isContainedInItem(df::unit* unit)
 bool isBuiltCageAtPos(df::coord pos)
 {
     bool cage = false;
-    for (size_t b=0; b < world->buildings.all.size(); b++)
+    vector<df::building*> buildings;
+    Spatial::getBuildingsAt(buildings, pos);
+    for (size_t b=0; b < buildings.size(); b++)
     {
-        df::building* building = world->buildings.all[b];
+        df::building* building = buildings[b];
         if( building->getType() == building_type::Cage
             && building->x1 == pos.x
             && building->y1 == pos.y
@@ -725,9 +676,11 @@ bool isBuiltCageAtPos(df::coord pos)
 bool isNestboxAtPos(int32_t x, int32_t y, int32_t z)
 {
     bool found = false;
-    for (size_t b=0; b < world->buildings.all.size(); b++)
+    vector<df::building*> buildings;
+    Spatial::getBuildingsAt(buildings, df::coord(x, y, z));
+    for (size_t b=0; b < buildings.size(); b++)
     {
-        df::building* building = world->buildings.all[b];
+        df::building* building = buildings[b];
         if( building->getType() == building_type::NestBox
             && building->x1 == x
             && building->y1 == y
@@ -959,14 +912,8 @@ void zoneInfo(color_ostream & out, df::building* building, bool verbose = false)
         int32_t cindex = civ->assigned_creature.at(c);
 
         // print list of all units assigned to that zone
-        for(size_t i = 0; i < world->units.all.size(); i++)
-        {
-            df::unit * creature = world->units.all[i];
-            if(creature->id != cindex)
-                continue;
-                    
+        if(df::unit * creature = Units::FindById(cindex))
             unitInfo(out, creature, verbose);
-        }
     }
 }
 
@@ -998,14 +945,8 @@ void cageInfo(color_ostream & out, df::building* building, bool verbose = false)
         int32_t cindex = cage->assigned_creature.at(c);
 
         // print list of all units assigned to that cage
-        for(size_t i = 0; i < world->units.all.size(); i++)
-        {
-            df::unit * creature = world->units.all[i];
-            if(creature->id != cindex)
-                continue;
-                    
+        if(df::unit * creature = Units::FindById(cindex))
             unitInfo(out, creature, verbose);
-        }
     }
 }
 
@@ -1373,16 +1314,15 @@ command_result df_zone (color_ostream &out, vector <string> & parameters)
     // (doesn't use the findXyzAtCursor() methods because zones might overlap and contain a cage or chain)
     if(zone_info) // || chain_info || cage_info)
     {
-        for (size_t b = 0; b < world->buildings.all.size(); b++)
-        {
-            df::building * building = world->buildings.all[b];
+        vector<df::building*> buildings;
+        if(all)
+            buildings = world->buildings.all;
+        else
+            Spatial::getBuildingsAt(buildings, df::coord(cursor->x, cursor->y, cursor->z));
 
-            // find building under cursor
-            if (!all &&
-                !(building->x1 <= cursor->x && cursor->x <= building->x2 &&
-                building->y1 <= cursor->y && cursor->y <= building->y2 &&
-                building->z == cursor->z))
-                continue;
+        for (size_t b = 0; b < buildings.size(); b++)
+        {
+            df::building * building = buildings[b];
 
             zoneInfo(out, building, verbose);
             chainInfo(out, building, verbose);
@@ -1410,15 +1350,14 @@ command_result df_zone (color_ostream &out, vector <string> & parameters)
         df::building * building;
         if(zone_assign)
         {
-		    // try to get building index from the id
-            int32_t index = findBuildingIndexById(target_zone);
-            if(index == -1)
+		    // try to get building from the id
+            building = Buildings::findBuildingByID(target_zone);
+            if(!building)
             {
                 out << "Invalid building id." << endl;
                 target_zone = -1;
                 return CR_WRONG_USAGE;
             }
-            building = world->buildings.all.at(index);
         }
 
         if(all || find_count)